@@ -15,8 +15,15 @@
 #include "exceptions/index_scan_completed_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/end_of_file_exception.h"
+#include "exceptions/index_read_only_exception.h"
 #include <climits>
-#include <stack>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 
 //#define DEBUG
@@ -24,529 +31,4859 @@
 namespace badgerdb
 {
 
+namespace {
+
+/**
+ * Log record types of the index.
+ */
+enum BTreeLogType {
+	BTREE_LOG_META = LOG_CLIENT_TYPES,	/* Image of the meta page */
+	BTREE_LOG_NODE,											/* Image of a node after a split or creation */
+	BTREE_LOG_LEAF_INSERT,							/* LeafInsertRec */
+	BTREE_LOG_NONLEAF_INSERT,						/* NonLeafInsertRec */
+	BTREE_LOG_COUNT,										/* CountRec */
+	BTREE_LOG_POSTING_ADD,							/* PostingAddRec */
+	BTREE_LOG_POSTING_TOTAL							/* PostingTotalRec */
+};
+
+/**
+ * Payload of BTREE_LOG_LEAF_INSERT: entry inserted at pos of a leaf.
+ */
+struct LeafInsertRec {
+	int pos;
+	int key;
+	RecordId rid;
+};
+
+/**
+ * Payload of BTREE_LOG_NONLEAF_INSERT: separator inserted at pos of a non-leaf node,
+ * with the page to its right and the counts of the children on both sides of it.
+ */
+struct NonLeafInsertRec {
+	int pos;
+	int key;
+	PageId pageNo;
+	int leftCount;
+	int rightCount;
+};
+
+/**
+ * Payload of BTREE_LOG_COUNT: new count of the child at pos of a non-leaf node. A unit
+ * has at most one record for each page, since recovery applies a unit to a page once.
+ */
+struct CountRec {
+	int pos;
+	int count;
+};
+
+/**
+ * Payload of BTREE_LOG_POSTING_ADD: record id added to a posting list page that had room
+ * for it, and the new length of the list if the page is its first page, else -1.
+ */
+struct PostingAddRec {
+	RecordId rid;
+	int total;
+};
+
+/**
+ * Payload of BTREE_LOG_POSTING_TOTAL: new length of the list a page is the first page of.
+ */
+struct PostingTotalRec {
+	int total;
+};
+
+// Leaves, non-leaf nodes and posting list pages share the latch and LSN header, so the
+// LSN of a node can be handled without knowing its kind.
+static_assert(offsetof(LeafNodeInt, lsn) == offsetof(NonLeafNodeInt, lsn), "Node LSNs must line up.");
+static_assert(offsetof(LeafNodeInt, lsn) == offsetof(PostingPageInt, lsn), "Node LSNs must line up.");
+
+Lsn nodeLsn(const Page& page)
+{
+	return reinterpret_cast<const LeafNodeInt*>(&page)->lsn;
+}
+
+void setNodeLsn(Page& page, const Lsn lsn)
+{
+	reinterpret_cast<LeafNodeInt*>(&page)->lsn = lsn;
+}
+
+/**
+ * True if a leaf entry stands for a posting list rather than for one record.
+ */
+bool isPosting(const RecordId& rid)
+{
+	return rid.slot_number == Page::INVALID_SLOT;
+}
+
+/**
+ * Order of the record ids in a posting list: by page number, then by slot number.
+ */
+bool ridLess(const RecordId& a, const RecordId& b)
+{
+	return (a.page_number != b.page_number) ? a.page_number < b.page_number : a.slot_number < b.slot_number;
+}
+
+/**
+ * Number of bytes of value as a varint: seven bits per byte, low bits first, with the
+ * high bit set on every byte but the last.
+ */
+int varintSize(std::uint32_t value)
+{
+	int size = 1;
+	for (; value >= 0x80; value >>= 7){
+		size++;
+	}
+	return size;
+}
+
+/**
+ * Write value as a varint and return the byte after it.
+ */
+unsigned char* putVarint(unsigned char* out, std::uint32_t value)
+{
+	for (; value >= 0x80; value >>= 7){
+		*out++ = static_cast<unsigned char>(value | 0x80);
+	}
+	*out++ = static_cast<unsigned char>(value);
+	return out;
+}
+
+/**
+ * Read a varint, without reading past end.
+ */
+std::uint32_t getVarint(const unsigned char*& in, const unsigned char* end)
+{
+	std::uint32_t value = 0;
+	for (int shift = 0; in < end && shift < 35; shift += 7){
+		unsigned char byte = *in++;
+		value |= static_cast<std::uint32_t>(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0){
+			break;
+		}
+	}
+	return value;
+}
+
+/**
+ * Number of bytes rid takes in a posting list page after prev, which is all zero for the
+ * first record id of a page.
+ */
+int postingSize(const RecordId& prev, const RecordId& rid)
+{
+	if (rid.page_number == prev.page_number){
+		return varintSize(0) + varintSize(rid.slot_number - prev.slot_number);
+	}
+	return varintSize(rid.page_number - prev.page_number) + varintSize(rid.slot_number);
+}
+
+/**
+ * Encode rid after prev at out.
+ */
+unsigned char* putPosting(unsigned char* out, const RecordId& prev, const RecordId& rid)
+{
+	if (rid.page_number == prev.page_number){
+		out = putVarint(out, 0);
+		return putVarint(out, rid.slot_number - prev.slot_number);
+	}
+	out = putVarint(out, rid.page_number - prev.page_number);
+	return putVarint(out, rid.slot_number);
+}
+
+/**
+ * Encode record ids, in order, after the last one of a posting list page. The caller
+ * checked that they fit.
+ */
+void appendPostings(PostingPageInt* page, const RecordId* rids, const int n)
+{
+	RecordId prev = (page->stored > 0) ? page->lastRid : RecordId();
+	unsigned char* out = page->data + page->bytes;
+	for (int i = 0; i < n; i++){
+		out = putPosting(out, prev, rids[i]);
+		prev = rids[i];
+	}
+	page->stored += n;
+	page->bytes = static_cast<int>(out - page->data);
+	page->lastRid = prev;
+}
+
+/**
+ * Append the record ids of a posting list page to out. The page may be read while a
+ * writer changes it, so decoding stays within the page; the caller validates the page's
+ * version before using the result.
+ */
+void decodePostings(const PostingPageInt* page, std::vector<RecordId>& out)
+{
+	int stored = std::min(std::max(page->stored, 0), POSTINGDATASIZE);
+	const unsigned char* in = page->data;
+	const unsigned char* end = in + std::min(std::max(page->bytes, 0), POSTINGDATASIZE);
+	RecordId rid = RecordId();
+	for (int i = 0; i < stored && in < end; i++){
+		std::uint32_t delta = getVarint(in, end);
+		if (delta == 0){
+			rid.slot_number = static_cast<SlotId>(rid.slot_number + getVarint(in, end));
+		}
+		else{
+			rid.page_number += delta;
+			rid.slot_number = static_cast<SlotId>(getVarint(in, end));
+		}
+		out.push_back(rid);
+	}
+}
+
+/**
+ * First record id of a non-empty posting list page.
+ */
+RecordId firstPosting(const PostingPageInt* page)
+{
+	const unsigned char* in = page->data;
+	const unsigned char* end = in + std::min(std::max(page->bytes, 0), POSTINGDATASIZE);
+	RecordId rid = RecordId();
+	rid.page_number = getVarint(in, end);
+	rid.slot_number = static_cast<SlotId>(getVarint(in, end));
+	return rid;
+}
+
+/**
+ * Insert a record id into a posting list page before the first one greater than it,
+ * re-encoding only that one. Returns false, leaving the page as it was, if it does not
+ * fit or is not below the last one.
+ */
+bool insertPosting(PostingPageInt* page, const RecordId& rid)
+{
+	const unsigned char* in = page->data;
+	const unsigned char* end = page->data + page->bytes;
+	RecordId prev = RecordId();
+	RecordId next = RecordId();
+	while (in < end){
+		const unsigned char* at = in;
+		next = prev;
+		std::uint32_t delta = getVarint(in, end);
+		if (delta == 0){
+			next.slot_number = static_cast<SlotId>(next.slot_number + getVarint(in, end));
+		}
+		else{
+			next.page_number += delta;
+			next.slot_number = static_cast<SlotId>(getVarint(in, end));
+		}
+		if (ridLess(rid, next)){
+			int size = postingSize(prev, rid) + postingSize(rid, next);
+			int grown = size - static_cast<int>(in - at);
+			if (page->bytes + grown > POSTINGDATASIZE){
+				return false;
+			}
+			unsigned char* out = page->data + (at - page->data);
+			memmove(out + size, in, end - in);
+			putPosting(putPosting(out, prev, rid), rid, next);
+			page->stored++;
+			page->bytes += grown;
+			return true;
+		}
+		prev = next;
+	}
+	return false;
+}
+
+/**
+ * Add sorted record ids to a posting list page, after the ones it holds equal to them.
+ * Those that do not fit, the largest ones of the page, are moved to rest, in order.
+ */
+void fillPostings(PostingPageInt* page, const RecordId* rids, std::size_t n, std::vector<RecordId>& rest)
+{
+	std::vector<RecordId> merged;
+	if (n == 1 && page->stored > 0 && ridLess(rids[0], page->lastRid) && insertPosting(page, rids[0])){
+		rest.clear();
+		return;
+	}
+	if (page->stored > 0 && n > 0 && ridLess(rids[0], page->lastRid)){
+		//not an append: merge with the ids already there, which start the page again
+		decodePostings(page, merged);
+		std::size_t old = merged.size();
+		merged.insert(merged.end(), rids, rids + n);
+		std::inplace_merge(merged.begin(), merged.begin() + old, merged.end(), ridLess);
+		page->stored = 0;
+		page->bytes = 0;
+		rids = &merged[0];
+		n = merged.size();
+	}
+
+	RecordId prev = (page->stored > 0) ? page->lastRid : RecordId();
+	int bytes = page->bytes;
+	std::size_t fit = 0;
+	for (; fit < n; fit++){
+		int size = postingSize(prev, rids[fit]);
+		if (bytes + size > POSTINGDATASIZE){
+			break;
+		}
+		bytes += size;
+		prev = rids[fit];
+	}
+	appendPostings(page, rids, static_cast<int>(fit));
+	rest.assign(rids + fit, rids + n);
+}
+
+/**
+ * Header of a packed leaf, at the start of its keyArray. Each entry takes entryBytes
+ * bytes, lowest bits first: the key less keyBase in keyBits bits, the page number less
+ * pageBase in pageBits bits and the slot number in slotBits bits. The page numbers of the
+ * posting lists of the leaf are stored backwards from the end of its bytes, and the entry
+ * for a list holds the index of its page number there in place of the page number.
+ */
+struct PackedLeafHeader {
+	int keyBase;
+	PageId pageBase;
+	unsigned char keyBits;
+	unsigned char pageBits;
+	unsigned char slotBits;
+	unsigned char entryBytes;
+	std::uint16_t postings;
+	std::uint16_t unused;
+};
+
+/**
+ * Bytes after the entries of a packed leaf kept free, so that each entry is read with one
+ * load of eight bytes.
+ */
+const int PACKED_TAIL = 8;
+
+static_assert(sizeof(RecordId) == 8 && offsetof(RecordId, slot_number) == 4, "Record ids are decoded as 8 bytes.");
+
+/**
+ * Number of bits value takes.
+ */
+int bitWidth(std::uint32_t value)
+{
+	int bits = 0;
+	for (; value != 0; value >>= 1){
+		bits++;
+	}
+	return bits;
+}
+
+/**
+ * The bits of value from shift on, bits of them.
+ */
+std::uint64_t bitField(const std::uint64_t value, const int shift, const int bits)
+{
+	return (bits == 0) ? 0 : (value >> shift) & ((std::uint64_t(1) << bits) - 1);
+}
+
+/**
+ * True if the fields of a header fit its entries. A leaf read while a writer changes it
+ * may show any header.
+ */
+bool validHeader(const PackedLeafHeader& h)
+{
+	return h.keyBits <= 32 && h.pageBits <= 32 && h.slotBits <= 16 && h.entryBytes >= 1 && h.entryBytes <= 8
+		&& h.keyBits + h.pageBits + h.slotBits <= 8 * h.entryBytes;
+}
+
+/**
+ * Number of entries a packed leaf with a header has room for.
+ */
+int packedCapacity(const PackedLeafHeader& h)
+{
+	int bytes = LEAFDATASIZE - static_cast<int>(sizeof(PackedLeafHeader)) - PACKED_TAIL
+		- h.postings * static_cast<int>(sizeof(PageId));
+	return (bytes < 0) ? 0 : std::min(bytes / h.entryBytes, MAXLEAFENTRIES);
+}
+
+/**
+ * Header of the packed layout of n > 0 sorted entries, with entryBytes 0 if an entry
+ * would take more than eight bytes.
+ */
+PackedLeafHeader packedLayout(const int* keys, const RecordId* rids, const int n)
+{
+	PageId low = 0;
+	PageId high = 0;
+	bool seen = false;
+	SlotId slots = 0;
+	int postings = 0;
+	for (int i = 0; i < n; i++){
+		if (isPosting(rids[i])){
+			postings++;
+			continue;
+		}
+		low = seen ? std::min(low, rids[i].page_number) : rids[i].page_number;
+		high = seen ? std::max(high, rids[i].page_number) : rids[i].page_number;
+		seen = true;
+		slots |= rids[i].slot_number;
+	}
+
+	PackedLeafHeader h = PackedLeafHeader();
+	h.keyBase = keys[0];
+	h.keyBits = static_cast<unsigned char>(bitWidth(static_cast<std::uint32_t>(keys[n-1]) - static_cast<std::uint32_t>(keys[0])));
+	h.pageBase = low;
+	h.pageBits = static_cast<unsigned char>(std::max(bitWidth(high - low), (postings > 0) ? bitWidth(postings - 1) : 0));
+	h.slotBits = static_cast<unsigned char>(bitWidth(slots));
+	h.postings = static_cast<std::uint16_t>(postings);
+	int bits = h.keyBits + h.pageBits + h.slotBits;
+	h.entryBytes = static_cast<unsigned char>((bits <= 64) ? std::max((bits + 7) / 8, 1) : 0);
+	return h;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+/**
+ * True if the CPU has AVX2.
+ */
+bool hasAvx2()
+{
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	return avx2;
+}
+
+/**
+ * Decode the entries [from, to) of a packed leaf four at a time with AVX2 gathers, as far
+ * as whole groups of four go, into keys and rids from their start. Entries for posting
+ * lists come out with the index of their page number added to pageBase.
+ *
+ * @return	Index of the first entry not decoded
+ */
+__attribute__((target("avx2")))
+int unpackAvx2(const unsigned char* entries, const PackedLeafHeader& h, const int from, const int to,
+               int* keys, RecordId* rids)
+{
+	const __m256i key_mask = _mm256_set1_epi64x((std::int64_t(1) << h.keyBits) - 1);
+	const __m256i page_mask = _mm256_set1_epi64x((std::int64_t(1) << h.pageBits) - 1);
+	const __m256i slot_mask = _mm256_set1_epi64x((std::int64_t(1) << h.slotBits) - 1);
+	const __m256i key_base = _mm256_set1_epi64x(static_cast<std::uint32_t>(h.keyBase));
+	const __m256i page_base = _mm256_set1_epi64x(h.pageBase);
+	const __m256i low_half = _mm256_set1_epi64x(0xffffffffLL);
+	const __m256i even_lanes = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	const __m128i page_shift = _mm_cvtsi32_si128(h.keyBits);
+	const __m128i slot_shift = _mm_cvtsi32_si128(h.keyBits + h.pageBits);
+	const __m128i step = _mm_set1_epi32(4 * h.entryBytes);
+	__m128i offsets = _mm_add_epi32(_mm_setr_epi32(0, h.entryBytes, 2 * h.entryBytes, 3 * h.entryBytes),
+	                                _mm_set1_epi32(from * h.entryBytes));
+	int i = from;
+	for (; i + 4 <= to; i += 4){
+		__m256i v = _mm256_i32gather_epi64(reinterpret_cast<const long long*>(entries), offsets, 1);
+		__m256i key = _mm256_add_epi64(_mm256_and_si256(v, key_mask), key_base);
+		__m256i page = _mm256_add_epi64(_mm256_and_si256(_mm256_srl_epi64(v, page_shift), page_mask), page_base);
+		__m256i slot = _mm256_and_si256(_mm256_srl_epi64(v, slot_shift), slot_mask);
+		__m256i rid = _mm256_or_si256(_mm256_and_si256(page, low_half), _mm256_slli_epi64(slot, 32));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(keys + (i - from)),
+		                 _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(key, even_lanes)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(rids + (i - from)), rid);
+		offsets = _mm_add_epi32(offsets, step);
+	}
+	return i;
+}
+#endif
+
+/**
+ * Reads the entries of a leaf or message buffer in either layout. The leaf may be read
+ * while a writer changes it, so reads stay within the leaf and within size(); the caller
+ * validates the leaf's version before using what it read.
+ */
+class LeafReader {
+ public:
+	explicit LeafReader(const LeafNodeInt* leaf)
+		: leaf_(leaf), data_(reinterpret_cast<const unsigned char*>(leaf->keyArray)),
+		  packed_(leaf->layout == LEAF_PACKED)
+	{
+		int capacity = INTARRAYLEAFSIZE;
+		if (packed_){
+			memcpy(&header_, data_, sizeof(header_));
+			capacity = validHeader(header_) ? packedCapacity(header_) : 0;
+		}
+		size_ = std::min(std::max(leaf->stored, 0), capacity);
+	}
+
+	/**
+	 * Number of entries.
+	 */
+	int size() const { return size_; }
+
+	/**
+	 * Number of bytes of keyArray and ridArray in use.
+	 */
+	int bytes() const
+	{
+		if (!packed_){
+			return size_ * static_cast<int>(sizeof(int) + sizeof(PackedRecordId));
+		}
+		return static_cast<int>(sizeof(PackedLeafHeader)) + size_ * header_.entryBytes
+			+ header_.postings * static_cast<int>(sizeof(PageId));
+	}
+
+	/**
+	 * Key of entry i < size().
+	 */
+	int key(const int i) const
+	{
+		if (!packed_){
+			return leaf_->keyArray[i];
+		}
+		return static_cast<int>(static_cast<std::uint32_t>(header_.keyBase)
+			+ static_cast<std::uint32_t>(bitField(entry(i), 0, header_.keyBits)));
+	}
+
+	/**
+	 * Record id of entry i < size().
+	 */
+	RecordId rid(const int i) const
+	{
+		if (!packed_){
+			return leaf_->ridArray[i];
+		}
+		std::uint64_t value = entry(i);
+		RecordId rid;
+		rid.page_number = header_.pageBase + static_cast<PageId>(bitField(value, header_.keyBits, header_.pageBits));
+		rid.slot_number = static_cast<SlotId>(bitField(value, header_.keyBits + header_.pageBits, header_.slotBits));
+		rid.padding = 0;
+		if (isPosting(rid)){
+			rid.page_number = postingPage(rid.page_number - header_.pageBase);
+		}
+		return rid;
+	}
+
+	/**
+	 * Index of the first entry in [from, to) with a key not less than key, or to. Packed
+	 * keys are compared as they are stored, less keyBase.
+	 */
+	int lowerBound(int from, int to, const int key) const
+	{
+		if (!packed_){
+			return std::lower_bound(leaf_->keyArray + from, leaf_->keyArray + to, key) - leaf_->keyArray;
+		}
+		if (key < header_.keyBase){
+			return from;
+		}
+		std::uint64_t target = static_cast<std::uint32_t>(key) - static_cast<std::uint32_t>(header_.keyBase);
+		while (from < to){
+			int middle = from + (to - from) / 2;
+			if (bitField(entry(middle), 0, header_.keyBits) < target){
+				from = middle + 1;
+			}
+			else{
+				to = middle;
+			}
+		}
+		return from;
+	}
+
+	/**
+	 * Index of the first entry in [from, to) with a key greater than key, or to.
+	 */
+	int upperBound(int from, int to, const int key) const
+	{
+		if (!packed_){
+			return std::upper_bound(leaf_->keyArray + from, leaf_->keyArray + to, key) - leaf_->keyArray;
+		}
+		if (key < header_.keyBase){
+			return from;
+		}
+		std::uint64_t target = static_cast<std::uint32_t>(key) - static_cast<std::uint32_t>(header_.keyBase);
+		while (from < to){
+			int middle = from + (to - from) / 2;
+			if (bitField(entry(middle), 0, header_.keyBits) <= target){
+				from = middle + 1;
+			}
+			else{
+				to = middle;
+			}
+		}
+		return from;
+	}
+
+	/**
+	 * Copy the entries [from, to) to keys and rids, to <= size().
+	 */
+	void unpack(const int from, const int to, int* keys, RecordId* rids) const
+	{
+		if (!packed_){
+			std::copy(leaf_->keyArray + from, leaf_->keyArray + to, keys);
+			std::copy(leaf_->ridArray + from, leaf_->ridArray + to, rids);
+			return;
+		}
+		int i = from;
+#if defined(__GNUC__) && defined(__x86_64__)
+		if (hasAvx2()){
+			i = unpackAvx2(data_ + sizeof(PackedLeafHeader), header_, from, to, keys, rids);
+			for (int j = 0; header_.postings > 0 && j < i - from; j++){
+				if (isPosting(rids[j])){
+					rids[j].page_number = postingPage(rids[j].page_number - header_.pageBase);
+				}
+			}
+		}
+#endif
+		for (; i < to; i++){
+			keys[i - from] = key(i);
+			rids[i - from] = rid(i);
+		}
+	}
+
+	/**
+	 * Append the entries [from, to) to keys and rids.
+	 */
+	void append(const int from, const int to, std::vector<int>& keys, std::vector<RecordId>& rids) const
+	{
+		if (from >= to){
+			return;
+		}
+		std::size_t old_size = keys.size();
+		keys.resize(old_size + (to - from));
+		rids.resize(old_size + (to - from));
+		unpack(from, to, &keys[old_size], &rids[old_size]);
+	}
+
+ private:
+	/**
+	 * Bytes of packed entry i, read with one load.
+	 */
+	std::uint64_t entry(const int i) const
+	{
+		std::uint64_t value;
+		memcpy(&value, data_ + sizeof(PackedLeafHeader) + static_cast<std::size_t>(i) * header_.entryBytes, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		value = __builtin_bswap64(value);
+#endif
+		return value;
+	}
+
+	/**
+	 * Page number of posting list index of the leaf.
+	 */
+	PageId postingPage(const PageId index) const
+	{
+		if (index >= header_.postings){
+			return Page::INVALID_NUMBER;
+		}
+		PageId pageNo;
+		memcpy(&pageNo, data_ + LEAFDATASIZE - (index + 1) * sizeof(PageId), sizeof(pageNo));
+		return pageNo;
+	}
+
+	const LeafNodeInt* leaf_;
+	const unsigned char* data_;
+	bool packed_;
+	PackedLeafHeader header_;
+	int size_;
+};
+
+/**
+ * Write entry i of a packed leaf. A posting list entry is given the index of its page
+ * number in place of the page number.
+ */
+void storeEntry(LeafNodeInt* leaf, const PackedLeafHeader& h, const int i, const int key, const RecordId& rid)
+{
+	std::uint64_t value = static_cast<std::uint32_t>(key) - static_cast<std::uint32_t>(h.keyBase);
+	value |= static_cast<std::uint64_t>(rid.page_number - h.pageBase) << h.keyBits;
+	if (h.slotBits > 0){
+		value |= static_cast<std::uint64_t>(rid.slot_number) << (h.keyBits + h.pageBits);
+	}
+	unsigned char* out = reinterpret_cast<unsigned char*>(leaf->keyArray) + sizeof(PackedLeafHeader)
+		+ static_cast<std::size_t>(i) * h.entryBytes;
+	for (int b = 0; b < h.entryBytes; b++){
+		out[b] = static_cast<unsigned char>(value >> (8 * b));
+	}
+}
+
+/**
+ * True if n sorted entries fit into one leaf.
+ */
+bool leafFits(const int* keys, const RecordId* rids, const int n)
+{
+	if (n <= INTARRAYLEAFSIZE){
+		return true;
+	}
+	PackedLeafHeader h = packedLayout(keys, rids, n);
+	return h.entryBytes > 0 && n <= packedCapacity(h);
+}
+
+/**
+ * Store n sorted entries in a leaf: wide if keyArray has room for them, else packed.
+ * Returns false, leaving the leaf as it was, if they do not fit.
+ */
+bool packLeaf(LeafNodeInt* leaf, const int* keys, const RecordId* rids, const int n)
+{
+	if (!leafFits(keys, rids, n)){
+		return false;
+	}
+	if (n <= INTARRAYLEAFSIZE){
+		std::copy(keys, keys + n, leaf->keyArray);
+		std::copy(rids, rids + n, leaf->ridArray);
+		leaf->layout = LEAF_WIDE;
+		leaf->stored = n;
+		return true;
+	}
+	PackedLeafHeader h = packedLayout(keys, rids, n);
+	unsigned char* data = reinterpret_cast<unsigned char*>(leaf->keyArray);
+	memcpy(data, &h, sizeof(h));
+	PageId index = h.pageBase;
+	for (int i = 0; i < n; i++){
+		if (isPosting(rids[i])){
+			memcpy(data + LEAFDATASIZE - (index - h.pageBase + 1) * sizeof(PageId), &rids[i].page_number, sizeof(PageId));
+			RecordId entry = rids[i];
+			entry.page_number = index++;
+			storeEntry(leaf, h, i, keys[i], entry);
+		}
+		else{
+			storeEntry(leaf, h, i, keys[i], rids[i]);
+		}
+	}
+	leaf->layout = LEAF_PACKED;
+	leaf->stored = n;
+	return true;
+}
+
+/**
+ * Insert an entry at pos of a leaf or message buffer, re-encoding a packed leaf only if
+ * the entry does not fit its fields. Returns false, leaving the leaf as it was, if the
+ * entries do not fit. The result depends only on the leaf and the entry, so recovery
+ * repeats an insert exactly.
+ */
+bool insertLeafEntry(LeafNodeInt* leaf, const int pos, const int key, const RecordId& rid)
+{
+	int n = leaf->stored;
+	if (leaf->layout != LEAF_PACKED && n < INTARRAYLEAFSIZE){
+		for (int i = n; i > pos; i--){
+			leaf->keyArray[i] = leaf->keyArray[i-1];
+			leaf->ridArray[i] = leaf->ridArray[i-1];
+		}
+		leaf->keyArray[pos] = key;
+		leaf->ridArray[pos] = rid;
+		leaf->stored++;
+		return true;
+	}
+	if (leaf->layout == LEAF_PACKED && !isPosting(rid)){
+		PackedLeafHeader h;
+		memcpy(&h, leaf->keyArray, sizeof(h));
+		std::uint64_t key_delta = static_cast<std::uint32_t>(key) - static_cast<std::uint32_t>(h.keyBase);
+		std::uint64_t page_delta = static_cast<std::uint32_t>(rid.page_number - h.pageBase);
+		if (n < packedCapacity(h) && key >= h.keyBase && key_delta >> h.keyBits == 0 && page_delta >> h.pageBits == 0
+				&& rid.slot_number >> h.slotBits == 0){
+			unsigned char* at = reinterpret_cast<unsigned char*>(leaf->keyArray) + sizeof(PackedLeafHeader)
+				+ static_cast<std::size_t>(pos) * h.entryBytes;
+			memmove(at + h.entryBytes, at, static_cast<std::size_t>(n - pos) * h.entryBytes);
+			storeEntry(leaf, h, pos, key, rid);
+			leaf->stored++;
+			return true;
+		}
+	}
+	std::vector<int> keys;
+	std::vector<RecordId> rids;
+	LeafReader reader(leaf);
+	reader.append(0, pos, keys, rids);
+	keys.push_back(key);
+	rids.push_back(rid);
+	reader.append(pos, n, keys, rids);
+	return packLeaf(leaf, &keys[0], &rids[0], n + 1);
+}
+
+/**
+ * Cut sorted entries into the fewest pieces of about the same size that each fit into a
+ * leaf. Returns the index of the first entry of each piece, then the number of entries.
+ */
+std::vector<std::size_t> cutLeaf(const std::vector<int>& keys, const std::vector<RecordId>& rids)
+{
+	std::size_t n = keys.size();
+	for (std::size_t pieces = std::max<std::size_t>((n + MAXLEAFENTRIES - 1) / MAXLEAFENTRIES, 1); ; pieces++){
+		std::vector<std::size_t> bounds;
+		for (std::size_t p = 0; p <= pieces; p++){
+			bounds.push_back(n * p / pieces);
+		}
+		bool fit = true;
+		for (std::size_t p = 0; fit && p < pieces; p++){
+			fit = leafFits(keys.data() + bounds[p], rids.data() + bounds[p], static_cast<int>(bounds[p+1] - bounds[p]));
+		}
+		if (fit){
+			return bounds;
+		}
+	}
+}
+
+/**
+ * Replays the log records of an index file.
+ */
+class BTreeRedo : public RedoHandler {
+ public:
+	void redo(const LogRecord& rec, Page& page) override
+	{
+		if (rec.type == BTREE_LOG_META){
+			// the meta page has no LSN, but only the last image of it counts anyway
+			memcpy(static_cast<void*>(&page), rec.data, Page::SIZE);
+			return;
+		}
+		if (nodeLsn(page) >= rec.commitLsn){
+			return;
+		}
+		switch (rec.type){
+		case BTREE_LOG_NODE:
+			// the image was taken with the node latched
+			memcpy(static_cast<void*>(&page), rec.data, Page::SIZE);
+			reinterpret_cast<LeafNodeInt*>(&page)->latch.init();
+			break;
+		case BTREE_LOG_LEAF_INSERT: {
+			LeafInsertRec r;
+			memcpy(&r, rec.data, sizeof(r));
+			insertLeafEntry(reinterpret_cast<LeafNodeInt*>(&page), r.pos, r.key, r.rid);
+			break;
+		}
+		case BTREE_LOG_NONLEAF_INSERT: {
+			NonLeafInsertRec r;
+			memcpy(&r, rec.data, sizeof(r));
+			NonLeafNodeInt* node = reinterpret_cast<NonLeafNodeInt*>(&page);
+			for (int n = node->stored; n > r.pos; n--){
+				node->keyArray[n] = node->keyArray[n-1];
+				node->pageNoArray[n+1] = node->pageNoArray[n];
+				node->countArray[n+1] = node->countArray[n];
+			}
+			node->keyArray[r.pos] = r.key;
+			node->pageNoArray[r.pos+1] = r.pageNo;
+			node->countArray[r.pos] = r.leftCount;
+			node->countArray[r.pos+1] = r.rightCount;
+			node->stored++;
+			break;
+		}
+		case BTREE_LOG_COUNT: {
+			CountRec r;
+			memcpy(&r, rec.data, sizeof(r));
+			reinterpret_cast<NonLeafNodeInt*>(&page)->countArray[r.pos] = r.count;
+			break;
+		}
+		case BTREE_LOG_POSTING_ADD: {
+			PostingAddRec r;
+			memcpy(&r, rec.data, sizeof(r));
+			PostingPageInt* list = reinterpret_cast<PostingPageInt*>(&page);
+			std::vector<RecordId> rest;
+			fillPostings(list, &r.rid, 1, rest);
+			if (r.total >= 0){
+				list->total = r.total;
+			}
+			break;
+		}
+		case BTREE_LOG_POSTING_TOTAL: {
+			PostingTotalRec r;
+			memcpy(&r, rec.data, sizeof(r));
+			reinterpret_cast<PostingPageInt*>(&page)->total = r.total;
+			break;
+		}
+		default:
+			return;
+		}
+		setNodeLsn(page, rec.commitLsn);
+	}
+};
+
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::BTreeIndex -- Constructor
+// -----------------------------------------------------------------------------
+
+BTreeIndex::BTreeIndex(const std::string & relationName,
+		std::string & outIndexName,
+		BufMgr *bufMgrIn,
+		const int attrByteOffset,
+		const Datatype attrType,
+		const IndexOpenMode openMode)
+{	
+	std::ostringstream idxStr;
+	idxStr << relationName << '.' << attrByteOffset;
+	outIndexName = idxStr.str();
+
+	this->bufMgr = bufMgrIn;
+	this->log = (openMode == READ_WRITE) ? bufMgrIn->getLog() : NULL;
+	this->lastLsn = 0;
+	this->openSnapshots = 0;
+	this->attributeType = attrType;
+	this->attrByteOffset = attrByteOffset;
+	this->leafOccupancy = INTARRAYLEAFSIZE;
+	this->nodeOccupancy = INTARRAYNONLEAFSIZE;
+	this->bufferedNodeOccupancy = std::min(INTBUFFEREDNONLEAFSIZE, INTARRAYNONLEAFSIZE);
+	this->insertsBuffered = false;
+	this->subtreeCounts = false;
+	this->postingLists = false;
+	this->sampleSeed = 0x9e3779b97f4a7c15ULL;
+	this->longestPosting = 1;
+	this->memtable = NULL;
+	this->hashedLookups = false;
+	this->openMode = openMode;
+	this->scanExecuting = false;
+	this->nextEntry = -1;
+	this->scanReverse = false;
+	this->nextMessage = 0;
+	this->nextPosting = 0;
+	this->nextRange = 0;
+	this->currentPageNum = Page::INVALID_NUMBER;
+
+	if (File::exists(outIndexName)){
+		file = new BlobFile(outIndexName, false);
+		if (log != NULL){
+			// bring the file up to date with the changes committed before a crash
+			BTreeRedo redo;
+			log->redo(file, redo);
+		}
+		headerPageNum = file->getFirstPageNo();
+
+		if (openMode == READ_ONLY_MMAP){
+			file->mapReadOnly();
+			// internal nodes are visited in no particular order; leaf scans
+			// prefetch their right sibling explicitly
+			file->adviseMapped(0, 0, BlobFile::ADVISE_RANDOM);
+		}
+		try{
+			ReadPageGuard meta_page = readNode(headerPageNum);
+			loadMetaInfo(meta_page.as<IndexMetaInfo>(), relationName);
+		}catch(BadIndexInfoException &e){
+			delete file;
+			throw;
+		}
+		loadShadowList();
+		return;
+	}
+	if (openMode == READ_ONLY_MMAP){
+		throw FileNotFoundException(outIndexName);
+	}
+	file = new BlobFile(outIndexName, true);
+
+	{
+		//allocate meta page
+		PageId pid;
+		WritePageGuard meta_page = bufMgr->allocPageGuarded(file, pid);
+		IndexMetaInfo* index_meta = meta_page.as<IndexMetaInfo>();
+		strncpy(index_meta->relationName,relationName.c_str(),sizeof(index_meta->relationName)-1);
+		index_meta->relationName[sizeof(index_meta->relationName)-1] = '\0';
+		index_meta->attrByteOffset = attrByteOffset;
+		index_meta->attrType = attrType;
+		index_meta->insertsBuffered = false;
+		index_meta->subtreeCounts = false;
+		index_meta->postingLists = false;
+		index_meta->statistics.analyzed = false;
+		
+		//allocate root page
+		PageId rootid;
+		WritePageGuard root_page = bufMgr->allocPageGuarded(file, rootid);
+		NonLeafNodeInt* root_node = root_page.as<NonLeafNodeInt>();
+		for(int i=0;i<INTARRAYNONLEAFSIZE;i++){
+			root_node->keyArray[i] = INT_MAX;
+			root_node->pageNoArray[i+1] = Page::INVALID_NUMBER;
+			root_node->countArray[i+1] = 0;
+		}
+		root_node->countArray[0] = 0;
+		root_node->latch.init();
+		root_node->level = 1;
+		root_node->stored = 0;
+		root_node->rightSibPageNo = Page::INVALID_NUMBER;
+		root_node->highKey = INT_MAX;
+		root_node->bufferPageNo = Page::INVALID_NUMBER;
+
+		// allocate the first leaf page
+		PageId childid;
+		WritePageGuard child_page = bufMgr->allocPageGuarded(file, childid);
+		LeafNodeInt* child_node = child_page.as<LeafNodeInt>();
+		child_node->latch.init();
+		child_node->rightSibPageNo = Page::INVALID_NUMBER;
+		child_node->leftSibPageNo = Page::INVALID_NUMBER;
+		child_node->highKey = INT_MAX;
+		child_node->stored = 0;
+		child_node->layout = LEAF_WIDE;
+		for(int i = 0; i < leafOccupancy; i++){
+			child_node->keyArray[i] = INT_MAX;
+		}
+		root_node->pageNoArray[0] = childid;
+
+		// allocate the first page of the shadow page list
+		PageId listid;
+		WritePageGuard list_page = bufMgr->allocPageGuarded(file, listid);
+		ShadowListPageInt* list = list_page.as<ShadowListPageInt>();
+		list->latch.init();
+		list->nextPageNo = Page::INVALID_NUMBER;
+		list->stored = 0;
+		shadowListPages.push_back(listid);
+		
+		//fill in fields of btree
+		index_meta->rootPageNo = rootid;
+		index_meta->shadowListPageNo = listid;
+		this->headerPageNum = pid;
+		this->rootPageNum = rootid;
+		this->height = 2;
+
+		//log the new file as a whole; records of an earlier file of the same name
+		//are ignored from here on
+		LogUnit unit;
+		if (log != NULL){
+			unit.add(LOG_FILE_CREATE, file, Page::INVALID_NUMBER, NULL, 0);
+			unit.add(BTREE_LOG_META, file, pid, meta_page.page(), Page::SIZE);
+			unit.add(BTREE_LOG_NODE, file, rootid, root_page.page(), Page::SIZE);
+			unit.add(BTREE_LOG_NODE, file, childid, child_page.page(), Page::SIZE);
+			unit.add(BTREE_LOG_NODE, file, listid, list_page.page(), Page::SIZE);
+		}
+		WritePageGuard* pages[] = { &meta_page, &root_page, &child_page, &list_page };
+		logUnit(unit, pages, 4);
+		if (log != NULL){
+			log->flush();
+		}
+	}
+
+	//insert entries from the relation
+	FileScan fc(relationName,bufMgr);
+	RecordId rid;
+	try{
+		while (true){
+			fc.scanNext(rid);
+			std::string data = fc.getRecord();
+			const int* key = reinterpret_cast<const int*>(data.c_str() + attrByteOffset);
+			insertEntry(key,rid);
+		}
+	}catch(EndOfFileException &e){
+	}
+
+}
+
+void BTreeIndex::loadMetaInfo(const IndexMetaInfo* meta, const std::string & relationName)
+{
+	if (relationName.compare(0, sizeof(meta->relationName) - 1, meta->relationName) != 0){
+		throw BadIndexInfoException("relation name does not match");
+	}
+	if (meta->attrByteOffset != attrByteOffset || meta->attrType != attributeType){
+		throw BadIndexInfoException("indexed attribute does not match");
+	}
+	rootPageNum = meta->rootPageNo;
+	insertsBuffered = meta->insertsBuffered;
+	subtreeCounts = meta->subtreeCounts;
+	postingLists = meta->postingLists;
+
+	ReadPageGuard root_page = readNode(rootPageNum);
+	height = root_page.as<NonLeafNodeInt>()->level + 1;
+}
+
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::~BTreeIndex -- destructor
+// -----------------------------------------------------------------------------
+
+BTreeIndex::~BTreeIndex()
+{
+	try{
+		if (scanExecuting){
+			endScan();
+		}
+		mergeMemtable();
+		if (openMode == READ_WRITE){
+			bufMgr->flushFile(file);
+		}
+	}catch(BadgerDbException &e){
+	}
+	delete memtable;
+	delete file;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readNode
+// -----------------------------------------------------------------------------
+
+ReadPageGuard BTreeIndex::readNode(const PageId pageNo)
+{
+	if (openMode == READ_ONLY_MMAP){
+		return ReadPageGuard(file->mappedPage(pageNo), pageNo);
+	}
+	return bufMgr->readPageGuarded(file, pageNo);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::writeNode
+// -----------------------------------------------------------------------------
+
+WritePageGuard BTreeIndex::writeNode(const PageId pageNo)
+{
+	if (openMode == READ_ONLY_MMAP){
+		throw IndexReadOnlyException(file->filename());
+	}
+	return bufMgr->writePageGuarded(file, pageNo);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readInner
+// -----------------------------------------------------------------------------
+
+ReadPageGuard BTreeIndex::readInner(const PageId pageNo)
+{
+	if (openMode == READ_ONLY_MMAP){
+		return readNode(pageNo);
+	}
+	const Page* held = bufMgr->heldPage(file, pageNo);
+	if (held != NULL){
+		return ReadPageGuard(held, pageNo);
+	}
+	ReadPageGuard page = bufMgr->readPageGuarded(file, pageNo);
+	bufMgr->holdPage(file, pageNo);
+	return page;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readLeaf
+// -----------------------------------------------------------------------------
+
+ReadPageGuard BTreeIndex::readLeaf(const PageId pageNo)
+{
+	ReadPageGuard page = readNode(pageNo);
+	if (openMode == READ_ONLY_MMAP){
+		return page;
+	}
+
+	const LeafNodeInt* leaf = page.as<LeafNodeInt>();
+	while (true){
+		std::uint64_t version = leaf->latch.readLock();
+		memcpy(static_cast<void*>(&scanLeaf), leaf, sizeof(LeafNodeInt));
+		if (leaf->latch.validate(version)){
+			break;
+		}
+	}
+	return ReadPageGuard(reinterpret_cast<const Page*>(&scanLeaf), pageNo);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readVersion / validVersion
+// -----------------------------------------------------------------------------
+
+std::uint64_t BTreeIndex::readVersion(const VersionLatch& latch) const
+{
+	return (openMode == READ_ONLY_MMAP) ? 0 : latch.readLock();
+}
+
+bool BTreeIndex::validVersion(const VersionLatch& latch, const std::uint64_t version) const
+{
+	return openMode == READ_ONLY_MMAP || latch.validate(version);
+}
+
+namespace {
+
+/**
+ * Index of the child of a non-leaf node to follow for key. Ties go to the left for
+ * searches, which must find the first duplicate, and to the right for inserts.
+ * The node may be read while a writer changes it, so stored is clamped to the node
+ * size; the caller validates the node's version before using the result.
+ */
+int childIndex(const NonLeafNodeInt* node, const int key, const bool tiesRight)
+{
+	int stored = std::min(std::max(node->stored, 0), INTARRAYNONLEAFSIZE);
+	const int* end = node->keyArray + stored;
+	return (tiesRight ? std::upper_bound(node->keyArray, end, key)
+	                  : std::lower_bound(node->keyArray, end, key)) - node->keyArray;
+}
+
+/**
+ * True if a search for key has to continue in the right sibling of a node split at
+ * highKey. Inserts send keys equal to the separator right; searches stay left, since
+ * duplicates of the separator may remain in the left node.
+ */
+bool movesRight(const PageId rightSibPageNo, const int highKey, const int key, const bool tiesRight)
+{
+	return rightSibPageNo != Page::INVALID_NUMBER && (tiesRight ? key >= highKey : key > highKey);
+}
+
+/**
+ * Number of entries under a non-leaf node, from the counts of its children.
+ */
+int subtreeCount(const NonLeafNodeInt* node)
+{
+	int count = 0;
+	for (int i = 0; i <= node->stored; i++){
+		count += node->countArray[i];
+	}
+	return count;
+}
+
+/**
+ * Random descents tried for each entry to draw from a range before the range is read
+ * instead.
+ */
+const std::size_t SAMPLE_ATTEMPTS = 64;
+
+/**
+ * Number of entries drawn to estimate quantiles without subtree counts.
+ */
+const std::size_t QUANTILE_SAMPLES = 4096;
+
+/**
+ * Advance a xorshift64* generator and return a random number in [0, n).
+ */
+std::uint64_t randomBelow(std::uint64_t& state, const std::uint64_t n)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return (state * 2685821657736338717ULL) % n;
+}
+
+/**
+ * Position of the entry at a fraction of count entries in key order.
+ */
+std::size_t quantilePosition(const double fraction, const std::size_t count)
+{
+	double position = std::min(std::max(fraction, 0.0), 1.0) * (count - 1);
+	return static_cast<std::size_t>(position + 0.5);
+}
+
+/**
+ * Percentage of its entries a node at the end of its level keeps when it splits at that
+ * end, as under inserts in key order. The new node then fills up with the keys that
+ * follow; the room left behind takes keys that arrive slightly out of order.
+ */
+const int EDGE_SPLIT_PERCENT = 90;
+
+/**
+ * Releases a write latch when it goes out of scope. Declared after the page guards in
+ * a scope, so the latch is dropped before the page is unpinned and a latched node is
+ * never written back.
+ */
+class WriteLatchHold{
+ public:
+	WriteLatchHold() : latch_(NULL) {}
+	~WriteLatchHold() { release(); }
+	void hold(VersionLatch& latch) { latch_ = &latch; }
+	void release() { if (latch_ != NULL) latch_->writeUnlock(); latch_ = NULL; }
+ private:
+	VersionLatch* latch_;
+};
+
+/**
+ * Insert an entry into a leaf or message buffer that has room, after the entries with
+ * the same key. Returns the position of the new entry.
+ */
+int insertSorted(LeafNodeInt* leaf, const int key, const RecordId rid)
+{
+	int m = std::upper_bound(leaf->keyArray, leaf->keyArray + leaf->stored, key) - leaf->keyArray;
+	for (int n = leaf->stored; n > m; n--){
+		leaf->keyArray[n] = leaf->keyArray[n-1];
+		leaf->ridArray[n] = leaf->ridArray[n-1];
+	}
+	leaf->keyArray[m] = key;
+	leaf->ridArray[m] = rid;
+	leaf->stored++;
+	return m;
+}
+
+/**
+ * Merge the entries of a leaf or message buffer with count messages of a buffer, starting
+ * at first, into keys and rids. Messages are newer than the entries they join, so they go
+ * after entries with the same key.
+ */
+void mergeMessages(const LeafNodeInt* leaf, const LeafNodeInt* buffer, const int first, const int count,
+                   std::vector<int>& keys, std::vector<RecordId>& rids)
+{
+	std::vector<int> leaf_keys;
+	std::vector<RecordId> leaf_rids;
+	LeafReader entries(leaf);
+	entries.append(0, entries.size(), leaf_keys, leaf_rids);
+	int stored = entries.size();
+	int total = stored + count;
+	keys.resize(total);
+	rids.resize(total);
+	for (int a = 0, b = first, c = 0; c < total; c++){
+		if (b == first + count || (a < stored && leaf_keys[a] <= buffer->keyArray[b])){
+			keys[c] = leaf_keys[a];
+			rids[c] = leaf_rids[a];
+			a++;
+		}
+		else{
+			keys[c] = buffer->keyArray[b];
+			rids[c] = buffer->ridArray[b];
+			b++;
+		}
+	}
+}
+
+/**
+ * Remove count messages starting at first from a message buffer.
+ */
+void removeMessages(LeafNodeInt* buffer, const int first, const int count)
+{
+	for (int n = first; n + count < buffer->stored; n++){
+		buffer->keyArray[n] = buffer->keyArray[n+count];
+		buffer->ridArray[n] = buffer->ridArray[n+count];
+	}
+	buffer->stored -= count;
+}
+
+/**
+ * Insert separator key at pos of a non-leaf node that has room, with pageNo to its right.
+ * The counts move with their children, as replaying BTREE_LOG_NONLEAF_INSERT moves them,
+ * and the new child counts nothing.
+ */
+void insertSeparator(NonLeafNodeInt* node, const int pos, const int key, const PageId pageNo)
+{
+	for (int n = node->stored; n > pos; n--){
+		node->keyArray[n] = node->keyArray[n-1];
+		node->pageNoArray[n+1] = node->pageNoArray[n];
+		node->countArray[n+1] = node->countArray[n];
+	}
+	node->keyArray[pos] = key;
+	node->pageNoArray[pos+1] = pageNo;
+	node->countArray[pos+1] = 0;
+	node->stored++;
+}
+
+/**
+ * Number of independent descents of a batch lookup whose nodes are fetched together.
+ */
+const std::size_t LOOKUP_GROUP_SIZE = 8;
+
+/**
+ * Orders the positions of batch keys by key.
+ */
+struct BatchKeyLess{
+	explicit BatchKeyLess(const int* keys) : keys(keys) {}
+	bool operator()(const std::size_t a, const std::size_t b) const { return keys[a] < keys[b]; }
+	const int* keys;
+};
+
+/**
+ * Hint the CPU to load the header of a node and the middle of its keys, where the binary
+ * search starts.
+ */
+void prefetchNode(const Page* page, const std::size_t middle)
+{
+	const char* data = reinterpret_cast<const char*>(page);
+#if defined(__GNUC__)
+	__builtin_prefetch(data);
+	__builtin_prefetch(data + middle);
+#else
+	(void)data;
+	(void)middle;
+#endif
+}
+
+/**
+ * Orders buffered messages by key alone.
+ */
+bool messageKeyLess(const RIDKeyPair<int>& a, const RIDKeyPair<int>& b)
+{
+	return a.key < b.key;
+}
+
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::findNode
+// -----------------------------------------------------------------------------
+
+PageId BTreeIndex::findNode(const int key, const bool tiesRight, const int level, std::vector<PageId>* path)
+{
+	// nodes near the root are held, so most descents pin nothing above the leaves
+	HeldReadSection held(bufMgr);
+	PageId pid = rootPageNum;
+	ReadPageGuard page = readInner(pid);
+	const NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+
+	// nodes are never removed, so after a failed validation the same node is simply
+	// read again
+	while (true){
+		std::uint64_t version = readVersion(node->latch);
+		int node_level = node->level;
+		if (node_level == level){
+			if (validVersion(node->latch, version)){
+				return pid;
+			}
+			continue;
+		}
+
+		PageId next;
+		bool right = movesRight(node->rightSibPageNo, node->highKey, key, tiesRight);
+		if (right){
+			next = node->rightSibPageNo;
+		}
+		else{
+			next = node->pageNoArray[childIndex(node, key, tiesRight)];
+		}
+		if (!validVersion(node->latch, version)){
+			continue;
+		}
+
+		if (!right){
+			if (path != NULL){
+				path->push_back(pid);
+			}
+			if (node_level == level + 1){
+				return next;
+			}
+		}
+		page = readInner(next);
+		node = page.as<NonLeafNodeInt>();
+		pid = next;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertEntry
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::insertEntry(const void *key, const RecordId rid) 
+{
+	if (openMode == READ_ONLY_MMAP){
+		throw IndexReadOnlyException(file->filename());
+	}
+
+	int int_key = *(const int*)key;
+	if (memtable != NULL){
+		insertMemtable(int_key, rid);
+		return;
+	}
+	if (insertsBuffered){
+		insertBuffered(int_key, rid);
+		return;
+	}
+	if (subtreeCounts){
+		insertCounted(int_key, rid);
+		return;
+	}
+	std::vector<PageId> path;
+	insertLeaf(int_key, rid, findNode(int_key, true, 0, &path), path, NULL);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertLeaf
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::insertLeaf(const int key, const RecordId rid, PageId leafPid, std::vector<PageId>& path,
+		const std::vector<int>* slots)
+{
+	std::vector<PageId> new_pids;
+	std::vector<int> separators;
+	std::vector<int> sizes;
+	{
+		//held until the leaf is unlatched, so no snapshot is taken halfway through
+		SharedLatchGuard snap_hold(snapLatch);
+		WritePageGuard leaf_page = writeNode(leafPid);
+		LeafNodeInt* leaf = leaf_page.as<LeafNodeInt>();
+		leaf->latch.writeLock();
+		WriteLatchHold leaf_hold;
+		leaf_hold.hold(leaf->latch);
+
+		//the leaf may have been split since the parent was read
+		while (movesRight(leaf->rightSibPageNo, leaf->highKey, key, true)){
+			WritePageGuard right_page = writeNode(leaf->rightSibPageNo);
+			LeafNodeInt* right = right_page.as<LeafNodeInt>();
+			right->latch.writeLock();
+			leaf_hold.release();
+			leaf_page = std::move(right_page);
+			leaf = right;
+			leaf_hold.hold(leaf->latch);
+		}
+		preserve(leaf_page);
+
+		//a key with many entries keeps them in a posting list
+		LeafReader entries(leaf);
+		int n = entries.size();
+		if (postingLists){
+			int from = entries.lowerBound(0, n, key);
+			int to = entries.upperBound(from, n, key);
+			bool listed = false;
+			for (int i = from; i < to; i++){
+				listed = listed || isPosting(entries.rid(i));
+			}
+			if ((listed || to - from + 1 >= POSTING_MIN_ENTRIES)
+					&& foldPostings(leaf_page, from, to, &rid, (slots != NULL) ? &path : NULL, slots)){
+				return;
+			}
+		}
+
+		//leaf has enough space
+		int m = entries.upperBound(0, n, key);
+		if (insertLeafEntry(leaf, m, key, rid)){
+			hashLeafKeys(leaf_page.pageNo(), leaf, m, m+1);
+
+			LogUnit unit;
+			if (log != NULL){
+				LeafInsertRec rec = { m, key, rid };
+				unit.add(BTREE_LOG_LEAF_INSERT, file, leaf_page.pageNo(), &rec, sizeof(rec));
+			}
+			WritePageGuard* pages[] = { &leaf_page };
+			if (slots != NULL){
+				logCounted(unit, pages, 1, false, path, *slots, 1);
+			}
+			else{
+				logUnit(unit, pages, 1);
+			}
+			return;
+		}
+
+		//leaf does not have enough space: copy everything with the new entry inserted
+		std::vector<int> keys;
+		std::vector<RecordId> rids;
+		entries.append(0, m, keys, rids);
+		keys.push_back(key);
+		rids.push_back(rid);
+		entries.append(m, n, keys, rids);
+
+		//where to cut. The last leaf overflowing at its end, as under ascending inserts,
+		//keeps EDGE_SPLIT_PERCENT of the entries and the new leaf takes the rest; the first
+		//leaf overflowing at its start, as under descending inserts, gives that many to the
+		//new leaf. Keys inserted in order then fill their leaves instead of leaving them half
+		//empty. Otherwise the entries are cut into even pieces, more than two if a wider
+		//packed layout makes halves too big.
+		std::vector<std::size_t> bounds;
+		bool at_end = m == n && leaf->rightSibPageNo == Page::INVALID_NUMBER;
+		bool at_start = m == 0 && leaf->leftSibPageNo == Page::INVALID_NUMBER;
+		if (at_end || at_start){
+			std::size_t kept = static_cast<std::size_t>(n) * EDGE_SPLIT_PERCENT / 100;
+			bounds.push_back(0);
+			bounds.push_back(at_end ? kept : n + 1 - kept);
+			bounds.push_back(n + 1);
+		}
+		else{
+			bounds = cutLeaf(keys, rids);
+		}
+		std::vector<WritePageGuard> new_pages;
+		fillLeaves(leaf_page, keys, rids, bounds, new_pages, separators, sizes);
+
+		//the old right sibling links back to the last new leaf in the same unit
+		WritePageGuard right_page;
+		WriteLatchHold right_hold;
+		std::vector<WritePageGuard*> pages(1, &leaf_page);
+		for (std::size_t i = 0; i < new_pages.size(); i++){
+			pages.push_back(&new_pages[i]);
+			new_pids.push_back(new_pages[i].pageNo());
+		}
+		PageId right_pid = new_pages.back().as<LeafNodeInt>()->rightSibPageNo;
+		if (right_pid != Page::INVALID_NUMBER){
+			right_page = writeNode(right_pid);
+			LeafNodeInt* right = right_page.as<LeafNodeInt>();
+			right->latch.writeLock();
+			right_hold.hold(right->latch);
+			preserve(right_page);
+			right->leftSibPageNo = new_pages.back().pageNo();
+			pages.push_back(&right_page);
+		}
+
+		LogUnit unit;
+		if (slots != NULL){
+			logCounted(unit, &pages[0], static_cast<int>(pages.size()), true, path, *slots, 1);
+		}
+		else{
+			logImages(unit, &pages[0], static_cast<int>(pages.size()));
+		}
+		leafPid = leaf_page.pageNo();
+	}
+
+	//the new leaves are reachable through the links; add their separators left to right
+	for (std::size_t i = 0; i < new_pids.size(); i++){
+		std::vector<PageId> parents(path);
+		insertIntoParent(separators[i], leafPid, new_pids[i], sizes[i], 1, parents);
+		leafPid = new_pids[i];
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::fillLeaves
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::fillLeaves(WritePageGuard& leafPage, const std::vector<int>& keys, const std::vector<RecordId>& rids,
+		const std::vector<std::size_t>& bounds, std::vector<WritePageGuard>& newPages,
+		std::vector<int>& separators, std::vector<int>& sizes)
+{
+	LeafNodeInt* leaf = leafPage.as<LeafNodeInt>();
+	std::size_t pieces = bounds.size() - 1;
+	newPages.resize(pieces - 1);
+	separators.resize(pieces - 1);
+	sizes.resize(pieces);
+
+	//the new leaves get their pages first, so that each knows its left neighbour, and are
+	//written right to left
+	for (std::size_t p = 1; p < pieces; p++){
+		PageId new_pid;
+		newPages[p - 1] = allocNode(new_pid);
+	}
+	PageId next_pid = leaf->rightSibPageNo;
+	int next_high = leaf->highKey;
+	for (std::size_t p = pieces - 1; p > 0; p--){
+		LeafNodeInt* new_leaf = newPages[p - 1].as<LeafNodeInt>();
+		new_leaf->latch.init();
+		packLeaf(new_leaf, keys.data() + bounds[p], rids.data() + bounds[p], static_cast<int>(bounds[p+1] - bounds[p]));
+		new_leaf->rightSibPageNo = next_pid;
+		new_leaf->leftSibPageNo = (p == 1) ? leafPage.pageNo() : newPages[p - 2].pageNo();
+		new_leaf->highKey = next_high;
+		hashLeafKeys(newPages[p - 1].pageNo(), new_leaf, 0, new_leaf->stored);
+
+		next_pid = newPages[p - 1].pageNo();
+		next_high = keys[bounds[p]];
+		separators[p - 1] = keys[bounds[p]];
+		sizes[p] = static_cast<int>(leafEntries(new_leaf, 0, new_leaf->stored));
+	}
+
+	packLeaf(leaf, keys.data(), rids.data(), static_cast<int>(bounds[1]));
+	leaf->rightSibPageNo = next_pid;
+	leaf->highKey = next_high;
+	hashLeafKeys(leafPage.pageNo(), leaf, 0, leaf->stored);
+	sizes[0] = static_cast<int>(leafEntries(leaf, 0, leaf->stored));
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertCounted
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::insertCounted(const int key, const RecordId rid)
+{
+	std::lock_guard<SharedLatch> count_hold(bufferLatch);
+	std::vector<PageId> path;
+	std::vector<int> slots;
+	PageId leaf_pid = countedPath(key, path, slots);
+	insertLeaf(key, rid, leaf_pid, path, &slots);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::countedPath
+// -----------------------------------------------------------------------------
+
+PageId BTreeIndex::countedPath(const int key, std::vector<PageId>& path, std::vector<int>& slots)
+{
+	//no other insert runs, so the nodes are read without validation
+	PageId pid = rootPageNum;
+	while (true){
+		ReadPageGuard page = readNode(pid);
+		const NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+		if (movesRight(node->rightSibPageNo, node->highKey, key, true)){
+			pid = node->rightSibPageNo;
+			continue;
+		}
+		int slot = childIndex(node, key, true);
+		path.push_back(pid);
+		slots.push_back(slot);
+		pid = node->pageNoArray[slot];
+		if (node->level == 1){
+			return pid;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::logCounted
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::logCounted(LogUnit& unit, WritePageGuard* const* pages, const int numPages, const bool images,
+		const std::vector<PageId>& path, const std::vector<int>& slots, const int delta)
+{
+	if (images && log != NULL){
+		for (int i = 0; i < numPages; i++){
+			unit.add(BTREE_LOG_NODE, file, pages[i]->pageNo(), pages[i]->page(), Page::SIZE);
+		}
+	}
+
+	std::vector<WritePageGuard> counted(path.size());
+	std::vector<WritePageGuard*> all(pages, pages + numPages);
+	for (std::size_t i = 0; i < path.size(); i++){
+		counted[i] = writeNode(path[i]);
+		preserve(counted[i]);
+		NonLeafNodeInt* node = counted[i].as<NonLeafNodeInt>();
+		node->countArray[slots[i]] += delta;
+		if (log != NULL){
+			CountRec rec = { slots[i], node->countArray[slots[i]] };
+			unit.add(BTREE_LOG_COUNT, file, path[i], &rec, sizeof(rec));
+		}
+		all.push_back(&counted[i]);
+	}
+	logUnit(unit, &all[0], static_cast<int>(all.size()));
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertIntoParent
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::insertIntoParent(int key, PageId leftPid, PageId rightPid, int leftCount, int level, std::vector<PageId>& path)
+{
+	while (true){
+		PageId pid;
+		if (path.empty()){
+			//the tree has grown since the descent
+			pid = findNode(key, true, level, NULL);
+		}
+		else{
+			pid = path.back();
+			path.pop_back();
+		}
+
+		SharedLatchGuard snap_hold(snapLatch);
+		WritePageGuard page = writeNode(pid);
+		NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+		node->latch.writeLock();
+		WriteLatchHold hold;
+		hold.hold(node->latch);
+
+		//find the node pointing to leftPid, moving right past nodes that were split.
+		//If leftPid has no separator yet because its own split is still on its way
+		//up, insert by key instead; that split will insert in front of this one.
+		int idx;
+		while (true){
+			idx = std::find(node->pageNoArray, node->pageNoArray + node->stored + 1, leftPid) - node->pageNoArray;
+			if (idx <= node->stored || !movesRight(node->rightSibPageNo, node->highKey, key, true)){
+				break;
+			}
+			WritePageGuard right_page = writeNode(node->rightSibPageNo);
+			NonLeafNodeInt* right = right_page.as<NonLeafNodeInt>();
+			right->latch.writeLock();
+			hold.release();
+			page = std::move(right_page);
+			node = right;
+			hold.hold(node->latch);
+		}
+		int pos = (idx <= node->stored) ? idx
+			: std::upper_bound(node->keyArray, node->keyArray + node->stored, key) - node->keyArray;
+		preserve(page);
+
+		//the child at pos keeps the entries up to leftPid, the new one counts the rest.
+		//Inserts with counts run one at a time, so the children are read unlatched.
+		int moved = 0;
+		if (subtreeCounts){
+			moved = node->countArray[pos] - leftCount;
+			for (PageId pid = node->pageNoArray[pos]; pid != leftPid && pid != Page::INVALID_NUMBER; ){
+				ReadPageGuard child_page = readNode(pid);
+				if (node->level == 1){
+					const LeafNodeInt* leaf = child_page.as<LeafNodeInt>();
+					moved -= static_cast<int>(leafEntries(leaf, 0, leaf->stored));
+					pid = child_page.as<LeafNodeInt>()->rightSibPageNo;
+				}
+				else{
+					moved -= subtreeCount(child_page.as<NonLeafNodeInt>());
+					pid = child_page.as<NonLeafNodeInt>()->rightSibPageNo;
+				}
+			}
+		}
+
+		LogUnit unit;
+		if(node->stored<nodeOccupancy){
+			for(int n=node->stored;n>pos;n--){
+				node->keyArray[n] = node->keyArray[n-1];
+				node->pageNoArray[n+1] = node->pageNoArray[n];
+				node->countArray[n+1] = node->countArray[n];
+			}
+			node->keyArray[pos] = key;
+			node->pageNoArray[pos+1] = rightPid;
+			node->countArray[pos+1] = moved;
+			node->countArray[pos] -= moved;
+			node->stored++;
+
+			if (log != NULL){
+				NonLeafInsertRec rec = { pos, key, rightPid, node->countArray[pos], moved };
+				unit.add(BTREE_LOG_NONLEAF_INSERT, file, page.pageNo(), &rec, sizeof(rec));
+			}
+			WritePageGuard* pages[] = { &page };
+			logUnit(unit, pages, 1);
+			return;
+		}
+
+		PageId new_pid;
+		WritePageGuard new_page = allocNode(new_pid);
+		NonLeafNodeInt* new_nonleaf = new_page.as<NonLeafNodeInt>();
+		new_nonleaf->latch.init();
+
+		//copy everything to the new array, insert at the corresponding location
+		int keyCopy[INTARRAYNONLEAFSIZE+1];
+		PageId pNoCopy[INTARRAYNONLEAFSIZE+2];
+		int countCopy[INTARRAYNONLEAFSIZE+2];
+		pNoCopy[0] = node->pageNoArray[0];
+		countCopy[0] = node->countArray[0];
+		for (int a=0, b=0; a<nodeOccupancy+1; a++){
+			if (a == pos){
+				keyCopy[a] = key;
+				pNoCopy[a+1] = rightPid;
+				countCopy[a+1] = moved;
+			}
+			else{
+				keyCopy[a] = node->keyArray[b];
+				pNoCopy[a+1] = node->pageNoArray[b+1];
+				countCopy[a+1] = node->countArray[b+1];
+				b++;
+			}
+		}
+		countCopy[pos] -= moved;
+
+		//the index of the key to by pushed up later. As with leaves, the last node of its
+		//level overflowing at its end keeps EDGE_SPLIT_PERCENT of its keys.
+		int half = (nodeOccupancy+1)/2;
+		if (pos == nodeOccupancy && node->rightSibPageNo == Page::INVALID_NUMBER){
+			half = nodeOccupancy * EDGE_SPLIT_PERCENT / 100;
+		}
+		//update the original node
+		for(int c=0;c<half;c++){
+			node->keyArray[c] = keyCopy[c];
+			node->pageNoArray[c] = pNoCopy[c];
+			node->countArray[c] = countCopy[c];
+		}
+		node->pageNoArray[half] = pNoCopy[half];
+		node->countArray[half] = countCopy[half];
+		
+		//update the new internal node
+		for (int c=half+1;c<nodeOccupancy+1;c++){
+			new_nonleaf->keyArray[c-half-1] = keyCopy[c];
+			new_nonleaf->pageNoArray[c-half-1] = pNoCopy[c];
+			new_nonleaf->countArray[c-half-1] = countCopy[c];
+		}
+		new_nonleaf->pageNoArray[nodeOccupancy-half] = pNoCopy[nodeOccupancy+1];
+		new_nonleaf->countArray[nodeOccupancy-half] = countCopy[nodeOccupancy+1];
+		new_nonleaf->level = node->level;
+		new_nonleaf->stored = nodeOccupancy-half;
+		new_nonleaf->rightSibPageNo = node->rightSibPageNo;
+		new_nonleaf->highKey = node->highKey;
+		new_nonleaf->bufferPageNo = Page::INVALID_NUMBER;
+
+		int push_up = keyCopy[half]; //the key to be pushed up
+		node->stored = half;
+		node->rightSibPageNo = new_pid;
+		node->highKey = push_up;
+
+		if (log != NULL){
+			unit.add(BTREE_LOG_NODE, file, page.pageNo(), page.page(), Page::SIZE);
+			unit.add(BTREE_LOG_NODE, file, new_pid, new_page.page(), Page::SIZE);
+		}
+		if (page.pageNo() == rootPageNum){
+			WritePageGuard* split[] = { &page, &new_page };
+			growRoot(split, 2, push_up, unit);
+			return;
+		}
+		WritePageGuard* pages[] = { &page, &new_page };
+		logUnit(unit, pages, 2);
+
+		key = push_up;
+		leftPid = page.pageNo();
+		rightPid = new_pid;
+		leftCount = subtreeCount(node);
+		level++;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::growRoot
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::growRoot(WritePageGuard* const* split, const int numSplit, const int key, LogUnit& unit)
+{
+	WritePageGuard& oldRoot = *split[0];
+	const PageId rightPid = split[1]->pageNo();
+	PageId new_root_pid;
+	WritePageGuard new_root_page = allocNode(new_root_pid);
+	NonLeafNodeInt* new_root = new_root_page.as<NonLeafNodeInt>();
+	new_root->latch.init();
+	new_root->keyArray[0] = key;
+	new_root->pageNoArray[0] = oldRoot.pageNo();
+	new_root->pageNoArray[1] = rightPid;
+	new_root->countArray[0] = subtreeCount(oldRoot.as<NonLeafNodeInt>());
+	new_root->countArray[1] = subtreeCount(split[1]->as<NonLeafNodeInt>());
+	for(int a=1;a<nodeOccupancy;a++){
+		new_root->keyArray[a] = INT_MAX;
+		new_root->pageNoArray[a+1] = Page::INVALID_NUMBER;
+		new_root->countArray[a+1] = 0;
+	}
+	new_root->level = oldRoot.as<NonLeafNodeInt>()->level+1;
+	new_root->stored = 1;
+	new_root->rightSibPageNo = Page::INVALID_NUMBER;
+	new_root->highKey = INT_MAX;
+	new_root->bufferPageNo = Page::INVALID_NUMBER;
+
+	//update the metapage. The old root is still latched, so any split of it or of
+	//its new sibling finds the new root in place.
+	WritePageGuard meta_page = writeNode(headerPageNum);
+	meta_page.as<IndexMetaInfo>()->rootPageNo = new_root_pid;
+
+	if (log != NULL){
+		unit.add(BTREE_LOG_NODE, file, new_root_pid, new_root_page.page(), Page::SIZE);
+		unit.add(BTREE_LOG_META, file, headerPageNum, meta_page.page(), Page::SIZE);
+	}
+	std::vector<WritePageGuard*> pages(split, split + numSplit);
+	pages.push_back(&new_root_page);
+	pages.push_back(&meta_page);
+	logUnit(unit, &pages[0], static_cast<int>(pages.size()));
+
+	this->height++;
+	this->rootPageNum = new_root_pid;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::foldPostings
+// -----------------------------------------------------------------------------
+
+bool BTreeIndex::foldPostings(WritePageGuard& leafPage, const int from, const int to, const RecordId* rid,
+		const std::vector<PageId>* path, const std::vector<int>* slots)
+{
+	LeafNodeInt* leaf = leafPage.as<LeafNodeInt>();
+	LeafReader entries(leaf);
+
+	//the record ids to add: those of the entries that are no list yet, and rid
+	int list = -1;
+	std::vector<RecordId> rids;
+	for (int i = from; i < to; i++){
+		RecordId entry = entries.rid(i);
+		if (isPosting(entry)){
+			list = i;
+		}
+		else{
+			rids.push_back(entry);
+		}
+	}
+	if (rid != NULL){
+		rids.push_back(*rid);
+	}
+	if (rids.empty()){
+		return false;
+	}
+	std::sort(rids.begin(), rids.end(), ridLess);
+
+	//the entries become one entry for the list, in place of the first of them. The page
+	//number of a list takes no bits of a packed leaf's fields, but its index may.
+	bool leaf_changed = list < 0 || to - from > 1;
+	std::vector<int> leaf_keys;
+	std::vector<RecordId> leaf_rids;
+	if (leaf_changed){
+		entries.append(0, from + 1, leaf_keys, leaf_rids);
+		entries.append(to, entries.size(), leaf_keys, leaf_rids);
+		leaf_rids[from].slot_number = Page::INVALID_SLOT;
+		if (!leafFits(leaf_keys.data(), leaf_rids.data(), static_cast<int>(leaf_keys.size()))){
+			return false;
+		}
+	}
+
+	//pages of the list that change, all but new ones latched
+	std::deque<WritePageGuard> pages;
+	std::deque<WriteLatchHold> holds;
+	PageId head;
+	if (list >= 0){
+		head = entries.rid(list).page_number;
+		pages.push_back(writeNode(head));
+		PostingPageInt* first = pages.back().as<PostingPageInt>();
+		first->latch.writeLock();
+		holds.emplace_back();
+		holds.back().hold(first->latch);
+		preserve(pages.back());
+	}
+	else{
+		pages.push_back(allocNode(head));
+		PostingPageInt* first = pages.back().as<PostingPageInt>();
+		first->latch.init();
+		first->nextPageNo = Page::INVALID_NUMBER;
+		first->lastPageNo = head;
+		first->stored = 0;
+		first->total = 0;
+		first->bytes = 0;
+	}
+	PostingPageInt* first = pages.front().as<PostingPageInt>();
+
+	//each page takes the record ids below the first one of the next page. Record ids from
+	//the first one of the last page on, such as those of new records, go straight there.
+	PageId pid = head;
+	if (first->lastPageNo != head){
+		ReadPageGuard last_page = readNode(first->lastPageNo);
+		if (!ridLess(rids[0], firstPosting(last_page.as<PostingPageInt>()))){
+			pid = first->lastPageNo;
+		}
+	}
+	bool split = false;
+	PageId changed = head;
+	std::size_t next_rid = 0;
+	while (next_rid < rids.size()){
+		WritePageGuard page_guard;
+		PostingPageInt* page = first;
+		if (pid != head){
+			page_guard = writeNode(pid);
+			page = page_guard.as<PostingPageInt>();
+		}
+		PageId next = page->nextPageNo;
+		std::size_t end = rids.size();
+		if (next != Page::INVALID_NUMBER){
+			ReadPageGuard next_page = readNode(next);
+			RecordId bound = firstPosting(next_page.as<PostingPageInt>());
+			end = std::lower_bound(rids.begin() + next_rid, rids.end(), bound, ridLess) - rids.begin();
+		}
+		if (end > next_rid){
+			if (pid != head){
+				page->latch.writeLock();
+				pages.push_back(std::move(page_guard));
+				holds.emplace_back();
+				holds.back().hold(page->latch);
+				preserve(pages.back());
+			}
+			changed = pid;
+
+			//if not all fit, the page keeps the first half of its record ids and the rest
+			//goes to new pages after it
+			std::vector<RecordId> rest;
+			fillPostings(page, &rids[next_rid], end - next_rid, rest);
+			if (!rest.empty()){
+				std::vector<RecordId> all;
+				decodePostings(page, all);
+				all.insert(all.end(), rest.begin(), rest.end());
+				std::size_t half = all.size() / 2;
+				page->stored = 0;
+				page->bytes = 0;
+				fillPostings(page, &all[0], half, rest);
+				rest.assign(all.begin() + half, all.end());
+			}
+			while (!rest.empty()){
+				split = true;
+				PageId new_pid;
+				pages.push_back(allocNode(new_pid));
+				PostingPageInt* new_page = pages.back().as<PostingPageInt>();
+				new_page->latch.init();
+				new_page->nextPageNo = page->nextPageNo;
+				new_page->lastPageNo = Page::INVALID_NUMBER;
+				new_page->stored = 0;
+				new_page->total = 0;
+				new_page->bytes = 0;
+				page->nextPageNo = new_pid;
+				if (new_page->nextPageNo == Page::INVALID_NUMBER){
+					first->lastPageNo = new_pid;
+				}
+				std::vector<RecordId> more;
+				fillPostings(new_page, &rest[0], rest.size(), more);
+				rest.swap(more);
+				page = new_page;
+			}
+		}
+		next_rid = end;
+		pid = next;
+	}
+	first->total += static_cast<int>(rids.size());
+	std::size_t longest = longestPosting.load(std::memory_order_relaxed);
+	while (static_cast<std::size_t>(first->total) > longest &&
+			!longestPosting.compare_exchange_weak(longest, first->total, std::memory_order_relaxed)){
+	}
+
+	if (leaf_changed){
+		leaf_rids[from].page_number = head;
+		leaf_rids[from].padding = 0;
+		packLeaf(leaf, leaf_keys.data(), leaf_rids.data(), static_cast<int>(leaf_keys.size()));
+	}
+
+	//a new record that fits into its page is logged as such
+	LogUnit unit;
+	bool images = split || leaf_changed || rids.size() > 1;
+	if (!images && log != NULL){
+		PostingAddRec rec = { rids[0], (changed == head) ? first->total : -1 };
+		unit.add(BTREE_LOG_POSTING_ADD, file, changed, &rec, sizeof(rec));
+		if (changed != head){
+			PostingTotalRec total = { first->total };
+			unit.add(BTREE_LOG_POSTING_TOTAL, file, head, &total, sizeof(total));
+		}
+	}
+	std::vector<WritePageGuard*> all;
+	if (leaf_changed){
+		all.push_back(&leafPage);
+	}
+	for (std::size_t i = 0; i < pages.size(); i++){
+		all.push_back(&pages[i]);
+	}
+	if (slots != NULL){
+		logCounted(unit, &all[0], static_cast<int>(all.size()), images, *path, *slots, (rid != NULL) ? 1 : 0);
+	}
+	else if (images){
+		logImages(unit, &all[0], static_cast<int>(all.size()));
+	}
+	else{
+		logUnit(unit, &all[0], static_cast<int>(all.size()));
+	}
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::foldLeaf
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::foldLeaf(const PageId pageNo)
+{
+	SharedLatchGuard snap_hold(snapLatch);
+	WritePageGuard page = writeNode(pageNo);
+	LeafNodeInt* leaf = page.as<LeafNodeInt>();
+	leaf->latch.writeLock();
+	WriteLatchHold hold;
+	hold.hold(leaf->latch);
+	preserve(page);
+	foldKeys(page);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::foldKeys
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::foldKeys(WritePageGuard& page)
+{
+	LeafNodeInt* leaf = page.as<LeafNodeInt>();
+	for (int from = 0; from < leaf->stored; ){
+		LeafReader entries(leaf);
+		int to = entries.upperBound(from, entries.size(), entries.key(from));
+		bool listed = false;
+		for (int i = from; i < to; i++){
+			listed = listed || isPosting(entries.rid(i));
+		}
+		if ((to - from >= POSTING_MIN_ENTRIES || (listed && to - from > 1))
+				&& foldPostings(page, from, to, NULL, NULL, NULL)){
+			to = from + 1;
+		}
+		from = to;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::setPostingLists
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::setPostingLists(const bool enable)
+{
+	if (openMode == READ_ONLY_MMAP){
+		throw IndexReadOnlyException(file->filename());
+	}
+	std::lock_guard<SharedLatch> fold_hold(bufferLatch);
+	if (enable == postingLists){
+		return;
+	}
+	if (enable){
+		PageId pid = findNode(INT_MIN, false, 0, NULL);
+		while (pid != Page::INVALID_NUMBER){
+			foldLeaf(pid);
+			ReadPageGuard page = readNode(pid);
+			pid = page.as<LeafNodeInt>()->rightSibPageNo;
+		}
+	}
+
+	SharedLatchGuard snap_hold(snapLatch);
+	WritePageGuard meta_page = writeNode(headerPageNum);
+	meta_page.as<IndexMetaInfo>()->postingLists = enable;
+	LogUnit unit;
+	if (log != NULL){
+		unit.add(BTREE_LOG_META, file, headerPageNum, meta_page.page(), Page::SIZE);
+	}
+	WritePageGuard* pages[] = { &meta_page };
+	logUnit(unit, pages, 1);
+	postingLists = enable;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readPostings
+// -----------------------------------------------------------------------------
+
+std::size_t BTreeIndex::readPostings(const PageId head, const std::size_t max, std::vector<RecordId>& out)
+{
+	std::size_t start = out.size();
+	PageId pid = head;
+	while (pid != Page::INVALID_NUMBER && out.size() - start < max){
+		ReadPageGuard page = readNode(pid);
+		const PostingPageInt* list = page.as<PostingPageInt>();
+		std::uint64_t version = readVersion(list->latch);
+		std::size_t old_size = out.size();
+		decodePostings(list, out);
+		PageId next = list->nextPageNo;
+		if (!validVersion(list->latch, version)){
+			out.resize(old_size);
+			continue;
+		}
+		pid = next;
+	}
+	if (out.size() - start > max){
+		out.resize(start + max);
+	}
+	return out.size() - start;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::postingAt
+// -----------------------------------------------------------------------------
+
+RecordId BTreeIndex::postingAt(const PageId head, std::size_t position)
+{
+	PageId pid = head;
+	std::vector<RecordId> rids;
+	while (true){
+		ReadPageGuard page = readNode(pid);
+		const PostingPageInt* list = page.as<PostingPageInt>();
+		std::uint64_t version = readVersion(list->latch);
+		std::size_t stored = std::min(std::max(list->stored, 0), POSTINGDATASIZE);
+		PageId next = list->nextPageNo;
+		rids.clear();
+		if (position < stored || next == Page::INVALID_NUMBER){
+			decodePostings(list, rids);
+		}
+		if (!validVersion(list->latch, version)){
+			continue;
+		}
+		if (position < stored || next == Page::INVALID_NUMBER){
+			return rids.empty() ? RecordId() : rids[std::min(position, rids.size() - 1)];
+		}
+		position -= stored;
+		pid = next;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::entrySize
+// -----------------------------------------------------------------------------
+
+std::size_t BTreeIndex::entrySize(const RecordId& rid)
+{
+	if (!isPosting(rid)){
+		return 1;
+	}
+	ReadPageGuard page = readNode(rid.page_number);
+	const PostingPageInt* list = page.as<PostingPageInt>();
+	while (true){
+		std::uint64_t version = readVersion(list->latch);
+		int total = list->total;
+		if (validVersion(list->latch, version)){
+			return std::max(total, 1);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::leafEntries
+// -----------------------------------------------------------------------------
+
+std::size_t BTreeIndex::leafEntries(const LeafNodeInt* leaf, const int from, const int to)
+{
+	LeafReader entries(leaf);
+	std::size_t count = 0;
+	for (int i = from; i < std::min(to, entries.size()); i++){
+		count += entrySize(entries.rid(i));
+	}
+	return count;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::expandPostings
+// -----------------------------------------------------------------------------
+
+std::size_t BTreeIndex::expandPostings(RecordId* out, const std::size_t from, const std::size_t to, const std::size_t max)
+{
+	std::vector<RecordId> entries(out + from, out + to);
+	std::size_t found = from;
+	for (std::size_t e = 0; e < entries.size() && found < max; e++){
+		if (isPosting(entries[e])){
+			std::vector<RecordId> rids;
+			readPostings(entries[e].page_number, max - found, rids);
+			std::copy(rids.begin(), rids.end(), out + found);
+			found += rids.size();
+		}
+		else{
+			out[found++] = entries[e];
+		}
+	}
+	return found;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertBuffered
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::insertBuffered(const int key, const RecordId rid)
+{
+	std::lock_guard<SharedLatch> flush_hold(bufferLatch);
+	SharedLatchGuard snap_hold(snapLatch);
+
+	while (true){
+		WritePageGuard root_page = writeNode(rootPageNum);
+		NonLeafNodeInt* root = root_page.as<NonLeafNodeInt>();
+		if (root->bufferPageNo == Page::INVALID_NUMBER){
+			//a new root gets its buffer with the first message
+			root->latch.writeLock();
+			WriteLatchHold root_hold;
+			root_hold.hold(root->latch);
+			preserve(root_page);
+			WritePageGuard buffer_page = writeBuffer(root);
+			insertSorted(buffer_page.as<LeafNodeInt>(), key, rid);
+
+			LogUnit unit;
+			WritePageGuard* pages[] = { &root_page, &buffer_page };
+			logImages(unit, pages, 2);
+			return;
+		}
+
+		{
+			WritePageGuard buffer_page = writeNode(root->bufferPageNo);
+			LeafNodeInt* buffer = buffer_page.as<LeafNodeInt>();
+			if (buffer->stored < leafOccupancy){
+				int m = insertSorted(buffer, key, rid);
+
+				LogUnit unit;
+				if (log != NULL){
+					LeafInsertRec rec = { m, key, rid };
+					unit.add(BTREE_LOG_LEAF_INSERT, file, buffer_page.pageNo(), &rec, sizeof(rec));
+				}
+				WritePageGuard* pages[] = { &buffer_page };
+				logUnit(unit, pages, 1);
+				return;
+			}
+		}
+
+		//the buffer is full; make room and try again
+		if (root->stored >= bufferedNodeOccupancy){
+			splitBufferedRoot(root_page);
+		}
+		else{
+			flushBuffer(root_page);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::writeBuffer
+// -----------------------------------------------------------------------------
+
+WritePageGuard BTreeIndex::writeBuffer(NonLeafNodeInt* node)
+{
+	if (node->bufferPageNo != Page::INVALID_NUMBER){
+		return writeNode(node->bufferPageNo);
+	}
+	PageId pid;
+	WritePageGuard page = allocNode(pid);
+	LeafNodeInt* buffer = page.as<LeafNodeInt>();
+	buffer->latch.init();
+	buffer->rightSibPageNo = Page::INVALID_NUMBER;
+	buffer->leftSibPageNo = Page::INVALID_NUMBER;
+	buffer->highKey = INT_MAX;
+	buffer->stored = 0;
+	buffer->layout = LEAF_WIDE;
+	node->bufferPageNo = pid;
+	return page;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::flushBuffer
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::flushBuffer(WritePageGuard& page)
+{
+	NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+	WritePageGuard buffer_page = writeNode(node->bufferPageNo);
+	LeafNodeInt* buffer = buffer_page.as<LeafNodeInt>();
+
+	//find the child with the most messages. Inserts send ties right, so the messages
+	//of child i are those from keyArray[i-1] up to but excluding keyArray[i].
+	int child = 0;
+	int first = 0;
+	int count = 0;
+	for (int i = 0, start = 0; i <= node->stored; i++){
+		int end = (i == node->stored) ? buffer->stored
+			: std::lower_bound(buffer->keyArray + start, buffer->keyArray + buffer->stored, node->keyArray[i]) - buffer->keyArray;
+		if (end - start > count){
+			child = i;
+			first = start;
+			count = end - start;
+		}
+		start = end;
+	}
+	if (completeSplit(page, child)){
+		return;
+	}
+
+	WritePageGuard child_page = writeNode(node->pageNoArray[child]);
+	if (node->level > 1){
+		NonLeafNodeInt* child_node = child_page.as<NonLeafNodeInt>();
+		if (child_node->stored >= bufferedNodeOccupancy){
+			buffer_page.release();
+			splitChild(page, child_page, child);
+			return;
+		}
+
+		WritePageGuard child_buffer_page;
+		WriteLatchHold child_hold;
+		WritePageGuard* pages[] = { &buffer_page, &child_buffer_page, &child_page };
+		int num_pages = 2;
+		if (child_node->bufferPageNo == Page::INVALID_NUMBER){
+			child_node->latch.writeLock();
+			child_hold.hold(child_node->latch);
+			preserve(child_page);
+			num_pages = 3;
+		}
+		child_buffer_page = writeBuffer(child_node);
+		LeafNodeInt* child_buffer = child_buffer_page.as<LeafNodeInt>();
+		if (child_buffer->stored + count > leafOccupancy){
+			//the messages do not fit; flush the child first
+			child_buffer_page.release();
+			buffer_page.release();
+			flushBuffer(child_page);
+			return;
+		}
+
+		std::vector<int> keys;
+		std::vector<RecordId> rids;
+		mergeMessages(child_buffer, buffer, first, count, keys, rids);
+		std::copy(keys.begin(), keys.end(), child_buffer->keyArray);
+		std::copy(rids.begin(), rids.end(), child_buffer->ridArray);
+		child_buffer->stored = static_cast<int>(keys.size());
+		removeMessages(buffer, first, count);
+
+		LogUnit unit;
+		logImages(unit, pages, num_pages);
+		return;
+	}
+
+	//the child is a leaf: merge the messages into it, splitting it if they do not fit
+	LeafNodeInt* leaf = child_page.as<LeafNodeInt>();
+	std::vector<int> keys;
+	std::vector<RecordId> rids;
+	mergeMessages(leaf, buffer, first, count, keys, rids);
+	removeMessages(buffer, first, count);
+
+	std::vector<WritePageGuard> new_pages;
+	WritePageGuard right_page;
+	WriteLatchHold node_hold;
+	WriteLatchHold leaf_hold;
+	WriteLatchHold right_hold;
+	leaf->latch.writeLock();
+	leaf_hold.hold(leaf->latch);
+	preserve(child_page);
+	std::vector<int> separators;
+	std::vector<int> sizes;
+	fillLeaves(child_page, keys, rids, cutLeaf(keys, rids), new_pages, separators, sizes);
+	std::vector<WritePageGuard*> pages;
+	pages.push_back(&buffer_page);
+	pages.push_back(&child_page);
+	if (!new_pages.empty()){
+		PageId right_pid = new_pages.back().as<LeafNodeInt>()->rightSibPageNo;
+		if (right_pid != Page::INVALID_NUMBER){
+			right_page = writeNode(right_pid);
+			LeafNodeInt* right = right_page.as<LeafNodeInt>();
+			right->latch.writeLock();
+			right_hold.hold(right->latch);
+			preserve(right_page);
+			right->leftSibPageNo = new_pages.back().pageNo();
+		}
+
+		//the node learns of the new leaves in the same unit
+		node->latch.writeLock();
+		node_hold.hold(node->latch);
+		preserve(page);
+		for (std::size_t i = 0; i < new_pages.size(); i++){
+			insertSeparator(node, child + static_cast<int>(i), separators[i], new_pages[i].pageNo());
+			pages.push_back(&new_pages[i]);
+		}
+		pages.push_back(&page);
+		if (right_page.isHeld()){
+			pages.push_back(&right_page);
+		}
+	}
+
+	LogUnit unit;
+	logImages(unit, &pages[0], static_cast<int>(pages.size()));
+
+	//keys that gained many entries move them to posting lists
+	if (postingLists){
+		foldKeys(child_page);
+		for (std::size_t i = 0; i < new_pages.size(); i++){
+			//reachable now that the node is logged
+			LeafNodeInt* new_leaf = new_pages[i].as<LeafNodeInt>();
+			new_leaf->latch.writeLock();
+			WriteLatchHold new_hold;
+			new_hold.hold(new_leaf->latch);
+			foldKeys(new_pages[i]);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::completeSplit
+// -----------------------------------------------------------------------------
+
+bool BTreeIndex::completeSplit(WritePageGuard& page, const int child)
+{
+	NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+	PageId right;
+	int high_key;
+	{
+		ReadPageGuard child_page = readNode(node->pageNoArray[child]);
+		if (node->level == 1){
+			right = child_page.as<LeafNodeInt>()->rightSibPageNo;
+			high_key = child_page.as<LeafNodeInt>()->highKey;
+		}
+		else{
+			right = child_page.as<NonLeafNodeInt>()->rightSibPageNo;
+			high_key = child_page.as<NonLeafNodeInt>()->highKey;
+		}
+	}
+
+	//the right sibling of the last child is the first child of the node's right sibling
+	bool linked = right == Page::INVALID_NUMBER
+		|| (child < node->stored ? right == node->pageNoArray[child+1]
+		                         : node->rightSibPageNo != Page::INVALID_NUMBER && high_key >= node->highKey);
+	if (linked){
+		return false;
+	}
+
+	node->latch.writeLock();
+	WriteLatchHold hold;
+	hold.hold(node->latch);
+	preserve(page);
+	insertSeparator(node, child, high_key, right);
+
+	LogUnit unit;
+	if (log != NULL){
+		NonLeafInsertRec rec = { child, high_key, right, node->countArray[child], node->countArray[child+1] };
+		unit.add(BTREE_LOG_NONLEAF_INSERT, file, page.pageNo(), &rec, sizeof(rec));
+	}
+	WritePageGuard* pages[] = { &page };
+	logUnit(unit, pages, 1);
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::splitBufferedNode
+// -----------------------------------------------------------------------------
+
+int BTreeIndex::splitBufferedNode(WritePageGuard& page, WritePageGuard& newPage,
+                                  WritePageGuard& buffer, WritePageGuard& newBuffer)
+{
+	NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+	PageId new_pid;
+	newPage = allocNode(new_pid);
+	NonLeafNodeInt* new_node = newPage.as<NonLeafNodeInt>();
+	new_node->latch.init();
+
+	//keys left of half stay, the key at half moves up, the rest moves to the new node
+	int half = node->stored/2;
+	int push_up = node->keyArray[half];
+	for (int c = half+1; c < node->stored; c++){
+		new_node->keyArray[c-half-1] = node->keyArray[c];
+		new_node->pageNoArray[c-half-1] = node->pageNoArray[c];
+	}
+	new_node->pageNoArray[node->stored-half-1] = node->pageNoArray[node->stored];
+	new_node->level = node->level;
+	new_node->stored = node->stored-half-1;
+	new_node->rightSibPageNo = node->rightSibPageNo;
+	new_node->highKey = node->highKey;
+	new_node->bufferPageNo = Page::INVALID_NUMBER;
+	node->stored = half;
+	node->rightSibPageNo = new_pid;
+	node->highKey = push_up;
+
+	//messages from the separator on belong to the new node
+	if (node->bufferPageNo != Page::INVALID_NUMBER){
+		buffer = writeNode(node->bufferPageNo);
+		LeafNodeInt* messages = buffer.as<LeafNodeInt>();
+		int m = std::lower_bound(messages->keyArray, messages->keyArray + messages->stored, push_up) - messages->keyArray;
+		if (m < messages->stored){
+			newBuffer = writeBuffer(new_node);
+			LeafNodeInt* new_messages = newBuffer.as<LeafNodeInt>();
+			for (int c = m; c < messages->stored; c++){
+				new_messages->keyArray[c-m] = messages->keyArray[c];
+				new_messages->ridArray[c-m] = messages->ridArray[c];
+			}
+			new_messages->stored = messages->stored-m;
+			messages->stored = m;
+		}
+	}
+	return push_up;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::splitChild
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::splitChild(WritePageGuard& page, WritePageGuard& childPage, const int child)
+{
+	NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+	NonLeafNodeInt* child_node = childPage.as<NonLeafNodeInt>();
+	WritePageGuard new_page;
+	WritePageGuard buffer_page;
+	WritePageGuard new_buffer_page;
+	WriteLatchHold node_hold;
+	WriteLatchHold child_hold;
+	node->latch.writeLock();
+	node_hold.hold(node->latch);
+	preserve(page);
+	child_node->latch.writeLock();
+	child_hold.hold(child_node->latch);
+	preserve(childPage);
+
+	int push_up = splitBufferedNode(childPage, new_page, buffer_page, new_buffer_page);
+	insertSeparator(node, child, push_up, new_page.pageNo());
+
+	WritePageGuard* pages[] = { &page, &childPage, &new_page, NULL, NULL };
+	int num_pages = 3;
+	if (buffer_page.isHeld()){
+		pages[num_pages++] = &buffer_page;
+	}
+	if (new_buffer_page.isHeld()){
+		pages[num_pages++] = &new_buffer_page;
+	}
+	LogUnit unit;
+	logImages(unit, pages, num_pages);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::splitBufferedRoot
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::splitBufferedRoot(WritePageGuard& rootPage)
+{
+	NonLeafNodeInt* root = rootPage.as<NonLeafNodeInt>();
+	WritePageGuard new_page;
+	WritePageGuard buffer_page;
+	WritePageGuard new_buffer_page;
+	WriteLatchHold root_hold;
+	root->latch.writeLock();
+	root_hold.hold(root->latch);
+	preserve(rootPage);
+
+	int push_up = splitBufferedNode(rootPage, new_page, buffer_page, new_buffer_page);
+
+	WritePageGuard* split[] = { &rootPage, &new_page, NULL, NULL };
+	int num_split = 2;
+	if (buffer_page.isHeld()){
+		split[num_split++] = &buffer_page;
+	}
+	if (new_buffer_page.isHeld()){
+		split[num_split++] = &new_buffer_page;
+	}
+	LogUnit unit;
+	if (log != NULL){
+		for (int i = 0; i < num_split; i++){
+			unit.add(BTREE_LOG_NODE, file, split[i]->pageNo(), split[i]->page(), Page::SIZE);
+		}
+	}
+	growRoot(split, num_split, push_up, unit);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::drainBuffers
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::drainBuffers()
+{
+	while (true){
+		WritePageGuard root_page = writeNode(rootPageNum);
+		NonLeafNodeInt* root = root_page.as<NonLeafNodeInt>();
+		if (bufferedCount(root) == 0){
+			break;
+		}
+		if (root->stored >= bufferedNodeOccupancy){
+			splitBufferedRoot(root_page);
+		}
+		else{
+			flushBuffer(root_page);
+		}
+	}
+	drainChildren(rootPageNum);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::drainChildren
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::drainChildren(const PageId pageNo)
+{
+	WritePageGuard page = writeNode(pageNo);
+	NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+	if (node->level == 1){
+		return;
+	}
+
+	//splits only add children to the right of the child being drained
+	for (int i = 0; i <= node->stored; i++){
+		while (true){
+			if (node->stored < nodeOccupancy && completeSplit(page, i)){
+				continue;
+			}
+			WritePageGuard child_page = writeNode(node->pageNoArray[i]);
+			NonLeafNodeInt* child = child_page.as<NonLeafNodeInt>();
+			if (bufferedCount(child) == 0){
+				break;
+			}
+			if (child->stored >= bufferedNodeOccupancy && node->stored < nodeOccupancy){
+				splitChild(page, child_page, i);
+			}
+			else{
+				flushBuffer(child_page);
+			}
+		}
+		drainChildren(node->pageNoArray[i]);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::bufferedCount
+// -----------------------------------------------------------------------------
+
+int BTreeIndex::bufferedCount(const NonLeafNodeInt* node)
+{
+	if (node->bufferPageNo == Page::INVALID_NUMBER){
+		return 0;
+	}
+	ReadPageGuard buffer_page = readNode(node->bufferPageNo);
+	return buffer_page.as<LeafNodeInt>()->stored;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::setInsertBuffering
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::setInsertBuffering(const bool enable)
+{
+	if (openMode == READ_ONLY_MMAP){
+		throw IndexReadOnlyException(file->filename());
+	}
+	std::lock_guard<SharedLatch> flush_hold(bufferLatch);
+	if (enable == insertsBuffered){
+		return;
+	}
+	SharedLatchGuard snap_hold(snapLatch);
+	if (!enable){
+		drainBuffers();
+	}
+
+	//counts are not kept through message buffers
+	WritePageGuard meta_page = writeNode(headerPageNum);
+	IndexMetaInfo* meta = meta_page.as<IndexMetaInfo>();
+	meta->insertsBuffered = enable;
+	meta->subtreeCounts = subtreeCounts && !enable;
+	LogUnit unit;
+	if (log != NULL){
+		unit.add(BTREE_LOG_META, file, headerPageNum, meta_page.page(), Page::SIZE);
+	}
+	WritePageGuard* pages[] = { &meta_page };
+	logUnit(unit, pages, 1);
+	insertsBuffered = enable;
+	subtreeCounts = meta->subtreeCounts;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::setSubtreeCounts
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::setSubtreeCounts(const bool enable)
+{
+	if (openMode == READ_ONLY_MMAP){
+		throw IndexReadOnlyException(file->filename());
+	}
+	std::lock_guard<SharedLatch> count_hold(bufferLatch);
+	if (enable == subtreeCounts){
+		return;
+	}
+	SharedLatchGuard snap_hold(snapLatch);
+	if (enable){
+		if (insertsBuffered){
+			drainBuffers();
+		}
+		recount(rootPageNum);
+	}
+
+	WritePageGuard meta_page = writeNode(headerPageNum);
+	IndexMetaInfo* meta = meta_page.as<IndexMetaInfo>();
+	meta->subtreeCounts = enable;
+	meta->insertsBuffered = insertsBuffered && !enable;
+	LogUnit unit;
+	if (log != NULL){
+		unit.add(BTREE_LOG_META, file, headerPageNum, meta_page.page(), Page::SIZE);
+	}
+	WritePageGuard* pages[] = { &meta_page };
+	logUnit(unit, pages, 1);
+	subtreeCounts = enable;
+	insertsBuffered = meta->insertsBuffered;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::recount
+// -----------------------------------------------------------------------------
+
+int BTreeIndex::recount(const PageId pageNo)
+{
+	WritePageGuard page = writeNode(pageNo);
+	NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+
+	//a child is counted with the nodes split off it, up to the next child of this node or
+	//the first child of its right sibling
+	PageId end = Page::INVALID_NUMBER;
+	if (node->rightSibPageNo != Page::INVALID_NUMBER){
+		ReadPageGuard right_page = readNode(node->rightSibPageNo);
+		end = right_page.as<NonLeafNodeInt>()->pageNoArray[0];
+	}
+	preserve(page);
+	int total = 0;
+	for (int i = 0; i <= node->stored; i++){
+		PageId stop = (i < node->stored) ? node->pageNoArray[i+1] : end;
+		int count = 0;
+		for (PageId pid = node->pageNoArray[i]; pid != stop && pid != Page::INVALID_NUMBER; ){
+			ReadPageGuard child_page = readNode(pid);
+			if (node->level == 1){
+				const LeafNodeInt* leaf = child_page.as<LeafNodeInt>();
+				count += static_cast<int>(leafEntries(leaf, 0, leaf->stored));
+				pid = child_page.as<LeafNodeInt>()->rightSibPageNo;
+				continue;
+			}
+			PageId next = child_page.as<NonLeafNodeInt>()->rightSibPageNo;
+			child_page.release();
+			count += recount(pid);
+			pid = next;
+		}
+		node->countArray[i] = count;
+		total += count;
+	}
+
+	LogUnit unit;
+	WritePageGuard* pages[] = { &page };
+	logImages(unit, pages, 1);
+	return total;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::settleEntries
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::settleEntries()
+{
+	if (memtable == NULL && !insertsBuffered){
+		return;
+	}
+	std::lock_guard<SharedLatch> flush_hold(bufferLatch);
+	if (memtable != NULL){
+		mergeMemtableEntries();
+	}
+	if (insertsBuffered){
+		SharedLatchGuard snap_hold(snapLatch);
+		drainBuffers();
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::countBelow
+// -----------------------------------------------------------------------------
+
+std::size_t BTreeIndex::countBelow(const int key, const bool inclusive)
+{
+	//entries equal to key are below it when inclusive, which is how inserts break ties
+	std::size_t below = 0;
+	PageId pid;
+	if (subtreeCounts){
+		//no insert runs while the caller holds bufferLatch, so the nodes are read without
+		//validation. The children left of the one followed are below key as a whole.
+		pid = rootPageNum;
+		while (true){
+			ReadPageGuard page = readNode(pid);
+			const NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+			if (movesRight(node->rightSibPageNo, node->highKey, key, inclusive)){
+				below += subtreeCount(node);
+				pid = node->rightSibPageNo;
+				continue;
+			}
+			int child = childIndex(node, key, inclusive);
+			for (int i = 0; i < child; i++){
+				below += node->countArray[i];
+			}
+			pid = node->pageNoArray[child];
+			if (node->level == 1){
+				break;
+			}
+		}
+	}
+	else{
+		pid = findNode(INT_MIN, false, 0, NULL);
+	}
+
+	while (true){
+		ReadPageGuard page = readNode(pid);
+		const LeafNodeInt* leaf = page.as<LeafNodeInt>();
+		std::uint64_t version = readVersion(leaf->latch);
+		PageId right = leaf->rightSibPageNo;
+		LeafReader entries(leaf);
+		int stored = entries.size();
+		bool moves = movesRight(right, leaf->highKey, key, inclusive);
+		int count = moves ? stored
+			: (inclusive ? entries.upperBound(0, stored, key) : entries.lowerBound(0, stored, key));
+		std::vector<PageId> lists;
+		for (int i = 0; i < count; i++){
+			RecordId entry = entries.rid(i);
+			if (isPosting(entry)){
+				lists.push_back(entry.page_number);
+			}
+		}
+		if (!validVersion(leaf->latch, version)){
+			continue;
+		}
+
+		//a posting list counts its entries, read once the leaf is known to be consistent
+		for (std::size_t i = 0; i < lists.size(); i++){
+			RecordId head;
+			head.page_number = lists[i];
+			head.slot_number = Page::INVALID_SLOT;
+			count += static_cast<int>(entrySize(head)) - 1;
+		}
+		below += count;
+		if (!moves){
+			return below;
+		}
+		pid = right;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::countRange
+// -----------------------------------------------------------------------------
+
+std::size_t BTreeIndex::countRange(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp)
+{
+	if (((lowOp != GT) && (lowOp != GTE)) || ((highOp != LT) && (highOp != LTE))) {
+		throw BadOpcodesException();
+	}
+	int low = *((const int*) lowVal);
+	int high = *((const int*) highVal);
+	if (low > high) {
+		throw BadScanrangeException();
+	}
+
+	settleEntries();
+	SharedLatchGuard count_hold(bufferLatch);
+	std::size_t upto = countBelow(high, highOp == LTE);
+	std::size_t below = countBelow(low, lowOp == GT);
+	return (upto > below) ? upto - below : 0;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::rank
+// -----------------------------------------------------------------------------
+
+std::size_t BTreeIndex::rank(const void* key)
+{
+	settleEntries();
+	SharedLatchGuard count_hold(bufferLatch);
+	return countBelow(*((const int*) key), false);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::select
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::select(const std::size_t position, void* outKey, RecordId& outRid)
+{
+	settleEntries();
+	SharedLatchGuard count_hold(bufferLatch);
+	selectEntry(position, *((int*) outKey), outRid);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::sampleRange
+// -----------------------------------------------------------------------------
+
+std::size_t BTreeIndex::sampleRange(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp,
+		const std::size_t n, void* outKeys, RecordId* outRids)
+{
+	if (((lowOp != GT) && (lowOp != GTE)) || ((highOp != LT) && (highOp != LTE))) {
+		throw BadOpcodesException();
+	}
+	int low = *((const int*) lowVal);
+	int high = *((const int*) highVal);
+	if (low > high) {
+		throw BadScanrangeException();
+	}
+	if ((lowOp == GT && low == INT_MAX) || (highOp == LT && high == INT_MIN)){
+		return 0;
+	}
+	low += (lowOp == GT) ? 1 : 0;
+	high -= (highOp == LT) ? 1 : 0;
+	if (low > high || n == 0){
+		return 0;
+	}
+
+	int* keys = (int*) outKeys;
+	std::uint64_t random = sampleSeed.fetch_add(0x9e3779b97f4a7c15ULL) | 1;
+	settleEntries();
+	SharedLatchGuard sample_hold(bufferLatch);
+
+	if (subtreeCounts){
+		std::size_t below = countBelow(low, false);
+		std::size_t upto = countBelow(high, true);
+		if (upto <= below){
+			return 0;
+		}
+		for (std::size_t i = 0; i < n; i++){
+			RecordId rid;
+			selectEntry(below + randomBelow(random, upto - below), keys[i], rid);
+			if (outRids != NULL){
+				outRids[i] = rid;
+			}
+		}
+		return n;
+	}
+
+	//start the descents from the lowest node that holds the whole range in more than one
+	//child; a range in a single leaf is simply read
+	PageId pid = rootPageNum;
+	bool narrow = false;
+	while (true){
+		ReadPageGuard page = readNode(pid);
+		const NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+		std::uint64_t version = readVersion(node->latch);
+		int first = childIndex(node, low, false);
+		int last = childIndex(node, high, true);
+		int level = node->level;
+		PageId child = node->pageNoArray[first];
+		if (!validVersion(node->latch, version)){
+			continue;
+		}
+		if (first != last){
+			break;
+		}
+		if (level == 1){
+			narrow = true;
+			break;
+		}
+		pid = child;
+	}
+
+	std::size_t drawn = 0;
+	std::size_t bound = longestPosting.load(std::memory_order_relaxed);
+	for (std::size_t attempts = 0; !narrow && drawn < n && attempts < SAMPLE_ATTEMPTS * n; attempts++){
+		RecordId rid;
+		std::size_t known = bound;
+		if (sampleDescent(pid, low, high, random, bound, keys[drawn], rid)){
+			if (outRids != NULL){
+				outRids[drawn] = rid;
+			}
+			drawn++;
+		}
+		else if (bound > known){
+			//the draws so far were too likely to keep the entries of this list
+			drawn = 0;
+		}
+	}
+	if (drawn < n){
+		std::vector<int> range_keys;
+		std::vector<RecordId> range_rids;
+		collectRange(low, high, range_keys, range_rids);
+		if (range_keys.empty()){
+			return 0;
+		}
+		for (; drawn < n; drawn++){
+			std::size_t i = randomBelow(random, range_keys.size());
+			keys[drawn] = range_keys[i];
+			if (outRids != NULL){
+				outRids[drawn] = range_rids[i];
+			}
+		}
+	}
+	return n;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::sampleDescent
+// -----------------------------------------------------------------------------
+
+bool BTreeIndex::sampleDescent(const PageId pageNo, const int low, const int high, std::uint64_t& random,
+		std::size_t& bound, int& outKey, RecordId& outRid)
+{
+	//nodes hold fewer keys while inserts are buffered
+	int slots = (insertsBuffered ? bufferedNodeOccupancy : nodeOccupancy) + 1;
+	PageId pid = pageNo;
+	bool top = true;
+	while (true){
+		ReadPageGuard page = readNode(pid);
+		const NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+		std::uint64_t version = readVersion(node->latch);
+		int first = childIndex(node, low, false);
+		int choices = childIndex(node, high, true) - first + 1;
+		std::uint64_t pick = randomBelow(random, top ? choices : std::max(slots, choices));
+		if (pick >= static_cast<std::uint64_t>(choices)){
+			return false;
+		}
+		PageId child = node->pageNoArray[first + pick];
+		int level = node->level;
+		if (!validVersion(node->latch, version)){
+			return false;
+		}
+		top = false;
+		if (level > 1){
+			pid = child;
+			continue;
+		}
+
+		ReadPageGuard leaf_page = readNode(child);
+		const LeafNodeInt* leaf = leaf_page.as<LeafNodeInt>();
+		std::uint64_t leaf_version = readVersion(leaf->latch);
+		LeafReader entries(leaf);
+		int slot = static_cast<int>(randomBelow(random, MAXLEAFENTRIES));
+		if (slot >= entries.size()){
+			return false;
+		}
+		outKey = entries.key(slot);
+		outRid = entries.rid(slot);
+		if (!validVersion(leaf->latch, leaf_version) || outKey < low || outKey > high){
+			return false;
+		}
+
+		//keep the entry with a probability of the number of entries it stands for
+		std::size_t size = entrySize(outRid);
+		if (size > bound){
+			bound = size;
+			std::size_t longest = longestPosting.load(std::memory_order_relaxed);
+			while (size > longest && !longestPosting.compare_exchange_weak(longest, size, std::memory_order_relaxed)){
+			}
+			return false;
+		}
+		if (bound > 1 && randomBelow(random, bound) >= size){
+			return false;
+		}
+		if (isPosting(outRid)){
+			outRid = postingAt(outRid.page_number, randomBelow(random, size));
+		}
+		return true;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::collectRange
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::collectRange(const int low, const int high, std::vector<int>& keys, std::vector<RecordId>& rids)
+{
+	PageId pid = findNode(low, false, 0, NULL);
+	while (true){
+		ReadPageGuard page = readNode(pid);
+		const LeafNodeInt* leaf = page.as<LeafNodeInt>();
+		std::uint64_t version = readVersion(leaf->latch);
+		std::size_t old_size = keys.size();
+		LeafReader entries(leaf);
+		int stored = entries.size();
+		int first = entries.lowerBound(0, stored, low);
+		int a = entries.upperBound(first, stored, high);
+		entries.append(first, a, keys, rids);
+		bool listed = std::find_if(rids.begin() + old_size, rids.end(), isPosting) != rids.end();
+		PageId right = leaf->rightSibPageNo;
+		bool done = a < stored || !movesRight(right, leaf->highKey, high, true);
+		if (!validVersion(leaf->latch, version)){
+			keys.resize(old_size);
+			rids.resize(old_size);
+			continue;
+		}
+
+		//posting lists are read once the leaf is known to be consistent
+		if (listed){
+			std::vector<int> leaf_keys(keys.begin() + old_size, keys.end());
+			std::vector<RecordId> leaf_rids(rids.begin() + old_size, rids.end());
+			keys.resize(old_size);
+			rids.resize(old_size);
+			for (std::size_t i = 0; i < leaf_keys.size(); i++){
+				std::size_t n = 1;
+				if (isPosting(leaf_rids[i])){
+					n = readPostings(leaf_rids[i].page_number, SIZE_MAX, rids);
+				}
+				else{
+					rids.push_back(leaf_rids[i]);
+				}
+				keys.resize(keys.size() + n, leaf_keys[i]);
+			}
+		}
+		if (done){
+			return;
+		}
+		pid = right;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::quantiles
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::quantiles(const double* fractions, const std::size_t n, void* outKeys)
+{
+	int* keys = (int*) outKeys;
+	if (subtreeCounts){
+		settleEntries();
+		SharedLatchGuard count_hold(bufferLatch);
+		std::size_t total = countBelow(INT_MAX, true);
+		if (total == 0){
+			throw NoSuchKeyFoundException();
+		}
+		for (std::size_t i = 0; i < n; i++){
+			RecordId rid;
+			selectEntry(quantilePosition(fractions[i], total), keys[i], rid);
+		}
+		return;
+	}
+
+	std::vector<int> sample(QUANTILE_SAMPLES);
+	int low = INT_MIN;
+	int high = INT_MAX;
+	if (sampleRange(&low, GTE, &high, LTE, sample.size(), &sample[0], NULL) == 0){
+		throw NoSuchKeyFoundException();
+	}
+	std::sort(sample.begin(), sample.end());
+	for (std::size_t i = 0; i < n; i++){
+		keys[i] = sample[quantilePosition(fractions[i], sample.size())];
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::analyze
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::analyze()
+{
+	if (openMode == READ_ONLY_MMAP){
+		throw IndexReadOnlyException(file->filename());
+	}
+	IndexStatistics stats;
+	memset(static_cast<void*>(&stats), 0, sizeof(stats));
+	stats.analyzed = true;
+
+	settleEntries();
+	{
+		SharedLatchGuard analyze_hold(bufferLatch);
+		stats.height = height;
+		int levels = std::min(stats.height, STATS_MAX_LEVELS);
+
+		//each non-leaf level from its leftmost node along the right links. Nodes hold
+		//fewer keys while inserts are buffered.
+		int slots = (insertsBuffered ? bufferedNodeOccupancy : nodeOccupancy) + 1;
+		for (int level = 1; level < levels; level++){
+			std::uint64_t children = 0;
+			PageId pid = findNode(INT_MIN, false, level, NULL);
+			while (pid != Page::INVALID_NUMBER){
+				ReadPageGuard page = readNode(pid);
+				const NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+				std::uint64_t version = readVersion(node->latch);
+				int stored = std::min(std::max(node->stored, 0), INTARRAYNONLEAFSIZE);
+				PageId right = node->rightSibPageNo;
+				if (!validVersion(node->latch, version)){
+					continue;
+				}
+				stats.levelNodes[level]++;
+				children += stored + 1;
+				pid = right;
+			}
+			stats.levelFill[level] = static_cast<double>(children) / stats.levelNodes[level] / slots;
+		}
+
+		//the leaves, in key order: a key is new unless it equals the one before it
+		std::vector<std::pair<PageId, std::uint64_t> > leaves;
+		std::uint64_t used = 0;
+		bool seen = false;
+		int last = 0;
+		PageId pid = findNode(INT_MIN, false, 0, NULL);
+		while (pid != Page::INVALID_NUMBER){
+			ReadPageGuard page = readNode(pid);
+			const LeafNodeInt* leaf = page.as<LeafNodeInt>();
+			std::uint64_t version = readVersion(leaf->latch);
+			LeafReader reader(leaf);
+			int stored = reader.size();
+			std::vector<int> keys;
+			std::vector<RecordId> rids;
+			reader.append(0, stored, keys, rids);
+			std::uint64_t distinct = 0;
+			bool leaf_seen = seen;
+			int leaf_last = last;
+			for (int i = 0; i < stored; i++){
+				if (!leaf_seen || keys[i] != leaf_last){
+					distinct++;
+				}
+				leaf_seen = true;
+				leaf_last = keys[i];
+			}
+			std::vector<RecordId> lists;
+			for (int i = 0; i < stored; i++){
+				if (isPosting(rids[i])){
+					lists.push_back(rids[i]);
+				}
+			}
+			int first = (stored > 0) ? keys[0] : 0;
+			int bytes = reader.bytes();
+			PageId right = leaf->rightSibPageNo;
+			if (!validVersion(leaf->latch, version)){
+				continue;
+			}
+			if (stored > 0 && !seen){
+				stats.minKey = first;
+			}
+			seen = leaf_seen;
+			last = leaf_last;
+			std::uint64_t entries = stored;
+			for (std::size_t i = 0; i < lists.size(); i++){
+				entries += entrySize(lists[i]) - 1;
+			}
+			stats.entries += entries;
+			stats.distinctKeys += distinct;
+			used += bytes;
+			leaves.push_back(std::make_pair(pid, entries));
+			pid = right;
+		}
+		stats.maxKey = last;
+		stats.levelNodes[0] = leaves.size();
+		stats.levelFill[0] = static_cast<double>(used) / leaves.size() / LEAFDATASIZE;
+
+		//bucket b ends with the entry at rank (b+1) * entries / buckets - 1, which is read
+		//from its leaf
+		std::uint64_t buckets = std::min(static_cast<std::uint64_t>(STATS_HISTOGRAM_BUCKETS), stats.entries);
+		stats.buckets = static_cast<int>(buckets);
+		std::size_t leaf_index = 0;
+		std::uint64_t before = 0;
+		std::uint64_t begin = 0;
+		for (std::uint64_t b = 0; b < buckets; b++){
+			std::uint64_t end = (b + 1) * stats.entries / buckets;
+			stats.bucketEntries[b] = end - begin;
+			begin = end;
+			while (before + leaves[leaf_index].second < end){
+				before += leaves[leaf_index].second;
+				leaf_index++;
+			}
+			while (true){
+				ReadPageGuard page = readNode(leaves[leaf_index].first);
+				const LeafNodeInt* leaf = page.as<LeafNodeInt>();
+				std::uint64_t version = readVersion(leaf->latch);
+				LeafReader reader(leaf);
+				std::vector<int> keys;
+				std::vector<RecordId> rids;
+				reader.append(0, reader.size(), keys, rids);
+				if (!validVersion(leaf->latch, version)){
+					continue;
+				}
+
+				//the entry at the offset, counting the entries of posting lists
+				std::uint64_t offset = end - 1 - before;
+				int key = keys.empty() ? stats.maxKey : keys.back();
+				for (std::size_t i = 0; i < keys.size(); i++){
+					std::size_t size = entrySize(rids[i]);
+					if (offset < size){
+						key = keys[i];
+						break;
+					}
+					offset -= size;
+				}
+				stats.bucketHigh[b] = key;
+				break;
+			}
+		}
+	}
+
+	//the meta page changes with the root latched, as in a root split
+	WritePageGuard root_page;
+	WriteLatchHold root_hold;
+	while (true){
+		PageId root = rootPageNum;
+		root_page = writeNode(root);
+		NonLeafNodeInt* node = root_page.as<NonLeafNodeInt>();
+		node->latch.writeLock();
+		root_hold.hold(node->latch);
+		if (root == rootPageNum){
+			break;
+		}
+		root_hold.release();
+	}
+	WritePageGuard meta_page = writeNode(headerPageNum);
+	meta_page.as<IndexMetaInfo>()->statistics = stats;
+	LogUnit unit;
+	if (log != NULL){
+		unit.add(BTREE_LOG_META, file, headerPageNum, meta_page.page(), Page::SIZE);
+	}
+	WritePageGuard* pages[] = { &meta_page };
+	logUnit(unit, pages, 1);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::statistics
+// -----------------------------------------------------------------------------
+
+IndexStatistics BTreeIndex::statistics()
+{
+	ReadPageGuard meta_page = readNode(headerPageNum);
+	return meta_page.as<IndexMetaInfo>()->statistics;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::selectEntry
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::selectEntry(const std::size_t position, int& outKey, RecordId& outRid)
+{
+	std::size_t rest = position;
+	PageId pid;
+	if (subtreeCounts){
+		pid = rootPageNum;
+		while (true){
+			ReadPageGuard page = readNode(pid);
+			const NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+			std::size_t total = subtreeCount(node);
+			if (rest >= total && node->rightSibPageNo != Page::INVALID_NUMBER){
+				rest -= total;
+				pid = node->rightSibPageNo;
+				continue;
+			}
+			int child = 0;
+			for (; child < node->stored && rest >= static_cast<std::size_t>(node->countArray[child]); child++){
+				rest -= node->countArray[child];
+			}
+			pid = node->pageNoArray[child];
+			if (node->level == 1){
+				break;
+			}
+		}
+	}
+	else{
+		pid = findNode(INT_MIN, false, 0, NULL);
+	}
+
+	while (true){
+		ReadPageGuard page = readNode(pid);
+		const LeafNodeInt* leaf = page.as<LeafNodeInt>();
+		std::uint64_t version = readVersion(leaf->latch);
+		PageId right = leaf->rightSibPageNo;
+		LeafReader entries(leaf);
+		std::size_t stored = entries.size();
+		std::vector<int> keys;
+		std::vector<RecordId> rids;
+		entries.append(0, static_cast<int>(stored), keys, rids);
+		bool listed = std::find_if(rids.begin(), rids.end(), isPosting) != rids.end();
+		int key = 0;
+		RecordId rid;
+		if (!listed && rest < stored){
+			key = keys[rest];
+			rid = rids[rest];
+		}
+		if (!listed){
+			keys.clear();
+			rids.clear();
+		}
+		if (!validVersion(leaf->latch, version)){
+			continue;
+		}
+		if (!listed && rest < stored){
+			outKey = key;
+			outRid = rid;
+			return;
+		}
+
+		//the position may fall into a posting list
+		for (std::size_t i = 0; i < rids.size(); i++){
+			std::size_t size = entrySize(rids[i]);
+			if (rest < size){
+				outKey = keys[i];
+				outRid = isPosting(rids[i]) ? postingAt(rids[i].page_number, rest) : rids[i];
+				return;
+			}
+			rest -= size;
+		}
+		if (right == Page::INVALID_NUMBER){
+			throw NoSuchKeyFoundException();
+		}
+		if (!listed){
+			rest -= stored;
+		}
+		pid = right;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::setLookupHash
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::setLookupHash(const bool enable)
+{
+	leafHash.clear();
+	hashedLookups = enable;
+	if (!enable){
+		return;
+	}
+
+	PageId pid = findNode(INT_MIN, false, 0, NULL);
+	while (pid != Page::INVALID_NUMBER){
+		ReadPageGuard page = readNode(pid);
+		const LeafNodeInt* leaf = page.as<LeafNodeInt>();
+		hashLeafKeys(pid, leaf, 0, leaf->stored);
+		pid = leaf->rightSibPageNo;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::hashLeafKeys
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::hashLeafKeys(const PageId pageNo, const LeafNodeInt* leaf, const int from, const int to)
+{
+	if (!hashedLookups){
+		return;
+	}
+
+	//a key above the first one of the leaf is in no leaf further left. The first key may
+	//also be in the left neighbour, whose entry is then kept.
+	LeafReader entries(leaf);
+	std::lock_guard<SharedLatch> hash_hold(leafHashLatch);
+	for (int i = from; i < std::min(to, entries.size()); i++){
+		int key = entries.key(i);
+		if (key == entries.key(0)){
+			leafHash.insert(std::make_pair(key, pageNo));
+		}
+		else{
+			leafHash[key] = pageNo;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::setMemtableSize
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::setMemtableSize(const std::size_t entries)
+{
+	if (openMode == READ_ONLY_MMAP){
+		throw IndexReadOnlyException(file->filename());
+	}
+	std::lock_guard<SharedLatch> merge_hold(bufferLatch);
+	if (memtable != NULL){
+		mergeMemtableEntries();
+		delete memtable;
+		memtable = NULL;
+	}
+	if (entries > 0){
+		memtable = new MemTable(entries);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::mergeMemtable
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::mergeMemtable()
+{
+	if (memtable == NULL){
+		return;
+	}
+	std::lock_guard<SharedLatch> merge_hold(bufferLatch);
+	mergeMemtableEntries();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::insertMemtable
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::insertMemtable(const int key, const RecordId rid)
+{
+	{
+		SharedLatchGuard merge_hold(bufferLatch);
+		std::lock_guard<std::mutex> lock(memtableMutex);
+		memtable->insert(key, rid);
+		if (!memtable->full()){
+			return;
+		}
+	}
+
+	//another insert may have merged it meanwhile
+	std::lock_guard<SharedLatch> merge_hold(bufferLatch);
+	if (memtable->full()){
+		mergeMemtableEntries();
+	}
+}
+
 // -----------------------------------------------------------------------------
-// BTreeIndex::BTreeIndex -- Constructor
+// BTreeIndex::mergeMemtableEntries
 // -----------------------------------------------------------------------------
 
-BTreeIndex::BTreeIndex(const std::string & relationName,
-		std::string & outIndexName,
-		BufMgr *bufMgrIn,
-		const int attrByteOffset,
-		const Datatype attrType)
-{	
-	std::ostringstream idxStr;
-	idxStr << relationName << '.' << attrByteOffset;
-	outIndexName = idxStr.str();
-	try{
-		BlobFile::exists(outIndexName);
-		BlobFile indexFile = BlobFile(outIndexName,false);
+void BTreeIndex::mergeMemtableEntries()
+{
+	if (memtable->size() == 0){
+		return;
+	}
+	//the merge adds leaves the plain way, which needs every buffer above them empty
+	if (insertsBuffered){
+		SharedLatchGuard snap_hold(snapLatch);
+		drainBuffers();
+	}
+
+	std::vector<int> keys;
+	std::vector<RecordId> rids;
+	MemTable::Iterator it = memtable->begin();
+	while (it.valid()){
+		std::vector<PageId> path;
+		std::vector<int> slots;
+		PageId leaf_pid = subtreeCounts ? countedPath(it.key(), path, slots) : findNode(it.key(), true, 0, &path);
+		std::vector<PageId> new_pids;
+		std::vector<int> separators;
+		std::vector<int> sizes;
+		{
+			SharedLatchGuard snap_hold(snapLatch);
+			WritePageGuard leaf_page = writeNode(leaf_pid);
+			LeafNodeInt* leaf = leaf_page.as<LeafNodeInt>();
+			leaf->latch.writeLock();
+			WriteLatchHold leaf_hold;
+			leaf_hold.hold(leaf->latch);
+
+			//a split interrupted by a crash may not have reached the parent
+			while (movesRight(leaf->rightSibPageNo, leaf->highKey, it.key(), true)){
+				WritePageGuard right_page = writeNode(leaf->rightSibPageNo);
+				LeafNodeInt* right = right_page.as<LeafNodeInt>();
+				right->latch.writeLock();
+				leaf_hold.release();
+				leaf_page = std::move(right_page);
+				leaf = right;
+				leaf_hold.hold(leaf->latch);
+			}
+			preserve(leaf_page);
+
+			//merge the leaf with the run of memtable entries that belongs to it, which
+			//starts with the current one
+			keys.clear();
+			rids.clear();
+			LeafReader entries(leaf);
+			int stored = entries.size();
+			bool bounded = leaf->rightSibPageNo != Page::INVALID_NUMBER;
+			int a = 0;
+			for (; it.valid() && (!bounded || it.key() < leaf->highKey); it.next()){
+				int b = entries.upperBound(a, stored, it.key());
+				entries.append(a, b, keys, rids);
+				a = b;
+				keys.push_back(it.key());
+				rids.push_back(it.rid());
+			}
+			entries.append(a, stored, keys, rids);
+
+			//cut the result into evenly filled leaves. The new ones are not reachable before
+			//the leaf and its old right sibling link to them in the same unit.
+			int added = static_cast<int>(keys.size()) - stored;
+			std::vector<WritePageGuard> new_pages;
+			fillLeaves(leaf_page, keys, rids, cutLeaf(keys, rids), new_pages, separators, sizes);
+			std::vector<WritePageGuard*> pages(1, &leaf_page);
+			for (std::size_t i = 0; i < new_pages.size(); i++){
+				pages.push_back(&new_pages[i]);
+				new_pids.push_back(new_pages[i].pageNo());
+			}
+
+			WritePageGuard right_page;
+			WriteLatchHold right_hold;
+			PageId right_pid = new_pages.empty() ? Page::INVALID_NUMBER : new_pages.back().as<LeafNodeInt>()->rightSibPageNo;
+			if (right_pid != Page::INVALID_NUMBER){
+				right_page = writeNode(right_pid);
+				LeafNodeInt* right = right_page.as<LeafNodeInt>();
+				right->latch.writeLock();
+				right_hold.hold(right->latch);
+				preserve(right_page);
+				right->leftSibPageNo = new_pids.back();
+				pages.push_back(&right_page);
+			}
+			LogUnit unit;
+			if (subtreeCounts){
+				logCounted(unit, &pages[0], static_cast<int>(pages.size()), true, path, slots, added);
+			}
+			else{
+				logImages(unit, &pages[0], static_cast<int>(pages.size()));
+			}
+
+			leaf_pid = leaf_page.pageNo();
+		}
+
+		//the new leaves are reachable through the links; add their separators left to right
+		PageId left_pid = leaf_pid;
+		for (std::size_t i = 0; i < new_pids.size(); i++){
+			std::vector<PageId> parents(path);
+			insertIntoParent(separators[i], left_pid, new_pids[i], sizes[i], 1, parents);
+			left_pid = new_pids[i];
+		}
+
+		//keys that gained many entries move them to posting lists
+		if (postingLists){
+			foldLeaf(leaf_pid);
+			for (std::size_t i = 0; i < new_pids.size(); i++){
+				foldLeaf(new_pids[i]);
+			}
+		}
+	}
+	memtable->clear();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::collectMemtable
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::collectMemtable(const int low, const int high, const bool bounded, std::vector<RIDKeyPair<int> >& out)
+{
+	std::size_t old_size = out.size();
+	{
+		std::lock_guard<std::mutex> lock(memtableMutex);
+		for (MemTable::Iterator it = memtable->seek(low); it.valid() && (!bounded || it.key() < high); it.next()){
+			RIDKeyPair<int> entry;
+			entry.set(it.rid(), it.key());
+			out.push_back(entry);
+		}
+	}
+	std::inplace_merge(out.begin(), out.begin() + old_size, out.end(), messageKeyLess);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::logUnit
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::logUnit(LogUnit& unit, WritePageGuard* const* pages, const int numPages)
+{
+	if (log == NULL){
+		for (int i = 0; i < numPages; i++){
+			pages[i]->markDirty();
+		}
+		return;
+	}
+
+	// flag the frames before the unit reaches the log, so a checkpoint cannot
+	// truncate the log past it while the pages are still only in memory
+	Lsn low = log->endLsn();
+	for (int i = 0; i < numPages; i++){
+		pages[i]->markDirty(low);
+	}
+	Lsn lsn = log->commit(unit);
+	for (int i = 0; i < numPages; i++){
+		if (pages[i]->pageNo() != headerPageNum){
+			setNodeLsn(*pages[i]->page(), lsn);
+		}
+		pages[i]->setPageLsn(lsn);
+	}
+
+	Lsn last = lastLsn;
+	while (lsn > last && !lastLsn.compare_exchange_weak(last, lsn)){
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::logImages
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::logImages(LogUnit& unit, WritePageGuard* const* pages, const int numPages)
+{
+	if (log != NULL){
+		for (int i = 0; i < numPages; i++){
+			unit.add(BTREE_LOG_NODE, file, pages[i]->pageNo(), pages[i]->page(), Page::SIZE);
+		}
+	}
+	logUnit(unit, pages, numPages);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::sync
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::sync()
+{
+	if (log == NULL){
+		return;
+	}
+	mergeMemtable();
+	Lsn last = lastLsn;
+	if (last != 0){
+		log->flush(last);
+	}
+}
+
+
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::startScan
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::startScan(const void* lowValParm,
+				   const Operator lowOpParm,
+				   const void* highValParm,
+				   const Operator highOpParm)
+{
+	// BadOpcodesException 
+	if (((lowOpParm != GT) && (lowOpParm != GTE)) || ((highOpParm != LT) && (highOpParm != LTE))) {
+		throw BadOpcodesException();
+	}
+	// BadScanrangeException 
+	if (*((int*) lowValParm) > *((int*) highValParm)) {
+		throw BadScanrangeException();
+	}
+	if (scanExecuting == true) {
+		endScan();
+	}
+
+	this -> lowValInt = *((int*) lowValParm);
+	this -> highValInt = *((int*) highValParm);
+	this -> lowOp = lowOpParm;
+	this -> highOp = highOpParm;
+	scanRanges.clear();
+	nextRange = 0;
+
+	// find the first entry satisfying the low bound, moving right if necessary
+	ReadPageGuard page = readScanLeaf(findNode(lowValInt, false, 0, NULL), lowValInt);
+	const LeafNodeInt* leaf = page.as<LeafNodeInt>();
+	RIDKeyPair<int> low;
+	low.set(RecordId(), lowValInt);
+	while (true) {
+		LeafReader entries(leaf);
+		nextEntry = (lowOp == GT) ? entries.upperBound(0, entries.size(), lowValInt)
+		                          : entries.lowerBound(0, entries.size(), lowValInt);
+		nextMessage = ((lowOp == GT) ? std::upper_bound(scanMessages.begin(), scanMessages.end(), low, messageKeyLess)
+		                             : std::lower_bound(scanMessages.begin(), scanMessages.end(), low, messageKeyLess)) - scanMessages.begin();
+		if (nextEntry < entries.size() || nextMessage < scanMessages.size()) {
+			break;
+		}
+		if (leaf->rightSibPageNo == Page::INVALID_NUMBER) {
+			throw NoSuchKeyFoundException();
+		}
+		page = readScanLeaf(leaf->rightSibPageNo, leaf->highKey);
+		leaf = page.as<LeafNodeInt>();
+	}
+
+	int key = scanFromLeaf(leaf) ? LeafReader(leaf).key(nextEntry) : scanMessages[nextMessage].key;
+	if ((highOp == LT && key >= highValInt) || (highOp == LTE && key > highValInt)) {
+		throw NoSuchKeyFoundException();
+	}
+
+	scanExecuting = true;
+	currentPageNum = page.pageNo();
+	currentPageData = std::move(page);
+	if (openMode == READ_ONLY_MMAP && leaf->rightSibPageNo != Page::INVALID_NUMBER) {
+		file->adviseMapped(leaf->rightSibPageNo, 1, BlobFile::ADVISE_WILLNEED);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readScanLeaf
+// -----------------------------------------------------------------------------
+
+ReadPageGuard BTreeIndex::readScanLeaf(const PageId pageNo, const int low)
+{
+	scanMessages.clear();
+	nextMessage = 0;
+	if (!insertsBuffered && memtable == NULL){
+		return readLeaf(pageNo);
+	}
+
+	//a flush or merge moves entries into the leaves; read both at one moment
+	SharedLatchGuard flush_hold(bufferLatch);
+	ReadPageGuard page = readLeaf(pageNo);
+	const LeafNodeInt* leaf = page.as<LeafNodeInt>();
+	bool bounded = leaf->rightSibPageNo != Page::INVALID_NUMBER;
+	if (insertsBuffered){
+		collectMessages(low, leaf->highKey, bounded, scanMessages);
+	}
+	if (memtable != NULL){
+		collectMemtable(low, leaf->highKey, bounded, scanMessages);
+	}
+	return page;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::collectMessages
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::collectMessages(const int low, const int high, const bool bounded, std::vector<RIDKeyPair<int> >& out)
+{
+	PageId pid = rootPageNum;
+	while (true){
+		ReadPageGuard page = readNode(pid);
+		const NonLeafNodeInt* node = page.as<NonLeafNodeInt>();
+		if (node->bufferPageNo != Page::INVALID_NUMBER){
+			ReadPageGuard buffer_page = readNode(node->bufferPageNo);
+			const LeafNodeInt* buffer = buffer_page.as<LeafNodeInt>();
+			int i = std::lower_bound(buffer->keyArray, buffer->keyArray + buffer->stored, low) - buffer->keyArray;
+			for (; i < buffer->stored && (!bounded || buffer->keyArray[i] < high); i++){
+				RIDKeyPair<int> message;
+				message.set(buffer->ridArray[i], buffer->keyArray[i]);
+				out.push_back(message);
+			}
+		}
+
+		if (movesRight(node->rightSibPageNo, node->highKey, low, true)){
+			pid = node->rightSibPageNo;
+		}
+		else if (node->level == 1){
+			break;
+		}
+		else{
+			pid = node->pageNoArray[childIndex(node, low, true)];
+		}
+	}
+	std::stable_sort(out.begin(), out.end(), messageKeyLess);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::scanFromLeaf
+// -----------------------------------------------------------------------------
+
+bool BTreeIndex::scanFromLeaf(const LeafNodeInt* leaf) const
+{
+	if (nextMessage >= scanMessages.size()){
+		return true;
+	}
+	LeafReader entries(leaf);
+	return nextEntry < entries.size() && entries.key(nextEntry) <= scanMessages[nextMessage].key;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::scanFromLeafBackward
+// -----------------------------------------------------------------------------
+
+bool BTreeIndex::scanFromLeafBackward(const LeafNodeInt* leaf) const
+{
+	// the reverse of the forward order: on equal keys the messages come last forwards
+	return nextMessage == 0
+		|| (nextEntry > 0 && LeafReader(leaf).key(nextEntry-1) > scanMessages[nextMessage-1].key);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::scanNext
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::scanNext(RecordId& outRid) 
+{
+	if (!scanExecuting) { 
+		throw ScanNotInitializedException(); 
+	}
+	if (scanReverse) {
+		if (!prevInRange()) {
+			throw IndexScanCompletedException();
+		}
+		const LeafNodeInt* leaf = currentPageData.as<LeafNodeInt>();
+		LeafReader entries(leaf);
+		if (scanFromLeafBackward(leaf) && isPosting(entries.rid(nextEntry-1))) {
+			// a posting list is read when the scan reaches it, and returned back to front
+			if (scanPostings.empty()) {
+				readPostings(entries.rid(nextEntry-1).page_number, SIZE_MAX, scanPostings);
+				nextPosting = scanPostings.size();
+			}
+			nextPosting -= 1;
+			outRid = scanPostings[nextPosting];
+			if (nextPosting == 0) {
+				scanPostings.clear();
+				nextEntry -= 1;
+			}
+		}
+		else if (scanFromLeafBackward(leaf)) {
+			nextEntry -= 1;
+			outRid = entries.rid(nextEntry);
+		}
+		else {
+			nextMessage -= 1;
+			outRid = scanMessages[nextMessage].rid;
+		}
 		return;
 	}
-	catch (FileNotFoundException &e){
+	if (!nextInRange()) {
+		throw IndexScanCompletedException();
+	}
+
+	const LeafNodeInt* leaf = currentPageData.as<LeafNodeInt>();
+	LeafReader entries(leaf);
+	if (scanFromLeaf(leaf) && isPosting(entries.rid(nextEntry))) {
+		// a posting list is read when the scan reaches it
+		if (scanPostings.empty()) {
+			readPostings(entries.rid(nextEntry).page_number, SIZE_MAX, scanPostings);
+			nextPosting = 0;
+		}
+		outRid = scanPostings[nextPosting];
+		nextPosting += 1;
+		if (nextPosting == scanPostings.size()) {
+			scanPostings.clear();
+			nextEntry += 1;
+		}
+	}
+	else if (scanFromLeaf(leaf)) {
+		outRid = entries.rid(nextEntry);
+		nextEntry += 1;
+	}
+	else {
+		outRid = scanMessages[nextMessage].rid;
+		nextMessage += 1;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::nextInRange
+// -----------------------------------------------------------------------------
+
+bool BTreeIndex::nextInRange()
+{
+	const LeafNodeInt* leaf = currentPageData.as<LeafNodeInt>();
+	while (true) {
+		while (nextEntry >= LeafReader(leaf).size() && nextMessage >= scanMessages.size()) {
+			// current leaf is used up; the last leaf stays current until endScan()
+			if (leaf->rightSibPageNo == Page::INVALID_NUMBER) {
+				return false;
+			}
+			currentPageNum = leaf->rightSibPageNo;
+			currentPageData = readScanLeaf(currentPageNum, leaf->highKey);
+			leaf = currentPageData.as<LeafNodeInt>();
+			nextEntry = 0;
+			if (openMode == READ_ONLY_MMAP && leaf->rightSibPageNo != Page::INVALID_NUMBER) {
+				file->adviseMapped(leaf->rightSibPageNo, 1, BlobFile::ADVISE_WILLNEED);
+			}
+		}
+
+		int key = scanFromLeaf(leaf) ? LeafReader(leaf).key(nextEntry) : scanMessages[nextMessage].key;
+		if (!((highOp == LTE && key > highValInt) || (highOp == LT && key >= highValInt))) {
+			return true;
+		}
+
+		// past the current range; ranges the key is past as well hold no entries
+		while (nextRange < scanRanges.size() && scanRanges[nextRange].second < key) {
+			nextRange++;
+		}
+		if (nextRange == scanRanges.size()) {
+			return false;
+		}
+		int low = scanRanges[nextRange].first;
+		highValInt = scanRanges[nextRange].second;
+		highOp = LTE;
+		nextRange++;
+		if (low > key) {
+			seekScan(low);
+			leaf = currentPageData.as<LeafNodeInt>();
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::prevInRange
+// -----------------------------------------------------------------------------
+
+bool BTreeIndex::prevInRange()
+{
+	const LeafNodeInt* leaf = currentPageData.as<LeafNodeInt>();
+	while (nextEntry == 0 && nextMessage == 0) {
+		// current leaf is used up; the first leaf stays current until endScan()
+		if (leaf->leftSibPageNo == Page::INVALID_NUMBER) {
+			return false;
+		}
+		currentPageNum = leftNeighbour(leaf->leftSibPageNo, currentPageNum);
+		currentPageData = readBackwardScanLeaf(currentPageNum);
+		leaf = currentPageData.as<LeafNodeInt>();
+		nextEntry = LeafReader(leaf).size();
+		nextMessage = scanMessages.size();
+		if (openMode == READ_ONLY_MMAP && leaf->leftSibPageNo != Page::INVALID_NUMBER) {
+			file->adviseMapped(leaf->leftSibPageNo, 1, BlobFile::ADVISE_WILLNEED);
+		}
+	}
+
+	int key = scanFromLeafBackward(leaf) ? LeafReader(leaf).key(nextEntry-1) : scanMessages[nextMessage-1].key;
+	return !((lowOp == GTE && key < lowValInt) || (lowOp == GT && key <= lowValInt));
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::leftNeighbour
+// -----------------------------------------------------------------------------
+
+PageId BTreeIndex::leftNeighbour(PageId left, const PageId pageNo)
+{
+	while (true) {
+		PageId next;
+		{
+			ReadPageGuard page = readNode(left);
+			const LeafNodeInt* leaf = page.as<LeafNodeInt>();
+			std::uint64_t version;
+			do {
+				version = readVersion(leaf->latch);
+				next = leaf->rightSibPageNo;
+			} while (!validVersion(leaf->latch, version));
+		}
+		if (next == pageNo || next == Page::INVALID_NUMBER) {
+			return left;
+		}
+		left = next;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readBackwardScanLeaf
+// -----------------------------------------------------------------------------
+
+ReadPageGuard BTreeIndex::readBackwardScanLeaf(const PageId pageNo)
+{
+	// the messages of a leaf are those from the high key of its left neighbour on; splits
+	// meanwhile do not move that bound
+	int low = INT_MIN;
+	if (insertsBuffered || memtable != NULL) {
+		PageId left;
+		{
+			ReadPageGuard page = readNode(pageNo);
+			const LeafNodeInt* leaf = page.as<LeafNodeInt>();
+			std::uint64_t version;
+			do {
+				version = readVersion(leaf->latch);
+				left = leaf->leftSibPageNo;
+			} while (!validVersion(leaf->latch, version));
+		}
+		if (left != Page::INVALID_NUMBER) {
+			ReadPageGuard page = readNode(leftNeighbour(left, pageNo));
+			const LeafNodeInt* leaf = page.as<LeafNodeInt>();
+			std::uint64_t version;
+			do {
+				version = readVersion(leaf->latch);
+				low = leaf->highKey;
+			} while (!validVersion(leaf->latch, version));
+		}
+	}
+	return readScanLeaf(pageNo, low);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::startReverseScan
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::startReverseScan(const void* lowValParm,
+				   const Operator lowOpParm,
+				   const void* highValParm,
+				   const Operator highOpParm)
+{
+	if (((lowOpParm != GT) && (lowOpParm != GTE)) || ((highOpParm != LT) && (highOpParm != LTE))) {
+		throw BadOpcodesException();
+	}
+	if (*((int*) lowValParm) > *((int*) highValParm)) {
+		throw BadScanrangeException();
+	}
+	if (scanExecuting == true) {
+		endScan();
+	}
+
+	this -> lowValInt = *((int*) lowValParm);
+	this -> highValInt = *((int*) highValParm);
+	this -> lowOp = lowOpParm;
+	this -> highOp = highOpParm;
+	scanRanges.clear();
+	nextRange = 0;
+
+	// start in the rightmost leaf that may hold an entry in the range: entries equal to
+	// the high key lie in the leaf an entry with it would be inserted into or further
+	// left, and a run of them may reach back over several leaves, whose leftmost one holds
+	// the entries just below it
+	currentPageNum = findNode(highValInt, highOp == LTE, 0, NULL);
+	currentPageData = readBackwardScanLeaf(currentPageNum);
+	LeafReader entries(currentPageData.as<LeafNodeInt>());
+	RIDKeyPair<int> high;
+	high.set(RecordId(), highValInt);
+	nextEntry = (highOp == LTE) ? entries.upperBound(0, entries.size(), highValInt)
+	                            : entries.lowerBound(0, entries.size(), highValInt);
+	nextMessage = ((highOp == LTE) ? std::upper_bound(scanMessages.begin(), scanMessages.end(), high, messageKeyLess)
+	                               : std::lower_bound(scanMessages.begin(), scanMessages.end(), high, messageKeyLess)) - scanMessages.begin();
+	scanReverse = true;
+	scanExecuting = true;
+	if (!prevInRange()) {
+		endScan();
+		throw NoSuchKeyFoundException();
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::seekScan
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::seekScan(const int low)
+{
+	const LeafNodeInt* leaf = currentPageData.as<LeafNodeInt>();
+	if (leaf->rightSibPageNo != Page::INVALID_NUMBER && low > leaf->highKey) {
+		currentPageNum = leaf->rightSibPageNo;
+		currentPageData = readScanLeaf(currentPageNum, leaf->highKey);
+		leaf = currentPageData.as<LeafNodeInt>();
+		if (leaf->rightSibPageNo != Page::INVALID_NUMBER && low > leaf->highKey) {
+			// farther than the next leaf
+			currentPageNum = findNode(low, false, 0, NULL);
+			currentPageData = readScanLeaf(currentPageNum, low);
+			leaf = currentPageData.as<LeafNodeInt>();
+		}
+		nextEntry = 0;
+	}
+
+	RIDKeyPair<int> message;
+	message.set(RecordId(), low);
+	LeafReader entries(leaf);
+	nextEntry = entries.lowerBound(nextEntry, entries.size(), low);
+	nextMessage = std::lower_bound(scanMessages.begin() + nextMessage, scanMessages.end(), message, messageKeyLess) - scanMessages.begin();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::startMultiRangeScan
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::startMultiRangeScan(const ScanRange* ranges, const std::size_t numRanges)
+{
+	std::vector<std::pair<int, int> > bounds;
+	for (std::size_t i = 0; i < numRanges; i++) {
+		const ScanRange& range = ranges[i];
+		if (((range.lowOp != GT) && (range.lowOp != GTE)) || ((range.highOp != LT) && (range.highOp != LTE))) {
+			throw BadOpcodesException();
+		}
+		int low = *((const int*) range.lowVal);
+		int high = *((const int*) range.highVal);
+		if (low > high) {
+			throw BadScanrangeException();
+		}
+
+		// make the bounds inclusive; a range such as (3, 4) holds no key
+		if (range.lowOp == GT) {
+			if (low == INT_MAX) {
+				continue;
+			}
+			low++;
+		}
+		if (range.highOp == LT) {
+			if (high == INT_MIN) {
+				continue;
+			}
+			high--;
+		}
+		if (low <= high) {
+			bounds.push_back(std::make_pair(low, high));
+		}
+	}
+
+	std::sort(bounds.begin(), bounds.end());
+	std::vector<std::pair<int, int> > merged;
+	for (std::size_t i = 0; i < bounds.size(); i++) {
+		if (!merged.empty() && (merged.back().second == INT_MAX || bounds[i].first <= merged.back().second + 1)) {
+			merged.back().second = std::max(merged.back().second, bounds[i].second);
+		}
+		else {
+			merged.push_back(bounds[i]);
+		}
 	}
-	BlobFile indexFile = BlobFile(outIndexName,true);
-	
 
-	//allocate meta page
-	PageId pid;
-	Page* meta_page;
-	bufMgrIn->allocPage(&indexFile,pid,meta_page);
-	IndexMetaInfo* index_meta = reinterpret_cast<IndexMetaInfo*>(meta_page);
-	strcpy(index_meta->relationName,relationName.c_str());
-	index_meta->attrByteOffset = attrByteOffset;
-	index_meta->attrType = attrType;
-	
-	//allocate root page
-	PageId rootid;
-	Page* root_page;
-	bufMgrIn->allocPage(&indexFile,rootid,root_page);
-	NonLeafNodeInt* root_node=reinterpret_cast<NonLeafNodeInt*>(root_page);
-	for(int i=0;i<INTARRAYNONLEAFSIZE;i++){
-		root_node->keyArray[i] = INT_MAX;
-		root_node->pageNoArray[i] = Page::INVALID_NUMBER;
-	}
-	root_node->level = 1;
-
-	// allocate the first leaf page
-	PageId childid;
-	Page* child_page;
-	bufMgrIn->allocPage(&indexFile, childid, child_page);
-	LeafNodeInt* child_node = reinterpret_cast<LeafNodeInt*>(child_page);
-	child_node->rightSibPageNo = -1;
-	for(int i = 0; i < leafOccupancy; i++){
-		child_node->keyArray[i] = INT_MAX;
-	}
-	
-	//fill in fields of btree
-	index_meta->rootPageNo = rootid;
-	this->file = &indexFile;
-	this->bufMgr = bufMgrIn;
-	this->headerPageNum = pid;
-	this->rootPageNum = rootid;
-	this->attributeType = attrType;
-	this->attrByteOffset = attrByteOffset;
-	this->leafOccupancy = INTARRAYLEAFSIZE;
-	this->nodeOccupancy = INTARRAYNONLEAFSIZE;
-	this->height = 2;
+	if (scanExecuting == true) {
+		endScan();
+	}
+	if (merged.empty()) {
+		throw NoSuchKeyFoundException();
+	}
 
-	//unpin
-	bufMgrIn->unPinPage(&indexFile,pid,true);
-	bufMgrIn->unPinPage(&indexFile,rootid,true);
-	bufMgrIn->unPinPage(&indexFile,childid,true);
+	scanRanges.swap(merged);
+	lowValInt = scanRanges[0].first;
+	lowOp = GTE;
+	highValInt = scanRanges[0].second;
+	highOp = LTE;
+	nextRange = 1;
 
-	//insert entries from the relation
-	FileScan fc = FileScan(relationName,bufMgrIn);
-	RecordId rid;
-	try{
-		while (true){
-			fc.scanNext(rid);
-			std::string data = fc.getRecord();
-			int* key = reinterpret_cast<int*>(&data + attrByteOffset);
-			insertEntry(key,rid);
-		}
-	}catch(EndOfFileException &e){
+	currentPageNum = findNode(lowValInt, false, 0, NULL);
+	currentPageData = readScanLeaf(currentPageNum, lowValInt);
+	nextEntry = 0;
+	seekScan(lowValInt);
+	scanExecuting = true;
+	if (!nextInRange()) {
+		endScan();
+		throw NoSuchKeyFoundException();
 	}
-
 }
 
+// -----------------------------------------------------------------------------
+// BTreeIndex::endScan
+// -----------------------------------------------------------------------------
+//
+void BTreeIndex::endScan() 
+{
+	if (!scanExecuting) { 
+		throw ScanNotInitializedException(); 
+	} 
+	scanExecuting = false;
+	currentPageData.release();
+	currentPageNum = Page::INVALID_NUMBER;
+	nextEntry = -1;
+	scanMessages.clear();
+	nextMessage = 0;
+	scanPostings.clear();
+	nextPosting = 0;
+	scanRanges.clear();
+	nextRange = 0;
+	scanReverse = false;
+}
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::~BTreeIndex -- destructor
+// BTreeIndex::lookup
 // -----------------------------------------------------------------------------
 
-BTreeIndex::~BTreeIndex()
+std::size_t BTreeIndex::lookup(const void* key, RecordId* out, const std::size_t max)
 {
+	int int_key = *(const int*)key;
+	if (!insertsBuffered && memtable == NULL){
+		return lookupLeaves(int_key, out, max);
+	}
+
+	//a flush or merge moves entries into the leaves; read both at one moment
+	SharedLatchGuard flush_hold(bufferLatch);
+	std::size_t found = lookupLeaves(int_key, out, max);
+	std::vector<RIDKeyPair<int> > messages;
+	int high = (int_key == INT_MAX) ? int_key : int_key + 1;
+	if (insertsBuffered){
+		collectMessages(int_key, high, int_key != INT_MAX, messages);
+	}
+	if (memtable != NULL){
+		collectMemtable(int_key, high, int_key != INT_MAX, messages);
+	}
+	for (std::size_t i = 0; i < messages.size() && found < max; i++){
+		out[found++] = messages[i].rid;
+	}
+	return found;
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::insertEntry
+// BTreeIndex::contains
 // -----------------------------------------------------------------------------
 
-void BTreeIndex::insertEntry(const void *key, const RecordId rid) 
+bool BTreeIndex::contains(const void* key)
 {
+	RecordId rid;
+	return lookup(key, &rid, 1) != 0;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::lookupBatch
+// -----------------------------------------------------------------------------
 
-	int int_key = *(int*)key;
-	Page* root_page;
-	bufMgr->readPage(file,rootPageNum,root_page);
-	NonLeafNodeInt* root_node = reinterpret_cast<NonLeafNodeInt*>(root_page);
-	
-	NonLeafNodeInt* current = root_node; //pointer to the current internal node looking at
-	PageId child_pid;
-	LeafNodeInt* leaf;
-	Page* child_page;
+void BTreeIndex::lookupBatch(const void* keys, const std::size_t n, RecordId* results, const std::size_t max, std::size_t* counts)
+{
+	const int* int_keys = (const int*)keys;
+	std::vector<std::size_t> order(n);
+	for (std::size_t i = 0; i < n; i++){
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), BatchKeyLess(int_keys));
 
-	node_stack.push(root_node);
-	pid_stack.push(rootPageNum);
+	if (insertsBuffered || memtable != NULL || hashedLookups){
+		for (std::size_t i = 0; i < n; i++){
+			counts[order[i]] = lookup(&int_keys[order[i]], results + order[i]*max, max);
+		}
+		return;
+	}
+	if (n == 0){
+		return;
+	}
 
+	std::vector<int> sorted(n);
+	for (std::size_t i = 0; i < n; i++){
+		sorted[i] = int_keys[order[i]];
+	}
 
-	while(current->level>=1){
-		int i;
-		//find the child node to proceed
-		for(i=0;i<nodeOccupancy;i++){
-			if (int_key<root_node->keyArray[i]){
-				child_pid = root_node->pageNoArray[i];
-				break;
+	//descend level by level; the runs of one round go through different nodes, so their
+	//nodes are fetched a group at a time before any of them is searched
+	BatchRange all = { rootPageNum, 0, n };
+	std::vector<BatchRange> runs(1, all);
+	std::vector<BatchRange> leaves;
+	while (!runs.empty()){
+		std::vector<BatchRange> next;
+		for (std::size_t g = 0; g < runs.size(); g += LOOKUP_GROUP_SIZE){
+			std::size_t group_end = std::min(g + LOOKUP_GROUP_SIZE, runs.size());
+			ReadPageGuard pages[LOOKUP_GROUP_SIZE];
+			for (std::size_t j = g; j < group_end; j++){
+				pages[j-g] = readNode(runs[j].pageNo);
+				prefetchNode(pages[j-g].page(), offsetof(NonLeafNodeInt, keyArray) + INTARRAYNONLEAFSIZE/2*sizeof(int));
 			}
-			if(i==nodeOccupancy-1){
-				i++;
-				child_pid = root_node->pageNoArray[i];
+			for (std::size_t j = g; j < group_end; j++){
+				routeBatch(pages[j-g].as<NonLeafNodeInt>(), sorted, runs[j], next, leaves);
 			}
 		}
+		runs.swap(next);
+	}
 
-		bufMgr->readPage(file,child_pid,child_page);
-
-		//only place to exit while loop
-		if(current->level==1){
-			leaf = reinterpret_cast<LeafNodeInt*>(child_page);
-			break;
+	for (std::size_t g = 0; g < leaves.size(); g += LOOKUP_GROUP_SIZE){
+		std::size_t group_end = std::min(g + LOOKUP_GROUP_SIZE, leaves.size());
+		ReadPageGuard pages[LOOKUP_GROUP_SIZE];
+		for (std::size_t j = g; j < group_end; j++){
+			pages[j-g] = readNode(leaves[j].pageNo);
+			prefetchNode(pages[j-g].page(), offsetof(LeafNodeInt, keyArray) + INTARRAYLEAFSIZE/2*sizeof(int));
 		}
-		//update current and continue the while loop
-		else{
-			current = reinterpret_cast<NonLeafNodeInt*>(child_page);
+		for (std::size_t j = g; j < group_end; j++){
+			for (std::size_t a = leaves[j].first; a < leaves[j].last; a++){
+				std::size_t i = order[a];
+				counts[i] = lookupFrom(pages[j-g].as<LeafNodeInt>(), sorted[a], results + i*max, max);
+			}
 		}
-		node_stack.push(current);
-		pid_stack.push(child_pid);
 	}
-	//found the leaf page to insert
+}
 
-	//leaf has enough space
-	if(leaf->stored<leafOccupancy){
-		int m = 0;
-		while(int_key>(leaf->keyArray[m])){
-			m++;
-		}
-		for(int n=leaf->stored;n>m;n--){
-			leaf->keyArray[n] = leaf->keyArray[n-1];
-			leaf->ridArray[n] = leaf->ridArray[n-1];
+// -----------------------------------------------------------------------------
+// BTreeIndex::routeBatch
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::routeBatch(const NonLeafNodeInt* node, const std::vector<int>& keys, const BatchRange& range,
+                            std::vector<BatchRange>& next, std::vector<BatchRange>& leaves)
+{
+	std::size_t next_mark = next.size();
+	std::size_t leaves_mark = leaves.size();
+	while (true){
+		std::uint64_t version = readVersion(node->latch);
+		std::vector<BatchRange>& children = (node->level == 1) ? leaves : next;
+		for (std::size_t a = range.first; a < range.last; ){
+			BatchRange run;
+			run.first = a;
+			if (movesRight(node->rightSibPageNo, node->highKey, keys[a], false)){
+				//the keys are sorted, so all the rest move right
+				run.pageNo = node->rightSibPageNo;
+				run.last = range.last;
+				next.push_back(run);
+			}
+			else{
+				int child = childIndex(node, keys[a], false);
+				std::size_t b = a + 1;
+				while (b < range.last && !movesRight(node->rightSibPageNo, node->highKey, keys[b], false)
+				       && childIndex(node, keys[b], false) == child){
+					b++;
+				}
+				run.pageNo = node->pageNoArray[child];
+				run.last = b;
+				children.push_back(run);
+			}
+			a = run.last;
 		}
-		leaf->keyArray[m] = int_key;
-		leaf->ridArray[m] = rid;
-		leaf->stored++;
-		//clean up
-		bufMgr->unPinPage(file,child_pid,true);
-		while(!node_stack.empty()){
-			bufMgr->unPinPage(file,pid_stack.top(),false);
-			node_stack.pop();
-			pid_stack.pop();
+		if (validVersion(node->latch, version)){
+			return;
 		}
+		next.resize(next_mark);
+		leaves.resize(leaves_mark);
 	}
+}
 
-	//leaf does not have enough space
-	else{
-		PageId new_pid;
-		Page* new_page;
-		LeafNodeInt* new_leaf;
-		bufMgr->allocPage(file,new_pid,new_page);
-		new_leaf = reinterpret_cast<LeafNodeInt*>(new_page);
+// -----------------------------------------------------------------------------
+// BTreeIndex::lookupLeaves
+// -----------------------------------------------------------------------------
 
-		//copy everything to the new array, insert at the corresponding location
-		RIDKeyPair<int>* deepCopy[leafOccupancy+1];
-		for (int a=0;a<leafOccupancy;a++){
-			deepCopy[a] = new RIDKeyPair<int>;
-			deepCopy[a]->set(leaf->ridArray[a],leaf->keyArray[a]);
+std::size_t BTreeIndex::lookupLeaves(const int int_key, RecordId* out, const std::size_t max)
+{
+	PageId pid;
+	if (hashedLookups){
+		SharedLatchGuard hash_hold(leafHashLatch);
+		std::unordered_map<int, PageId>::const_iterator hit = leafHash.find(int_key);
+		if (hit == leafHash.end()){
+			return 0;
 		}
+		//entries only ever move right, so the leaf found is at worst left of the key
+		pid = hit->second;
+	}
+	else{
+		pid = findNode(int_key, false, 0, NULL);
+	}
+	ReadPageGuard page = readNode(pid);
+	return lookupFrom(page.as<LeafNodeInt>(), int_key, out, max);
+}
 
-		//insert the new key
-		int m = 0;
-		while(int_key>(deepCopy[m]->key)){
-			m++;
-		}
-		for(int b=leafOccupancy;b>m;b--){
-			deepCopy[b] = deepCopy[b-1];
-		}
-		deepCopy[m] = new RIDKeyPair<int>;
-		deepCopy[m]->set(rid,int_key);
-		int half = (leafOccupancy+1)/2; //the index of the key to be copied up
+// -----------------------------------------------------------------------------
+// BTreeIndex::lookupFrom
+// -----------------------------------------------------------------------------
 
-		//update the original child
-		for(int c=0;c<leafOccupancy;c++){
-			if(c<half){
-				leaf->keyArray[c] = deepCopy[c]->key;
-				leaf->ridArray[c] = deepCopy[c]->rid;
-			}
-			else{
-				leaf->keyArray[c] = INT_MAX;
-			}
-		}
-		
-		//update the new child
-		for (int c=0;c<leafOccupancy;c++){
-			if(c+half<leafOccupancy+1){
-				new_leaf->keyArray[c] = deepCopy[c+half]->key;
-				new_leaf->ridArray[c] = deepCopy[c+half]->rid;
+std::size_t BTreeIndex::lookupFrom(const LeafNodeInt* leaf, const int int_key, RecordId* out, const std::size_t max)
+{
+	ReadPageGuard page;
+	std::size_t found = 0;
+	while (found < max){
+		std::size_t leaf_start = found;
+		bool past_leaf;
+		PageId next;
+
+		// read the matching entries, again if a writer changed the leaf meanwhile
+		while (true){
+			std::uint64_t version = readVersion(leaf->latch);
+			LeafReader entries(leaf);
+			int stored = entries.size();
+			int i = entries.lowerBound(0, stored, int_key);
+			found = leaf_start;
+			for (; i < stored && entries.key(i) == int_key && found < max; i++){
+				out[found++] = entries.rid(i);
 			}
-			else{
-				new_leaf->keyArray[c] = INT_MAX;
+			// duplicates may continue in the right sibling
+			past_leaf = (i == stored) && !(int_key < leaf->highKey);
+			next = leaf->rightSibPageNo;
+			if (validVersion(leaf->latch, version)){
+				break;
 			}
 		}
 
-		//set the fields correspondingly
-		new_leaf->rightSibPageNo = leaf->rightSibPageNo;
-		leaf->rightSibPageNo = new_pid;
-		leaf->stored = half;
-		new_leaf->stored = leafOccupancy+1-half;
-
-		//cleanup the new array created
-		for(int c=0;c<leafOccupancy+1;c++){
-			delete deepCopy[c];
+		// posting lists are read once the leaf is known to be consistent
+		if (std::find_if(out + leaf_start, out + found, isPosting) != out + found){
+			found = expandPostings(out, leaf_start, found, max);
 		}
+		if (!past_leaf || next == Page::INVALID_NUMBER){
+			break;
+		}
+		page = readNode(next);
+		leaf = page.as<LeafNodeInt>();
+	}
+	return found;
+}
 
-		int copy_up = new_leaf->keyArray[0];
-
-		//clean up the two leaf pages
-		bufMgr->unPinPage(file,child_pid,true);
-		bufMgr->unPinPage(file,new_pid,true);
-
-		insert_internal(copy_up,new_pid);
+// -----------------------------------------------------------------------------
+// BTreeIndex::snapshot
+// -----------------------------------------------------------------------------
 
+BTreeSnapshot* BTreeIndex::snapshot()
+{
+	std::unique_lock<SharedLatch> flush_hold(bufferLatch, std::defer_lock);
+	if (memtable != NULL){
+		flush_hold.lock();
+		mergeMemtableEntries();
+	}
+	else if (insertsBuffered){
+		flush_hold.lock();
+		SharedLatchGuard snap_hold(snapLatch);
+		drainBuffers();
 	}
 
+	//wait for the inserts that are changing nodes right now
+	std::lock_guard<SharedLatch> quiesce(snapLatch);
+	BTreeSnapshot* snap = new BTreeSnapshot(this, rootPageNum);
+	std::lock_guard<std::mutex> lock(snapMutex);
+	snapshots.push_back(snap);
+	openSnapshots++;
+	return snap;
 }
 
-void BTreeIndex::insert_internal(int key,PageId new_child_pid){
-	NonLeafNodeInt* parent = node_stack.top();
-	PageId parent_pid = pid_stack.top();
-	if(parent->stored<nodeOccupancy){
-		int m = 0;
-		while(key>(parent->keyArray[m])){
-			m++;
-		}
-		int n;
-		
-		for(n=parent->stored;n>m;n--){
-			parent->keyArray[n] = parent->keyArray[n-1];
-			parent->pageNoArray[n+1] = parent->pageNoArray[n];
-		}
-		parent->keyArray[m] = key;
-		parent->pageNoArray[m+1] = new_child_pid;
-		parent->stored++;
-		//clean up
-		bufMgr->unPinPage(file,parent_pid,true);
-		while(!node_stack.empty()){
-			bufMgr->unPinPage(file,pid_stack.top(),false);
-			node_stack.pop();
-			pid_stack.pop();
-		}
+// -----------------------------------------------------------------------------
+// BTreeIndex::preserve
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::preserve(const WritePageGuard& page)
+{
+	if (openSnapshots == 0){
 		return;
 	}
-	else{
-		PageId new_pid;
-		Page* new_page;
-		NonLeafNodeInt* new_nonleaf;
-		bufMgr->allocPage(file,new_pid,new_page);
-		new_nonleaf = reinterpret_cast<NonLeafNodeInt*>(new_page);
 
-		//copy everything to the new array, insert at the corresponding location
-		int keyCopy[nodeOccupancy+1];
-		PageId pNoCopy[nodeOccupancy+2];
-		int a;
-		for(a=0;a<nodeOccupancy;a++){
-			keyCopy[a] = parent->keyArray[a];
-			pNoCopy[a] = parent->pageNoArray[a];
-		}
-		pNoCopy[a] = parent->pageNoArray[a];
-
-		//insert the new key
-		int m = 0;
-		while(key>keyCopy[m]){
-			m++;
-		}
-		for(int b=nodeOccupancy;b>m;b--){
-			keyCopy[b] = keyCopy[b-1];
-			pNoCopy[b+1] = pNoCopy[b];
-		}
-		keyCopy[m] = key;
-		pNoCopy[m+1]=new_child_pid;	
-
-		int half = nodeOccupancy/2;//the index of the key to by pushed up later
-		//update the original child
-		for(int c=0;c<nodeOccupancy;c++){
-			if(c<half){
-				parent->keyArray[c] = keyCopy[c];
-				parent->pageNoArray[c] = pNoCopy[c];
+	//every snapshot without a copy of the node still sees its current version, so
+	//one shadow page serves all of them
+	std::lock_guard<std::mutex> lock(snapMutex);
+	PageId shadow = Page::INVALID_NUMBER;
+	for (std::size_t i = 0; i < snapshots.size(); i++){
+		if (snapshots[i]->shadows.count(page.pageNo()) != 0){
+			continue;
+		}
+		if (shadow == Page::INVALID_NUMBER){
+			WritePageGuard shadow_page;
+			if (freeShadows.empty()){
+				shadow_page = bufMgr->allocPageGuarded(file, shadow);
+				memcpy(static_cast<void*>(shadow_page.page()), page.page(), Page::SIZE);
+				addShadowPage(shadow_page);
 			}
 			else{
-				parent->keyArray[c] = INT_MAX;
-				if(c==half){
-					parent->pageNoArray[c] = pNoCopy[c];
-				}
+				shadow = freeShadows.back();
+				freeShadows.pop_back();
+				shadow_page = bufMgr->writePageGuarded(file, shadow);
+				memcpy(static_cast<void*>(shadow_page.page()), page.page(), Page::SIZE);
+				shadow_page.markDirty();
 			}
 		}
-		parent->stored = half;
-		
-		//update the new internal node
-		for (int c=0;c<nodeOccupancy;c++){
-			if(c+half+1<nodeOccupancy+1){
-				new_nonleaf->keyArray[c] = keyCopy[c+half+1];
-				new_nonleaf->pageNoArray[c] = pNoCopy[c+half+1];
-			}
-			else{
-				new_nonleaf->keyArray[c] = INT_MAX;
-				if(c+half+1==nodeOccupancy+1){
-					new_nonleaf->pageNoArray[c] = pNoCopy[c+half+1];
-				}
+		snapshots[i]->shadows[page.pageNo()] = shadow;
+		shadowRefs[shadow]++;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::readSnapshotNode
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::readSnapshotNode(const BTreeSnapshot* snap, const PageId pageNo, Page* out)
+{
+	while (true){
+		PageId shadow = Page::INVALID_NUMBER;
+		{
+			std::lock_guard<std::mutex> lock(snapMutex);
+			std::unordered_map<PageId, PageId>::const_iterator it = snap->shadows.find(pageNo);
+			if (it != snap->shadows.end()){
+				shadow = it->second;
 			}
 		}
-		new_nonleaf->level = parent->level;
-		new_nonleaf->stored = nodeOccupancy-half;
+		if (shadow != Page::INVALID_NUMBER){
+			//shadow pages never change while a snapshot uses them
+			ReadPageGuard page = readNode(shadow);
+			memcpy(static_cast<void*>(out), page.page(), Page::SIZE);
+			return;
+		}
 
-		
-		int push_up = keyCopy[half]; //the key to be pushed up
+		ReadPageGuard page = readNode(pageNo);
+		const VersionLatch& latch = page.as<LeafNodeInt>()->latch;
+		std::uint64_t version = readVersion(latch);
+		memcpy(static_cast<void*>(out), page.page(), Page::SIZE);
+		if (!validVersion(latch, version)){
+			continue;
+		}
 
-		//check root or not
-		if(parent_pid==rootPageNum){
-			PageId new_root_pid;
-			Page* new_root_page;
-			NonLeafNodeInt* new_root;
-			bufMgr->allocPage(file,new_root_pid,new_root_page);
-			new_root = reinterpret_cast<NonLeafNodeInt*>(new_root_page);
-
-			new_root->keyArray[0] = push_up;
-			new_root->pageNoArray[0] = parent_pid;
-			new_root->pageNoArray[1] = new_pid;
-			for(int a=1;a<nodeOccupancy;a++){
-				new_root->keyArray[a] = INT_MAX;
-				new_root->pageNoArray[a+1] = Page::INVALID_NUMBER;
-			}
-			new_root->level = parent->level+1;
-			new_root->stored = 1;
-
-
-			this->height++;
-			this->rootPageNum = new_root_pid;
-
-			//update the metapage
-			PageId pid=static_cast<PageId>(-1);
-			Page* meta_page;
-			bufMgr->readPage(file,pid,meta_page);
-			IndexMetaInfo* index_meta = reinterpret_cast<IndexMetaInfo*>(meta_page);
-			index_meta->rootPageNo = new_root_pid;
-
-			//unpin
-			bufMgr->unPinPage(file,parent_pid,true);
-			bufMgr->unPinPage(file,new_pid,true);
-			bufMgr->unPinPage(file,new_root_pid,true);
-			bufMgr->unPinPage(file,pid,true);
+		//a writer preserves the node before changing it, so if it has not been
+		//preserved by now, the copy predates every change since the snapshot
+		std::lock_guard<std::mutex> lock(snapMutex);
+		if (snap->shadows.count(pageNo) == 0){
 			return;
 		}
-		else{
-			//clean up and update next insert's parent before calling itself
-			bufMgr->unPinPage(file,parent_pid,true);
-			bufMgr->unPinPage(file,new_pid,true);
-			node_stack.pop();
-			pid_stack.pop();
-			insert_internal(push_up,new_pid);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::closeSnapshot
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::closeSnapshot(BTreeSnapshot* snap)
+{
+	std::lock_guard<std::mutex> lock(snapMutex);
+	snapshots.erase(std::find(snapshots.begin(), snapshots.end(), snap));
+	openSnapshots--;
+	for (std::unordered_map<PageId, PageId>::const_iterator it = snap->shadows.begin();
+	     it != snap->shadows.end(); ++it){
+		if (--shadowRefs[it->second] == 0){
+			shadowRefs.erase(it->second);
+			freeShadows.push_back(it->second);
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::loadShadowList
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::loadShadowList()
+{
+	ReadPageGuard meta_page = readNode(headerPageNum);
+	PageId pid = meta_page.as<IndexMetaInfo>()->shadowListPageNo;
+	while (pid != Page::INVALID_NUMBER){
+		ReadPageGuard list_page = readNode(pid);
+		const ShadowListPageInt* list = list_page.as<ShadowListPageInt>();
+		shadowListPages.push_back(pid);
+		for (int i = 0; i < list->stored; i++){
+			freeShadows.push_back(list->pageNoArray[i]);
+			shadowListOf[list->pageNoArray[i]] = pid;
+		}
+		pid = list->nextPageNo;
+	}
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::addShadowPage
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::addShadowPage(WritePageGuard& shadow)
+{
+	//the page goes to the log with the list, so that recovery finds every page the
+	//list names in the file
+	LogUnit unit;
+	for (std::size_t i = 0; i < shadowListPages.size(); i++){
+		WritePageGuard list_page = writeNode(shadowListPages[i]);
+		ShadowListPageInt* list = list_page.as<ShadowListPageInt>();
+		if (list->stored == SHADOWLISTSIZE){
+			continue;
 		}
+		list->pageNoArray[list->stored++] = shadow.pageNo();
+		shadowListOf[shadow.pageNo()] = list_page.pageNo();
+		WritePageGuard* pages[] = { &list_page, &shadow };
+		logImages(unit, pages, 2);
+		return;
+	}
+
+	//every page of the list is full; link a new one at its end
+	PageId new_pid;
+	WritePageGuard new_page = bufMgr->allocPageGuarded(file, new_pid);
+	ShadowListPageInt* new_list = new_page.as<ShadowListPageInt>();
+	new_list->latch.init();
+	new_list->nextPageNo = Page::INVALID_NUMBER;
+	new_list->stored = 1;
+	new_list->pageNoArray[0] = shadow.pageNo();
+	WritePageGuard last_page = writeNode(shadowListPages.back());
+	last_page.as<ShadowListPageInt>()->nextPageNo = new_pid;
+	shadowListPages.push_back(new_pid);
+	shadowListOf[shadow.pageNo()] = new_pid;
+	WritePageGuard* pages[] = { &new_page, &last_page, &shadow };
+	logImages(unit, pages, 3);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeIndex::dropShadowPage
+// -----------------------------------------------------------------------------
+
+void BTreeIndex::dropShadowPage(const PageId pageNo)
+{
+	std::unordered_map<PageId, PageId>::iterator it = shadowListOf.find(pageNo);
+	WritePageGuard list_page = writeNode(it->second);
+	shadowListOf.erase(it);
+	ShadowListPageInt* list = list_page.as<ShadowListPageInt>();
+	PageId* slot = std::find(list->pageNoArray, list->pageNoArray + list->stored, pageNo);
+	*slot = list->pageNoArray[--list->stored];
+	LogUnit unit;
+	WritePageGuard* pages[] = { &list_page };
+	logImages(unit, pages, 1);
+}
 
+// -----------------------------------------------------------------------------
+// BTreeIndex::allocNode
+// -----------------------------------------------------------------------------
+
+WritePageGuard BTreeIndex::allocNode(PageId& pageNo)
+{
+	{
+		std::lock_guard<std::mutex> lock(snapMutex);
+		if (!freeShadows.empty()){
+			//the page leaves the list first; a crash before the node is logged loses
+			//the page, like a new page of the file
+			pageNo = freeShadows.back();
+			freeShadows.pop_back();
+			dropShadowPage(pageNo);
+			WritePageGuard page = writeNode(pageNo);
+			memset(static_cast<void*>(page.page()), 0, Page::SIZE);
+			page.markDirty();
+			return page;
+		}
 	}
+	return bufMgr->allocPageGuarded(file, pageNo);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeSnapshot::BTreeSnapshot -- Constructor
+// -----------------------------------------------------------------------------
 
+BTreeSnapshot::BTreeSnapshot(BTreeIndex* index, const PageId rootPageNo)
+	: index(index), rootPageNo(rootPageNo), scanExecuting(false), nextEntry(-1), nextPosting(0)
+{
 }
 
+// -----------------------------------------------------------------------------
+// BTreeSnapshot::~BTreeSnapshot -- destructor
+// -----------------------------------------------------------------------------
 
+BTreeSnapshot::~BTreeSnapshot()
+{
+	index->closeSnapshot(this);
+}
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::startScan
+// BTreeSnapshot::findLeaf
 // -----------------------------------------------------------------------------
 
-void BTreeIndex::startScan(const void* lowValParm,
+void BTreeSnapshot::findLeaf(const int key)
+{
+	PageId pid = rootPageNo;
+	const NonLeafNodeInt* node = reinterpret_cast<const NonLeafNodeInt*>(&nodeCopy);
+	while (true){
+		index->readSnapshotNode(this, pid, &nodeCopy);
+		if (movesRight(node->rightSibPageNo, node->highKey, key, false)){
+			pid = node->rightSibPageNo;
+			continue;
+		}
+		pid = node->pageNoArray[childIndex(node, key, false)];
+		if (node->level == 1){
+			break;
+		}
+	}
+	index->readSnapshotNode(this, pid, &leafCopy);
+}
+
+// -----------------------------------------------------------------------------
+// BTreeSnapshot::startScan
+// -----------------------------------------------------------------------------
+
+void BTreeSnapshot::startScan(const void* lowValParm,
 				   const Operator lowOpParm,
 				   const void* highValParm,
 				   const Operator highOpParm)
 {
-    if (scanExecuting == true) {
-      endScan();
-    }
-	scanExecuting = true;
+	if (((lowOpParm != GT) && (lowOpParm != GTE)) || ((highOpParm != LT) && (highOpParm != LTE))) {
+		throw BadOpcodesException();
+	}
+	if (*((int*) lowValParm) > *((int*) highValParm)) {
+		throw BadScanrangeException();
+	}
+	scanExecuting = false;
+	postings.clear();
+
+	lowValInt = *((int*) lowValParm);
+	highValInt = *((int*) highValParm);
+	lowOp = lowOpParm;
+	highOp = highOpParm;
+
+	findLeaf(lowValInt);
+	const LeafNodeInt* leaf = reinterpret_cast<const LeafNodeInt*>(&leafCopy);
+	while (true) {
+		LeafReader entries(leaf);
+		nextEntry = (lowOp == GT) ? entries.upperBound(0, entries.size(), lowValInt)
+		                          : entries.lowerBound(0, entries.size(), lowValInt);
+		if (nextEntry < entries.size()) {
+			break;
+		}
+		if (leaf->rightSibPageNo == Page::INVALID_NUMBER) {
+			throw NoSuchKeyFoundException();
+		}
+		index->readSnapshotNode(this, leaf->rightSibPageNo, &leafCopy);
+	}
 
-    this -> lowValInt = *((int*) lowValParm);
-    this -> highValInt = *((int*) highValParm);
-    this -> lowOp = lowOpParm;
-    this -> highOp = highOpParm;
-
-    // BadOpcodesException 
-    if (((lowOp != GT) && (lowOp != GTE)) || ((highOp != LT) &&  (highOp != LTE))) {
-      throw BadOpcodesException();
-    }
-    // BadScanrangeException 
-    if (this -> lowValInt > this -> highValInt) {
-      throw BadScanrangeException();
-    }
-
-    currentPageNum = rootPageNum;
-
-    std::stack <PageId> stack;
-    stack.push(rootPageNum);
-
-    bufMgr -> readPage(file, rootPageNum, currentPageData); // read root page
-    NonLeafNodeInt* current = reinterpret_cast < NonLeafNodeInt * > (currentPageData);
-
-    LeafNodeInt* leaf;
-
-    while (current -> level != 1) {
-      for (int i = 0; i < nodeOccupancy; i++) {
-        if (lowValInt < current -> keyArray[i]) {
-          currentPageNum = current -> pageNoArray[i];
-          stack.push(currentPageNum);
-          bufMgr -> readPage(file, currentPageNum, currentPageData); // read next page
-          current = reinterpret_cast <NonLeafNodeInt*> (currentPageData);
-          break;
-        }
-        if (i == nodeOccupancy - 1) { // go to the last pageId
-          currentPageNum = current -> pageNoArray[i + 1];
-          stack.push(currentPageNum);
-          bufMgr -> readPage(file, currentPageNum, currentPageData); // read next page
-          current = reinterpret_cast <NonLeafNodeInt*> (currentPageData);
-        }
-      }
-    }
-
-    // unpin pages
-    while (!stack.empty()) {
-      bufMgr -> unPinPage(file, stack.top(), false);
-      stack.pop();
-    }
-
-    for (int i = 0; i < nodeOccupancy; i++) {
-      if (lowValInt < current -> keyArray[i]) {
-        currentPageNum = current -> pageNoArray[i];
-        bufMgr -> readPage(file, currentPageNum, currentPageData); // read next page
-        leaf = reinterpret_cast <LeafNodeInt*> (currentPageData);
-        break;
-      }
-      if (i == nodeOccupancy - 1) { // go to the last pageId
-        currentPageNum = current -> pageNoArray[i + 1];
-        bufMgr -> readPage(file, currentPageNum, currentPageData); // read next page
-        leaf = reinterpret_cast <LeafNodeInt*> (currentPageData);
-      }
-    }
-
-    nextEntry = 0;
-    bool key_found = false;
-
-    while (!key_found) {
-      if (((lowOp == GT) && (leaf -> keyArray[nextEntry] > lowValInt)) || ((lowOp == GTE) && (leaf -> keyArray[nextEntry] >= lowValInt))) {
-        key_found = true;
-      }
-      nextEntry += 1;
-      if (nextEntry == leafOccupancy) {
-        //PageId prev = currentPageNum;
-        if ((int) leaf -> rightSibPageNo == -1) { // how to check whether a pageId is valid?
-          throw NoSuchKeyFoundException();
-        }
-        // currentPageNum = leaf -> rightSibPageNo;
-        // bufMgr -> unPinPage(file, prev, false); 
-        // bufMgr -> readPage(file, currentPageNum, currentPageData); // read next page
-        // leaf = reinterpret_cast <LeafNodeInt*> (currentPageData);
-        // nextEntry = 0;
-      }
-    }
-	// bufMgr -> unPinPage(file, currentPageNum, true); 
+	int key = LeafReader(leaf).key(nextEntry);
+	if ((highOp == LT && key >= highValInt) || (highOp == LTE && key > highValInt)) {
+		throw NoSuchKeyFoundException();
+	}
+	scanExecuting = true;
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::scanNext
+// BTreeSnapshot::scanNext
 // -----------------------------------------------------------------------------
 
-void BTreeIndex::scanNext(RecordId& outRid) 
+void BTreeSnapshot::scanNext(RecordId& outRid)
 {
-	if (!scanExecuting) { 
-		throw ScanNotInitializedException(); 
+	if (!scanExecuting) {
+		throw ScanNotInitializedException();
+	}
+	const LeafNodeInt* leaf = reinterpret_cast<const LeafNodeInt*>(&leafCopy);
+	while (nextEntry >= LeafReader(leaf).size()) {
+		if (leaf->rightSibPageNo == Page::INVALID_NUMBER) {
+			throw IndexScanCompletedException();
+		}
+		index->readSnapshotNode(this, leaf->rightSibPageNo, &leafCopy);
+		nextEntry = 0;
 	}
-	bufMgr->readPage(file, currentPageNum, currentPageData);
-	LeafNodeInt* leaf = reinterpret_cast<LeafNodeInt*> (currentPageData);
-	if (((highOp == LTE) && (leaf->keyArray[nextEntry] > highValInt)) || ((highOp == LT) && (leaf->keyArray[nextEntry] >= highValInt))) {
+
+	LeafReader entries(leaf);
+	int key = entries.key(nextEntry);
+	if ((highOp == LTE && key > highValInt) || (highOp == LT && key >= highValInt)) {
 		throw IndexScanCompletedException();
-	} else {
-		outRid = leaf->ridArray[nextEntry];
+	}
+	RecordId entry = entries.rid(nextEntry);
+	if (!isPosting(entry)) {
+		outRid = entry;
+		nextEntry += 1;
+		return;
+	}
+	if (postings.empty()) {
+		readPostings(entry.page_number, SIZE_MAX, postings);
+		nextPosting = 0;
+	}
+	outRid = postings[nextPosting];
+	nextPosting += 1;
+	if (nextPosting == postings.size()) {
+		postings.clear();
 		nextEntry += 1;
-		if (nextEntry == leafOccupancy) {
-			if ((int)leaf->rightSibPageNo == -1) {
-				throw IndexScanCompletedException();
-			} else {
-				PageId prev = currentPageNum;
-				currentPageNum = leaf -> rightSibPageNo;
-				bufMgr -> unPinPage(file, prev, false); 
-        		bufMgr -> readPage(file, currentPageNum, currentPageData); // read next page
-				nextEntry = 0;
-				}
-		}
 	}
 }
 
 // -----------------------------------------------------------------------------
-// BTreeIndex::endScan
+// BTreeSnapshot::endScan
 // -----------------------------------------------------------------------------
-//
-void BTreeIndex::endScan() 
+
+void BTreeSnapshot::endScan()
 {
-	if (!scanExecuting) { 
-		throw ScanNotInitializedException(); 
-	} 
+	if (!scanExecuting) {
+		throw ScanNotInitializedException();
+	}
 	scanExecuting = false;
-	bufMgr->unPinPage(file, currentPageNum, false);
-	currentPageData = nullptr;
-	currentPageNum = static_cast<PageId>(-1);
-  	nextEntry = -1;
+	nextEntry = -1;
+	postings.clear();
+}
+
+// -----------------------------------------------------------------------------
+// BTreeSnapshot::lookup
+// -----------------------------------------------------------------------------
+
+std::size_t BTreeSnapshot::lookup(const void* key, RecordId* out, const std::size_t max)
+{
+	int int_key = *(const int*)key;
+	std::size_t found = 0;
+
+	findLeaf(int_key);
+	const LeafNodeInt* leaf = reinterpret_cast<const LeafNodeInt*>(&leafCopy);
+	while (found < max){
+		LeafReader entries(leaf);
+		int i = entries.lowerBound(0, entries.size(), int_key);
+		for (; i < entries.size() && entries.key(i) == int_key && found < max; i++){
+			RecordId entry = entries.rid(i);
+			if (!isPosting(entry)){
+				out[found++] = entry;
+				continue;
+			}
+			std::vector<RecordId> rids;
+			readPostings(entry.page_number, max - found, rids);
+			std::copy(rids.begin(), rids.end(), out + found);
+			found += rids.size();
+		}
+		// duplicates may continue in the right sibling
+		if (i < entries.size() || int_key < leaf->highKey || leaf->rightSibPageNo == Page::INVALID_NUMBER){
+			break;
+		}
+		index->readSnapshotNode(this, leaf->rightSibPageNo, &leafCopy);
+	}
+	return found;
+}
+
+// -----------------------------------------------------------------------------
+// BTreeSnapshot::readPostings
+// -----------------------------------------------------------------------------
+
+void BTreeSnapshot::readPostings(const PageId head, const std::size_t max, std::vector<RecordId>& out)
+{
+	std::size_t start = out.size();
+	for (PageId pid = head; pid != Page::INVALID_NUMBER && out.size() - start < max; ){
+		index->readSnapshotNode(this, pid, &nodeCopy);
+		const PostingPageInt* list = reinterpret_cast<const PostingPageInt*>(&nodeCopy);
+		decodePostings(list, out);
+		pid = list->nextPageNo;
+	}
+	if (out.size() - start > max){
+		out.resize(start + max);
+	}
 }
 
 }
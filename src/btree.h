@@ -16,8 +16,16 @@
 #include "page.h"
 #include "file.h"
 #include "buffer.h"
+#include "latch.h"
+#include "wal.h"
+#include "memtable.h"
 
-#include <stack>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace badgerdb
 {
@@ -44,17 +52,115 @@ enum Operator
 };
 
 
+/**
+ * @brief Index open modes. Passed to the BTreeIndex constructor.
+ */
+enum IndexOpenMode
+{
+	READ_WRITE = 0,		/* Pages are pinned in and written through the buffer manager */
+	READ_ONLY_MMAP = 1	/* Existing index file is mapped read-only and nodes are read in place */
+};
+
+
+/**
+ * @brief Layouts of the entries of a leaf.
+ */
+enum LeafLayout
+{
+	LEAF_WIDE = 0,		/* Keys and record ids in keyArray and ridArray */
+	LEAF_PACKED = 1		/* Entries bit-packed into the bytes of keyArray and ridArray */
+};
+
+
+/**
+ * @brief Record id as stored in leaves: the page number and slot number of a RecordId in
+ * 6 bytes, without its padding. The page number is split into halves so that the array
+ * of them needs no more than 2-byte alignment. Converts to and from RecordId, so leaf
+ * entries are read and written as record ids.
+ */
+struct PackedRecordId {
+	PackedRecordId() {}
+
+	PackedRecordId(const RecordId& rid)
+		: pageLow(static_cast<std::uint16_t>(rid.page_number)),
+		  pageHigh(static_cast<std::uint16_t>(rid.page_number >> 16)),
+		  slot_number(rid.slot_number) {}
+
+	operator RecordId() const {
+		RecordId rid;
+		rid.page_number = pageLow | (static_cast<PageId>(pageHigh) << 16);
+		rid.slot_number = slot_number;
+		rid.padding = 0;
+		return rid;
+	}
+
+  /**
+   * Page number of the record id.
+   */
+	PageId pageNumber() const { return pageLow | (static_cast<PageId>(pageHigh) << 16); }
+
+  /**
+   * Low and high 16 bits of the page number.
+   */
+	std::uint16_t pageLow;
+	std::uint16_t pageHigh;
+
+  /**
+   * Slot number of the record id.
+   */
+	SlotId slot_number;
+};
+
+static_assert(sizeof(PackedRecordId) == 6, "Packed record id must take 6 bytes.");
+
 /**
  * @brief Number of key slots in B+Tree leaf for INTEGER key.
  */
-//                                                  sibling ptr             key               rid
-const  int INTARRAYLEAFSIZE = ( Page::SIZE - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( RecordId ) );
+//                                                    latch                    lsn              sibling ptrs             high key        stored          layout               key               rid
+const  int INTARRAYLEAFSIZE = ( Page::SIZE - sizeof( VersionLatch ) - sizeof( Lsn ) - 2*sizeof( PageId ) - sizeof( int ) - sizeof( int ) - sizeof( int ) ) / ( sizeof( int ) + sizeof( PackedRecordId ) );
+
+/**
+ * @brief Number of bytes of keyArray and ridArray of a leaf, which a packed leaf uses as one
+ * area.
+ */
+const  int LEAFDATASIZE = INTARRAYLEAFSIZE * ( sizeof( int ) + sizeof( PackedRecordId ) );
+
+/**
+ * @brief Largest number of entries of a leaf in any layout.
+ */
+const  int MAXLEAFENTRIES = 4 * INTARRAYLEAFSIZE;
 
 /**
  * @brief Number of key slots in B+Tree non-leaf for INTEGER key.
  */
-//                                                     level     extra pageNo                  key       pageNo
-const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - sizeof( int ) - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( PageId ) );
+//                                                       latch                    lsn             level     extra pageNo     extra count          sibling ptr          high key         buffer               stored                  key       pageNo         count
+const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - sizeof( VersionLatch ) - sizeof( Lsn ) - sizeof( int ) - sizeof( PageId ) - sizeof( int ) - sizeof( PageId ) - sizeof( int ) - sizeof( PageId ) - sizeof( int ) ) / ( sizeof( int ) + sizeof( PageId ) + sizeof( int ) );
+
+/**
+ * @brief Number of key slots used in a B+Tree non-leaf node for INTEGER key while inserts
+ * are buffered. A full message buffer then holds many messages for each child, so that
+ * every flush to a child moves a large batch.
+ */
+const  int INTBUFFEREDNONLEAFSIZE = 64;
+
+/**
+ * @brief Number of bytes of encoded record ids in a posting list page.
+ */
+//                                                  latch                    lsn          next and last page       stored, total, bytes        last rid
+const  int POSTINGDATASIZE = Page::SIZE - sizeof( VersionLatch ) - sizeof( Lsn ) - 2*sizeof( PageId ) - 3*sizeof( int ) - sizeof( RecordId );
+
+/**
+ * @brief Number of page numbers in a page of the shadow page list.
+ */
+//                                                  latch                    lsn          next page          stored
+const  int SHADOWLISTSIZE = ( Page::SIZE - sizeof( VersionLatch ) - sizeof( Lsn ) - sizeof( PageId ) - sizeof( int ) ) / sizeof( PageId );
+
+/**
+ * @brief Number of entries of one key in a leaf from which they are moved to a posting list
+ * while posting lists are on. From then on the key takes a single leaf entry, so the
+ * leaf splits no more for it, and its record ids are stored in a few bytes each.
+ */
+const  int POSTING_MIN_ENTRIES = 16;
 
 /**
  * @brief Structure to store a key-rid pair. It is used to pass the pair to functions that 
@@ -102,6 +208,78 @@ bool operator<( const RIDKeyPair<T>& r1, const RIDKeyPair<T>& r2 )
 		return r1.rid.page_number < r2.rid.page_number;
 }
 
+/**
+ * @brief Number of buckets in the histogram of IndexStatistics.
+ */
+const int STATS_HISTOGRAM_BUCKETS = 64;
+
+/**
+ * @brief Number of tree levels IndexStatistics reports on, from the leaves up.
+ */
+const int STATS_MAX_LEVELS = 8;
+
+/**
+ * @brief Statistics of an index, collected by BTreeIndex::analyze() and kept in the
+ * meta page. They describe the index as of that call and are not updated by inserts.
+ */
+struct IndexStatistics{
+  /**
+   * False if the index was never analyzed; the other members are then unset.
+   */
+	bool analyzed;
+
+  /**
+   * Number of entries.
+   */
+	std::uint64_t entries;
+
+  /**
+   * Number of distinct keys.
+   */
+	std::uint64_t distinctKeys;
+
+  /**
+   * Smallest and largest key; unset if there are no entries.
+   */
+	int minKey;
+	int maxKey;
+
+  /**
+   * Number of levels of the tree, leaves included.
+   */
+	int height;
+
+  /**
+   * Number of nodes at each level, leaves first. Levels above STATS_MAX_LEVELS are left out.
+   */
+	std::uint32_t levelNodes[ STATS_MAX_LEVELS ];
+
+  /**
+   * Fraction of the slots of the nodes at each level that are in use, leaves first: of the
+   * bytes for entries in leaves, of the child slots in non-leaf nodes (as many as they hold
+   * while inserts are buffered, if they are).
+   */
+	double levelFill[ STATS_MAX_LEVELS ];
+
+  /**
+   * Number of buckets of the histogram in use; fewer than STATS_HISTOGRAM_BUCKETS only if
+   * there are fewer entries.
+   */
+	int buckets;
+
+  /**
+   * Equi-depth histogram: the entries in key order are cut into buckets of (nearly) the
+   * same number of entries. Bucket b holds the entries after those of bucket b-1, up to
+   * and including entries with key bucketHigh[b]; a key may span several buckets.
+   */
+	int bucketHigh[ STATS_HISTOGRAM_BUCKETS ];
+
+  /**
+   * Number of entries in each bucket of the histogram.
+   */
+	std::uint64_t bucketEntries[ STATS_HISTOGRAM_BUCKETS ];
+};
+
 /**
  * @brief The meta page, which holds metadata for Index file, is always first page of the btree index file and is cast
  * to the following structure to store or retrieve information from it.
@@ -130,6 +308,31 @@ struct IndexMetaInfo{
    * Page number of root page of the B+ Tree inside the file index file.
    */
 	PageId rootPageNo;
+
+  /**
+   * True if inserts go through the message buffers of the non-leaf nodes.
+   */
+	bool insertsBuffered;
+
+  /**
+   * True if the non-leaf nodes keep the number of entries under each child up to date.
+   */
+	bool subtreeCounts;
+
+  /**
+   * True if the entries of a key with many duplicates in a leaf go to a posting list.
+   */
+	bool postingLists;
+
+  /**
+   * Statistics stored by the last BTreeIndex::analyze().
+   */
+	IndexStatistics statistics;
+
+  /**
+   * First page of the list of shadow pages.
+   */
+	PageId shadowListPageNo;
 };
 
 /*
@@ -143,6 +346,18 @@ at this level are just above the leaf nodes. Otherwise set to 0.
  * @brief Structure for all non-leaf nodes when the key is of INTEGER type.
 */
 struct NonLeafNodeInt{
+  /**
+   * Version latch guarding the node. Never held while the page is unpinned, so the
+   * copy on disk is always unlocked.
+   */
+	VersionLatch latch;
+
+  /**
+   * Commit LSN of the last logged change to the node. Recovery skips records the
+   * node already reflects.
+   */
+	Lsn lsn;
+
   /**
    * Level of the node in the tree.
    */
@@ -158,6 +373,32 @@ struct NonLeafNodeInt{
    */
 	PageId pageNoArray[ INTARRAYNONLEAFSIZE + 1 ];
 
+  /**
+   * Number of entries under each child in pageNoArray, including those in nodes split off
+   * the child whose separator is not in this node yet. Only kept up to date while the
+   * index has subtree counts turned on.
+   */
+	int countArray[ INTARRAYNONLEAFSIZE + 1 ];
+
+  /**
+   * Page number of the node on the right side at the same level, or Page::INVALID_NUMBER
+   * for the rightmost node. A search that arrives after the node was split follows this link.
+   */
+	PageId rightSibPageNo;
+
+  /**
+   * Separator the node was split at. Keys >= highKey are inserted into the right sibling.
+   * Unused while rightSibPageNo is Page::INVALID_NUMBER.
+   */
+	int highKey;
+
+  /**
+   * Page holding the message buffer of the node, or Page::INVALID_NUMBER if it has none.
+   * The buffer is laid out like a leaf: the entries inserted into the subtree of the node
+   * that have not been flushed to its children yet, in key order.
+   */
+	PageId bufferPageNo;
+
   /**
    * stores the number of keys currently in this node
    */
@@ -169,15 +410,39 @@ struct NonLeafNodeInt{
  * @brief Structure for all leaf nodes when the key is of INTEGER type.
 */
 struct LeafNodeInt{
+  /**
+   * Version latch guarding the node. Never held while the page is unpinned, so the
+   * copy on disk is always unlocked.
+   */
+	VersionLatch latch;
+
+  /**
+   * Commit LSN of the last logged change to the leaf. Recovery skips records the
+   * leaf already reflects.
+   */
+	Lsn lsn;
+
   /**
    * Stores keys.
    */
 	int keyArray[ INTARRAYLEAFSIZE ];
 
   /**
-   * Stores RecordIds.
+   * Stores RecordIds, packed.
    */
-	RecordId ridArray[ INTARRAYLEAFSIZE ];
+	PackedRecordId ridArray[ INTARRAYLEAFSIZE ];
+
+  /**
+   * LEAF_WIDE, or LEAF_PACKED if the leaf holds more entries than keyArray does. A packed
+   * leaf starts the bytes of keyArray and ridArray with the smallest key and page number
+   * of its entries and the number of bits of each field, followed by the entries in as
+   * few whole bytes each as the fields take: the key and the page number less the
+   * smallest ones, and the slot number. Searches compare keys as they are stored. The
+   * page numbers of posting lists, which are far from those of records, are kept at the
+   * end of the bytes, and an entry for a posting list holds the index of its page number
+   * there instead. Message buffers are always wide.
+   */
+	int layout;
 
   /**
    * Page number of the leaf on the right side.
@@ -185,212 +450,1588 @@ struct LeafNodeInt{
    */
 	PageId rightSibPageNo;
 
+  /**
+   * Page number of the leaf on the left side, for backward scans. Set when that leaf
+   * splits, in the same step as its right link, so it may only lag behind after a split
+   * of the left leaf by pointing further left.
+   */
+	PageId leftSibPageNo;
+
+  /**
+   * Separator the leaf was split at. Keys >= highKey are inserted into the right sibling.
+   * Unused while rightSibPageNo is Page::INVALID_NUMBER.
+   */
+	int highKey;
+
   /**
    * stores the number of keys currently in this leaf
    */
   int stored = 0;
 };
 
-
 /**
- * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
- * relation. This index supports only one scan at a time.
+ * @brief Page of a posting list. A leaf entry whose record id has slot Page::INVALID_SLOT
+ * stands for all the entries of its key in a posting list starting at the page numbered
+ * by the record id; record ids of records never have that slot. The pages of a list hold
+ * the record ids in order of page and slot number, each page in order from its first
+ * byte: the difference of the page number to the one before (to 0 for the first one of a
+ * page), then the slot number, or, if the page number is the same, 0 and the difference
+ * of the slot number, all as varints. A list is changed only with the leaf holding its
+ * entry latched.
 */
-class BTreeIndex {
-
- private:
-
+struct PostingPageInt{
   /**
-   * File object for the index file.
+   * Version latch guarding the page, as in the nodes.
    */
-	File		*file;
+	VersionLatch latch;
 
   /**
-   * Buffer Manager Instance.
+   * Commit LSN of the last logged change to the page.
    */
-	BufMgr	*bufMgr;
+	Lsn lsn;
 
   /**
-   * Page number of meta page.
+   * Page number of the next page of the list, or Page::INVALID_NUMBER for the last one.
    */
-	PageId	headerPageNum;
+	PageId nextPageNo;
 
   /**
-   * page number of root page of B+ tree inside index file.
+   * Page number of the last page of the list. Kept in the first page only.
    */
-	PageId	rootPageNum;
+	PageId lastPageNo;
 
   /**
-   * Datatype of attribute over which index is built.
+   * Number of record ids in this page.
    */
-	Datatype	attributeType;
+	int stored;
 
   /**
-   * Offset of attribute, over which index is built, inside records. 
+   * Number of record ids in the whole list. Kept in the first page only.
    */
-	int 		attrByteOffset;
+	int total;
 
   /**
-   * Number of keys in leaf node, depending upon the type of key.
+   * Number of bytes of data in use.
    */
-	int			leafOccupancy;
+	int bytes;
 
   /**
-   * Number of keys in non-leaf node, depending upon the type of key.
+   * Last record id in this page, so that larger ones are appended without decoding it.
+   * Unused while stored is 0.
    */
-	int			nodeOccupancy;
-
-
-	// MEMBERS SPECIFIC TO SCANNING
+	RecordId lastRid;
 
   /**
-   * True if an index scan has been started.
+   * Encoded record ids.
    */
-	bool		scanExecuting;
+	unsigned char data[ POSTINGDATASIZE ];
+};
 
+/**
+ * @brief Page of the list of every shadow page in the index file. Snapshots do not outlive
+ * the index object, so all of them are free again once the file is opened; until then
+ * BTreeIndex::preserve() and the allocation of new nodes draw on them. The list starts at
+ * a page made with the file and grows by pages linked at its end. It is only changed
+ * under BTreeIndex::snapMutex.
+*/
+struct ShadowListPageInt{
   /**
-   * Index of next entry to be scanned in current leaf being scanned.
+   * Version latch, as in the nodes; unused.
    */
-	int			nextEntry;
+	VersionLatch latch;
 
   /**
-   * Page number of current page being scanned.
+   * Commit LSN of the last logged change to the page.
    */
-	PageId	currentPageNum;
+	Lsn lsn;
 
   /**
-   * Current Page being scanned.
+   * Page number of the next page of the list, or Page::INVALID_NUMBER for the last one.
    */
-	Page		*currentPageData;
+	PageId nextPageNo;
 
   /**
-   * Low INTEGER value for scan.
+   * Number of page numbers in this page.
    */
-	int			lowValInt;
+	int stored;
 
   /**
-   * Low DOUBLE value for scan.
+   * Page numbers of shadow pages, in no particular order.
    */
-	double	lowValDouble;
+	PageId pageNoArray[ SHADOWLISTSIZE ];
+};
 
-  /**
-   * Low STRING value for scan.
-   */
-	std::string	lowValString;
+static_assert(sizeof(NonLeafNodeInt) <= Page::SIZE, "Non-leaf node must fit in a page.");
+static_assert(sizeof(LeafNodeInt) <= Page::SIZE, "Leaf node must fit in a page.");
+static_assert(sizeof(PostingPageInt) <= Page::SIZE, "Posting list page must fit in a page.");
+static_assert(sizeof(ShadowListPageInt) <= Page::SIZE, "Shadow list page must fit in a page.");
+static_assert(sizeof(IndexMetaInfo) <= Page::SIZE, "Meta page must fit in a page.");
 
+/**
+ * @brief One interval of BTreeIndex::startMultiRangeScan(), given like the arguments of
+ * BTreeIndex::startScan().
+*/
+struct ScanRange{
   /**
-   * High INTEGER value for scan.
+   * Low value of the range, pointer to integer / double / char string.
    */
-	int			highValInt;
+	const void* lowVal;
 
   /**
-   * High DOUBLE value for scan.
+   * Low operator (GT/GTE).
    */
-	double	highValDouble;
+	Operator lowOp;
 
   /**
-   * High STRING value for scan.
-   */
-	std::string highValString;
-	
-  /**
-   * Low Operator. Can only be GT(>) or GTE(>=).
+   * High value of the range, pointer to integer / double / char string.
    */
-	Operator	lowOp;
+	const void* highVal;
 
   /**
-   * High Operator. Can only be LT(<) or LTE(<=).
+   * High operator (LT/LTE).
    */
-	Operator	highOp;
+	Operator highOp;
+};
 
+/**
+ * @brief Run of the sorted keys of BTreeIndex::lookupBatch() that descends through the
+ * same node.
+*/
+struct BatchRange{
   /**
-   * stores the height of the tree
-   */
-  int height; 
-  /**
-   * stores parent nodes when traversing the tree during insert
+   * Page number of the node the keys are at.
    */
-  std::stack<NonLeafNodeInt*> node_stack;
+	PageId pageNo;
+
   /**
-   * stores parent nodes pid when traversing the tree during insert
-   * used for unpinning
+   * Index of the first key of the run.
    */
-  std::stack<PageId> pid_stack;
-
-	
- public:
+	std::size_t first;
 
   /**
-   * BTreeIndex Constructor. 
-	 * Check to see if the corresponding index file exists. If so, open the file.
-	 * If not, create it and insert entries for every tuple in the base relation using FileScan class.
-   *
-   * @param relationName        Name of file.
-   * @param outIndexName        Return the name of index file.
-   * @param bufMgrIn						Buffer Manager Instance
-   * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
-   * @param attrType						Datatype of attribute over which index is built
+   * Index past the last key of the run.
    */
-	BTreeIndex(const std::string & relationName, std::string & outIndexName,
-						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType);
-	
+	std::size_t last;
+};
 
-  /**
-   * BTreeIndex Destructor. 
-	 * End any initialized scan, flush index file, after unpinning any pinned pages, from the buffer manager
-	 * and delete file instance thereby closing the index file.
-	 * Destructor should not throw any exceptions. All exceptions should be caught in here itself. 
-	 * */
-	~BTreeIndex();
 
+class BTreeIndex;
 
+/**
+ * @brief Read-only view of a BTreeIndex as it was when BTreeIndex::snapshot() returned.
+ * Inserts into the index go on unhindered: before a node is first changed after the
+ * snapshot was taken, its old version is copied to a shadow page of the index file, and
+ * the snapshot reads the shadow instead. Shadow pages are reused, for shadows or new
+ * nodes, once every snapshot that needs them has been deleted. Like the index, a
+ * snapshot supports one scan at a time; separate snapshots can be used from separate
+ * threads.
+*/
+class BTreeSnapshot {
+ public:
   /**
-	 * Insert a new entry using the pair <value,rid>. 
-	 * Start from root to recursively find out the leaf to insert the entry in. The insertion may cause splitting of leaf node.
-	 * This splitting will require addition of new leaf page number entry into the parent non-leaf, which may in-turn get split.
-	 * This may continue all the way upto the root causing the root to get split. If root gets split, metapage needs to be changed accordingly.
-	 * Make sure to unpin pages as soon as you can.
-   * @param key			Key to insert, pointer to integer/double/char string
-   * @param rid			Record ID of a record whose entry is getting inserted into the index.
-	**/
-	void insertEntry(const void* key, const RecordId rid);
-
+   * Close the snapshot and release the shadow pages only it needed. Must be deleted
+   * before the index it was taken of.
+   */
+	~BTreeSnapshot();
 
-  void insert_internal(int key, PageId new_child_pid);
+	BTreeSnapshot(const BTreeSnapshot&) = delete;
+	BTreeSnapshot& operator=(const BTreeSnapshot&) = delete;
 
   /**
-	 * Begin a filtered scan of the index.  For instance, if the method is called 
-	 * using ("a",GT,"d",LTE) then we should seek all entries with a value 
-	 * greater than "a" and less than or equal to "d".
-	 * If another scan is already executing, that needs to be ended here.
-	 * Set up all the variables for scan. Start from root to find out the leaf page that contains the first RecordID
-	 * that satisfies the scan parameters. Keep that page pinned in the buffer pool.
+	 * Begin a filtered scan of the snapshot, like BTreeIndex::startScan().
    * @param lowVal	Low value of range, pointer to integer / double / char string
    * @param lowOp		Low operator (GT/GTE)
    * @param highVal	High value of range, pointer to integer / double / char string
    * @param highOp	High operator (LT/LTE)
    * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values 
    * @throws  BadScanrangeException If lowVal > highval
-	 * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that satisfies the scan criteria.
+	 * @throws  NoSuchKeyFoundException If there is no key in the snapshot that satisfies the scan criteria.
 	**/
 	void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
 
-
   /**
-	 * Fetch the record id of the next index entry that matches the scan.
-	 * Return the next record from current page being scanned. If current page has been scanned to its entirety, move on to the right sibling of current page, if any exists, to start scanning that page. Make sure to unpin any pages that are no longer required.
+	 * Fetch the record id of the next entry that matches the scan.
    * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
 	 * @throws ScanNotInitializedException If no scan has been initialized.
 	 * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
 	**/
-	void scanNext(RecordId& outRid);  // returned record id
-
+	void scanNext(RecordId& outRid);
 
   /**
-	 * Terminate the current scan. Unpin any pinned pages. Reset scan specific variables.
+	 * Terminate the current scan.
 	 * @throws ScanNotInitializedException If no scan has been initialized.
 	**/
 	void endScan();
+
+  /**
+	 * Find the record ids of the entries with the given key, like BTreeIndex::lookup().
+   * @param key			Key to look up, pointer to integer/double/char string
+   * @param out			Array receiving up to max record ids
+   * @param max			Capacity of out
+   * @return				Number of record ids stored in out
+	**/
+	std::size_t lookup(const void* key, RecordId* out, const std::size_t max);
+
+ private:
+	friend class BTreeIndex;
+
+	BTreeSnapshot(BTreeIndex* index, const PageId rootPageNo);
+
+  /**
+   * Copy the leaf of the snapshot whose key range holds key into leafCopy, searching
+   * like BTreeIndex::lookup().
+   */
+	void findLeaf(const int key);
+
+  /**
+   * Append the record ids of a posting list, as the snapshot sees it, to out.
+   *
+   * @param head		First page of the list
+   * @param max			Number of record ids to read at most
+   * @param out			Receives the record ids
+   */
+	void readPostings(const PageId head, const std::size_t max, std::vector<RecordId>& out);
+
+  /**
+   * Index the snapshot was taken of.
+   */
+	BTreeIndex* index;
+
+  /**
+   * Root page of the index when the snapshot was taken.
+   */
+	PageId rootPageNo;
+
+  /**
+   * Page number of every node changed since the snapshot was taken, mapped to the
+   * shadow page holding its version as of the snapshot. Guarded by the index's snapMutex.
+   */
+	std::unordered_map<PageId, PageId> shadows;
+
+  /**
+   * True if a scan has been started.
+   */
+	bool scanExecuting;
+
+  /**
+   * Index of next entry to be scanned in leafCopy.
+   */
+	int nextEntry;
+
+  /**
+   * Record ids of the posting list of the entry at nextEntry while the scan is in it,
+   * else empty.
+   */
+	std::vector<RecordId> postings;
+
+  /**
+   * Index of next record id to be scanned in postings.
+   */
+	std::size_t nextPosting;
+
+  /**
+   * Bounds and operators of the scan.
+   */
+	int lowValInt;
+	int highValInt;
+	Operator lowOp;
+	Operator highOp;
+
+  /**
+   * Copy of the non-leaf node being descended through.
+   */
+	Page nodeCopy;
+
+  /**
+   * Copy of the leaf being scanned or searched.
+   */
+	Page leafCopy;
+};
+
+
+/**
+ * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
+ * relation. This index supports only one scan at a time.
+ *
+ * insertEntry() and lookup() may be called from several threads at once. Every node
+ * carries a VersionLatch; readers check that the version of a node they read did not
+ * change instead of latching it, and writers latch only the nodes they modify. Nodes at
+ * each level are linked left to right and carry the key they were split at (B-link tree,
+ * after Lehman and Yao), so a search that reaches a node after it was split moves right
+ * instead of restarting, and a split latches only one level at a time. Non-leaf nodes
+ * are held in the buffer pool (BufMgr::holdPage()) as descents first reach them, while
+ * there is room, so that a descent writes no shared cache line until it pins the leaf.
+ *
+ * If the buffer manager has a write-ahead log attached, every change is logged while the
+ * nodes it touches are latched: an insert into a leaf as a small record, a split of one
+ * level as images of the nodes involved. Each unit is atomic on recovery; splits that
+ * were committed at a lower level but not yet at the level above are harmless, since
+ * the B-link right links keep the new nodes reachable.
+ *
+ * snapshot() returns a consistent read-only view for long scans; see BTreeSnapshot.
+ *
+ * For write-heavy workloads setInsertBuffering() turns on buffered inserts (B-epsilon
+ * tree style): an insert only adds a message to the buffer of the root, and a full buffer
+ * is flushed to the child it holds the most messages for, so that every leaf write takes
+ * in a batch of entries. Lookups and scans merge the buffers on the way to a leaf with
+ * the leaf. Buffered inserts run one at a time and hold off reads while they flush.
+ *
+ * setMemtableSize() puts a MemTable in front of the tree instead (LSM style): inserts
+ * only add to the sorted in-memory table, and once it is full its entries are merged into
+ * the tree in one left-to-right pass that rewrites each leaf they belong to once. Lookups
+ * and scans merge the memtable with the leaves.
+ *
+ * setSubtreeCounts() makes every non-leaf node keep the number of entries under each of
+ * its children, so that countRange(), rank() and select() read one node per level
+ * instead of walking the leaves. Inserts then run one at a time, since each one adds to
+ * the counts along its whole path.
+ *
+ * setPostingLists() is for keys with many duplicates: once a key has many entries in a
+ * leaf, they are replaced by a single entry pointing to a posting list that holds their
+ * record ids, sorted and delta-encoded in pages of their own (see PostingPageInt). Such
+ * a key then takes a few bytes per entry instead of a whole leaf slot, and its entries
+ * are read off contiguous pages.
+*/
+class BTreeIndex {
+	friend class BTreeSnapshot;
+
+ private:
+
+  /**
+   * File object for the index file.
+   */
+	BlobFile	*file;
+
+  /**
+   * Mode the index file was opened in. In READ_ONLY_MMAP mode nodes are read
+   * straight out of the file mapping and the buffer manager is never used.
+   */
+	IndexOpenMode	openMode;
+
+  /**
+   * Buffer Manager Instance.
+   */
+	BufMgr	*bufMgr;
+
+  /**
+   * Write-ahead log of the buffer manager, or NULL if changes are not logged.
+   */
+	LogManager	*log;
+
+  /**
+   * Commit LSN of the latest change made through this object; sync() makes the log
+   * durable up to it.
+   */
+	std::atomic<Lsn>	lastLsn;
+
+  /**
+   * Page number of meta page.
+   */
+	PageId	headerPageNum;
+
+  /**
+   * page number of root page of B+ tree inside index file.
+   */
+	std::atomic<PageId>	rootPageNum;
+
+  /**
+   * Datatype of attribute over which index is built.
+   */
+	Datatype	attributeType;
+
+  /**
+   * Offset of attribute, over which index is built, inside records. 
+   */
+	int 		attrByteOffset;
+
+  /**
+   * Number of keys in a wide leaf node, depending upon the type of key.
+   */
+	int			leafOccupancy;
+
+  /**
+   * Number of keys in non-leaf node, depending upon the type of key.
+   */
+	int			nodeOccupancy;
+
+
+	// MEMBERS SPECIFIC TO SCANNING
+
+  /**
+   * True if an index scan has been started.
+   */
+	bool		scanExecuting;
+
+  /**
+   * Index of next entry to be scanned in current leaf being scanned. In a backward scan,
+   * the index after it.
+   */
+	int			nextEntry;
+
+  /**
+   * True if the scan runs backwards, from the high bound down.
+   */
+	bool		scanReverse;
+
+  /**
+   * Page number of current page being scanned.
+   */
+	PageId	currentPageNum;
+
+  /**
+   * Current Page being scanned. In READ_WRITE mode this is scanLeaf.
+   */
+	ReadPageGuard	currentPageData;
+
+  /**
+   * Consistent copy of the leaf being scanned, so that concurrent inserts cannot
+   * shift entries under the scan.
+   */
+	LeafNodeInt	scanLeaf;
+
+  /**
+   * Messages still buffered above the leaf being scanned, and memtable entries, that
+   * belong to it, in key order. Merged with the entries of the leaf; empty unless inserts
+   * are buffered or go to a memtable.
+   */
+	std::vector<RIDKeyPair<int> >	scanMessages;
+
+  /**
+   * Index of next message to be scanned in scanMessages. In a backward scan, the index
+   * after it.
+   */
+	std::size_t	nextMessage;
+
+  /**
+   * Record ids of the posting list of the leaf entry being scanned while the scan is in
+   * the middle of it, else empty.
+   */
+	std::vector<RecordId>	scanPostings;
+
+  /**
+   * Index of next record id to be scanned in scanPostings. In a backward scan, the index
+   * after it.
+   */
+	std::size_t	nextPosting;
+
+  /**
+   * Low INTEGER value for scan.
+   */
+	int			lowValInt;
+
+  /**
+   * Low DOUBLE value for scan.
+   */
+	double	lowValDouble;
+
+  /**
+   * Low STRING value for scan.
+   */
+	std::string	lowValString;
+
+  /**
+   * High INTEGER value for scan.
+   */
+	int			highValInt;
+
+  /**
+   * High DOUBLE value for scan.
+   */
+	double	highValDouble;
+
+  /**
+   * High STRING value for scan.
+   */
+	std::string highValString;
+	
+  /**
+   * Low Operator. Can only be GT(>) or GTE(>=).
+   */
+	Operator	lowOp;
+
+  /**
+   * High Operator. Can only be LT(<) or LTE(<=).
+   */
+	Operator	highOp;
+
+  /**
+   * Ranges of a multi-range scan as inclusive bounds, sorted and disjoint. The scan is
+   * in the range before nextRange; empty for a single range scan.
+   */
+	std::vector<std::pair<int, int> >	scanRanges;
+
+  /**
+   * Index in scanRanges of the range the scan moves on to next.
+   */
+	std::size_t	nextRange;
+
+  /**
+   * Move the scan forward to the next entry within the scan ranges, leaving it there.
+   *
+   * @return	False if there is none
+   */
+	bool nextInRange();
+
+  /**
+   * Move a backward scan to the next entry, if it is within the scan range.
+   *
+   * @return	False if there is none
+   */
+	bool prevInRange();
+
+  /**
+   * Read a leaf for a backward scan like readScanLeaf(), with the buffered messages and
+   * memtable entries of its whole key range.
+   *
+   * @param pageNo	Page number of the leaf
+   * @return				Guard holding the leaf or its copy
+   */
+	ReadPageGuard readBackwardScanLeaf(const PageId pageNo);
+
+  /**
+   * Find the leaf whose right link points at a given leaf, starting from a leaf left of
+   * it: leaves split off since the left link was set lie in between.
+   *
+   * @param left		Page number of a leaf left of the given one
+   * @param pageNo	Page number of the given leaf
+   * @return				Page number of its left neighbour
+   */
+	PageId leftNeighbour(PageId left, const PageId pageNo);
+
+  /**
+   * Move the scan forward to the first entry >= low: within the current leaf, through
+   * the right link if low is in the next leaf, else by a new descent.
+   *
+   * @param low		Key to move to
+   */
+	void seekScan(const int low);
+
+  /**
+   * stores the height of the tree
+   */
+  std::atomic<int> height; 
+
+	// MEMBERS SPECIFIC TO SNAPSHOTS
+
+  /**
+   * Held shared by every insert step from before it latches its first node until it
+   * has released its nodes, and exclusively by snapshot(), so that a snapshot is taken
+   * between changes and every change after it preserves the old node first.
+   */
+	SharedLatch	snapLatch;
+
+  /**
+   * Guards snapshots, the shadow maps of the snapshots, shadowRefs, freeShadows and the
+   * shadow page list.
+   */
+	std::mutex	snapMutex;
+
+  /**
+   * Open snapshots, oldest first.
+   */
+	std::vector<BTreeSnapshot*>	snapshots;
+
+  /**
+   * Number of open snapshots; only changed with snapLatch held exclusively or under
+   * snapMutex, so inserts can skip preserve() work cheaply when it is zero.
+   */
+	std::atomic<int>	openSnapshots;
+
+  /**
+   * Number of open snapshots using each shadow page.
+   */
+	std::unordered_map<PageId, int>	shadowRefs;
+
+  /**
+   * Shadow pages no snapshot uses, ready for reuse.
+   */
+	std::vector<PageId>	freeShadows;
+
+  /**
+   * Pages of the shadow page list, in list order.
+   */
+	std::vector<PageId>	shadowListPages;
+
+  /**
+   * Page of the shadow page list holding each shadow page.
+   */
+	std::unordered_map<PageId, PageId>	shadowListOf;
+
+	// MEMBERS SPECIFIC TO BUFFERED INSERTS
+
+  /**
+   * True while inserts are buffered; mirrors the meta page.
+   */
+	bool	insertsBuffered;
+
+  /**
+   * Number of keys in a non-leaf node while inserts are buffered.
+   */
+	int	bufferedNodeOccupancy;
+
+  /**
+   * Held exclusively by buffered inserts and memtable merges, which move entries between
+   * pages in several steps, and by inserts with subtree counts. Shared by memtable inserts,
+   * by lookups and scans of an index with buffered inserts or a memtable, and by readers
+   * of subtree counts.
+   */
+	SharedLatch	bufferLatch;
+
+	// MEMBERS SPECIFIC TO THE LOOKUP HASH
+
+  /**
+   * True while leafHash is kept up to date; see setLookupHash().
+   */
+	bool	hashedLookups;
+
+  /**
+   * For every key in the leaves, the leftmost leaf it is in, or a leaf to the left of
+   * that one. Lookups start there instead of descending from the root.
+   */
+	std::unordered_map<int, PageId>	leafHash;
+
+  /**
+   * Shared by lookups reading leafHash, held exclusively while it changes.
+   */
+	SharedLatch	leafHashLatch;
+
+  /**
+   * Record in leafHash that the keys in [from, to) of a leaf are in it. Called by writers
+   * with the leaf latched, after they put the keys there. Does nothing unless hashed
+   * lookups are on.
+   *
+   * @param pageNo	Page number of the leaf
+   * @param leaf		The leaf
+   * @param from		Index of the first key to record
+   * @param to			Index past the last key to record
+   */
+	void hashLeafKeys(const PageId pageNo, const LeafNodeInt* leaf, const int from, const int to);
+
+	// MEMBERS SPECIFIC TO THE MEMTABLE
+
+  /**
+   * Entries inserted but not yet merged into the tree, or NULL if inserts go to the tree.
+   */
+	MemTable*	memtable;
+
+  /**
+   * Guards the contents of memtable while bufferLatch is only held shared.
+   */
+	std::mutex	memtableMutex;
+
+  /**
+   * Add an entry to the memtable, merging the memtable into the tree once it is full.
+   *
+   * @param key			Key of the entry
+   * @param rid			Record id of the entry
+   */
+	void insertMemtable(const int key, const RecordId rid);
+
+  /**
+   * Merge every memtable entry into the leaves, in key order: each leaf that gets entries
+   * is rewritten once, split into as many evenly filled leaves as needed. Caller holds
+   * bufferLatch exclusively.
+   */
+	void mergeMemtableEntries();
+
+  /**
+   * Merge the memtable entries with keys in [low, high) into out, which is in key order.
+   * Caller holds bufferLatch.
+   *
+   * @param low			Smallest key to collect
+   * @param high		Keys from high on are left out
+   * @param bounded	False to leave out no keys from low on
+   * @param out			Entries to merge with
+   */
+	void collectMemtable(const int low, const int high, const bool bounded, std::vector<RIDKeyPair<int> >& out);
+
+	// MEMBERS SPECIFIC TO SUBTREE COUNTS
+
+  /**
+   * True while the non-leaf nodes keep subtree counts; mirrors the meta page.
+   */
+	bool	subtreeCounts;
+
+  /**
+   * Add an entry to the tree and count it in every node above its leaf. Inserts with
+   * subtree counts run one at a time, under bufferLatch held exclusively.
+   *
+   * @param key			Key of the entry
+   * @param rid			Record id of the entry
+   */
+	void insertCounted(const int key, const RecordId rid);
+
+  /**
+   * Descend from the root to the leaf an insert of key goes to, like findNode(), and
+   * record the child followed at each non-leaf node. Caller holds bufferLatch exclusively.
+   *
+   * @param key				Key to insert
+   * @param path			Receives the non-leaf nodes passed through, root first
+   * @param slots			Receives the index of the child followed in each node of path
+   * @return					Page number of the leaf
+   */
+	PageId countedPath(const int key, std::vector<PageId>& path, std::vector<int>& slots);
+
+  /**
+   * Log a unit together with the counts of a path: add delta to the count of the child
+   * followed at each node of the path, and log the changed nodes with the pages of the
+   * unit. Routing does not read counts and readers of counts hold bufferLatch, so the
+   * nodes of the path are not latched.
+   *
+   * @param unit			Records describing the changes to pages
+   * @param pages			Guards of the changed pages
+   * @param numPages	Number of guards in pages
+   * @param images		True to log images of pages, as logImages() does
+   * @param path			Non-leaf nodes from countedPath()
+   * @param slots			Child followed in each node of path
+   * @param delta			Number of entries added under the path
+   */
+	void logCounted(LogUnit& unit, WritePageGuard* const* pages, const int numPages, const bool images,
+		const std::vector<PageId>& path, const std::vector<int>& slots, const int delta);
+
+  /**
+   * Recompute the counts of a non-leaf node and of every non-leaf node below it.
+   *
+   * @param pageNo		Page number of the node
+   * @return					Number of entries under the node
+   */
+	int recount(const PageId pageNo);
+
+  /**
+   * Number of entries with keys below key, or up to key if inclusive. Reads one node per
+   * level with subtree counts, and walks the leaves without them.
+   *
+   * @param key				Key to count up to
+   * @param inclusive	True to count entries equal to key too
+   */
+	std::size_t countBelow(const int key, const bool inclusive);
+
+  /**
+   * Find the entry at a position in key order, as select() does. Caller holds bufferLatch
+   * shared.
+   *
+   * @param position	Position of the entry
+   * @param outKey		Receives the key of the entry
+   * @param outRid		Receives the record id of the entry
+   * @throws  NoSuchKeyFoundException If the index holds no more than position entries
+   */
+	void selectEntry(const std::size_t position, int& outKey, RecordId& outRid);
+
+  /**
+   * Merge the memtable and flush the message buffers into the leaves, so that the
+   * leaves and the counts above them hold every entry.
+   */
+	void settleEntries();
+
+	// MEMBERS SPECIFIC TO SAMPLING
+
+  /**
+   * Seed of the next sampling call. Each call takes its own, so that concurrent calls
+   * draw different samples and a run of the same calls is repeatable.
+   */
+	std::atomic<std::uint64_t>	sampleSeed;
+
+  /**
+   * Length of the longest posting list a descent or an insert has seen since the index
+   * was opened; descents accept an entry with a probability of its length over this.
+   */
+	std::atomic<std::size_t>	longestPosting;
+
+  /**
+   * Draw one entry with a key in [low, high] by a random descent from a node (after Olken
+   * and Rotem). Each node picks one of nodeOccupancy + 1 child slots and each leaf one of
+   * MAXLEAFENTRIES entry slots at random, and the descent is rejected when it picks an
+   * unused slot, a child outside the range or a key outside it. Every entry in the range
+   * is then drawn with the same probability, whatever the fill of the nodes on its path.
+   * The node itself picks among its children in the range only, so it has to be the same
+   * for every draw. An entry is then kept with a probability of entrySize() over bound,
+   * and a posting list entry gives a record id of its list picked at random, so that
+   * every record id of a list is as likely as any other entry.
+   *
+   * @param pageNo		Page number of the non-leaf node to start from
+   * @param low				Smallest key to draw
+   * @param high			Largest key to draw
+   * @param random		State of the random generator
+   * @param bound			Length of the longest posting list known; raised, and the descent
+   *									rejected, if it picks a longer one
+   * @param outKey		Receives the key of the entry drawn
+   * @param outRid		Receives the record id of the entry drawn
+   * @return					False if the descent was rejected
+   */
+	bool sampleDescent(const PageId pageNo, const int low, const int high, std::uint64_t& random,
+		std::size_t& bound, int& outKey, RecordId& outRid);
+
+  /**
+   * Append the entries with keys in [low, high] to keys and rids, walking the leaves.
+   *
+   * @param low				Smallest key to collect
+   * @param high			Largest key to collect
+   * @param keys			Receives the keys
+   * @param rids			Receives the record ids
+   */
+	void collectRange(const int low, const int high, std::vector<int>& keys, std::vector<RecordId>& rids);
+
+	// MEMBERS SPECIFIC TO POSTING LISTS
+
+  /**
+   * True while keys with many entries in a leaf get posting lists; mirrors the meta page.
+   */
+	bool	postingLists;
+
+  /**
+   * Move the entries [from, to) of a write-latched leaf, which all have the same key, into
+   * its posting list for the key, together with rid if not NULL, and log the change. The
+   * list is created if none of the entries is one. Adding a single record id that fits
+   * into its page is logged as a small record, anything else as images. Does nothing if
+   * a new list would widen the fields of a packed leaf so far that its entries no longer
+   * fit.
+   *
+   * @param leafPage	Guard of the leaf, preserved already
+   * @param from			Index of the first entry
+   * @param to				Index past the last entry
+   * @param rid				Record id of a new entry to add, or NULL
+   * @param path			Nodes from countedPath() to count the new entry in, or NULL
+   * @param slots			Child followed in each node of path, or NULL
+   * @return					False if nothing was done
+   */
+	bool foldPostings(WritePageGuard& leafPage, const int from, const int to, const RecordId* rid,
+		const std::vector<PageId>* path, const std::vector<int>* slots);
+
+  /**
+   * Give every key with enough entries in a leaf a posting list, as inserts do when they
+   * reach that number.
+   *
+   * @param pageNo		Page number of the leaf
+   */
+	void foldLeaf(const PageId pageNo);
+
+  /**
+   * Like foldLeaf(), for a leaf the caller has latched and preserved.
+   *
+   * @param page			Guard of the leaf
+   */
+	void foldKeys(WritePageGuard& page);
+
+  /**
+   * Append the record ids of a posting list to out.
+   *
+   * @param head			First page of the list
+   * @param max				Number of record ids to read at most
+   * @param out				Receives the record ids
+   * @return					Number of record ids appended
+   */
+	std::size_t readPostings(const PageId head, const std::size_t max, std::vector<RecordId>& out);
+
+  /**
+   * Record id at a position of a posting list.
+   *
+   * @param head			First page of the list
+   * @param position	Position in the list, counting from 0
+   */
+	RecordId postingAt(const PageId head, std::size_t position);
+
+  /**
+   * Number of entries a leaf entry stands for: the length of its posting list, or 1.
+   */
+	std::size_t entrySize(const RecordId& rid);
+
+  /**
+   * Number of entries the entries [from, to) of a leaf stand for.
+   */
+	std::size_t leafEntries(const LeafNodeInt* leaf, const int from, const int to);
+
+  /**
+   * Replace the posting entries among out[from, to) by the record ids of their lists,
+   * keeping at most max record ids in out.
+   *
+   * @return					Number of record ids in out afterwards
+   */
+	std::size_t expandPostings(RecordId* out, const std::size_t from, const std::size_t to, const std::size_t max);
+
+  /**
+   * Add an entry to the buffer of the root, flushing buffers down as needed to make room.
+   *
+   * @param key			Key of the entry
+   * @param rid			Record id of the entry
+   */
+	void insertBuffered(const int key, const RecordId rid);
+
+  /**
+   * Get the message buffer of a non-leaf node, giving the node an empty one first if it
+   * has none. In that case the caller has latched the node and logs it with the buffer.
+   *
+   * @param node	The node
+   * @return			Guard holding the pinned buffer
+   */
+	WritePageGuard writeBuffer(NonLeafNodeInt* node);
+
+  /**
+   * Move the messages for one child out of the non-empty buffer of a non-leaf node: the
+   * child with the most messages gets them in its buffer, or merged into it if it is a
+   * leaf. A child that is full is split first instead, a child whose buffer has no room
+   * is flushed first instead; so a call may move no messages, but always makes progress.
+   * The node must have room for one more key.
+   *
+   * @param page	Guard of the node
+   */
+	void flushBuffer(WritePageGuard& page);
+
+  /**
+   * If a child of a non-leaf node was split without its separator reaching the node,
+   * typically by an unbuffered insert interrupted by a crash, add the separator now, so
+   * that messages for the new right node are not routed to the old one.
+   *
+   * @param page		Guard of the node, which must have room for one more key
+   * @param child		Index of the child
+   * @return				True if a separator was added
+   */
+	bool completeSplit(WritePageGuard& page, const int child);
+
+  /**
+   * Split a latched non-leaf node in half, giving the messages of its buffer that belong
+   * to the new right node a buffer of their own. The caller adds the separator to the
+   * level above and logs the changes.
+   *
+   * @param page				Guard of the node
+   * @param newPage			Receives the new right node
+   * @param buffer			Receives the buffer of the node, if it has one
+   * @param newBuffer		Receives the buffer of the new node, if it got messages
+   * @return						Separator of the split
+   */
+	int splitBufferedNode(WritePageGuard& page, WritePageGuard& newPage,
+	                      WritePageGuard& buffer, WritePageGuard& newBuffer);
+
+  /**
+   * Split a full non-leaf child of a non-leaf node and add the separator to the node.
+   *
+   * @param page				Guard of the node, which must have room for one more key
+   * @param childPage		Guard of the child
+   * @param child				Index of the child
+   */
+	void splitChild(WritePageGuard& page, WritePageGuard& childPage, const int child);
+
+  /**
+   * Split the full root and put a new root with an empty buffer above it.
+   *
+   * @param rootPage	Guard of the root
+   */
+	void splitBufferedRoot(WritePageGuard& rootPage);
+
+  /**
+   * Flush every message down to the leaves.
+   */
+	void drainBuffers();
+
+  /**
+   * Flush every message in the buffers below a non-leaf node, whose own buffer is empty,
+   * down to the leaves.
+   *
+   * @param pageNo	Page number of the node
+   */
+	void drainChildren(const PageId pageNo);
+
+  /**
+   * Number of messages in the buffer of a non-leaf node.
+   */
+	int bufferedCount(const NonLeafNodeInt* node);
+
+  /**
+   * Collect the buffered messages with keys in [low, high) from the buffers on the way
+   * to the leaf low is inserted into. The range must lie within the key range of that
+   * leaf. Caller holds bufferLatch.
+   *
+   * @param low			Smallest key to collect
+   * @param high		Keys from high on are left out
+   * @param bounded	False to leave out no keys from low on
+   * @param out			Receives the messages, in key order
+   */
+	void collectMessages(const int low, const int high, const bool bounded, std::vector<RIDKeyPair<int> >& out);
+
+  /**
+   * Read a leaf for scanning like readLeaf() and load the buffered messages and memtable
+   * entries that belong to it from low on into scanMessages.
+   *
+   * @param pageNo	Page number of the leaf
+   * @param low			Smallest key of interest; at most the first key of the leaf's range
+   * @return				Guard holding the leaf or its copy
+   */
+	ReadPageGuard readScanLeaf(const PageId pageNo, const int low);
+
+  /**
+   * True if the next entry of the scan comes from the current leaf rather than from
+   * scanMessages.
+   */
+	bool scanFromLeaf(const LeafNodeInt* leaf) const;
+
+  /**
+   * Same as scanFromLeaf() for a backward scan.
+   */
+	bool scanFromLeafBackward(const LeafNodeInt* leaf) const;
+
+  /**
+   * Find the record ids of the entries with the given key in the leaves, ignoring the
+   * message buffers and the memtable.
+   */
+	std::size_t lookupLeaves(const int key, RecordId* out, const std::size_t max);
+
+  /**
+   * Find the record ids of the entries with the given key in the leaves, starting at a
+   * pinned leaf at or left of the first one that can hold the key.
+   */
+	std::size_t lookupFrom(const LeafNodeInt* leaf, const int key, RecordId* out, const std::size_t max);
+
+  /**
+   * Route a sorted range of batch keys through a non-leaf node: split it into runs that
+   * go to the same child, or to the right sibling, and append them to next, or to leaves
+   * for children that are leaves.
+   *
+   * @param node		The node, pinned
+   * @param keys		Sorted keys of the batch
+   * @param range		Range of keys that reached the node
+   * @param next		Receives the runs that continue at a non-leaf node
+   * @param leaves	Receives the runs that reached a leaf
+   */
+	void routeBatch(const NonLeafNodeInt* node, const std::vector<int>& keys, const BatchRange& range,
+	                std::vector<BatchRange>& next, std::vector<BatchRange>& leaves);
+
+  /**
+   * Add an image of each changed page to unit and log it with logUnit().
+   */
+	void logImages(LogUnit& unit, WritePageGuard* const* pages, const int numPages);
+
+  /**
+   * Copy a write-latched node that is about to change to a shadow page for every open
+   * snapshot that still sees its current version. Caller holds snapLatch shared.
+   *
+   * @param page	Guard of the node
+   */
+	void preserve(const WritePageGuard& page);
+
+  /**
+   * Copy the version of a node that a snapshot sees into out, consistently with
+   * concurrent inserts.
+   *
+   * @param snap		The snapshot
+   * @param pageNo	Page number of the node
+   * @param out			Receives the node
+   */
+	void readSnapshotNode(const BTreeSnapshot* snap, const PageId pageNo, Page* out);
+
+  /**
+   * Forget a snapshot that is being deleted and recycle the shadow pages only it used.
+   */
+	void closeSnapshot(BTreeSnapshot* snap);
+
+  /**
+   * Read the shadow page list of the file; every shadow page in it is free.
+   */
+	void loadShadowList();
+
+  /**
+   * Add a new shadow page to the shadow page list, logged together with its first
+   * contents. Caller holds snapMutex.
+   *
+   * @param shadow	Guard of the shadow page, filled in already
+   */
+	void addShadowPage(WritePageGuard& shadow);
+
+  /**
+   * Take a page out of the shadow page list, logged. Caller holds snapMutex.
+   *
+   * @param pageNo	Page number of the shadow page
+   */
+	void dropShadowPage(const PageId pageNo);
+
+  /**
+   * Get a page for a new node: a free shadow page if there is one, otherwise a new page
+   * of the file. The page is cleared; the caller logs it with the node.
+   *
+   * @param pageNo	Receives the page number
+   * @return				Guard holding the page
+   */
+	WritePageGuard allocNode(PageId& pageNo);
+
+  /**
+   * Get the node stored in the given page of the index file for reading. In READ_WRITE
+   * mode the page stays pinned in the buffer pool until the guard is released.
+   * In READ_ONLY_MMAP mode the guard points into the file mapping.
+   *
+   * @param pageNo	Page number of the node
+   * @return				Guard holding the page
+   */
+	ReadPageGuard readNode(const PageId pageNo);
+
+  /**
+   * Get the node stored in the given page of the index file for modification.
+   *
+   * @param pageNo	Page number of the node
+   * @return				Guard holding the pinned page
+   */
+	WritePageGuard writeNode(const PageId pageNo);
+
+  /**
+   * Read a leaf for scanning. In READ_WRITE mode the leaf is copied into scanLeaf under
+   * its version latch and unpinned again.
+   *
+   * @param pageNo	Page number of the leaf
+   * @return				Guard holding the leaf or its copy
+   */
+	ReadPageGuard readLeaf(const PageId pageNo);
+
+  /**
+   * Read a non-leaf node during a descent, which the caller runs inside a
+   * HeldReadSection. In READ_WRITE mode the node is held in the buffer pool the first
+   * time it is read, while there is room, so that later descents read it without
+   * pinning it or taking the pool latch.
+   *
+   * @param pageNo	Page number of the node
+   * @return				Guard holding the page, or pointing at the held page
+   */
+	ReadPageGuard readInner(const PageId pageNo);
+
+  /**
+   * Wait for the node's latch to be free and return its version. Nodes of a READ_ONLY_MMAP
+   * index never change and are not latched.
+   */
+	std::uint64_t readVersion(const VersionLatch& latch) const;
+
+  /**
+   * True if the node's latch is still at the version returned by readVersion().
+   */
+	bool validVersion(const VersionLatch& latch, const std::uint64_t version) const;
+
+  /**
+   * Descend from the root to the node at the given level whose key range holds key,
+   * without latching, and reading held non-leaf nodes without pinning them. Searches (tiesRight false) end at the leftmost node that may hold
+   * the key; entries only ever move right when a node splits, so the caller finds any
+   * entry >= key by following right siblings from there.
+   *
+   * @param key				Key to search for
+   * @param tiesRight	True to descend like an insert of key, false like a search for it
+   * @param level			Level of the node to return; 0 for a leaf
+   * @param path			If not NULL, receives the non-leaf nodes passed through, root first
+   * @return					Page number of the node
+   */
+	PageId findNode(const int key, const bool tiesRight, const int level, std::vector<PageId>* path);
+
+  /**
+   * Insert an entry into the leaf an insert of key goes to, splitting it if it is full.
+   *
+   * @param key				Key of the entry
+   * @param rid				Record id of the entry
+   * @param leafPid		Page number of the leaf found by the descent; the entry may belong
+   *									further right
+   * @param path			Nodes passed through on the way down
+   * @param slots			Child followed in each node of path, whose counts the entry is
+   *									added to in the unit of the leaf; NULL without subtree counts
+   */
+	void insertLeaf(const int key, const RecordId rid, PageId leafPid, std::vector<PageId>& path,
+		const std::vector<int>* slots);
+
+  /**
+   * Store sorted entries in a write-latched leaf, and in new leaves after it if they do
+   * not fit. The entries are cut at bounds: the leaf keeps the first piece and each
+   * further piece goes to a new leaf, linked from the one before it. The caller links the
+   * old right sibling of the leaf back to the last new leaf and logs the leaf, the new
+   * leaves and that sibling in one unit, then adds the separators to the level above.
+   *
+   * @param leafPage		Guard of the leaf, preserved already
+   * @param keys				Keys of the entries
+   * @param rids				Record ids of the entries
+   * @param bounds			Index of the first entry of each piece, then the number of entries
+   * @param newPages		Receives the guards of the new leaves, left to right
+   * @param separators	Receives the first key of each new leaf
+   * @param sizes				Receives the number of entries each piece stands for
+   */
+	void fillLeaves(WritePageGuard& leafPage, const std::vector<int>& keys, const std::vector<RecordId>& rids,
+		const std::vector<std::size_t>& bounds, std::vector<WritePageGuard>& newPages,
+		std::vector<int>& separators, std::vector<int>& sizes);
+
+  /**
+   * Add the separator produced by a split to the level above, splitting nodes there and
+   * further up as needed. The split node must already be unlatched.
+   *
+   * @param key				Separator; the first key of the new right node
+   * @param leftPid		Page number of the node that was split
+   * @param rightPid	Page number of the new right node
+   * @param leftCount	Number of entries left in leftPid; the parent counts everything
+   *									else it counted with leftPid under rightPid from now on
+   * @param level			Level to insert the separator into
+   * @param path			Nodes passed through on the way down; used as hints for the parents
+   */
+	void insertIntoParent(int key, PageId leftPid, PageId rightPid, int leftCount, int level, std::vector<PageId>& path);
+
+  /**
+   * Put a new root above the current root, which the caller has just split and still
+   * holds latched. The split and the new root are logged as one unit.
+   *
+   * @param split			Guards of the pages changed by the split: the current root, the
+   *									new right node, then any others
+   * @param numSplit	Number of guards in split
+   * @param key				Separator of the split
+   * @param unit			Log records of the split
+   */
+	void growRoot(WritePageGuard* const* split, const int numSplit, const int key, LogUnit& unit);
+
+  /**
+   * Mark latched, pinned pages dirty with the changes described by unit, append the unit
+   * to the log and stamp the nodes and their frames with its commit LSN. Without a log
+   * the pages are only marked dirty.
+   *
+   * @param unit			Records describing the changes
+   * @param pages			Guards of the changed pages
+   * @param numPages	Number of guards in pages
+   */
+	void logUnit(LogUnit& unit, WritePageGuard* const* pages, const int numPages);
+
+  /**
+   * Check that the meta page of an existing index file describes the requested index
+   * and load the root page number and tree height from it.
+   *
+   * @param meta						Meta page of the index file
+   * @param relationName		Name of the base relation
+   * @throws  BadIndexInfoException If the meta page does not match the parameters
+   */
+	void loadMetaInfo(const IndexMetaInfo* meta, const std::string & relationName);
+
+	
+ public:
+
+  /**
+   * BTreeIndex Constructor. 
+	 * Check to see if the corresponding index file exists. If so, open the file.
+	 * If not, create it and insert entries for every tuple in the base relation using FileScan class.
+	 * If the buffer manager has a log attached, an existing index opened READ_WRITE is first
+	 * brought up to date with the changes committed to the log (crash recovery).
+   *
+   * @param relationName        Name of file.
+   * @param outIndexName        Return the name of index file.
+   * @param bufMgrIn						Buffer Manager Instance
+   * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
+   * @param attrType						Datatype of attribute over which index is built
+   * @param openMode						READ_ONLY_MMAP to open an existing index file through a read-only
+   *                          memory mapping instead of the buffer manager
+   * @throws  FileNotFoundException If openMode is READ_ONLY_MMAP and the index file does not exist
+   * @throws  BadIndexInfoException If an existing index file was built for a different relation or attribute
+   */
+	BTreeIndex(const std::string & relationName, std::string & outIndexName,
+						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType,
+						const IndexOpenMode openMode = READ_WRITE);
+	
+
+  /**
+   * BTreeIndex Destructor. 
+	 * End any initialized scan, flush index file, after unpinning any pinned pages, from the buffer manager
+	 * and delete file instance thereby closing the index file.
+	 * Destructor should not throw any exceptions. All exceptions should be caught in here itself. 
+	 * */
+	~BTreeIndex();
+
+
+  /**
+	 * Insert a new entry using the pair <value,rid>. 
+	 * Start from root to recursively find out the leaf to insert the entry in. The insertion may cause splitting of leaf node.
+	 * This splitting will require addition of new leaf page number entry into the parent non-leaf, which may in-turn get split.
+	 * This may continue all the way upto the root causing the root to get split. If root gets split, metapage needs to be changed accordingly.
+	 * Make sure to unpin pages as soon as you can.
+   * @param key			Key to insert, pointer to integer/double/char string
+   * @param rid			Record ID of a record whose entry is getting inserted into the index.
+   * @throws  IndexReadOnlyException If the index was opened in READ_ONLY_MMAP mode
+	**/
+	void insertEntry(const void* key, const RecordId rid);
+
+
+  /**
+	 * Begin a filtered scan of the index.  For instance, if the method is called 
+	 * using ("a",GT,"d",LTE) then we should seek all entries with a value 
+	 * greater than "a" and less than or equal to "d".
+	 * If another scan is already executing, that needs to be ended here.
+	 * Set up all the variables for scan. Start from root to find out the leaf page that contains the first RecordID
+	 * that satisfies the scan parameters. Keep that page pinned in the buffer pool.
+   * @param lowVal	Low value of range, pointer to integer / double / char string
+   * @param lowOp		Low operator (GT/GTE)
+   * @param highVal	High value of range, pointer to integer / double / char string
+   * @param highOp	High operator (LT/LTE)
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values 
+   * @throws  BadScanrangeException If lowVal > highval
+	 * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that satisfies the scan criteria.
+	**/
+	void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+
+  /**
+	 * Begin a backward scan of the index: the same entries as startScan() with the same
+	 * arguments, returned by scanNext() from the high bound down, in descending key order.
+	 * The scan starts at the leaf holding the high bound and follows the left links, so
+	 * reading the first k entries only touches the leaves that hold them.
+   * @param lowVal	Low value of range, pointer to integer / double / char string
+   * @param lowOp		Low operator (GT/GTE)
+   * @param highVal	High value of range, pointer to integer / double / char string
+   * @param highOp	High operator (LT/LTE)
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values 
+   * @throws  BadScanrangeException If lowVal > highval
+	 * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that satisfies the scan criteria.
+	**/
+	void startReverseScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+
+  /**
+	 * Begin a scan of several ranges at once, such as an IN-list or a disjunction of
+	 * ranges, read with scanNext() and endScan() like any scan. The entries of all ranges
+	 * come back once each, in key order, in one pass over the leaf chain: the scan moves to
+	 * the next range within the current leaf or through the right link when it is close
+	 * by, and descends from the root only to skip ahead. Overlapping ranges are merged.
+   * @param ranges			Array of ranges, in any order
+   * @param numRanges		Number of ranges
+   * @throws  BadOpcodesException If the operators of a range do not contain one of their expected values
+   * @throws  BadScanrangeException If the low value of a range is greater than its high value
+	 * @throws  NoSuchKeyFoundException If there is no key in the B+ tree within any of the ranges.
+	**/
+	void startMultiRangeScan(const ScanRange* ranges, const std::size_t numRanges);
+
+
+  /**
+	 * Fetch the record id of the next index entry that matches the scan.
+	 * Return the next record from current page being scanned. If current page has been scanned to its entirety, move on to the right sibling of current page, if any exists, to start scanning that page. Make sure to unpin any pages that are no longer required.
+   * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	 * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+	**/
+	void scanNext(RecordId& outRid);  // returned record id
+
+
+  /**
+	 * Terminate the current scan. Unpin any pinned pages. Reset scan specific variables.
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	void endScan();
+
+
+  /**
+	 * Find the record ids of the entries with the given key without starting a scan.
+	 * Safe to call concurrently with other lookups and inserts.
+   * @param key			Key to look up, pointer to integer/double/char string
+   * @param out			Array receiving up to max record ids
+   * @param max			Capacity of out
+   * @return				Number of record ids stored in out
+	**/
+	std::size_t lookup(const void* key, RecordId* out, const std::size_t max);
+
+
+  /**
+	 * Check whether the index holds an entry with the given key. Same as a lookup() for
+	 * at most one record id.
+   * @param key			Key to look up, pointer to integer/double/char string
+   * @return				True if an entry has the key
+	**/
+	bool contains(const void* key);
+
+
+  /**
+	 * Look up many keys at once, e.g. the probe side of a join. The keys are sorted and
+	 * descend the tree together, level by level, so that a node is read once for all the
+	 * keys that pass through it; the nodes of several independent descents are pinned and
+	 * prefetched before any is searched, so that their misses overlap. With buffered
+	 * inserts, a memtable or hashed lookups the keys are looked up one by one, in key order.
+	 * Safe to call concurrently with other lookups and inserts.
+   * @param keys		Array of n keys, integer/double/char string
+   * @param n				Number of keys
+   * @param results	Array of n*max record ids; those of keys[i] are stored from results[i*max] on
+   * @param max			Number of record ids to find at most per key
+   * @param counts	Array of n counts; counts[i] receives the number of record ids found for keys[i]
+	**/
+	void lookupBatch(const void* keys, const std::size_t n, RecordId* results, const std::size_t max, std::size_t* counts);
+
+
+  /**
+	 * Make every insert that has returned so far durable, by syncing the write-ahead log
+	 * up to the last change made through this index. Threads that sync at the same time
+	 * share one log sync (group commit); see LogManager::configure() for trading latency
+	 * for fewer syncs. The memtable, if any, is merged into the tree first. Does nothing if
+	 * the buffer manager has no log attached.
+	 * @throws LogIOException If the log cannot be written
+	**/
+	void sync();
+
+
+  /**
+	 * Take a snapshot of the index. Waits for inserts that are in the middle of changing
+	 * a node, but does not block later ones. Snapshots do not see message buffers or the
+	 * memtable, so with buffered inserts every buffered entry is flushed down to the leaves
+	 * first, and the memtable is merged into the tree. The caller
+	 * deletes the snapshot, before the index, to release it.
+	 * @return				New snapshot
+	**/
+	BTreeSnapshot* snapshot();
+
+
+  /**
+	 * Turn buffered inserts on or off. The setting is stored in the index file and kept
+	 * until changed again. Turning buffering off flushes every buffered entry down to the
+	 * leaves first. Must not be called while other threads use the index.
+   * @param enable	True to buffer inserts
+   * @throws  IndexReadOnlyException If the index was opened in READ_ONLY_MMAP mode
+	**/
+	void setInsertBuffering(const bool enable);
+
+
+  /**
+	 * Turn hashed lookups on or off. While on, the index keeps an in-memory hash table from
+	 * every key in the leaves to the leaf it is in, updated as leaves get entries and
+	 * split, so that lookup() and contains() go straight to the leaf, and find out without
+	 * any page read that a key is in no leaf. Costs memory per distinct key. Turning them
+	 * on reads every leaf. The setting is not stored in the index file. Must not be called
+	 * while other threads use the index.
+   * @param enable	True to keep the hash table
+	**/
+	void setLookupHash(const bool enable);
+
+
+  /**
+	 * Put a memtable in front of the tree, or remove it. Inserts then go to the memtable,
+	 * which is merged into the tree once it holds the given number of entries, and by
+	 * mergeMemtable(), sync(), snapshot() and the destructor. Entries in the memtable are
+	 * not logged, so they survive a crash only once merged. An existing memtable is merged
+	 * first. The setting is not stored in the index file. Must not be called while other
+	 * threads use the index.
+   * @param entries	Number of entries at which the memtable is merged; 0 for no memtable
+   * @throws  IndexReadOnlyException If the index was opened in READ_ONLY_MMAP mode
+	**/
+	void setMemtableSize(const std::size_t entries);
+
+
+  /**
+	 * Merge the memtable into the tree now. Does nothing if there is no memtable.
+	**/
+	void mergeMemtable();
+
+
+  /**
+	 * Turn subtree counts on or off. The setting is stored in the index file and kept until
+	 * changed again. Turning counts on recomputes them for the whole tree and turns buffered
+	 * inserts off; turning buffered inserts on turns counts off. Must not be called while
+	 * other threads use the index.
+   * @param enable	True to keep subtree counts
+   * @throws  IndexReadOnlyException If the index was opened in READ_ONLY_MMAP mode
+	**/
+	void setSubtreeCounts(const bool enable);
+
+
+  /**
+	 * Turn posting lists on or off. While on, once a leaf holds POSTING_MIN_ENTRIES entries
+	 * of a key, they are moved into a posting list, which takes the further entries of the
+	 * key that reach the leaf. Entries that reach a leaf from a message buffer or the
+	 * memtable are moved in the same way when they are merged into it. Turning posting
+	 * lists on moves the entries of such keys in every leaf; turning them off leaves
+	 * existing lists in place, but stores new entries in the leaves. The setting is
+	 * stored in the index file and kept until changed again. Must not be called while
+	 * other threads use the index.
+   * @param enable	True to use posting lists
+   * @throws  IndexReadOnlyException If the index was opened in READ_ONLY_MMAP mode
+	**/
+	void setPostingLists(const bool enable);
+
+
+  /**
+	 * Count the entries in a key range, without reading them. Takes one node read per
+	 * level with subtree counts, and a walk over the leaves of the range without them.
+	 * The memtable and message buffers are merged into the leaves first.
+	 * @param lowVal	Low value of range, pointer to integer / double / char string
+	 * @param lowOp		Low operator (GT/GTE)
+	 * @param highVal	High value of range, pointer to integer / double / char string
+	 * @param highOp	High operator (LT/LTE)
+	 * @return				Number of entries in the range
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+   * @throws  BadScanrangeException If lowVal > highval
+   * @throws  IndexReadOnlyException If the index buffers inserts and was opened in
+   *					READ_ONLY_MMAP mode
+	**/
+	std::size_t countRange(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+
+  /**
+	 * Number of entries with keys below key: the position in key order the first entry
+	 * with that key has, or would have.
+	 * @param key		Key to rank
+	 * @return			Number of entries with smaller keys
+   * @throws  IndexReadOnlyException If the index buffers inserts and was opened in
+   *					READ_ONLY_MMAP mode
+	**/
+	std::size_t rank(const void* key);
+
+
+  /**
+	 * Find the entry at a position in key order, counting from 0; entries with equal keys
+	 * are in the order lookup() returns them.
+	 * @param position	Position of the entry
+	 * @param outKey		Receives the key of the entry
+	 * @param outRid		Receives the record id of the entry
+   * @throws  NoSuchKeyFoundException If the index holds no more than position entries
+   * @throws  IndexReadOnlyException If the index buffers inserts and was opened in
+   *					READ_ONLY_MMAP mode
+	**/
+	void select(const std::size_t position, void* outKey, RecordId& outRid);
+
+
+  /**
+	 * Draw entries from a key range at random, with replacement, each entry in the range
+	 * equally likely. With subtree counts every draw is a select() of a random position;
+	 * without them it is a random descent that is retried until it lands in the range,
+	 * and keeps a posting list entry in proportion to the length of its list. Narrow
+	 * ranges, and ranges whose entries are short next to the longest list, where few
+	 * descents would succeed, are read instead. Nodes split off another
+	 * whose separator has not reached the parent yet are not drawn from by descents.
+	 * The memtable and message buffers are merged into the leaves first.
+	 * @param lowVal	Low value of range, pointer to integer / double / char string
+	 * @param lowOp		Low operator (GT/GTE)
+	 * @param highVal	High value of range, pointer to integer / double / char string
+	 * @param highOp	High operator (LT/LTE)
+	 * @param n				Number of entries to draw
+	 * @param outKeys	Receives the keys of the entries drawn, in the order drawn
+	 * @param outRids	If not NULL, receives their record ids
+	 * @return				n, or 0 if the range is empty
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values
+   * @throws  BadScanrangeException If lowVal > highval
+   * @throws  IndexReadOnlyException If the index buffers inserts and was opened in
+   *					READ_ONLY_MMAP mode
+	**/
+	std::size_t sampleRange(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp,
+		const std::size_t n, void* outKeys, RecordId* outRids);
+
+
+  /**
+	 * Estimate the keys at given fractions of the index in key order: 0 for the smallest
+	 * key, 0.5 for the median, 1 for the largest. Exact with subtree counts; otherwise
+	 * read off a random sample of the entries, which puts each within about one percent
+	 * of the entries of its true position.
+	 * @param fractions	Fractions to find the keys at, each in [0, 1]
+	 * @param n					Number of fractions
+	 * @param outKeys		Receives the key at each fraction
+   * @throws  NoSuchKeyFoundException If the index is empty
+   * @throws  IndexReadOnlyException If the index buffers inserts and was opened in
+   *					READ_ONLY_MMAP mode
+	**/
+	void quantiles(const double* fractions, const std::size_t n, void* outKeys);
+
+
+  /**
+	 * Collect statistics of the index and store them in the meta page, replacing those of
+	 * the last call: number of entries and of distinct keys, smallest and largest key, an
+	 * equi-depth histogram and the number and fill of the nodes at each level. Reads every
+	 * node once, and the leaves at the bucket boundaries once more. The memtable and
+	 * message buffers are merged into the leaves first. Inserts may go on meanwhile; the
+	 * statistics then describe the index at some point during the call, approximately.
+   * @throws  IndexReadOnlyException If the index was opened in READ_ONLY_MMAP mode
+	**/
+	void analyze();
+
+
+  /**
+	 * Statistics stored by the last analyze(), which may have been made by an earlier
+	 * process.
+	 * @return				The statistics; analyzed is false if there are none
+	**/
+	IndexStatistics statistics();
 	
 };
 
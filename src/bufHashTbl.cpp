@@ -15,16 +15,21 @@
 
 namespace badgerdb {
 
-int BufHashTbl::hash(const File* file, const PageId pageNo)
+int BufHashTbl::hash(const File* file, const PageId pageNo) const
+{
+  return hash(file, pageNo, HTSIZE);
+}
+
+int BufHashTbl::hash(const File* file, const PageId pageNo, const int size) const
 {
   int tmp, value;
   tmp = (long)file;  // cast of pointer to the file object to an integer
-  value = (tmp + pageNo) % HTSIZE;
+  value = (tmp + pageNo) % size;
   return value;
 }
 
 BufHashTbl::BufHashTbl(int htSize)
-	: HTSIZE(htSize)
+	: HTSIZE(htSize), OLDHTSIZE(0), oldHt(NULL), migrateNext(0)
 {
   // allocate an array of pointers to hashBuckets
   ht = new hashBucket* [htSize];
@@ -34,6 +39,7 @@ BufHashTbl::BufHashTbl(int htSize)
 
 BufHashTbl::~BufHashTbl()
 {
+  migrate(OLDHTSIZE);
   for(int i = 0; i < HTSIZE; i++) {
     hashBucket* tmpBuf = ht[i];
     while (ht[i]) {
@@ -45,8 +51,62 @@ BufHashTbl::~BufHashTbl()
   delete [] ht;
 }
 
+void BufHashTbl::migrate(int buckets)
+{
+  if (!oldHt)
+    return;
+
+  for (; buckets > 0 && migrateNext < OLDHTSIZE; buckets--, migrateNext++)
+  {
+    while (oldHt[migrateNext])
+    {
+      hashBucket* tmpBuc = oldHt[migrateNext];
+      oldHt[migrateNext] = tmpBuc->next;
+
+      int index = hash(tmpBuc->file, tmpBuc->pageNo);
+      tmpBuc->next = ht[index];
+      ht[index] = tmpBuc;
+    }
+  }
+
+  if (migrateNext == OLDHTSIZE)
+  {
+    delete [] oldHt;
+    oldHt = NULL;
+    OLDHTSIZE = 0;
+  }
+}
+
+void BufHashTbl::resize(const int htSize)
+{
+  // finish any earlier resize first so at most two tables exist
+  migrate(OLDHTSIZE);
+
+  oldHt = ht;
+  OLDHTSIZE = HTSIZE;
+  migrateNext = 0;
+
+  HTSIZE = htSize;
+  ht = new hashBucket* [htSize];
+  for(int i=0; i < HTSIZE; i++)
+    ht[i] = NULL;
+}
+
 void BufHashTbl::insert(const File* file, const PageId pageNo, const FrameId frameNo)
 {
+  migrate(MIGRATE_STEP);
+
+  // an entry may still sit in a bucket of the old table that has not been moved yet
+  if (oldHt)
+  {
+    hashBucket* oldBuc = oldHt[hash(file, pageNo, OLDHTSIZE)];
+    while (oldBuc) {
+      if (oldBuc->file == file && oldBuc->pageNo == pageNo)
+    		throw HashAlreadyPresentException(oldBuc->file->filename(), oldBuc->pageNo, oldBuc->frameNo);
+      oldBuc = oldBuc->next;
+    }
+  }
+
   int index = hash(file, pageNo);
 
   hashBucket* tmpBuc = ht[index];
@@ -69,6 +129,8 @@ void BufHashTbl::insert(const File* file, const PageId pageNo, const FrameId fra
 
 void BufHashTbl::lookup(const File* file, const PageId pageNo, FrameId &frameNo) 
 {
+  migrate(MIGRATE_STEP);
+
   int index = hash(file, pageNo);
   hashBucket* tmpBuc = ht[index];
   while (tmpBuc) {
@@ -80,31 +142,79 @@ void BufHashTbl::lookup(const File* file, const PageId pageNo, FrameId &frameNo)
     tmpBuc = tmpBuc->next;
   }
 
+  if (oldHt)
+  {
+    tmpBuc = oldHt[hash(file, pageNo, OLDHTSIZE)];
+    while (tmpBuc) {
+      if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
+      {
+        frameNo = tmpBuc->frameNo;
+        return;
+      }
+      tmpBuc = tmpBuc->next;
+    }
+  }
+
   throw HashNotFoundException(file->filename(), pageNo);
 }
 
+bool BufHashTbl::find(const File* file, const PageId pageNo, FrameId &frameNo) const
+{
+  for (hashBucket* tmpBuc = ht[hash(file, pageNo)]; tmpBuc; tmpBuc = tmpBuc->next)
+  {
+    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
+    {
+      frameNo = tmpBuc->frameNo;
+      return true;
+    }
+  }
+
+  if (oldHt)
+  {
+    for (hashBucket* tmpBuc = oldHt[hash(file, pageNo, OLDHTSIZE)]; tmpBuc; tmpBuc = tmpBuc->next)
+    {
+      if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
+      {
+        frameNo = tmpBuc->frameNo;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 void BufHashTbl::remove(const File* file, const PageId pageNo) {
 
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  hashBucket* prevBuc = NULL;
+  migrate(MIGRATE_STEP);
 
-  while (tmpBuc)
+  // look in the current table, then in the one still being drained
+  for (int pass = 0; pass < 2; pass++)
 	{
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-		{
-      if(prevBuc) 
-				prevBuc->next = tmpBuc->next;
-      else
-				ht[index] = tmpBuc->next;
+    hashBucket** table = (pass == 0) ? ht : oldHt;
+    if (!table)
+      break;
 
-      delete tmpBuc;
-      return;
-    }
-		else
+    int index = hash(file, pageNo, (pass == 0) ? HTSIZE : OLDHTSIZE);
+    hashBucket* tmpBuc = table[index];
+    hashBucket* prevBuc = NULL;
+
+    while (tmpBuc)
 		{
-      prevBuc = tmpBuc;
-      tmpBuc = tmpBuc->next;
+      if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
+			{
+        if(prevBuc) 
+					prevBuc->next = tmpBuc->next;
+        else
+					table[index] = tmpBuc->next;
+
+        delete tmpBuc;
+        return;
+      }
+			else
+			{
+        prevBuc = tmpBuc;
+        tmpBuc = tmpBuc->next;
+      }
     }
   }
 
@@ -54,6 +54,28 @@ class BufHashTbl
 	 */
   hashBucket**  ht;
 
+	/**
+	 *	Size of the table being drained into ht after a resize
+	 */
+  int OLDHTSIZE;
+
+	/**
+	 * Table left over from the last resize whose buckets are still being moved
+	 * into ht, or NULL once every bucket has been moved
+	 */
+  hashBucket**  oldHt;
+
+	/**
+	 * Index of the next bucket of oldHt to move
+	 */
+  int migrateNext;
+
+	/**
+	 * Number of oldHt buckets moved by every insert, lookup and remove while a
+	 * resize is in progress
+	 */
+  static const int MIGRATE_STEP = 4;
+
 	/**
 	 * returns hash value between 0 and HTSIZE-1 computed using file and pageNo
 	 *
@@ -61,7 +83,25 @@ class BufHashTbl
 	 * @param pageNo  Page number in the file
 	 * @return  			Hash value.
 	 */
-  int	 hash(const File* file, const PageId pageNo);
+  int	 hash(const File* file, const PageId pageNo) const;
+
+	/**
+	 * returns hash value between 0 and size-1 computed using file and pageNo
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @param size		Number of buckets
+	 * @return  			Hash value.
+	 */
+  int	 hash(const File* file, const PageId pageNo, const int size) const;
+
+	/**
+	 * Move up to the given number of buckets from oldHt into ht, and free oldHt
+	 * once it is empty.
+	 *
+	 * @param buckets	Number of buckets to move
+	 */
+  void migrate(int buckets);
 
  public:
 	/**
@@ -96,6 +136,18 @@ class BufHashTbl
 	 */
   void lookup(const File* file, const PageId pageNo, FrameId &frameNo);
 
+	/**
+   * Check if (file, pageNo) is currently in the buffer pool without advancing a
+   * pending rehash, so that several threads may call it at once as long as nobody
+   * modifies the table meanwhile.
+	 *
+	 * @param file  	File object
+	 * @param pageNo	Page number in the file
+	 * @param frameNo Frame number reference
+	 * @return				False if the page entry is not in the hash table
+	 */
+  bool find(const File* file, const PageId pageNo, FrameId &frameNo) const;
+
 	/**
    * Delete entry (file,pageNo) from hash table.
 	 *
@@ -104,6 +156,15 @@ class BufHashTbl
    * @throws HashNotFoundException if the page entry is not found in the hash table 
 	 */
   void remove(const File* file, const PageId pageNo);  
+
+	/**
+   * Change the number of buckets. Entries are not rehashed all at once: the old
+   * table is kept and a few of its buckets are moved over on every later
+   * insert, lookup and remove, so no single call pays for the whole rehash.
+	 *
+	 * @param htSize	New number of buckets
+	 */
+  void resize(const int htSize);
 };
 
 }
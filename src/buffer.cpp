@@ -7,71 +7,338 @@
 
 #include <memory>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
 #include "buffer.h"
+#include "exceptions/badgerdb_exception.h"
 #include "exceptions/buffer_exceeded_exception.h"
 #include "exceptions/page_not_pinned_exception.h"
 #include "exceptions/page_pinned_exception.h"
-#include "exceptions/bad_buffer_exception.h"
 #include "exceptions/hash_not_found_exception.h"
 
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
 namespace badgerdb { 
 
+namespace {
+
+/**
+ * Size of the huge pages the pool mapping is rounded up to
+ */
+const std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+/**
+ * Map bytes of anonymous memory for the pool: reserved huge pages if there are
+ * enough, transparent huge pages otherwise. MAP_FAILED if neither works.
+ */
+void* mapPool(std::size_t bytes)
+{
+  void* pool = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (pool == MAP_FAILED)
+  {
+    // no huge pages reserved; ask for transparent huge pages instead
+    pool = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pool != MAP_FAILED)
+      madvise(pool, bytes, MADV_HUGEPAGE);
+  }
+  return pool;
+}
+
+/**
+ * Number of NUMA nodes with memory, as reported by sysfs. One if unknown.
+ */
+std::uint32_t numaNodeCount()
+{
+  // the file holds a list such as "0" or "0-3"; the last number is the highest node
+  std::ifstream online("/sys/devices/system/node/online");
+  std::string nodes;
+  if (!(online >> nodes))
+    return 1;
+  std::size_t pos = nodes.find_last_of(",-");
+  std::uint32_t last = std::stoul(pos == std::string::npos ? nodes : nodes.substr(pos + 1));
+  // node masks below are a single word
+  return std::min<std::uint32_t>(last + 1, 8 * sizeof(unsigned long));
+}
+
+/**
+ * Apply a NUMA memory policy to a range of the pool before it is first touched.
+ * Failures leave the default policy in place.
+ */
+void bindRange(void* addr, std::size_t len, int mode, unsigned long nodeMask)
+{
+  const std::size_t sysPage = sysconf(_SC_PAGESIZE);
+  std::size_t skew = reinterpret_cast<std::uintptr_t>(addr) % sysPage;
+  syscall(SYS_mbind, static_cast<char*>(addr) - skew, len + skew, mode,
+          &nodeMask, 8 * sizeof(nodeMask) + 1, 0);
+}
+
+}
+
 //----------------------------------------
 // Constructor of the class BufMgr
 //----------------------------------------
 
-BufMgr::BufMgr(std::uint32_t bufs)
-	: numBufs(bufs) {
+BufMgr::BufMgr(std::uint32_t bufs, const PoolPlacement placement)
+	: numBufs(bufs), log(NULL), heldCount(0), holdsEnabled(true), writerStop(false) {
 	bufDescTable = new BufDesc[bufs];
 
+  for (std::uint32_t i = 0; i < HELD_PAGE_SLOTS; i++)
+    heldPages[i].state = 0;
+  for (std::uint32_t i = 0; i < READER_SLOTS; i++)
+    heldReaders[i].readers = 0;
+
   for (FrameId i = 0; i < bufs; i++) 
   {
   	bufDescTable[i].frameNo = i;
   	bufDescTable[i].valid = false;
   }
 
-  bufPool = new Page[bufs];
+  // Map the pool rather than new[] it: the kernel hands out zeroed pages lazily, and
+  // with huge pages a large pool needs far fewer TLB entries. Every frame is overwritten
+  // by readPage()/allocPage() before use, so the Page objects are never constructed.
+  poolBytes = (((std::size_t) bufs * sizeof(Page)) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+  void* pool = mapPool(poolBytes);
+  if (pool == MAP_FAILED)
+  {
+    delete [] bufDescTable;
+    throw std::bad_alloc();
+  }
+  bufPool = static_cast<Page*>(pool);
+
+  poolPlacement = placement;
+  numNodes = (placement == POOL_DEFAULT) ? 1 : numaNodeCount();
+  numPartitions = 1;
+  if (numNodes > 1 && placement == POOL_PARTITION)
+    numPartitions = std::min(numNodes, std::max(bufs, 1u));
+  applyPlacement();
 
-  int htsize = ((((int) (bufs * 1.2))*2)/2)+1;
-  hashTable = new BufHashTbl (htsize);  // allocate the buffer hash table
+  clockHands.resize(numPartitions);
+  for (std::uint32_t part = 0; part < numPartitions; part++)
+    clockHands[part] = partitionEnd(part) - 1;
 
-  clockHand = bufs - 1;
+  hashTable = new BufHashTbl (hashTableSize(bufs));  // allocate the buffer hash table
+}
+
+int BufMgr::hashTableSize(std::uint32_t bufs)
+{
+  return ((((int) (bufs * 1.2))*2)/2)+1;
+}
+
+void BufMgr::applyPlacement()
+{
+  // policies only steer pages that have not been touched yet
+  if (numNodes > 1 && poolPlacement == POOL_INTERLEAVE)
+  {
+    bindRange(bufPool, poolBytes, MPOL_INTERLEAVE, (numNodes == 8 * sizeof(unsigned long)) ? ~0UL : (1UL << numNodes) - 1);
+  }
+  else if (numNodes > 1 && poolPlacement == POOL_PARTITION)
+  {
+    for (std::uint32_t part = 0; part < numPartitions; part++)
+    {
+      if (partitionEnd(part) > partitionBegin(part))
+        bindRange(&bufPool[partitionBegin(part)], (partitionEnd(part) - partitionBegin(part)) * sizeof(Page),
+                  MPOL_PREFERRED, 1UL << part);
+    }
+  }
+}
+
+void BufMgr::resize(std::uint32_t newBufs)
+{
+  // held frames may move or go away, and so may the pool they are read from
+  std::lock_guard<std::mutex> holds(holdMutex);
+  drainHeldReaders();
+  std::lock_guard<SlottedSharedLatch> lock(bufLatch);
+  releaseHolds(NULL);
+
+  if (newBufs == 0)
+    throw BufferExceededException();
+  if (newBufs == numBufs)
+    return;
+
+  if (newBufs < numBufs)
+  {
+    // refuse up front if a frame that has to go is pinned
+    for (FrameId i = newBufs; i < numBufs; i++)
+    {
+      if (bufDescTable[i].valid && bufDescTable[i].pinCnt > 0)
+        throw PagePinnedException(bufDescTable[i].file->filename(), bufDescTable[i].pageNo, i);
+    }
+
+    // move pages from the tail into empty frames of the part of the pool that
+    // stays; evict whatever does not fit
+    std::vector<BufDesc*> evicted;
+    std::vector<BufDesc*> dirtyBufs;
+    FrameId freeFrame = 0;
+    for (FrameId i = newBufs; i < numBufs; i++)
+    {
+      BufDesc* tmpbuf = &(bufDescTable[i]);
+      if (!tmpbuf->valid)
+        continue;
+
+      while (freeFrame < newBufs && bufDescTable[freeFrame].valid)
+        freeFrame++;
+
+      if (freeFrame < newBufs)
+      {
+        BufDesc* dest = &(bufDescTable[freeFrame]);
+        bufPool[freeFrame] = bufPool[i];
+        hashTable->remove(tmpbuf->file, tmpbuf->pageNo);
+        unlinkFrame(i);
+        dest->Set(tmpbuf->file, tmpbuf->pageNo);
+        dest->pinCnt = 0;
+        dest->dirty = tmpbuf->dirty.load();
+        dest->refbit = tmpbuf->refbit.load();
+        dest->recLSN = tmpbuf->recLSN.load();
+        dest->pageLSN = tmpbuf->pageLSN.load();
+        linkFrame(freeFrame);
+        hashTable->insert(dest->file, dest->pageNo, freeFrame);
+        tmpbuf->Clear();
+      }
+      else
+      {
+        evicted.push_back(tmpbuf);
+        if (tmpbuf->dirty)
+          dirtyBufs.push_back(tmpbuf);
+      }
+    }
+
+    writeBack(dirtyBufs);
+    for (std::size_t i = 0; i < evicted.size(); i++)
+    {
+      hashTable->remove(evicted[i]->file, evicted[i]->pageNo);
+      unlinkFrame(evicted[i]->frameNo);
+      evicted[i]->Clear();
+    }
+
+    // hand the memory of the dropped frames back to the system
+    std::size_t keepBytes = (((std::size_t) newBufs * sizeof(Page)) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    if (keepBytes < poolBytes)
+      madvise(reinterpret_cast<char*>(bufPool) + keepBytes, poolBytes - keepBytes, MADV_DONTNEED);
+  }
+  else if ((std::size_t) newBufs * sizeof(Page) > poolBytes)
+  {
+    std::size_t newBytes = (((std::size_t) newBufs * sizeof(Page)) + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    void* pool = mremap(bufPool, poolBytes, newBytes, 0);
+    if (pool == MAP_FAILED)
+    {
+      // the mapping cannot grow in place, so every frame moves; callers only
+      // hold Page pointers into pinned frames
+      for (FrameId i = 0; i < numBufs; i++)
+      {
+        if (bufDescTable[i].valid && bufDescTable[i].pinCnt > 0)
+          throw PagePinnedException(bufDescTable[i].file->filename(), bufDescTable[i].pageNo, i);
+      }
+      pool = mremap(bufPool, poolBytes, newBytes, MREMAP_MAYMOVE);
+      if (pool == MAP_FAILED)
+      {
+        // hugetlb mappings cannot be remapped at all; copy the frames to a new one
+        pool = mapPool(newBytes);
+        if (pool == MAP_FAILED)
+          throw std::bad_alloc();
+        memcpy(pool, static_cast<void*>(bufPool), (std::size_t) numBufs * sizeof(Page));
+        munmap(bufPool, poolBytes);
+      }
+    }
+    bufPool = static_cast<Page*>(pool);
+    poolBytes = newBytes;
+  }
+
+  BufDesc* newTable = new BufDesc[newBufs];
+  for (FrameId i = 0; i < newBufs; i++)
+  {
+    if (i < numBufs)
+      newTable[i] = bufDescTable[i];
+    newTable[i].frameNo = i;
+  }
+  delete [] bufDescTable;
+  bufDescTable = newTable;
+  numBufs = newBufs;
+
+  // partition boundaries have moved
+  applyPlacement();
+  for (std::uint32_t part = 0; part < numPartitions; part++)
+  {
+    if (partitionEnd(part) > partitionBegin(part))
+      clockHands[part] = partitionEnd(part) - 1;
+  }
+
+  hashTable->resize(hashTableSize(newBufs));
 }
 
 
 BufMgr::~BufMgr() {
+  stopBackgroundWriter();
+
   //Flush out all unwritten pages
+  std::vector<BufDesc*> dirtyBufs;
   for (std::uint32_t i = 0; i < numBufs; i++) 
   {
   	BufDesc* tmpbuf = &(bufDescTable[i]);
   	if (tmpbuf->valid == true && tmpbuf->dirty == true)
-		{
-			tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
-  	}
+			dirtyBufs.push_back(tmpbuf);
+  }
+  try
+  {
+    writeBack(dirtyBufs);
+    if (log != NULL)
+    {
+      // every logged change is on disk now
+      syncFiles();
+      log->truncate(log->endLsn());
+    }
+  }
+  catch (const BadgerDbException&)
+  {
+    // the log keeps the changes that did not reach the disk; recovery replays them
   }
 
 	delete hashTable;
   delete [] bufDescTable;
-  delete [] bufPool;
+  munmap(bufPool, poolBytes);
 }
 
-void BufMgr::allocBuf(FrameId & frame) 
+std::uint32_t BufMgr::localPartition() const
+{
+  if (numPartitions == 1)
+    return 0;
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+    return 0;
+  return node % numPartitions;
+}
+
+bool BufMgr::allocBufIn(std::uint32_t part, FrameId & frame)
 {
   // perform first part of clock algorithm to search for 
   // open buffer frame
   // Assumes non-concurrent access to buffer manager
+  std::uint32_t partBufs = partitionEnd(part) - partitionBegin(part);
   std::uint32_t numScanned = 0;
   bool found = 0;
+  FrameId& clockHand = clockHands[part];
 
-  while (numScanned < 2*numBufs)	//Need to scn twice
+  if (partBufs == 0)
+    return false;
+
+  while (numScanned < 2*partBufs)	//Need to scn twice
   {
     // advance the clock
-    advanceClock();
+    advanceClock(part);
     numScanned++;
 
     // if invalid, use frame
     if (! bufDescTable[clockHand].valid)
     {
+      found = true;
       break;
     }
 
@@ -84,6 +351,7 @@ void BufMgr::allocBuf(FrameId & frame)
         // hasn't been referenced and is not pinned, use it
         // remove previous entry from hash table
         hashTable->remove(bufDescTable[clockHand].file, bufDescTable[clockHand].pageNo);
+        unlinkFrame(clockHand);
         found = true;
         break;
       }
@@ -96,18 +364,20 @@ void BufMgr::allocBuf(FrameId & frame)
     }
   }
   
-  // check for full buffer pool
-  if (!found && numScanned >= 2*numBufs)
+  // check for full partition
+  if (!found)
   {
-    throw BufferExceededException();
+    return false;
   }
   
   // flush any existing changes to disk if necessary
   if (bufDescTable[clockHand].dirty)
   {
     bufStats.diskwrites++;
+    forceLog(bufDescTable[clockHand].pageLSN);
     //status = bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo,
     bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo, bufPool[clockHand]);
+    noteWritten(&bufDescTable[clockHand]);
   }
 
 	//Reset all the BufDesc entry for the frame before returning the frame
@@ -115,10 +385,23 @@ void BufMgr::allocBuf(FrameId & frame)
 
   // return new frame number
   frame = clockHand;
+  return true;
+}
+
+void BufMgr::allocBuf(FrameId & frame) 
+{
+  // prefer memory on the caller's node, then fall back to the other partitions
+  std::uint32_t home = localPartition();
+  for (std::uint32_t k = 0; k < numPartitions; k++)
+  {
+    if (allocBufIn((home + k) % numPartitions, frame))
+      return;
+  }
+  throw BufferExceededException();
 } // end allocBuf
 
 	
-void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
+FrameId BufMgr::pinPage(File* file, const PageId pageNo)
 {
   // check to see if it is already in the buffer pool
   // std::cout << "readPage called on file.page " << file << "." << pageNo << endl;
@@ -130,7 +413,6 @@ void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
     // set the referenced bit
     bufDescTable[frameNo].refbit = true;
     bufDescTable[frameNo].pinCnt++;
-    page = &bufPool[frameNo];
   }
   catch(const HashNotFoundException &e) //not in the buffer pool, must allocate a new page
   {
@@ -144,16 +426,61 @@ void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
 
     // set up the entry properly
     bufDescTable[frameNo].Set(file, pageNo);
-    page = &bufPool[frameNo];
+    linkFrame(frameNo);
 
     // insert in the hash table
     hashTable->insert(file, pageNo, frameNo);
   }
+  return frameNo;
+}
+
+FrameId BufMgr::fixPage(File* file, const PageId pageNo)
+{
+  {
+    SlottedLatchGuard shared(bufLatch);
+
+    FrameId frameNo;
+    if (hashTable->find(file, pageNo, frameNo))
+    {
+      // nobody can evict the frame while the latch is held shared
+      bufDescTable[frameNo].pinCnt++;
+      bufDescTable[frameNo].refbit = true;
+      return frameNo;
+    }
+  }
+
+  std::lock_guard<SlottedSharedLatch> lock(bufLatch);
+  return pinPage(file, pageNo);
+}
+
+void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
+{
+  page = &bufPool[fixPage(file, pageNo)];
+}
+
+void BufMgr::readPage(File* file, const PageId pageNo, Page*& page, FrameId& frameNo)
+{
+  frameNo = fixPage(file, pageNo);
+  page = &bufPool[frameNo];
+}
+
+ReadPageGuard BufMgr::readPageGuarded(File* file, const PageId pageNo)
+{
+  FrameId frameNo = fixPage(file, pageNo);
+  return ReadPageGuard(this, pageNo, frameNo, &bufPool[frameNo]);
+}
+
+WritePageGuard BufMgr::writePageGuarded(File* file, const PageId pageNo)
+{
+  FrameId frameNo = fixPage(file, pageNo);
+  return WritePageGuard(this, pageNo, frameNo, &bufPool[frameNo], false);
 }
 
 
 void BufMgr::unPinPage(File* file, const PageId pageNo, const bool dirty) 
 {
+  std::lock_guard<SlottedSharedLatch> lock(bufLatch);
+
   // lookup in hashtable
   FrameId frameNo = 0;
   hashTable->lookup(file, pageNo, frameNo);
@@ -168,7 +495,38 @@ void BufMgr::unPinPage(File* file, const PageId pageNo, const bool dirty)
   else bufDescTable[frameNo].pinCnt--;
 }
 
-void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page) 
+void BufMgr::markDirty(const FrameId frameNo, const Lsn recLsn)
+{
+  SlottedLatchGuard shared(bufLatch);
+
+  BufDesc* tmpbuf = &(bufDescTable[frameNo]);
+  tmpbuf->dirty = true;
+  Lsn cur = tmpbuf->recLSN;
+  while ((cur == 0 || recLsn < cur) && !tmpbuf->recLSN.compare_exchange_weak(cur, recLsn))
+    ;
+}
+
+void BufMgr::unPinPage(const FrameId frameNo, const bool dirty, const Lsn pageLsn) 
+{
+  SlottedLatchGuard shared(bufLatch);
+
+  BufDesc* tmpbuf = &(bufDescTable[frameNo]);
+  // set the dirty bit and LSN before the pin goes, so a writer that sees the
+  // frame unpinned also sees it dirty and knows how far to force the log
+  if (dirty == true) tmpbuf->dirty = dirty;
+  Lsn cur = tmpbuf->pageLSN;
+  while (pageLsn > cur && !tmpbuf->pageLSN.compare_exchange_weak(cur, pageLsn))
+    ;
+
+  int pins = tmpbuf->pinCnt;
+  do
+  {
+    if (pins == 0)
+    	throw PageNotPinnedException(tmpbuf->valid ? tmpbuf->file->filename() : std::string(), tmpbuf->pageNo, frameNo);
+  } while (!tmpbuf->pinCnt.compare_exchange_weak(pins, pins - 1));
+}
+
+FrameId BufMgr::allocFrame(File* file, PageId &pageNo) 
 {
   FrameId frameNo;
 
@@ -178,48 +536,192 @@ void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page)
   // allocate a new page in the file
 	//std::cerr << "buffer data size:" << bufPool[frameNo].data_.length() << "\n";
   bufPool[frameNo] = file->allocatePage(pageNo);
-  page = &bufPool[frameNo];
 
   // set up the entry properly
   bufDescTable[frameNo].Set(file, pageNo);
+  linkFrame(frameNo);
 
   // insert in the hash table
   hashTable->insert(file, pageNo, frameNo);
+  return frameNo;
+}
+
+void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page) 
+{
+  std::lock_guard<SlottedSharedLatch> lock(bufLatch);
+
+  page = &bufPool[allocFrame(file, pageNo)];
+}
+
+void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page, FrameId& frameNo) 
+{
+  std::lock_guard<SlottedSharedLatch> lock(bufLatch);
+
+  frameNo = allocFrame(file, pageNo);
+  page = &bufPool[frameNo];
+}
+
+WritePageGuard BufMgr::allocPageGuarded(File* file, PageId &pageNo) 
+{
+  std::lock_guard<SlottedSharedLatch> lock(bufLatch);
+
+  FrameId frameNo = allocFrame(file, pageNo);
+  return WritePageGuard(this, pageNo, frameNo, &bufPool[frameNo], true);
+}
+
+bool BufMgr::holdPage(File* file, const PageId pageNo)
+{
+  if (heldCount.load(std::memory_order_relaxed) >= std::min(HELD_PAGE_SLOTS / 2, numBufs / 4))
+    return false;
+
+  std::lock_guard<SlottedSharedLatch> lock(bufLatch);
+  FrameId frameNo;
+  if (!holdsEnabled || heldCount >= std::min(HELD_PAGE_SLOTS / 2, numBufs / 4) ||
+      !hashTable->find(file, pageNo, frameNo) || bufDescTable[frameNo].held)
+    return false;
+
+  std::uint32_t slot = heldSlot(file, pageNo);
+  while (heldPages[slot].state.load(std::memory_order_relaxed) != 0)
+    slot = (slot + 1) % HELD_PAGE_SLOTS;
+  heldPages[slot].file = file;
+  heldPages[slot].pageNo = pageNo;
+  heldPages[slot].frameNo = frameNo;
+  heldPages[slot].state.store(1, std::memory_order_release);
+
+  bufDescTable[frameNo].held = true;
+  bufDescTable[frameNo].pinCnt++;
+  heldCount++;
+  return true;
+}
+
+const Page* BufMgr::heldPage(const File* file, const PageId pageNo)
+{
+  // pairs with drainHeldReaders(): either it sees our section or we see it has begun
+  if (!holdsEnabled.load())
+    return NULL;
+
+  for (std::uint32_t slot = heldSlot(file, pageNo); ; slot = (slot + 1) % HELD_PAGE_SLOTS)
+  {
+    const HeldPage& held = heldPages[slot];
+    if (held.state.load(std::memory_order_acquire) == 0)
+      return NULL;
+    if (held.pageNo == pageNo && held.file == file)
+      return &bufPool[held.frameNo];
+  }
+}
+
+std::uint32_t BufMgr::heldSlot(const File* file, const PageId pageNo)
+{
+  std::uint64_t key = reinterpret_cast<std::uintptr_t>(file) ^ ((std::uint64_t) pageNo << 20);
+  return (std::uint32_t) ((key * 0x9e3779b97f4a7c15ULL) >> 40) % HELD_PAGE_SLOTS;
+}
+
+void BufMgr::drainHeldReaders()
+{
+  holdsEnabled.store(false);
+  for (std::uint32_t i = 0; i < READER_SLOTS; i++)
+  {
+    while (heldReaders[i].readers.load() != 0)
+      std::this_thread::yield();
+  }
+}
+
+void BufMgr::releaseHolds(const File* file)
+{
+  std::vector<const File*> keptFiles;
+  std::vector<PageId> keptPages;
+  std::vector<FrameId> keptFrames;
+  for (std::uint32_t i = 0; i < HELD_PAGE_SLOTS; i++)
+  {
+    HeldPage* held = &heldPages[i];
+    if (held->state == 0)
+      continue;
+    if (file == NULL || held->file == file)
+    {
+      BufDesc* tmpbuf = &(bufDescTable[held->frameNo]);
+      tmpbuf->held = false;
+      tmpbuf->pinCnt--;
+      heldCount--;
+    }
+    else
+    {
+      keptFiles.push_back(held->file);
+      keptPages.push_back(held->pageNo);
+      keptFrames.push_back(held->frameNo);
+    }
+    held->state = 0;
+  }
+
+  // the entries left may be cut off from their probe sequence; put them back afresh
+  for (std::size_t i = 0; i < keptFiles.size(); i++)
+  {
+    std::uint32_t slot = heldSlot(keptFiles[i], keptPages[i]);
+    while (heldPages[slot].state != 0)
+      slot = (slot + 1) % HELD_PAGE_SLOTS;
+    heldPages[slot].file = keptFiles[i];
+    heldPages[slot].pageNo = keptPages[i];
+    heldPages[slot].frameNo = keptFrames[i];
+    heldPages[slot].state = 1;
+  }
+  holdsEnabled.store(true);
 }
 
 void BufMgr::flushFile(const File* file) 
 {
-  for (std::uint32_t i = 0; i < numBufs; i++)
+  std::unique_lock<std::mutex> holds(holdMutex, std::defer_lock);
+  if (file != NULL)
+  {
+    holds.lock();
+    drainHeldReaders();
+  }
+  std::lock_guard<SlottedSharedLatch> lock(bufLatch);
+  if (file != NULL)
+    releaseHolds(file);
+
+  std::unordered_map<const File*, FrameId>::iterator head = fileFrames.find(file);
+  if (head == fileFrames.end())
+    return;
+
+  std::vector<BufDesc*> fileBufs;
+  std::vector<BufDesc*> dirtyBufs;
+  for (FrameId i = head->second; i != NO_FRAME; i = bufDescTable[i].nextInFile)
 	{
   	BufDesc* tmpbuf = &(bufDescTable[i]);
-  	if(tmpbuf->file && tmpbuf->valid == true && tmpbuf->file == file)
-		{
-	    if (tmpbuf->pinCnt > 0)
-  			throw PagePinnedException(file->filename(), tmpbuf->pageNo, tmpbuf->frameNo);
+	  if (tmpbuf->pinCnt > 0)
+  		throw PagePinnedException(file->filename(), tmpbuf->pageNo, tmpbuf->frameNo);
+
+	  fileBufs.push_back(tmpbuf);
+	  if (tmpbuf->dirty == true)
+	    dirtyBufs.push_back(tmpbuf);
+  }
 
-	    if (tmpbuf->dirty == true)
-			{
-				//if ((status = tmpbuf->file->writePage(tmpbuf->pageNo, &(bufPool[i]))) != OK)
-				tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
-				tmpbuf->dirty = false;
-    	}
+  writeBack(dirtyBufs);
+  std::unordered_set<File*>::iterator unsynced = unsyncedFiles.find(const_cast<File*>(file));
+  if (unsynced != unsyncedFiles.end())
+  {
+    (*unsynced)->sync();
+    unsyncedFiles.erase(unsynced);
+  }
 
-    	hashTable->remove(file,tmpbuf->pageNo);
-    	tmpbuf->Clear();
-  	}
-		else if (tmpbuf->valid == false && tmpbuf->file == file)
-  		throw BadBufferException(tmpbuf->frameNo, tmpbuf->dirty, tmpbuf->valid, tmpbuf->refbit);
+  for (std::size_t i = 0; i < fileBufs.size(); i++)
+	{
+    hashTable->remove(file, fileBufs[i]->pageNo);
+    fileBufs[i]->Clear();
   }
+  fileFrames.erase(head);
 }
 
 void BufMgr::disposePage(File* file, const PageId pageNo)
 {
+  std::lock_guard<SlottedSharedLatch> lock(bufLatch);
+
 	//Deallocate from file altogether
   //See if it is in the buffer pool
   FrameId frameNo = 0;
   hashTable->lookup(file, pageNo, frameNo);
 
 	// clear the page
+	unlinkFrame(frameNo);
 	bufDescTable[frameNo].Clear();
 
 	hashTable->remove(file, pageNo);
@@ -228,6 +730,289 @@ void BufMgr::disposePage(File* file, const PageId pageNo)
   file->deletePage(pageNo);
 }
 
+void BufMgr::linkFrame(FrameId frameNo)
+{
+  BufDesc* tmpbuf = &(bufDescTable[frameNo]);
+  std::unordered_map<const File*, FrameId>::iterator head = fileFrames.find(tmpbuf->file);
+
+  tmpbuf->prevInFile = NO_FRAME;
+  if (head == fileFrames.end())
+  {
+    tmpbuf->nextInFile = NO_FRAME;
+    fileFrames[tmpbuf->file] = frameNo;
+  }
+  else
+  {
+    tmpbuf->nextInFile = head->second;
+    bufDescTable[head->second].prevInFile = frameNo;
+    head->second = frameNo;
+  }
+}
+
+void BufMgr::unlinkFrame(FrameId frameNo)
+{
+  BufDesc* tmpbuf = &(bufDescTable[frameNo]);
+
+  if (tmpbuf->nextInFile != NO_FRAME)
+    bufDescTable[tmpbuf->nextInFile].prevInFile = tmpbuf->prevInFile;
+
+  if (tmpbuf->prevInFile != NO_FRAME)
+    bufDescTable[tmpbuf->prevInFile].nextInFile = tmpbuf->nextInFile;
+  else if (tmpbuf->nextInFile != NO_FRAME)
+    fileFrames[tmpbuf->file] = tmpbuf->nextInFile;
+  else
+    fileFrames.erase(tmpbuf->file);
+
+  tmpbuf->prevInFile = tmpbuf->nextInFile = NO_FRAME;
+}
+
+std::uint32_t BufMgr::cleanAhead(std::uint32_t maxPages)
+{
+  std::uint32_t written = 0;
+
+  for (std::uint32_t part = 0; part < numPartitions; part++)
+  {
+    // Look at the frames the clock hand reaches next. Frames with the refbit set
+    // get another sweep before they can be evicted, so the window covers a
+    // quarter of the partition.
+    FrameId begin = partitionBegin(part);
+    std::uint32_t partBufs = partitionEnd(part) - begin;
+    std::uint32_t window = partBufs / 4 + 1;
+    FrameId frameNo = clockHands[part];
+
+    for (std::uint32_t i = 0; i < window && i < partBufs && written < maxPages; i++)
+    {
+      frameNo = begin + (frameNo - begin + 1) % partBufs;
+      BufDesc* tmpbuf = &(bufDescTable[frameNo]);
+      if (tmpbuf->valid && tmpbuf->dirty && tmpbuf->pinCnt == (tmpbuf->held ? 1 : 0))
+      {
+        forceLog(tmpbuf->pageLSN);
+        tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[frameNo]);
+        noteWritten(tmpbuf);
+        tmpbuf->dirty = false;
+        bufStats.diskwrites++;
+        bufStats.cleanerwrites++;
+        written++;
+      }
+    }
+  }
+  return written;
+}
+
+std::uint32_t BufMgr::checkpoint()
+{
+  std::lock_guard<SlottedSharedLatch> lock(bufLatch);
+
+  std::vector<BufDesc*> dirtyBufs;
+  for (std::uint32_t i = 0; i < numBufs; i++)
+  {
+    BufDesc* tmpbuf = &(bufDescTable[i]);
+    // pinning takes the latch, so the only pin a held frame can have now is the hold
+    if (tmpbuf->valid && tmpbuf->dirty && tmpbuf->pinCnt == (tmpbuf->held ? 1 : 0))
+      dirtyBufs.push_back(tmpbuf);
+  }
+
+  writeBack(dirtyBufs);
+  bufStats.cleanerwrites += dirtyBufs.size();
+
+  if (log != NULL)
+  {
+    // Records older than every logged change still only in memory describe pages
+    // that are on disk once the files are synced. Units in flight mark their
+    // frames before they reach the log, and cannot do so while we hold the latch.
+    syncFiles();
+    Lsn keep = log->endLsn();
+    for (std::uint32_t i = 0; i < numBufs; i++)
+    {
+      Lsn rec = bufDescTable[i].recLSN;
+      if (bufDescTable[i].valid && rec != 0 && rec < keep)
+        keep = rec;
+    }
+    log->truncate(keep);
+  }
+  return dirtyBufs.size();
+}
+
+void BufMgr::writeBack(std::vector<BufDesc*>& dirtyBufs)
+{
+  // write-ahead rule: one log force covers the whole batch
+  Lsn upTo = 0;
+  for (std::size_t k = 0; k < dirtyBufs.size(); k++)
+    upTo = std::max(upTo, dirtyBufs[k]->pageLSN.load());
+  forceLog(upTo);
+
+  std::sort(dirtyBufs.begin(), dirtyBufs.end(),
+      [](const BufDesc* a, const BufDesc* b) {
+        if (a->file != b->file)
+          return a->file < b->file;
+        return a->pageNo < b->pageNo;
+      });
+
+  std::vector<const Page*> run;
+  std::size_t i = 0;
+  while (i < dirtyBufs.size())
+  {
+    // gather the longest run of consecutive pages of one file
+    std::size_t j = i;
+    run.clear();
+    do
+    {
+      run.push_back(&bufPool[dirtyBufs[j]->frameNo]);
+      j++;
+    } while (j < dirtyBufs.size() && dirtyBufs[j]->file == dirtyBufs[i]->file
+             && dirtyBufs[j]->pageNo == dirtyBufs[j-1]->pageNo + 1);
+
+    dirtyBufs[i]->file->writePages(dirtyBufs[i]->pageNo, &run[0], run.size());
+    for (; i < j; i++)
+    {
+      noteWritten(dirtyBufs[i]);
+      dirtyBufs[i]->dirty = false;
+      bufStats.diskwrites++;
+    }
+  }
+}
+
+void BufMgr::noteWritten(BufDesc* buf)
+{
+  if (buf->recLSN != 0)
+  {
+    unsyncedFiles.insert(buf->file);
+    buf->recLSN = 0;
+  }
+}
+
+void BufMgr::syncFiles()
+{
+  // a file whose sync fails stays unsynced, so the log is not truncated past it
+  while (!unsyncedFiles.empty())
+  {
+    std::unordered_set<File*>::iterator it = unsyncedFiles.begin();
+    (*it)->sync();
+    unsyncedFiles.erase(it);
+  }
+}
+
+void BufMgr::attachLog(LogManager* logMgr)
+{
+  std::lock_guard<SlottedSharedLatch> lock(bufLatch);
+  log = logMgr;
+}
+
+void BufMgr::backgroundWriter(unsigned intervalMs, std::uint32_t maxPages)
+{
+  std::unique_lock<std::mutex> lock(writerMutex);
+  while (!writerStop)
+  {
+    writerWakeup.wait_for(lock, std::chrono::milliseconds(intervalMs));
+    if (writerStop)
+      break;
+    lock.unlock();
+    try
+    {
+      std::lock_guard<SlottedSharedLatch> latch(bufLatch);
+      cleanAhead(maxPages);
+    }
+    catch (const BadgerDbException&)
+    {
+      // pages that failed to write stay dirty and are tried again next round
+    }
+    lock.lock();
+  }
+}
+
+void BufMgr::startBackgroundWriter(unsigned intervalMs, std::uint32_t maxPages)
+{
+  std::lock_guard<std::mutex> lock(writerMutex);
+  if (writerThread.joinable())
+    return;
+  writerStop = false;
+  writerThread = std::thread(&BufMgr::backgroundWriter, this, intervalMs, maxPages);
+}
+
+void BufMgr::stopBackgroundWriter()
+{
+  {
+    std::lock_guard<std::mutex> lock(writerMutex);
+    if (!writerThread.joinable())
+      return;
+    writerStop = true;
+  }
+  writerWakeup.notify_all();
+  writerThread.join();
+}
+
+//----------------------------------------
+// PageGuard
+//----------------------------------------
+
+PageGuard::PageGuard()
+  : bufMgr_(NULL), pageNo_(Page::INVALID_NUMBER), frameNo_(NO_FRAME), page_(NULL), dirty_(false),
+    pageLsn_(0)
+{
+}
+
+PageGuard::PageGuard(BufMgr* bufMgr, PageId pageNo, FrameId frameNo, Page* page, bool dirty)
+  : bufMgr_(bufMgr), pageNo_(pageNo), frameNo_(frameNo), page_(page), dirty_(dirty),
+    pageLsn_(0)
+{
+}
+
+PageGuard::PageGuard(PageGuard&& other)
+  : bufMgr_(other.bufMgr_), pageNo_(other.pageNo_), frameNo_(other.frameNo_),
+    page_(other.page_), dirty_(other.dirty_), pageLsn_(other.pageLsn_)
+{
+  other.page_ = NULL;
+  other.bufMgr_ = NULL;
+}
+
+PageGuard& PageGuard::operator=(PageGuard&& other)
+{
+  if (this != &other)
+  {
+    release();
+    bufMgr_ = other.bufMgr_;
+    pageNo_ = other.pageNo_;
+    frameNo_ = other.frameNo_;
+    page_ = other.page_;
+    dirty_ = other.dirty_;
+    pageLsn_ = other.pageLsn_;
+    other.page_ = NULL;
+    other.bufMgr_ = NULL;
+  }
+  return *this;
+}
+
+PageGuard::~PageGuard()
+{
+  try
+  {
+    release();
+  }
+  catch (const BadgerDbException &e)
+  {
+  }
+}
+
+void PageGuard::release()
+{
+  if (page_ == NULL)
+    return;
+
+  BufMgr* bufMgr = bufMgr_;
+  page_ = NULL;
+  bufMgr_ = NULL;
+  if (bufMgr != NULL)
+    bufMgr->unPinPage(frameNo_, dirty_, pageLsn_);
+  dirty_ = false;
+  pageLsn_ = 0;
+}
+
+void WritePageGuard::markDirty(const Lsn recLsn)
+{
+  dirty_ = true;
+  bufMgr_->markDirty(frameNo_, recLsn);
+}
+
 void BufMgr::printSelf(void) 
 {
   BufDesc* tmpbuf;
@@ -9,7 +9,16 @@
 
 #include "file.h"
 #include "bufHashTbl.h"
+#include "latch.h"
+#include "wal.h"
 #include <iostream>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 namespace badgerdb {
 
@@ -18,6 +27,29 @@ namespace badgerdb {
 */
 class BufMgr;
 
+/**
+* @brief Frame number used to terminate the per-file frame lists
+*/
+const FrameId NO_FRAME = static_cast<FrameId>(-1);
+
+/**
+* @brief Number of slots of the table of held pages; at most half of them are used
+*/
+const std::uint32_t HELD_PAGE_SLOTS = 2048;
+
+/**
+* @brief Entry of the table of held pages. Filled in while state is 0, then published by
+* setting state to 1; readers only look at the other fields once they see the 1.
+*/
+struct HeldPage
+{
+	std::atomic<int> state;
+	const File* file;
+	PageId pageNo;
+	FrameId frameNo;
+};
+
+
 /**
 * @brief Class for maintaining information about buffer pool frames
 */
@@ -42,24 +74,52 @@ class BufDesc {
   FrameId	frameNo;
 
 	/**
-   * Number of times this page has been pinned
+   * Number of times this page has been pinned. Updated by concurrent readers.
 	 */
-  int pinCnt;
+  std::atomic<int> pinCnt;
 
 	/**
    * True if page is dirty;  false otherwise
 	 */
-  bool dirty;
+  std::atomic<bool> dirty;
 
 	/**
    * True if page is valid
 	 */
   bool valid;
 
+	/**
+   * True if the page is held by BufMgr::holdPage(); the hold counts as one pin
+	 */
+  bool held;
+
 	/**
    * Has this buffer frame been reference recently
 	 */
-  bool refbit;
+  std::atomic<bool> refbit;
+
+	/**
+   * Lower bound on the LSN of the first logged change that is not on disk yet;
+   * zero if the page has no unwritten logged changes. The log is not truncated
+   * past it.
+	 */
+  std::atomic<Lsn> recLSN;
+
+	/**
+   * LSN of the last logged change to the page. The page is not written before
+   * the log is durable up to it.
+	 */
+  std::atomic<Lsn> pageLSN;
+
+	/**
+   * Previous frame holding a page of the same file, or NO_FRAME
+	 */
+  FrameId prevInFile;
+
+	/**
+   * Next frame holding a page of the same file, or NO_FRAME
+	 */
+  FrameId nextInFile;
 
 	/**
    * Initialize buffer frame for a new user
@@ -72,6 +132,9 @@ class BufDesc {
     dirty = false;
     refbit = false;
 		valid = false;
+		held = false;
+		recLSN = pageLSN = 0;
+		prevInFile = nextInFile = NO_FRAME;
   };
 
 	/**
@@ -88,7 +151,9 @@ class BufDesc {
     pinCnt = 1;
     dirty = false;
     valid = true;
+    held = false;
     refbit = true;
+    recLSN = pageLSN = 0;
   }
 
   void Print()
@@ -103,6 +168,7 @@ class BufDesc {
 
 		std::cout << "valid:" << valid << " ";
 		std::cout << "pinCnt:" << pinCnt << " ";
+		std::cout << "held:" << held << " ";
 		std::cout << "dirty:" << dirty << " ";
 		std::cout << "refbit:" << refbit << "\n";
   }
@@ -113,10 +179,41 @@ class BufDesc {
   BufDesc()
 	{
   	Clear();
+  }
+
+	/**
+   * Copy the state of another descriptor. Used when the frame table is reallocated.
+	 */
+  BufDesc& operator=(const BufDesc& other)
+	{
+		file = other.file;
+		pageNo = other.pageNo;
+		frameNo = other.frameNo;
+		pinCnt = other.pinCnt.load();
+		dirty = other.dirty.load();
+		valid = other.valid;
+		held = other.held;
+		refbit = other.refbit.load();
+		recLSN = other.recLSN.load();
+		pageLSN = other.pageLSN.load();
+		prevInFile = other.prevInFile;
+		nextInFile = other.nextInFile;
+		return *this;
   }
 };
 
 
+/**
+* @brief Placement of the buffer pool memory on NUMA machines. Passed to the BufMgr constructor.
+*/
+enum PoolPlacement
+{
+	POOL_DEFAULT = 0,		/* First-touch placement chosen by the kernel */
+	POOL_INTERLEAVE = 1,	/* Pool pages interleaved round-robin over all nodes */
+	POOL_PARTITION = 2		/* One slice of the pool per node, each with its own clock hand */
+};
+
+
 /**
 * @brief Class to maintain statistics of buffer usage 
 */
@@ -137,12 +234,18 @@ struct BufStats
 	 */
   int diskwrites;
 
+	/**
+   * Number of pages written back by the background writer or a checkpoint
+   * (also counted in diskwrites)
+	 */
+  int cleanerwrites;
+
 	/**
    * Clear all values 
 	 */
   void clear()
   {
-		accesses = diskreads = diskwrites = 0;
+		accesses = diskreads = diskwrites = cleanerwrites = 0;
   }
       
 	/**
@@ -155,16 +258,233 @@ struct BufStats
 };
 
 
+/**
+* @brief Move-only handle to a page pinned in the buffer pool. The page is unpinned when the
+* guard is released, destroyed or assigned over, so pins cannot leak when an exception
+* unwinds past the code that pinned the page. The guard remembers the frame holding the
+* page, so unpinning does not go through the hash table.
+*/
+class PageGuard
+{
+ public:
+	/**
+   * Construct a guard that holds no page
+	 */
+  PageGuard();
+
+	/**
+   * Take over the page held by another guard; the other guard is left empty
+	 */
+  PageGuard(PageGuard&& other);
+
+	/**
+   * Release the page currently held, then take over the page held by another guard
+	 */
+  PageGuard& operator=(PageGuard&& other);
+
+  PageGuard(const PageGuard&) = delete;
+  PageGuard& operator=(const PageGuard&) = delete;
+
+	/**
+   * Unpin the page if it is still held. Errors are swallowed.
+	 */
+  ~PageGuard();
+
+	/**
+   * Unpin the page now, marking it dirty if it was modified and passing on the LSN
+	 * set with WritePageGuard::setPageLsn(). Does nothing if the guard holds no page.
+	 *
+   * @throws  PageNotPinnedException If the page is no longer pinned
+	 */
+  void release();
+
+	/**
+   * Returns true if the guard holds a page
+	 */
+  bool isHeld() const { return page_ != NULL; }
+
+	/**
+   * Returns the number of the held page in its file
+	 */
+  PageId pageNo() const { return pageNo_; }
+
+	/**
+   * Returns the buffer pool frame holding the page
+	 */
+  FrameId frameNo() const { return frameNo_; }
+
+ protected:
+	/**
+   * Construct a guard for a page pinned by bufMgr, or for a page outside the buffer
+	 * pool if bufMgr is NULL
+	 */
+  PageGuard(BufMgr* bufMgr, PageId pageNo, FrameId frameNo, Page* page, bool dirty);
+
+	/**
+   * Buffer manager the page is pinned in; NULL for pages outside the buffer pool
+	 */
+  BufMgr* bufMgr_;
+
+	/**
+   * Page number in the file
+	 */
+  PageId pageNo_;
+
+	/**
+   * Frame holding the page
+	 */
+  FrameId frameNo_;
+
+	/**
+   * The pinned page, or NULL if the guard holds nothing
+	 */
+  Page* page_;
+
+	/**
+   * True if the page has to be marked dirty when it is unpinned
+	 */
+  bool dirty_;
+
+	/**
+   * LSN of the last logged change, handed to the buffer manager on unpin; zero if none
+	 */
+  Lsn pageLsn_;
+
+  friend class BufMgr;
+};
+
+/**
+* @brief Page guard giving read-only access to the page.
+*/
+class ReadPageGuard : public PageGuard
+{
+ public:
+  ReadPageGuard() {}
+  ReadPageGuard(ReadPageGuard&& other) : PageGuard(std::move(other)) {}
+  ReadPageGuard& operator=(ReadPageGuard&& other) { PageGuard::operator=(std::move(other)); return *this; }
+
+	/**
+   * Wrap a page that does not live in the buffer pool, such as a page of a read-only
+	 * file mapping. Releasing the guard does nothing.
+	 *
+	 * @param page		The page
+	 * @param pageNo	Page number of the page in its file
+	 */
+  ReadPageGuard(const Page* page, PageId pageNo)
+    : PageGuard(NULL, pageNo, NO_FRAME, const_cast<Page*>(page), false) {}
+
+	/**
+   * Returns the page
+	 */
+  const Page* page() const { return page_; }
+
+	/**
+   * Returns the page contents viewed as a T, e.g. a B+ tree node
+	 */
+  template <class T>
+  const T* as() const { return reinterpret_cast<const T*>(page_); }
+
+ private:
+  ReadPageGuard(BufMgr* bufMgr, PageId pageNo, FrameId frameNo, Page* page)
+    : PageGuard(bufMgr, pageNo, frameNo, page, false) {}
+
+  friend class BufMgr;
+};
+
+/**
+* @brief Page guard giving write access to the page. Call markDirty() after changing
+* the page so that it is written back.
+*/
+class WritePageGuard : public PageGuard
+{
+ public:
+  WritePageGuard() {}
+  WritePageGuard(WritePageGuard&& other) : PageGuard(std::move(other)) {}
+  WritePageGuard& operator=(WritePageGuard&& other) { PageGuard::operator=(std::move(other)); return *this; }
+
+	/**
+   * Returns the page
+	 */
+  Page* page() const { return page_; }
+
+	/**
+   * Returns the page contents viewed as a T, e.g. a B+ tree node
+	 */
+  template <class T>
+  T* as() const { return reinterpret_cast<T*>(page_); }
+
+	/**
+   * Mark the page dirty; it is flagged in the buffer pool when the guard is released
+	 */
+  void markDirty() { dirty_ = true; }
+
+	/**
+   * Mark the page dirty with a change that is about to be logged. The frame is flagged
+	 * right away, before the change reaches the log, so that a checkpoint does not
+	 * truncate the log past it.
+	 *
+	 * @param recLsn	LogManager::endLsn() read before the change was committed to the log
+	 */
+  void markDirty(const Lsn recLsn);
+
+	/**
+   * Record the LSN of the logged change; the page is not written back before the
+	 * log is durable up to it.
+	 *
+	 * @param lsn		Commit LSN returned by LogManager::commit()
+	 */
+  void setPageLsn(const Lsn lsn) { if (lsn > pageLsn_) pageLsn_ = lsn; }
+
+ private:
+  WritePageGuard(BufMgr* bufMgr, PageId pageNo, FrameId frameNo, Page* page, bool dirty)
+    : PageGuard(bufMgr, pageNo, frameNo, page, dirty) {}
+
+  friend class BufMgr;
+};
+
+
 /**
 * @brief The central class which manages the buffer pool including frame allocation and deallocation to pages in the file 
 */
 class BufMgr 
 {
+  friend class WritePageGuard;
+
  private:
 	/**
-   * Current position of clockhand in our buffer pool
+   * Number of pool partitions; one per NUMA node with POOL_PARTITION, otherwise one
+	 */
+  std::uint32_t numPartitions;
+
+	/**
+   * Current position of the clockhand in each partition of our buffer pool
+	 */
+  std::vector<FrameId> clockHands;
+
+	/**
+   * Size in bytes of the anonymous mapping that backs bufPool
 	 */
-  FrameId clockHand;
+  std::size_t poolBytes;
+
+	/**
+   * NUMA placement requested for the pool
+	 */
+  PoolPlacement poolPlacement;
+
+	/**
+   * Number of NUMA nodes the pool is spread over
+	 */
+  std::uint32_t numNodes;
+
+	/**
+   * (Re)apply the NUMA memory policy of poolPlacement to the whole pool
+	 */
+  void applyPlacement();
+
+	/**
+   * Number of hash table buckets used for a pool of the given size
+	 */
+  static int hashTableSize(std::uint32_t bufs);
 
 	/**
    * Number of frames in the buffer pool
@@ -181,21 +501,247 @@ class BufMgr
 	 */
   BufDesc *bufDescTable;
 
+	/**
+   * Maps each file with pages in the buffer pool to the first frame of the list,
+   * threaded through BufDesc::nextInFile, of all frames holding its pages
+	 */
+  std::unordered_map<const File*, FrameId> fileFrames;
+
 	/**
    * Maintains Buffer pool usage statistics 
 	 */
   BufStats bufStats;
 
 	/**
-   * Advance clock to next frame in the buffer pool
+	 * Add a frame that has just been assigned to a page to the frame list of its file.
+	 *
+	 * @param frameNo		Frame number
+	 */
+  void linkFrame(FrameId frameNo);
+
+	/**
+	 * Remove a valid frame from the frame list of its file before it is cleared.
+	 *
+	 * @param frameNo		Frame number
+	 */
+  void unlinkFrame(FrameId frameNo);
+
+	/**
+   * Write-ahead log the pool obeys, or NULL
+	 */
+  LogManager* log;
+
+	/**
+   * Files that had logged pages written back since they were last synced. They are
+   * synced before the log is truncated past the records describing those pages.
+	 */
+  std::unordered_set<File*> unsyncedFiles;
+
+	/**
+	 * Force the log out up to the LSN of a page that is about to be written back.
+	 *
+	 * @param pageLsn		LSN of the last logged change to the page; zero if none
 	 */
-  void advanceClock()
+  void forceLog(const Lsn pageLsn)
   {
-		clockHand = (clockHand + 1) % numBufs;
+		if (log != NULL && pageLsn != 0)
+			log->flush(pageLsn);
   }
 
 	/**
-	 * Allocate a free frame.  
+	 * Note that a frame has just been written back. Caller must hold bufLatch exclusively.
+	 *
+	 * @param buf				Descriptor of the frame
+	 */
+  void noteWritten(BufDesc* buf);
+
+	/**
+	 * Sync the files in unsyncedFiles. Caller must hold bufLatch exclusively.
+	 *
+	 * @throws FileIOException If a file could not be synced; it stays in unsyncedFiles
+	 */
+  void syncFiles();
+
+	/**
+	 * Flag a pinned frame dirty with a change that is about to be logged.
+	 *
+	 * @param frameNo		Frame number
+	 * @param recLsn		Lower bound on the LSN the change will get
+	 */
+  void markDirty(const FrameId frameNo, const Lsn recLsn);
+
+	/**
+   * Guards the frame table, the hash table and the files. Pinning a page that is
+   * already resident and unpinning by frame take it shared; everything that changes
+   * which page a frame holds, or does I/O, takes it exclusively.
+	 */
+  SlottedSharedLatch bufLatch;
+
+	/**
+   * Pages held by holdPage(), open-addressed by file and page number. Entries are only
+   * added, under bufLatch held exclusively, except by releaseHolds() once no reader is
+   * left.
+	 */
+  HeldPage heldPages[HELD_PAGE_SLOTS];
+
+	/**
+   * Number of entries in heldPages
+	 */
+  std::atomic<std::uint32_t> heldCount;
+
+	/**
+   * False while holds are released; readers then leave heldPages alone
+	 */
+  std::atomic<bool> holdsEnabled;
+
+	/**
+   * Readers inside a HeldReadSection, spread over slots by thread
+	 */
+  ReaderSlot heldReaders[READER_SLOTS];
+
+	/**
+   * Serializes releasing holds
+	 */
+  std::mutex holdMutex;
+
+	/**
+   * Slot of heldPages where the search for a page starts
+	 */
+  static std::uint32_t heldSlot(const File* file, const PageId pageNo);
+
+	/**
+	 * Stop new readers from using heldPages and wait for those inside a HeldReadSection
+	 * to leave. Caller holds holdMutex and not bufLatch.
+	 */
+  void drainHeldReaders();
+
+	/**
+	 * Release the holds on the pages of a file, or of every file, rebuild heldPages from
+	 * the rest and let readers use it again. Caller has drained the readers and holds
+	 * holdMutex and bufLatch exclusively.
+	 *
+	 * @param file		File whose pages to release; NULL for all
+	 */
+  void releaseHolds(const File* file);
+
+  friend class HeldReadSection;
+
+	/**
+   * Protects the background writer's start/stop handshake
+	 */
+  std::mutex writerMutex;
+
+	/**
+   * Background writer thread, if one has been started
+	 */
+  std::thread writerThread;
+
+	/**
+   * Wakes the background writer up early when it has to stop
+	 */
+  std::condition_variable writerWakeup;
+
+	/**
+   * Set to ask the background writer to exit
+	 */
+  bool writerStop;
+
+	/**
+   * Body of the background writer thread
+	 *
+	 * @param intervalMs	Milliseconds to sleep between cleaning rounds
+	 * @param maxPages		Maximum number of pages written per round
+	 */
+  void backgroundWriter(unsigned intervalMs, std::uint32_t maxPages);
+
+	/**
+	 * Write back the given dirty frames. Frames are sorted by file and page number and
+	 * runs of consecutive pages of a file go out in a single File::writePages() call.
+	 * The frames are marked clean. Caller must hold bufLatch exclusively.
+	 *
+	 * @param dirtyBufs		Descriptors of the frames to write; reordered by this call
+	 */
+  void writeBack(std::vector<BufDesc*>& dirtyBufs);
+
+	/**
+	 * Write back dirty, unpinned frames that the clock hand will reach next, so that
+	 * allocBuf() finds clean victims. Caller must hold bufLatch exclusively.
+	 *
+	 * @param maxPages		Maximum number of pages to write
+	 * @return						Number of pages written
+	 */
+  std::uint32_t cleanAhead(std::uint32_t maxPages);
+
+	/**
+   * First frame of a partition
+	 */
+  FrameId partitionBegin(std::uint32_t part) const
+  {
+		return (FrameId) (((std::uint64_t) numBufs * part) / numPartitions);
+  }
+
+	/**
+   * One past the last frame of a partition
+	 */
+  FrameId partitionEnd(std::uint32_t part) const
+  {
+		return partitionBegin(part + 1);
+  }
+
+	/**
+   * Advance the clock of a partition to the next frame in that partition
+	 */
+  void advanceClock(std::uint32_t part)
+  {
+		FrameId begin = partitionBegin(part);
+		clockHands[part] = begin + (clockHands[part] - begin + 1) % (partitionEnd(part) - begin);
+  }
+
+	/**
+   * Partition serving the NUMA node the calling thread runs on
+	 */
+  std::uint32_t localPartition() const;
+
+	/**
+	 * Run the clock algorithm over one partition of the pool.
+	 *
+	 * @param part			Partition to search
+	 * @param frame   	Frame ID of allocated frame returned via this variable
+	 * @return					False if every frame of the partition is pinned
+	 */
+  bool allocBufIn(std::uint32_t part, FrameId & frame);
+
+	/**
+	 * Pin the given page of the file, reading it into a free frame if it is not in the
+	 * buffer pool. Caller must hold bufLatch exclusively.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @return				Frame holding the page
+	 */
+  FrameId pinPage(File* file, const PageId pageNo);
+
+	/**
+	 * Pin the given page of the file. A page that is already resident is pinned under
+	 * the shared latch only; otherwise falls back to pinPage() under the exclusive latch.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @return				Frame holding the page
+	 */
+  FrameId fixPage(File* file, const PageId pageNo);
+
+	/**
+	 * Allocate a new page in the file and pin it in a free frame. Caller must hold bufLatch exclusively.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Number assigned to the new page
+	 * @return				Frame holding the page
+	 */
+  FrameId allocFrame(File* file, PageId &pageNo);
+
+	/**
+	 * Allocate a free frame, from the caller's own partition if possible.
 	 *
 	 * @param frame   	Frame reference, frame ID of allocated frame returned via this variable
 	 * @throws BufferExceededException If no such buffer is found which can be allocated
@@ -209,9 +755,16 @@ class BufMgr
   Page* bufPool;
 
 	/**
-   * Constructor of BufMgr class
+   * Constructor of BufMgr class.
+	 * The pool is an anonymous mapping backed by huge pages when the system has them
+	 * (transparent huge pages otherwise). Its memory is zero-filled by the kernel on
+	 * first touch, so construction does not walk the pool.
+	 *
+	 * @param bufs				Number of frames in the buffer pool
+	 * @param placement		How the pool memory is spread over NUMA nodes. Ignored on
+	 *                    machines with a single node.
 	 */
-  BufMgr(std::uint32_t bufs);
+  BufMgr(std::uint32_t bufs, const PoolPlacement placement = POOL_DEFAULT);
 	
 	/**
    * Destructor of BufMgr class
@@ -229,6 +782,17 @@ class BufMgr
 	 */
   void readPage(File* file, const PageId PageNo, Page*& page);
 
+	/**
+	 * Reads the given page like readPage() and also returns the frame holding it, so that
+	 * the caller can later unpin it with unPinPage(frameNo, dirty) without a hash lookup.
+	 *
+	 * @param file   	File object
+	 * @param PageNo  Page number in the file to be read
+	 * @param page  	Reference to page pointer. The in-memory Page object is returned via this reference.
+	 * @param frameNo	Frame number of the page is returned via this reference.
+	 */
+  void readPage(File* file, const PageId PageNo, Page*& page, FrameId& frameNo);
+
 	/**
 	 * Unpin a page from memory since it is no longer required for it to remain in memory.
 	 *
@@ -239,6 +803,18 @@ class BufMgr
 	 */
   void unPinPage(File* file, const PageId PageNo, const bool dirty);
 
+	/**
+	 * Unpin the page held by a frame returned from readPage() or allocPage(). Goes
+	 * straight to the frame's descriptor instead of probing the hash table.
+	 *
+	 * @param frameNo	Frame number
+	 * @param dirty		True if the page to be unpinned needs to be marked dirty
+	 * @param pageLsn	LSN of the log record describing the change, if it was logged.
+	 *                The page is not written back before the log is durable up to it.
+   * @throws  PageNotPinnedException If the page is not already pinned
+	 */
+  void unPinPage(const FrameId frameNo, const bool dirty, const Lsn pageLsn = 0);
+
 	/**
 	 * Allocates a new, empty page in the file and returns the Page object.
 	 * The newly allocated page is also assigned a frame in the buffer pool.
@@ -250,13 +826,81 @@ class BufMgr
   void allocPage(File* file, PageId &PageNo, Page*& page); 
 
 	/**
-	 * Writes out all dirty pages of the file to disk.
+	 * Allocates a new page like allocPage() and also returns the frame holding it.
+	 *
+	 * @param file   	File object
+	 * @param PageNo  Page number. The number assigned to the page in the file is returned via this reference.
+	 * @param page  	Reference to page pointer. The newly allocated in-memory Page object is returned via this reference.
+	 * @param frameNo	Frame number of the new page is returned via this reference.
+	 */
+  void allocPage(File* file, PageId &PageNo, Page*& page, FrameId& frameNo); 
+
+	/**
+	 * Reads the given page like readPage() and returns a guard that unpins it.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file to be read
+	 * @return				Guard holding the pinned page for reading
+	 */
+  ReadPageGuard readPageGuarded(File* file, const PageId pageNo);
+
+	/**
+	 * Reads the given page like readPage() and returns a guard that unpins it, marking
+	 * it dirty if the holder called markDirty().
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file to be read
+	 * @return				Guard holding the pinned page for writing
+	 */
+  WritePageGuard writePageGuarded(File* file, const PageId pageNo);
+
+	/**
+	 * Allocates a new page like allocPage() and returns a guard that unpins it. The new
+	 * page is already marked dirty.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number. The number assigned to the page in the file is returned via this reference.
+	 * @return				Guard holding the pinned page for writing
+	 */
+  WritePageGuard allocPageGuarded(File* file, PageId &pageNo);
+
+	/**
+	 * Keep a resident page pinned until its file is flushed or the pool is resized, and
+	 * let heldPage() find it without the latch or a pin. Meant for the few pages nearly
+	 * every access goes through, such as the upper levels of an index. Does nothing if
+	 * the page is not resident or already held, or if a quarter of the pool (at most
+	 * half of HELD_PAGE_SLOTS) is held already; that last check only reads a counter.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @return				True if the page is held now
+	 */
+  bool holdPage(File* file, const PageId pageNo);
+
+	/**
+	 * Find a held page. The caller must be inside a HeldReadSection and may use the page
+	 * until the section ends. Neither the latch nor any counter other threads write is
+	 * touched, so readers on many threads do not contend. Nor are they ordered with
+	 * writers of the page, so the page must carry its own synchronization, like the
+	 * version latch of an index node.
+	 *
+	 * @param file   	File object
+	 * @param pageNo  Page number in the file
+	 * @return				The page, or NULL if it is not held
+	 */
+  const Page* heldPage(const File* file, const PageId pageNo);
+
+	/**
+	 * Writes out all dirty pages of the file to disk, in page number order and with
+	 * consecutive pages coalesced into single writes, and removes the file's pages from the buffer pool.
+	 * Holds on pages of the file are released first.
+	 * With a log attached, the file is synced if it holds logged pages.
+	 * Only the frames holding pages of this file are visited.
 	 * All the frames assigned to the file need to be unpinned from buffer pool before this function can be successfully called.
-	 * Otherwise Error returned.
+	 * Otherwise Error returned and nothing is written.
 	 *
 	 * @param file   	File object
    * @throws  PagePinnedException If any page of the file is pinned in the buffer pool 
-   * @throws BadBufferException If any frame allocated to the file is found to be invalid
 	 */
   void flushFile(const File* file);
 
@@ -270,6 +914,67 @@ class BufMgr
   void disposePage(File* file, const PageId PageNo);
 
 	/**
+	 * Grow or shrink the buffer pool to the given number of frames while it is in use.
+	 * When shrinking, pages held by the frames that go away are moved into empty frames
+	 * that stay, or evicted (and written back if dirty) when there are none; their
+	 * memory is returned to the system. When growing, the pool mapping is extended in
+	 * place if possible. The hash table is resized and rehashed incrementally by later
+	 * calls. Every hold is released first.
+	 *
+	 * @param newBufs	New number of frames
+	 * @throws PagePinnedException If a frame that would have to move or go away is pinned
+	 * @throws BufferExceededException If newBufs is zero
+	 */
+  void resize(std::uint32_t newBufs);
+
+	/**
+	 * Write out every dirty, unpinned page in the buffer pool, in file and page number
+	 * order; a held page counts as unpinned unless it is also pinned otherwise. Frames
+	 * stay resident and are only marked clean. Pinned pages may be in the middle of an
+	 * update and are left for a later checkpoint.
+	 * With a log attached, the files written to are synced and the log is truncated
+	 * up to the oldest logged change still only in memory.
+	 *
+	 * @return				Number of pages written
+	 * @throws FileIOException If a page could not be written or a file synced; the log
+	 *				is then left as it was
+	 */
+  std::uint32_t checkpoint();
+
+	/**
+	 * Start a background thread that keeps writing back dirty, unpinned frames just
+	 * ahead of the clock hand, so that a page miss rarely has to wait for the write
+	 * of its victim. Does nothing if the writer is already running.
+	 *
+	 * @param intervalMs	Milliseconds to sleep between cleaning rounds
+	 * @param maxPages		Maximum number of pages written per round
+	 */
+  void startBackgroundWriter(unsigned intervalMs = 50, std::uint32_t maxPages = 16);
+
+	/**
+	 * Stop the background writer thread and wait for it to exit. Does nothing if no
+	 * writer is running.
+	 */
+  void stopBackgroundWriter();
+
+	/**
+	 * Make the pool obey a write-ahead log: no page is written back before the log
+	 * records describing its changes are durable. The log must outlive the buffer
+	 * manager or be detached by attaching NULL.
+	 *
+	 * @param logMgr		Log to attach, or NULL to detach
+	 */
+  void attachLog(LogManager* logMgr);
+
+	/**
+   * Returns the attached log, or NULL
+	 */
+  LogManager* getLog() const
+  {
+		return log;
+  }
+
+	/**
    * Print member variable values. 
 	 */
   void  printSelf();
@@ -291,4 +996,33 @@ class BufMgr
   }
 };
 
+/**
+* @brief Lets the calling thread read pages with BufMgr::heldPage() for the lifetime of
+* the section. Entering and leaving only write a counter shared with few or no other
+* threads. Sections may nest.
+*/
+class HeldReadSection
+{
+ public:
+  explicit HeldReadSection(BufMgr* bufMgr)
+    : slot_(bufMgr->heldReaders[readerSlot()].readers)
+  {
+		slot_.fetch_add(1);
+  }
+
+  ~HeldReadSection()
+  {
+		slot_.fetch_sub(1, std::memory_order_release);
+  }
+
+  HeldReadSection(const HeldReadSection&) = delete;
+  HeldReadSection& operator=(const HeldReadSection&) = delete;
+
+ private:
+	/**
+   * Counter the thread announced itself in
+	 */
+  std::atomic<int>& slot_;
+};
+
 }
@@ -0,0 +1,41 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "badgerdb_exception.h"
+
+namespace badgerdb {
+
+/**
+ * @brief An exception that is thrown when a modification is requested on an
+ *        index that was opened read-only.
+ */
+class IndexReadOnlyException : public BadgerDbException {
+ public:
+  /**
+   * Constructs an index read-only exception for the given index file.
+   *
+   * @param name  Name of the index file.
+   */
+  explicit IndexReadOnlyException(const std::string& name);
+
+  /**
+   * Returns the name of the index file that caused this exception.
+   */
+  virtual const std::string& filename() const { return filename_; }
+
+ protected:
+  /**
+   * Name of index file that caused this exception.
+   */
+  const std::string& filename_;
+};
+
+}
@@ -13,8 +13,13 @@
 #include <string>
 #include <cstdio>
 #include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "exceptions/file_exists_exception.h"
+#include "exceptions/file_io_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/file_open_exception.h"
 #include "exceptions/invalid_page_exception.h"
@@ -59,11 +64,47 @@ File::~File() {
 }
 
 
+void File::writePages(const PageId first_page, const Page* const* pages,
+                      const PageId num_pages) {
+  for (PageId i = 0; i < num_pages; ++i) {
+    writePage(first_page + i, *pages[i]);
+  }
+}
+
 PageId File::getFirstPageNo() {
   const FileHeader& header = readHeader();
   return header.first_used_page;
 }
 
+PageId File::getNumPages() {
+  const FileHeader& header = readHeader();
+  return header.num_pages;
+}
+
+void File::sync() {
+  stream_->flush();
+  checkWritten();
+  // The stream does not expose its descriptor; syncing any descriptor of the
+  // file flushes the data written through the stream.
+  const int fd = ::open(filename_.c_str(), O_RDWR);
+  if (fd < 0) {
+    throw FileOpenException(filename_);
+  }
+  const int synced = fdatasync(fd);
+  ::close(fd);
+  if (synced != 0) {
+    throw FileIOException(filename_);
+  }
+}
+
+void File::checkWritten() {
+  if (!*stream_) {
+    // Clear the error so later writes are attempted again.
+    stream_->clear();
+    throw FileIOException(filename_);
+  }
+}
+
 File::File(const std::string& name, const bool create_new) : filename_(name) {
   openIfNeeded(create_new);
 
@@ -126,6 +167,7 @@ void File::writeHeader(const FileHeader& header) {
   stream_->seekp(0 /* pos */, std::ios::beg);
   stream_->write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
   stream_->flush();
+  checkWritten();
 }
 
 
@@ -319,6 +361,7 @@ void PageFile::writePage(const PageId page_number, const PageHeader& header,
   stream_->write(reinterpret_cast<const char*>(&header), sizeof(PageHeader));
   stream_->write(&new_page.data_[0], Page::DATA_SIZE);
   stream_->flush();
+  checkWritten();
 }
 
 PageHeader PageFile::readPageHeader(PageId page_number) const {
@@ -340,20 +383,22 @@ BlobFile BlobFile::open(const std::string& filename) {
 }
 
 BlobFile::BlobFile(const std::string& name, const bool create_new)
-: File(name, create_new) {
+: File(name, create_new), map_base_(NULL), map_length_(0) {
 }
 
 BlobFile::~BlobFile() {
+  unmap();
 }
 
 BlobFile::BlobFile(const BlobFile& other)
-: File(other.filename_, false /* create_new */)
+: File(other.filename_, false /* create_new */), map_base_(NULL), map_length_(0)
 {
 }
 
 BlobFile& BlobFile::operator=(const BlobFile& rhs) {
   // This accounts for self-assignment and assignment of a File object for the
   // same file.
+  unmap();
   close();	//close my file and associate me with the new one
   filename_ = rhs.filename_;
   openIfNeeded(false /* create_new */);
@@ -389,6 +434,17 @@ void BlobFile::writePage(const PageId new_page_number, const Page& new_page) {
 	stream_->seekp(pagePosition(new_page_number), std::ios::beg);
 	stream_->write(reinterpret_cast<const char*>(&new_page), Page::SIZE);
 	stream_->flush();
+	checkWritten();
+}
+
+void BlobFile::writePages(const PageId first_page, const Page* const* pages,
+                          const PageId num_pages) {
+	stream_->seekp(pagePosition(first_page), std::ios::beg);
+	for (PageId i = 0; i < num_pages; ++i) {
+		stream_->write(reinterpret_cast<const char*>(pages[i]), Page::SIZE);
+	}
+	stream_->flush();
+	checkWritten();
 }
 
 //delePage should not be called for a blob_file, not supported
@@ -396,4 +452,90 @@ void BlobFile::deletePage(const PageId page_number) {
 	throw InvalidPageException(page_number, filename_);
 }
 
+void BlobFile::extendTo(const PageId num_pages) {
+	FileHeader header = readHeader();
+	if (header.num_pages >= num_pages) {
+		return;
+	}
+	if (header.first_used_page == Page::INVALID_NUMBER) {
+		header.first_used_page = header.num_pages;
+	}
+	header.num_pages = num_pages;
+	writeHeader(header);
+}
+
+void BlobFile::mapReadOnly() {
+	if (map_base_ != NULL) {
+		return;
+	}
+	// Make sure everything written through the stream is visible to the mapping.
+	stream_->flush();
+
+	const int fd = ::open(filename_.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw FileOpenException(filename_);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(FileHeader)) {
+		::close(fd);
+		throw FileOpenException(filename_);
+	}
+	void* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	// The mapping stays valid after the descriptor is closed.
+	::close(fd);
+	if (base == MAP_FAILED) {
+		throw FileOpenException(filename_);
+	}
+	map_base_ = static_cast<const char*>(base);
+	map_length_ = st.st_size;
+}
+
+void BlobFile::unmap() {
+	if (map_base_ == NULL) {
+		return;
+	}
+	munmap(const_cast<char*>(map_base_), map_length_);
+	map_base_ = NULL;
+	map_length_ = 0;
+}
+
+const Page* BlobFile::mappedPage(const PageId page_number) const {
+	const std::size_t offset = pagePosition(page_number);
+	if (map_base_ == NULL || page_number == Page::INVALID_NUMBER ||
+	    offset + Page::SIZE > map_length_) {
+		throw InvalidPageException(page_number, filename_);
+	}
+	return reinterpret_cast<const Page*>(map_base_ + offset);
+}
+
+void BlobFile::adviseMapped(const PageId first_page, const PageId num_pages,
+                            const MapAdvice advice) const {
+	if (map_base_ == NULL) {
+		return;
+	}
+	int posix_advice = MADV_NORMAL;
+	switch (advice) {
+		case ADVISE_RANDOM:     posix_advice = MADV_RANDOM; break;
+		case ADVISE_SEQUENTIAL: posix_advice = MADV_SEQUENTIAL; break;
+		case ADVISE_WILLNEED:   posix_advice = MADV_WILLNEED; break;
+	}
+
+	std::size_t begin = 0;
+	std::size_t end = map_length_;
+	if (num_pages != 0) {
+		begin = pagePosition(first_page);
+		end = begin + (std::size_t) num_pages * Page::SIZE;
+		if (begin >= map_length_) {
+			return;
+		}
+		if (end > map_length_) {
+			end = map_length_;
+		}
+	}
+	// madvise() wants a start address aligned to the system page size.
+	const std::size_t sys_page = sysconf(_SC_PAGESIZE);
+	begin -= begin % sys_page;
+	madvise(const_cast<char*>(map_base_) + begin, end - begin, posix_advice);
+}
+
 }
@@ -143,6 +143,19 @@ class File {
    */
   virtual void writePage(const PageId page_number, const Page& new_page) = 0;
 
+  /**
+   * Writes a run of pages with consecutive page numbers, starting at
+   * first_page, and flushes the stream once at the end.  The default
+   * implementation calls writePage() for each page.
+   * No bounds checking is performed.
+   *
+   * @param first_page  Number of the first page of the run.
+   * @param pages       Pointers to the pages to write, in page number order.
+   * @param num_pages   Number of pages in the run.
+   */
+  virtual void writePages(const PageId first_page, const Page* const* pages,
+                          const PageId num_pages);
+
   /**
    * Deletes a page from the file.
    *
@@ -164,6 +177,22 @@ class File {
    */
 	PageId getFirstPageNo();
 
+  /**
+   * Returns the number of pages in the file, counting the header.  Pages
+   * numbered below this have been allocated at some point.
+   *
+   * @return  Number of pages in the file.
+   */
+  PageId getNumPages();
+
+  /**
+   * Forces everything written to the file so far out to stable storage.
+   *
+   * @throws  FileOpenException  If the file could not be opened for syncing.
+   * @throws  FileIOException    If writing or syncing the file failed.
+   */
+  void sync();
+
  protected:
   /**
    * Returns the position of the page with the given number in the file (as an
@@ -210,6 +239,13 @@ class File {
    */
   void writeHeader(const FileHeader& header);
 
+  /**
+   * Checks that the writes to the stream since the last check succeeded.
+   *
+   * @throws  FileIOException  If a write failed.
+   */
+  void checkWritten();
+
   typedef std::map<std::string, std::shared_ptr<std::fstream> > StreamMap;
   typedef std::map<std::string, int> CountMap;
 
@@ -467,12 +503,95 @@ class BlobFile : public File {
    */
   void writePage(const PageId page_number, const Page& new_page) override;
 
+  /**
+   * Writes a run of pages with consecutive page numbers, which are stored
+   * back to back in a blob file, with a single seek and a single flush.
+   * No bounds checking is performed.
+   *
+   * @param first_page  Number of the first page of the run.
+   * @param pages       Pointers to the pages to write, in page number order.
+   * @param num_pages   Number of pages in the run.
+   */
+  void writePages(const PageId first_page, const Page* const* pages,
+                  const PageId num_pages) override;
+
   /**
    * Deletes a page from the file.
    *
    * @param page_number   Number of page to delete.
    */
   void deletePage(const PageId page_number) override;
+
+  /**
+   * Grows the header's page count to num_pages if it is smaller, so that pages
+   * written directly by recovery count as allocated.  Never shrinks the file.
+   *
+   * @param num_pages   Number of pages the file must at least have.
+   */
+  void extendTo(const PageId num_pages);
+
+  /**
+   * Access patterns that can be hinted for pages of a mapped file.
+   */
+  enum MapAdvice {
+    ADVISE_RANDOM,      /* Pages are visited in no particular order */
+    ADVISE_SEQUENTIAL,  /* Pages are visited once, in increasing order */
+    ADVISE_WILLNEED     /* Pages will be visited soon; start reading them in */
+  };
+
+  /**
+   * Maps the whole file read-only into memory so that pages can be accessed
+   * in place through mappedPage() rather than copied out by readPage().
+   * Pages allocated after the file has been mapped are not visible through
+   * the mapping.  Only one mapping is kept per BlobFile object; mapping an
+   * already mapped file is a no-op.
+   *
+   * @throws  FileOpenException  If the file could not be mapped.
+   */
+  void mapReadOnly();
+
+  /**
+   * Releases the mapping created by mapReadOnly(), if there is one.
+   */
+  void unmap();
+
+  /**
+   * Returns true if the file is currently mapped by this object.
+   */
+  bool isMapped() const { return map_base_ != NULL; }
+
+  /**
+   * Returns the page with the given number inside the read-only mapping.
+   * The page must not be written to.
+   *
+   * @param page_number   Number of page to return.
+   * @return  Pointer to the page inside the mapping.
+   * @throws  InvalidPageException  If the file is not mapped or the page lies
+   *                                outside the mapping.
+   */
+  const Page* mappedPage(const PageId page_number) const;
+
+  /**
+   * Passes an access pattern hint for a range of mapped pages on to the
+   * kernel.  Hints are advisory; failures are ignored.
+   *
+   * @param first_page  Number of first page of the range.
+   * @param num_pages   Number of pages in the range.  Zero means the whole file.
+   * @param advice      Expected access pattern.
+   */
+  void adviseMapped(const PageId first_page, const PageId num_pages,
+                    const MapAdvice advice) const;
+
+ private:
+  /**
+   * Start of the read-only mapping of the file, or NULL if not mapped.
+   */
+  const char* map_base_;
+
+  /**
+   * Length of the mapping in bytes.
+   */
+  std::size_t map_length_;
 };
 
 }
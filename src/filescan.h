@@ -49,17 +49,12 @@ class FileScan
 	BufMgr				*bufMgr;
 
   /**
-   * Current page being scanned.
+   * Current page being scanned, pinned until the scan moves past it.
    */
-  Page*         curPage;
+  WritePageGuard curPage;
 
   FileIterator  filePageIter;
   PageIterator  pageRecordIter;
-
-  /**
-   * True if page has been updated
-   */
-  bool  	      curDirtyFlag;
 };
 
 }
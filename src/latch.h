@@ -0,0 +1,241 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
+
+namespace badgerdb {
+
+/**
+* @brief Reader-writer latch. lock()/unlock() take it exclusively, so it can be used with
+* std::lock_guard; SharedLatchGuard holds it in shared mode. Waiting writers block new
+* readers, so a stream of readers cannot starve a writer.
+*/
+class SharedLatch {
+ public:
+  SharedLatch()
+  {
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&rwlock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+  }
+
+  ~SharedLatch()
+  {
+    pthread_rwlock_destroy(&rwlock);
+  }
+
+  SharedLatch(const SharedLatch&) = delete;
+  SharedLatch& operator=(const SharedLatch&) = delete;
+
+  void lock() { pthread_rwlock_wrlock(&rwlock); }
+  void unlock() { pthread_rwlock_unlock(&rwlock); }
+  void lock_shared() { pthread_rwlock_rdlock(&rwlock); }
+  void unlock_shared() { pthread_rwlock_unlock(&rwlock); }
+
+ private:
+  pthread_rwlock_t rwlock;
+};
+
+/**
+* @brief Holds a SharedLatch in shared mode for the lifetime of the guard.
+*/
+class SharedLatchGuard {
+ public:
+  explicit SharedLatchGuard(SharedLatch& latch) : latch_(latch) { latch_.lock_shared(); }
+  ~SharedLatchGuard() { latch_.unlock_shared(); }
+
+  SharedLatchGuard(const SharedLatchGuard&) = delete;
+  SharedLatchGuard& operator=(const SharedLatchGuard&) = delete;
+
+ private:
+  SharedLatch& latch_;
+};
+
+/**
+* @brief Number of counters readers of a SlottedSharedLatch, and of held buffer pool
+* pages, are spread over.
+*/
+const std::uint32_t READER_SLOTS = 128;
+
+/**
+* @brief Count of the readers of some threads, alone in its cache line.
+*/
+struct ReaderSlot {
+  std::atomic<int> readers;
+  char padding[64 - sizeof(std::atomic<int>)];
+};
+
+/**
+* @brief Slot of a ReaderSlot array the calling thread counts itself in. Threads get
+* slots round robin, so up to READER_SLOTS threads each have one of their own.
+*/
+inline std::uint32_t readerSlot()
+{
+  static std::atomic<std::uint32_t> nextSlot(0);
+  static thread_local std::uint32_t slot = nextSlot++ % READER_SLOTS;
+  return slot;
+}
+
+/**
+* @brief Reader-writer latch for latches taken shared far more often than exclusively.
+* A reader only writes the counter of its thread's ReaderSlot, so readers on separate
+* threads do not fight over a cache line; a writer raises a flag and waits for every
+* counter to drop to zero. Readers wait while the flag is up, so a stream of readers
+* cannot starve a writer. Used like SharedLatch, with SlottedLatchGuard for shared mode.
+*/
+class SlottedSharedLatch {
+ public:
+  SlottedSharedLatch() : writing(false)
+  {
+    for (std::uint32_t i = 0; i < READER_SLOTS; i++)
+      slots[i].readers.store(0, std::memory_order_relaxed);
+  }
+
+  SlottedSharedLatch(const SlottedSharedLatch&) = delete;
+  SlottedSharedLatch& operator=(const SlottedSharedLatch&) = delete;
+
+  void lock()
+  {
+    writerMutex.lock();
+    writing.store(true);
+    for (std::uint32_t i = 0; i < READER_SLOTS; i++)
+    {
+      while (slots[i].readers.load() != 0)
+        std::this_thread::yield();
+    }
+  }
+
+  void unlock()
+  {
+    writing.store(false, std::memory_order_release);
+    writerMutex.unlock();
+  }
+
+  void lock_shared()
+  {
+    std::atomic<int>& readers = slots[readerSlot()].readers;
+    while (true)
+    {
+      // pairs with lock(): either the writer sees this reader or the reader sees the flag
+      readers.fetch_add(1);
+      if (!writing.load())
+        return;
+      readers.fetch_sub(1);
+      while (writing.load(std::memory_order_relaxed))
+        std::this_thread::yield();
+    }
+  }
+
+  void unlock_shared()
+  {
+    slots[readerSlot()].readers.fetch_sub(1, std::memory_order_release);
+  }
+
+ private:
+  ReaderSlot slots[READER_SLOTS];
+  std::atomic<bool> writing;
+  std::mutex writerMutex;
+};
+
+/**
+* @brief Holds a SlottedSharedLatch in shared mode for the lifetime of the guard.
+*/
+class SlottedLatchGuard {
+ public:
+  explicit SlottedLatchGuard(SlottedSharedLatch& latch) : latch_(latch) { latch_.lock_shared(); }
+  ~SlottedLatchGuard() { latch_.unlock_shared(); }
+
+  SlottedLatchGuard(const SlottedLatchGuard&) = delete;
+  SlottedLatchGuard& operator=(const SlottedLatchGuard&) = delete;
+
+ private:
+  SlottedSharedLatch& latch_;
+};
+
+/**
+* @brief Version latch for optimistic lock coupling. The version is even while the latch
+* is free and odd while a writer holds it; every write bumps it. Readers never write the
+* latch: they remember the version, read the protected data and then validate() that the
+* version has not moved, retrying otherwise. Writers upgrade from a version they read, so
+* a writer that raced with another one fails instead of waiting.
+*/
+class VersionLatch {
+ public:
+  /**
+   * Wait until no writer holds the latch and return the current version.
+   */
+  std::uint64_t readLock() const
+  {
+    std::uint64_t v = version.load(std::memory_order_acquire);
+    for (int spins = 0; v & 1; spins++)
+    {
+      if (spins > 64)
+        std::this_thread::yield();
+      v = version.load(std::memory_order_acquire);
+    }
+    return v;
+  }
+
+  /**
+   * True if no writer has held the latch since readLock() returned v, i.e. everything
+   * read in between is consistent.
+   */
+  bool validate(const std::uint64_t v) const
+  {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return version.load(std::memory_order_relaxed) == v;
+  }
+
+  /**
+   * Take the latch for writing if it is still at version v.
+   *
+   * @return	False if another writer got there first
+   */
+  bool tryUpgrade(const std::uint64_t v)
+  {
+    std::uint64_t expected = v;
+    return version.compare_exchange_strong(expected, v + 1, std::memory_order_acquire);
+  }
+
+  /**
+   * Take the latch for writing, waiting for other writers.
+   */
+  void writeLock()
+  {
+    while (!tryUpgrade(readLock()))
+      ;
+  }
+
+  /**
+   * Release a write latch, publishing a new version.
+   */
+  void writeUnlock()
+  {
+    version.fetch_add(1, std::memory_order_release);
+  }
+
+  /**
+   * Reset the latch of a freshly allocated node.
+   */
+  void init()
+  {
+    version.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<std::uint64_t> version;
+};
+
+}
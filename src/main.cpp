@@ -9,8 +9,21 @@
 #include <cstdlib>	// group added
 #include <ctime>	// group added
 #include <set>		// group added
+#include <map>
+#include <climits>
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <csignal>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "btree.h"
+#include "wal.h"
 #include "page.h"
 #include "filescan.h"
 #include "page_iterator.h"
@@ -23,6 +36,8 @@
 #include "exceptions/bad_opcodes_exception.h"
 #include "exceptions/scan_not_initialized_exception.h"
 #include "exceptions/end_of_file_exception.h"
+#include "exceptions/log_io_exception.h"
+#include "exceptions/index_read_only_exception.h"
 
 #define checkPassFail(a, b) 																				\
 {																																		\
@@ -89,6 +104,21 @@ void test_8_search_all_key();
 void test_9_reopen_tree();
 void test_10_construct_tree();
 void test_11_construct();
+void test_12_resize_pool();
+void test_13_wal_recovery();
+void test_14_snapshot();
+void test_15_buffered_inserts();
+void test_16_memtable();
+void test_17_counts();
+void test_18_log_write_failure();
+void test_19_concurrent();
+void test_20_leaf_layouts();
+void test_21_posting_lists();
+void test_22_range_scans();
+void test_23_lookups();
+void test_24_statistics();
+void test_25_read_only_mmap();
+void test_26_group_commit();
 
 
 
@@ -97,6 +127,27 @@ void contiguous_createRelationForward();	// 4
 void contiguous_createRelationBackward();	// 5
 void contiguous_createRelationRandom();		// 6
 void test_out_of_bound();					//7
+off_t fileSize(const std::string& name);
+void insertShifted(BTreeIndex* index, BufMgr* pool, int shift);
+int snapshotScan(BTreeSnapshot* snap, int lowVal, Operator lowOp, int highVal, Operator highOp);
+PageId indexPages();
+int countMismatches(BTreeIndex* index, const std::vector<int>& keys);
+void insertRange(BTreeIndex* index, int first, int count);
+void lookupRange(BTreeIndex* index, int count, int rounds, std::atomic<int>* misses);
+void createRelationEmpty();
+std::uint64_t ridCode(const RecordId& rid);
+int scanMismatches(BTreeIndex* index, const std::map<std::uint64_t, int>& keyOf, int lowVal, Operator lowOp, int highVal, Operator highOp,
+                   bool reverse = false);
+int lookupMismatches(BTreeIndex* index, const std::map<std::uint64_t, int>& keyOf, int key);
+void insertDuplicates(BTreeIndex* index, std::map<std::uint64_t, int>& keyOf, int key, int count);
+int postingMismatches(BTreeIndex* index, const std::map<std::uint64_t, int>& keyOf);
+void insertKey(BTreeIndex* index, std::map<std::uint64_t, int>& keyOf, int key);
+bool inRange(int key, int lowVal, Operator lowOp, int highVal, Operator highOp);
+int multiRangeMismatches(BTreeIndex* index, const std::map<std::uint64_t, int>& keyOf, const std::vector<ScanRange>& ranges);
+int probeMismatches(BTreeIndex* index, const std::map<std::uint64_t, int>& keyOf, const std::vector<int>& probes);
+int batchMismatches(BTreeIndex* index, const std::vector<int>& probes, std::size_t max);
+int sampleMismatches(BTreeIndex* index, const std::map<std::uint64_t, int>& keyOf, const std::vector<int>& keys, int slack);
+void insertAndSync(BTreeIndex* index, int first, int count);
 
 
 
@@ -168,6 +219,21 @@ int main(int argc, char **argv)
 	test4_stress_contiguous_ascending();
 	test5_stress_contiguous_descending();
 	test6_stress_contiguous_random();
+	test_12_resize_pool();
+	test_13_wal_recovery();
+	test_14_snapshot();
+	test_15_buffered_inserts();
+	test_16_memtable();
+	test_17_counts();
+	test_18_log_write_failure();
+	test_19_concurrent();
+	test_20_leaf_layouts();
+	test_21_posting_lists();
+	test_22_range_scans();
+	test_23_lookups();
+	test_24_statistics();
+	test_25_read_only_mmap();
+	test_26_group_commit();
 	test7_out_of_bound();
 	test_8_search_all_key();
 	test_9_reopen_tree();
@@ -375,6 +441,1056 @@ void test_11_construct()
 	
 }
 
+void test_12_resize_pool()
+// Grow and shrink the buffer pool while index pages are resident in it.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_12_resize_pool" << std::endl;
+	createRelationForward();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+
+	{
+		BufMgr pool(32);
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+
+		// past the end of the mapping, so the frames move
+		pool.resize(1024);
+		checkPassFail(intScan(&index, 25, GT, 40, LT), 14)
+		// evicts most of the index
+		pool.resize(16);
+		checkPassFail(intScan(&index, 300, GT, 400, LT), 99)
+		pool.resize(4096);
+		checkPassFail(intScan(&index, 3000, GTE, 4000, LT), 1000)
+	}
+	File::remove(intIndexName);
+	deleteRelation();
+}
+
+void test_13_wal_recovery()
+// Recover an index from its write-ahead log after the process building it dies without
+// writing its pages back.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_13_wal_recovery" << std::endl;
+	createRelationForward();
+	const std::string logName = relationName + ".log";
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+	std::remove(logName.c_str());
+
+	// the child checkpoints halfway, so redo starts from written back pages, and is
+	// killed before anything after that is written back
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		BufMgr* pool = new BufMgr(32);
+		LogManager* log = new LogManager(logName);
+		pool->attachLog(log);
+		BTreeIndex* index = new BTreeIndex(relationName, intIndexName, pool, offsetof(tuple, i), INTEGER);
+		pool->checkpoint();
+		insertShifted(index, pool, relationSize);
+		log->flush();
+		kill(getpid(), SIGKILL);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	bool killed = WIFSIGNALED(status);
+	checkPassFail(killed, true)
+
+	// a flush cut short leaves part of a record behind
+	off_t logSize = fileSize(logName);
+	FILE* torn = fopen(logName.c_str(), "ab");
+	const char partial[13] = { 0x5a, 0x00, 0x00, 0x00, 0x7f };
+	fwrite(partial, 1, sizeof(partial), torn);
+	fclose(torn);
+
+	{
+		LogManager log(logName);
+		checkPassFail(fileSize(logName), logSize)
+		BufMgr pool(64);
+		pool.attachLog(&log);
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		checkPassFail(intScan(&index, -1, GT, 2 * relationSize, LT), 2 * relationSize)
+		checkPassFail(intScan(&index, relationSize - 10, GTE, relationSize + 10, LT), 20)
+
+		// nothing is left only in memory, so the whole log goes
+		insertShifted(&index, &pool, 2 * relationSize);
+		pool.checkpoint();
+		bool truncated = fileSize(logName) < logSize;
+		checkPassFail(truncated, true)
+	}
+	{
+		LogManager log(logName);
+		BufMgr pool(64);
+		pool.attachLog(&log);
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		checkPassFail(intScan(&index, -1, GT, 3 * relationSize, LT), 3 * relationSize)
+	}
+	File::remove(intIndexName);
+	std::remove(logName.c_str());
+	deleteRelation();
+}
+
+void test_14_snapshot()
+// Scan a snapshot while entries are inserted, then reuse the shadow pages it left behind.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_14_snapshot" << std::endl;
+	createRelationForward();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+
+	BufMgr pool(64);
+	{
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		BTreeSnapshot* snap = index.snapshot();
+
+		// every leaf gets a second entry per key and splits under the scans
+		std::thread writer(insertShifted, &index, &pool, 0);
+		for (int i = 0; i < 3; i++)
+		{
+			checkPassFail(snapshotScan(snap, -1, GT, relationSize, LT), relationSize)
+		}
+		writer.join();
+		checkPassFail(snapshotScan(snap, 100, GTE, 200, LT), 100)
+		int key = 150;
+		RecordId out[4];
+		checkPassFail(snap->lookup(&key, out, 4), 1)
+		checkPassFail(intScan(&index, 100, GTE, 200, LT), 200)
+		delete snap;
+	}
+	pool.flushFile(NULL);
+	PageId pages = indexPages();
+
+	// the shadows of the deleted snapshot hold the nodes of a later one
+	{
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		BTreeSnapshot* snap = index.snapshot();
+		insertShifted(&index, &pool, relationSize);
+		checkPassFail(snapshotScan(snap, -1, GT, 2 * relationSize, LT), 2 * relationSize)
+		checkPassFail(intScan(&index, -1, GT, 2 * relationSize, LT), 3 * relationSize)
+		delete snap;
+	}
+	pool.flushFile(NULL);
+	checkPassFail(indexPages(), pages)
+	File::remove(intIndexName);
+	deleteRelation();
+}
+
+void test_15_buffered_inserts()
+// Buffer inserts in the non-leaf nodes until flushes split the leaves, scanning through
+// the buffered entries on the way.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_15_buffered_inserts" << std::endl;
+	createRelationForward();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+
+	BufMgr pool(64);
+	std::uint32_t leaves;
+	{
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		index.analyze();
+		leaves = index.statistics().levelNodes[0];
+		index.setInsertBuffering(true);
+		insertShifted(&index, &pool, 0);
+		insertShifted(&index, &pool, relationSize);
+		checkPassFail(intScan(&index, -1, GT, 2 * relationSize, LT), 3 * relationSize)
+		checkPassFail(intScan(&index, 100, GTE, 200, LT), 200)
+		checkPassFail(intScan(&index, relationSize - 50, GT, relationSize + 50, LTE), 149)
+		int key = 150;
+		RecordId out[4];
+		checkPassFail(index.lookup(&key, out, 4), 2)
+	}
+	{
+		// still buffered after reopening
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		insertShifted(&index, &pool, 2 * relationSize);
+		checkPassFail(intScan(&index, -1, GT, 3 * relationSize, LT), 4 * relationSize)
+		index.setInsertBuffering(false);
+		checkPassFail(intScan(&index, -1, GT, 3 * relationSize, LT), 4 * relationSize)
+		checkPassFail(intScan(&index, 2 * relationSize - 10, GTE, 2 * relationSize + 10, LT), 20)
+		index.analyze();
+		IndexStatistics stats = index.statistics();
+		checkPassFail(stats.entries, (std::uint64_t)(4 * relationSize))
+		bool split = stats.levelNodes[0] > leaves;
+		checkPassFail(split, true)
+	}
+	File::remove(intIndexName);
+	deleteRelation();
+}
+
+void test_16_memtable()
+// Insert through a memtable that fills up and merges into the tree several times, scanning
+// the tree and the memtable together in between.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_16_memtable" << std::endl;
+	createRelationForward();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+
+	BufMgr pool(64);
+	{
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		index.setMemtableSize(3000);
+		insertShifted(&index, &pool, 0);
+		checkPassFail(intScan(&index, -1, GT, relationSize, LT), 2 * relationSize)
+		checkPassFail(intScan(&index, 100, GTE, 200, LT), 200)
+		int key = 150;
+		RecordId out[4];
+		checkPassFail(index.lookup(&key, out, 4), 2)
+
+		insertShifted(&index, &pool, relationSize);
+		checkPassFail(intScan(&index, -1, GT, 2 * relationSize, LT), 3 * relationSize)
+		checkPassFail(intScan(&index, relationSize - 50, GT, relationSize + 50, LTE), 149)
+		index.mergeMemtable();
+		checkPassFail(intScan(&index, -1, GT, 2 * relationSize, LT), 3 * relationSize)
+
+		// the destructor merges what is left
+		insertShifted(&index, &pool, 2 * relationSize);
+		checkPassFail(intScan(&index, 2 * relationSize - 10, GTE, 2 * relationSize + 10, LT), 20)
+	}
+	{
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		checkPassFail(intScan(&index, -1, GT, 3 * relationSize, LT), 4 * relationSize)
+		index.analyze();
+		checkPassFail(index.statistics().entries, (std::uint64_t)(4 * relationSize))
+	}
+	File::remove(intIndexName);
+	deleteRelation();
+}
+
+void test_17_counts()
+// Compare countRange(), rank() and select() with counts over a sorted copy of the keys,
+// with and without subtree counts.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_17_counts" << std::endl;
+	createRelationRandom();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+
+	BufMgr pool(64);
+	{
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		std::vector<int> keys;
+		for (int i = 0; i < stressSize; i++)
+		{
+			keys.push_back(i);
+		}
+
+		// the extra entries all point at some record of the relation
+		RecordId anyRid;
+		int first = 0;
+		index.select(0, &first, anyRid);
+
+		// runs of duplicates and keys past both ends of the relation
+		srand(17);
+		for (int i = 0; i < 3 * relationSize; i++)
+		{
+			int key = (i % 4 == 0) ? 2500 : rand() % (stressSize + relationSize) - relationSize / 2;
+			index.insertEntry(&key, anyRid);
+			keys.push_back(key);
+		}
+		std::sort(keys.begin(), keys.end());
+
+		checkPassFail(countMismatches(&index, keys), 0)
+		index.setSubtreeCounts(true);
+		checkPassFail(countMismatches(&index, keys), 0)
+		for (int i = 0; i < relationSize; i++)
+		{
+			int key = rand() % (2 * relationSize);
+			index.insertEntry(&key, anyRid);
+			keys.insert(std::upper_bound(keys.begin(), keys.end(), key), key);
+		}
+		checkPassFail(countMismatches(&index, keys), 0)
+
+		bool thrown = false;
+		try
+		{
+			int key;
+			index.select(keys.size(), &key, anyRid);
+		}
+		catch(const NoSuchKeyFoundException &e)
+		{
+			thrown = true;
+		}
+		checkPassFail(thrown, true)
+	}
+	File::remove(intIndexName);
+	deleteRelation();
+}
+
+void test_18_log_write_failure()
+// Fail a flush of the log with a file size limit, then flush again once the limit is
+// lifted: no committed record may be lost.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_18_log_write_failure" << std::endl;
+	createRelationForward();
+	const std::string logName = relationName + ".log";
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+	std::remove(logName.c_str());
+
+	// the limit applies to the whole process, so the child takes it
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		BufMgr* pool = new BufMgr(1024);
+		LogManager* log = new LogManager(logName);
+		pool->attachLog(log);
+		BTreeIndex* index = new BTreeIndex(relationName, intIndexName, pool, offsetof(tuple, i), INTEGER);
+		log->flush();
+
+		signal(SIGXFSZ, SIG_IGN);
+		struct rlimit limit;
+		getrlimit(RLIMIT_FSIZE, &limit);
+		struct rlimit lowered = limit;
+		lowered.rlim_cur = fileSize(logName) + 100;
+		setrlimit(RLIMIT_FSIZE, &lowered);
+		insertShifted(index, pool, relationSize);
+		const Lsn durable = log->flushedLsn();
+		try
+		{
+			log->flush();
+			_exit(2);
+		}
+		catch(const LogIOException &e)
+		{
+		}
+		if (log->flushedLsn() != durable)
+		{
+			_exit(3);
+		}
+
+		// committed while the log could not be written
+		insertShifted(index, pool, 2 * relationSize);
+		setrlimit(RLIMIT_FSIZE, &limit);
+		log->flush();
+		kill(getpid(), SIGKILL);
+	}
+	int status;
+	waitpid(pid, &status, 0);
+	bool killed = WIFSIGNALED(status);
+	checkPassFail(killed, true)
+
+	{
+		LogManager log(logName);
+		BufMgr pool(64);
+		pool.attachLog(&log);
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		checkPassFail(intScan(&index, -1, GT, 3 * relationSize, LT), 3 * relationSize)
+		checkPassFail(intScan(&index, relationSize - 10, GTE, relationSize + 10, LT), 20)
+	}
+	File::remove(intIndexName);
+	std::remove(logName.c_str());
+	deleteRelation();
+}
+
+void test_19_concurrent()
+// Insert from several threads while others look up keys that are already there, with a
+// pool small enough that pages are evicted, then check every entry.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_19_concurrent" << std::endl;
+	createRelationForward();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+
+	const int writers = 4;
+	const int readers = 4;
+	BufMgr pool(256);
+	{
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		std::atomic<int> misses(0);
+		std::vector<std::thread> threads;
+		for (int t = 0; t < writers; t++)
+		{
+			threads.push_back(std::thread(insertRange, &index, (t + 1) * relationSize, relationSize));
+		}
+		for (int t = 0; t < readers; t++)
+		{
+			threads.push_back(std::thread(lookupRange, &index, relationSize, 4, &misses));
+		}
+		for (std::size_t t = 0; t < threads.size(); t++)
+		{
+			threads[t].join();
+		}
+		checkPassFail(misses.load(), 0)
+
+		std::atomic<int> missing(0);
+		lookupRange(&index, (writers + 1) * relationSize, 1, &missing);
+		checkPassFail(missing.load(), 0)
+		checkPassFail(intScan(&index, -1, GT, (writers + 1) * relationSize, LT), (writers + 1) * relationSize)
+		checkPassFail(intScan(&index, 2 * relationSize - 10, GTE, 2 * relationSize + 10, LT), 20)
+	}
+	File::remove(intIndexName);
+	deleteRelation();
+}
+
+void test_20_leaf_layouts()
+// Fill leaves with entries whose keys, page numbers and slot numbers spread so far that
+// packed leaves take each entry size from 2 to 8 bytes, or stay wide, and compare scans
+// from many start keys, which decode runs of every length and offset, with a sorted
+// copy. Then widen the ranges of the leaves and compare again.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_20_leaf_layouts" << std::endl;
+
+	// entry i has key INT_MIN + i * keyStep, slot 1 + i % 2^slotBits and page
+	// 1 + (i >> slotBits) * pageStep; packed is 1 if the leaves hold more entries than
+	// wide ones can, 0 if they are all wide and -1 if it depends on the splits
+	struct LayoutCase
+	{
+		unsigned keyStep;
+		int slotBits;
+		PageId pageStep;
+		int packed;
+	};
+	const LayoutCase cases[] = {
+		{ 0, 12, 1, 1 },						// 2 bytes
+		{ 1, 8, 1, 1 },							// 3 and 4 bytes
+		{ 64, 8, 1, 1 },						// 4 bytes
+		{ 1024, 8, 16, 1 },					// 5 bytes
+		{ 1 << 18, 14, 1 << 16, -1 },	// 5 and 6 bytes
+		{ 1 << 16, 10, 1 << 12, -1 },	// 7 bytes
+		{ 1 << 19, 6, 1 << 20, -1 },	// 8 bytes
+		{ 1 << 20, 4, 1 << 24, 0 },		// wide
+	};
+	const int count = 3000;
+
+	for (std::size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+	{
+		createRelationEmpty();
+		try
+		{
+			File::remove(intIndexName);
+		}
+		catch(const FileNotFoundException &e)
+		{
+		}
+
+		BufMgr pool(256);
+		{
+			BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+			std::vector<int> order;
+			for (int i = 0; i < count; i++)
+			{
+				order.push_back(i);
+			}
+			std::mt19937 rng(c);
+			std::shuffle(order.begin(), order.end(), rng);
+
+			std::map<std::uint64_t, int> keyOf;
+			for (int i = 0; i < count; i++)
+			{
+				int key = static_cast<int>(static_cast<unsigned>(INT_MIN) + order[i] * cases[c].keyStep);
+				RecordId rid = RecordId();
+				rid.slot_number = 1 + (order[i] & ((1 << cases[c].slotBits) - 1));
+				rid.page_number = 1 + (order[i] >> cases[c].slotBits) * cases[c].pageStep;
+				index.insertEntry(&key, rid);
+				keyOf[ridCode(rid)] = key;
+			}
+			index.analyze();
+			if (cases[c].packed >= 0)
+			{
+				int packed = (index.statistics().levelNodes[0] * INTARRAYLEAFSIZE < count) ? 1 : 0;
+				checkPassFail(packed, cases[c].packed)
+			}
+
+			// entries out of the leaves' ranges of keys, pages and slots
+			for (int i = 0; i < count; i += 150)
+			{
+				int key = static_cast<int>(static_cast<unsigned>(INT_MIN) + i * cases[c].keyStep);
+				RecordId rid = RecordId();
+				rid.slot_number = 0x7fff - i;
+				rid.page_number = 0xfffff000 + i;
+				index.insertEntry(&key, rid);
+				keyOf[ridCode(rid)] = key;
+			}
+			int last = INT_MAX;
+			RecordId lastRid = RecordId();
+			lastRid.page_number = 0xffffff00;
+			lastRid.slot_number = 1;
+			index.insertEntry(&last, lastRid);
+			keyOf[ridCode(lastRid)] = last;
+
+			int mismatches = scanMismatches(&index, keyOf, INT_MIN, GTE, INT_MAX, LTE);
+			std::vector<int> keys;
+			for (std::map<std::uint64_t, int>::const_iterator it = keyOf.begin(); it != keyOf.end(); ++it)
+			{
+				keys.push_back(it->second);
+			}
+			std::sort(keys.begin(), keys.end());
+			for (std::size_t i = 0; i < keys.size(); i += 37)
+			{
+				mismatches += scanMismatches(&index, keyOf, keys[i], GTE, keys[std::min(i + 1 + i % 211, keys.size() - 1)], LTE);
+				mismatches += scanMismatches(&index, keyOf, keys[i], GT, INT_MAX, LTE);
+			}
+			checkPassFail(mismatches, 0)
+		}
+		File::remove(intIndexName);
+		deleteRelation();
+	}
+}
+
+void test_21_posting_lists()
+// Fold the entries of a key into a posting list at POSTING_MIN_ENTRIES, grow lists over
+// many pages with record ids in random order, and turn posting lists on for an index
+// that has many duplicates already; lookups, counts and scans in both directions are
+// compared with a map from record id to key each time.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_21_posting_lists" << std::endl;
+	for (int enableLater = 0; enableLater < 2; enableLater++)
+	{
+		createRelationEmpty();
+		try
+		{
+			File::remove(intIndexName);
+		}
+		catch(const FileNotFoundException &e)
+		{
+		}
+
+		BufMgr pool(256);
+		{
+			BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+			const bool listed = enableLater == 0;
+			index.setPostingLists(listed);
+			std::map<std::uint64_t, int> keyOf;
+			for (int key = 0; key < 100; key++)
+			{
+				insertDuplicates(&index, keyOf, key, 1);
+			}
+
+			// the leaf fills with each duplicate until the entries of the key are folded
+			bool folded = listed;
+			double fill = 0;
+			for (int entries = 2; entries <= POSTING_MIN_ENTRIES; entries++)
+			{
+				insertDuplicates(&index, keyOf, 50, 1);
+				index.analyze();
+				double previous = fill;
+				fill = index.statistics().levelFill[0];
+				if ((entries < POSTING_MIN_ENTRIES || enableLater) ? fill <= previous : fill >= previous)
+				{
+					folded = false;
+				}
+			}
+			checkPassFail(folded, listed)
+			checkPassFail(postingMismatches(&index, keyOf), 0)
+
+			// lists over many pages, and keys on both sides of them
+			insertDuplicates(&index, keyOf, 60, 20000);
+			insertDuplicates(&index, keyOf, 70, 3000);
+			insertDuplicates(&index, keyOf, 40, 500);
+			insertDuplicates(&index, keyOf, 0, 100);
+			insertDuplicates(&index, keyOf, 99, 100);
+			checkPassFail(postingMismatches(&index, keyOf), 0)
+
+			if (enableLater)
+			{
+				index.analyze();
+				double before = index.statistics().levelFill[0];
+				index.setPostingLists(true);
+				index.analyze();
+				bool shrunk = index.statistics().levelFill[0] < before;
+				checkPassFail(shrunk, true)
+				checkPassFail(postingMismatches(&index, keyOf), 0)
+				insertDuplicates(&index, keyOf, 60, 2000);
+				checkPassFail(postingMismatches(&index, keyOf), 0)
+			}
+		}
+		File::remove(intIndexName);
+		deleteRelation();
+	}
+}
+
+void test_22_range_scans()
+// Compare multi-range scans and reverse scans with a map from record id to key, over
+// runs of duplicates that cross leaves and keys at INT_MIN and INT_MAX, with the entries
+// in the leaves, half of them in message buffers, or half of them in the memtable.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_22_range_scans" << std::endl;
+	for (int mode = 0; mode < 3; mode++)
+	{
+		createRelationEmpty();
+		try
+		{
+			File::remove(intIndexName);
+		}
+		catch(const FileNotFoundException &e)
+		{
+		}
+
+		BufMgr pool(256);
+		{
+			BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+			std::map<std::uint64_t, int> keyOf;
+			srand(22);
+			for (int half = 0; half < 2; half++)
+			{
+				if (half == 1 && mode == 1)
+				{
+					index.setInsertBuffering(true);
+				}
+				if (half == 1 && mode == 2)
+				{
+					index.setMemtableSize(100000);
+				}
+				for (int i = 0; i < 10000; i++)
+				{
+					insertKey(&index, keyOf, rand() % 40001 - 20000);
+				}
+				for (int i = 0; i < 1500; i++)
+				{
+					insertKey(&index, keyOf, (i % 2 == 0) ? 777 : 0);
+				}
+				for (int i = 0; i < 25; i++)
+				{
+					insertKey(&index, keyOf, INT_MIN);
+					insertKey(&index, keyOf, INT_MAX);
+				}
+			}
+
+			int mismatches = 0;
+			const int bounds[] = { INT_MIN, -20000, -15000, -1, 0, 1, 776, 777, 778, 15000, 20000, INT_MAX };
+			const int numBounds = sizeof(bounds) / sizeof(bounds[0]);
+			for (int l = 0; l < numBounds; l++)
+			{
+				for (int h = l; h < numBounds; h++)
+				{
+					mismatches += scanMismatches(&index, keyOf, bounds[l], GTE, bounds[h], LTE, true);
+					mismatches += scanMismatches(&index, keyOf, bounds[l], GT, bounds[h], LT, true);
+					mismatches += scanMismatches(&index, keyOf, bounds[l], GT, bounds[h], LTE, true);
+					mismatches += scanMismatches(&index, keyOf, bounds[l], GTE, bounds[h], LT, true);
+				}
+			}
+			checkPassFail(mismatches, 0)
+
+			const int minKey = INT_MIN;
+			const int maxKey = INT_MAX;
+			const int keys[] = { -19990, -19980, -15000, 0, 5, 100, 200, 300, 500, 776, 777, 778, 790, 800, 19980, 19990 };
+			std::vector<std::vector<ScanRange> > cases(7);
+			// overlapping
+			cases[0].push_back(ScanRange{ &keys[7], GT, &keys[13], LT });
+			cases[0].push_back(ScanRange{ &keys[5], GTE, &keys[8], LTE });
+			cases[0].push_back(ScanRange{ &keys[12], GTE, &keys[12], LTE });
+			// adjacent, given out of order
+			cases[1].push_back(ScanRange{ &keys[6], GT, &keys[7], LTE });
+			cases[1].push_back(ScanRange{ &keys[3], GTE, &keys[5], LT });
+			cases[1].push_back(ScanRange{ &keys[5], GTE, &keys[6], LTE });
+			// at both ends of the keys, and empty there
+			cases[2].push_back(ScanRange{ &minKey, GT, &keys[2], LTE });
+			cases[2].push_back(ScanRange{ &keys[14], GTE, &maxKey, LT });
+			cases[2].push_back(ScanRange{ &maxKey, GT, &maxKey, LTE });
+			cases[2].push_back(ScanRange{ &minKey, GTE, &minKey, LT });
+			cases[3].push_back(ScanRange{ &minKey, GTE, &minKey, LTE });
+			cases[3].push_back(ScanRange{ &maxKey, GTE, &maxKey, LTE });
+			// far apart, skipping many leaves
+			cases[4].push_back(ScanRange{ &keys[14], GTE, &keys[15], LTE });
+			cases[4].push_back(ScanRange{ &keys[0], GTE, &keys[1], LTE });
+			cases[4].push_back(ScanRange{ &keys[3], GT, &keys[4], LT });
+			// the run of duplicates alone, and no key at all
+			cases[5].push_back(ScanRange{ &keys[9], GT, &keys[11], LT });
+			cases[6].push_back(ScanRange{ &maxKey, GT, &maxKey, LTE });
+			for (std::size_t c = 0; c < cases.size(); c++)
+			{
+				mismatches += multiRangeMismatches(&index, keyOf, cases[c]);
+			}
+
+			// many small ranges, some overlapping
+			std::vector<int> lows;
+			std::vector<int> highs;
+			for (int r = 0; r < 200; r++)
+			{
+				lows.push_back(rand() % 40001 - 20000);
+				highs.push_back(lows.back() + rand() % 300);
+			}
+			std::vector<ScanRange> ranges;
+			for (std::size_t r = 0; r < lows.size(); r++)
+			{
+				ranges.push_back(ScanRange{ &lows[r], (r % 2) ? GT : GTE, &highs[r], (r % 3) ? LTE : LT });
+			}
+			mismatches += multiRangeMismatches(&index, keyOf, ranges);
+			checkPassFail(mismatches, 0)
+		}
+		File::remove(intIndexName);
+		deleteRelation();
+	}
+}
+
+void test_23_lookups()
+// Compare lookup() and contains() with a map from record id to key, before and after
+// turning on the lookup hash and while inserts split the leaves it points to, and
+// lookupBatch() with one lookup() per key for clustered, scattered and repeated probes.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_23_lookups" << std::endl;
+	createRelationEmpty();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+
+	BufMgr pool(256);
+	{
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		std::map<std::uint64_t, int> keyOf;
+		srand(23);
+		for (int i = 0; i < 5000; i++)
+		{
+			int key = rand() % 100000;
+			for (int d = (i % 50 == 0) ? rand() % 100 : 0; d >= 0; d--)
+			{
+				insertKey(&index, keyOf, key);
+			}
+		}
+
+		// every probe of a range around an inserted key, and some far away
+		std::vector<int> probes;
+		for (std::map<std::uint64_t, int>::const_iterator it = keyOf.begin(); it != keyOf.end(); ++it)
+		{
+			if (it->first % 13 == 0)
+			{
+				for (int key = it->second - 2; key <= it->second + 2; key++)
+				{
+					probes.push_back(key);
+				}
+			}
+		}
+		probes.push_back(INT_MIN);
+		probes.push_back(-1);
+		probes.push_back(100000);
+		probes.push_back(INT_MAX);
+		checkPassFail(probeMismatches(&index, keyOf, probes), 0)
+
+		// the hash is filled from the leaves, then kept up as they split
+		index.setLookupHash(true);
+		checkPassFail(probeMismatches(&index, keyOf, probes), 0)
+		for (int i = 0; i < 20000; i++)
+		{
+			int key = rand() % 100000;
+			insertKey(&index, keyOf, key);
+			if (i % 4 == 0)
+			{
+				probes.push_back(key);
+			}
+		}
+		checkPassFail(probeMismatches(&index, keyOf, probes), 0)
+
+		// clustered, scattered and repeated probes, unsorted, with and without the hash
+		std::vector<int> clustered;
+		for (int key = 5000; key < 7000; key++)
+		{
+			clustered.push_back(key);
+		}
+		std::vector<int> scattered;
+		for (int i = 0; i < 2000; i++)
+		{
+			scattered.push_back(rand() % 120000 - 10000);
+		}
+		std::vector<int> repeated;
+		for (int i = 0; i < 2000; i++)
+		{
+			repeated.push_back(probes[(i * 7) % 40]);
+		}
+		int mismatches = 0;
+		for (int hashed = 1; hashed >= 0; hashed--)
+		{
+			index.setLookupHash(hashed == 1);
+			mismatches += batchMismatches(&index, clustered, 4);
+			mismatches += batchMismatches(&index, scattered, 200);
+			mismatches += batchMismatches(&index, repeated, 1);
+			mismatches += batchMismatches(&index, repeated, 200);
+		}
+		checkPassFail(mismatches, 0)
+	}
+	File::remove(intIndexName);
+	deleteRelation();
+}
+
+void test_24_statistics()
+// Check analyze(), sampleRange() and quantiles() against exact values for a known key set:
+// the keys j * 2^18 for j < 6400, twice each, with record ids spread so widely that every
+// leaf is wide.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_24_statistics" << std::endl;
+	createRelationEmpty();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+
+	const int distinct = 6400;
+	const int shift = 18;
+	BufMgr pool(256);
+	{
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		bool analyzed = index.statistics().analyzed;
+		checkPassFail(analyzed, false)
+		bool thrown = false;
+		try
+		{
+			double half = 0.5;
+			int key;
+			index.quantiles(&half, 1, &key);
+		}
+		catch(const NoSuchKeyFoundException &e)
+		{
+			thrown = true;
+		}
+		checkPassFail(thrown, true)
+
+		std::vector<int> order;
+		for (int i = 0; i < 2 * distinct; i++)
+		{
+			order.push_back(i);
+		}
+		std::mt19937 rng(24);
+		std::shuffle(order.begin(), order.end(), rng);
+		std::map<std::uint64_t, int> keyOf;
+		for (std::size_t i = 0; i < order.size(); i++)
+		{
+			int key = (order[i] / 2) << shift;
+			RecordId rid = RecordId();
+			rid.page_number = 1 + order[i] * 2654435761u;
+			rid.slot_number = 0x8000 | order[i];
+			index.insertEntry(&key, rid);
+			keyOf[ridCode(rid)] = key;
+		}
+		std::vector<int> keys;
+		for (std::map<std::uint64_t, int>::const_iterator it = keyOf.begin(); it != keyOf.end(); ++it)
+		{
+			keys.push_back(it->second);
+		}
+		std::sort(keys.begin(), keys.end());
+
+		// 64 buckets of 200 entries, the last key of each bucket twice
+		index.analyze();
+		IndexStatistics stats = index.statistics();
+		int mismatches = 0;
+		mismatches += (stats.analyzed && stats.entries == keys.size() && stats.distinctKeys == (std::uint64_t) distinct) ? 0 : 1;
+		mismatches += (stats.minKey == 0 && stats.maxKey == (distinct - 1) << shift) ? 0 : 1;
+		mismatches += (stats.buckets == STATS_HISTOGRAM_BUCKETS) ? 0 : 1;
+		for (int b = 0; b < STATS_HISTOGRAM_BUCKETS; b++)
+		{
+			mismatches += (stats.bucketEntries[b] == 200 && stats.bucketHigh[b] == (100 * b + 99) << shift) ? 0 : 1;
+		}
+
+		// wide leaves use ten bytes an entry; each node above has one child slot in use
+		// for each node below it
+		mismatches += (stats.levelFill[0] == static_cast<double>(keys.size() * (sizeof(int) + sizeof(PackedRecordId)))
+		               / stats.levelNodes[0] / LEAFDATASIZE) ? 0 : 1;
+		for (int level = 1; level < stats.height; level++)
+		{
+			mismatches += (stats.levelFill[level] == static_cast<double>(stats.levelNodes[level-1])
+			               / stats.levelNodes[level] / (INTARRAYNONLEAFSIZE + 1)) ? 0 : 1;
+		}
+		mismatches += (stats.height > 1 && stats.levelNodes[stats.height-1] == 1) ? 0 : 1;
+		checkPassFail(mismatches, 0)
+
+		// the same samples and quantiles within 3% of the entries of their positions by
+		// random descents, and exactly with subtree counts
+		checkPassFail(sampleMismatches(&index, keyOf, keys, keys.size() * 3 / 100), 0)
+		index.setSubtreeCounts(true);
+		checkPassFail(sampleMismatches(&index, keyOf, keys, 0), 0)
+	}
+	File::remove(intIndexName);
+	deleteRelation();
+}
+
+void test_25_read_only_mmap()
+// Open an index through a read-only mapping: scans and lookups work, and every call that
+// would change the index file throws IndexReadOnlyException and leaves it as it was.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_25_read_only_mmap" << std::endl;
+	createRelationForward();
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+
+	BufMgr pool(64);
+	{
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		insertShifted(&index, &pool, relationSize);
+	}
+	{
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER, READ_ONLY_MMAP);
+		checkPassFail(intScan(&index, -1, GT, 2 * relationSize, LT), 2 * relationSize)
+		checkPassFail(intScan(&index, relationSize - 10, GTE, relationSize + 10, LT), 20)
+		int key = relationSize + 7;
+		RecordId out[4];
+		checkPassFail(index.lookup(&key, out, 4), 1)
+
+		int thrown = 0;
+		for (int call = 0; call < 6; call++)
+		{
+			try
+			{
+				RecordId rid = out[0];
+				switch (call)
+				{
+				case 0: index.insertEntry(&key, rid); break;
+				case 1: index.analyze(); break;
+				case 2: index.setInsertBuffering(true); break;
+				case 3: index.setMemtableSize(1000); break;
+				case 4: index.setSubtreeCounts(true); break;
+				case 5: index.setPostingLists(true); break;
+				}
+			}
+			catch(const IndexReadOnlyException &e)
+			{
+				thrown++;
+			}
+		}
+		checkPassFail(thrown, 6)
+		checkPassFail(intScan(&index, -1, GT, 2 * relationSize, LT), 2 * relationSize)
+		checkPassFail(index.lookup(&key, out, 4), 1)
+	}
+	{
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		checkPassFail(intScan(&index, -1, GT, 2 * relationSize, LT), 2 * relationSize)
+		index.analyze();
+		checkPassFail(index.statistics().entries, (std::uint64_t)(2 * relationSize))
+	}
+	File::remove(intIndexName);
+	deleteRelation();
+}
+
+void test_26_group_commit()
+// Sync from several threads at once with a group commit delay: they must share syncs.
+// Then let the background syncer make inserts durable without any sync call.
+{
+	std::cout << "---------------------" << std::endl;
+	std::cout << "test_26_group_commit" << std::endl;
+	createRelationForward();
+	const std::string logName = relationName + ".log";
+	try
+	{
+		File::remove(intIndexName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+	std::remove(logName.c_str());
+
+	{
+		LogManager log(logName);
+		BufMgr pool(1024);
+		pool.attachLog(&log);
+		BTreeIndex index(relationName, intIndexName, &pool, offsetof(tuple, i), INTEGER);
+		GroupCommitConfig config;
+		config.delayUs = 2000;
+		log.configure(config);
+		log.clearStats();
+
+		const int threads = 8;
+		const int perThread = 50;
+		std::vector<std::thread> syncers;
+		for (int t = 0; t < threads; t++)
+		{
+			syncers.push_back(std::thread(insertAndSync, &index, relationSize + t * perThread, perThread));
+		}
+		for (int t = 0; t < threads; t++)
+		{
+			syncers[t].join();
+		}
+		LogStats stats = log.getStats();
+		bool shared = stats.syncs > 0 && stats.syncs < stats.syncRequests;
+		checkPassFail(shared, true)
+		bool committed = stats.commits >= (std::uint64_t)(threads * perThread);
+		checkPassFail(committed, true)
+		bool durable = log.flushedLsn() >= log.endLsn();
+		checkPassFail(durable, true)
+		checkPassFail(intScan(&index, relationSize - 1, GT, relationSize + threads * perThread, LT), threads * perThread)
+
+		// no sync calls from here on
+		config.delayUs = 0;
+		config.intervalMs = 5;
+		log.configure(config);
+		log.clearStats();
+		for (int i = 0; i < 100; i++)
+		{
+			int key = 2 * relationSize + i;
+			RecordId rid = RecordId();
+			rid.page_number = 1;
+			rid.slot_number = 1;
+			index.insertEntry(&key, rid);
+		}
+		const Lsn end = log.endLsn();
+		for (int wait = 0; wait < 200 && log.flushedLsn() < end; wait++)
+		{
+			usleep(10000);
+		}
+		bool synced = log.flushedLsn() >= end && log.getStats().syncs > 0;
+		checkPassFail(synced, true)
+		config.intervalMs = 0;
+		log.configure(config);
+	}
+	File::remove(intIndexName);
+	std::remove(logName.c_str());
+	deleteRelation();
+}
+
 // -----------------------------------------------------------------------------
 // user test helpers(group added)
 // -----------------------------------------------------------------------------
@@ -775,9 +1891,10 @@ int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operato
 		try
 		{
 			index->scanNext(scanRid);
-			bufMgr->readPage(file1, scanRid.page_number, curPage);
+			FrameId curFrame;
+			bufMgr->readPage(file1, scanRid.page_number, curPage, curFrame);
 			RECORD myRec = *(reinterpret_cast<const RECORD*>(curPage->getRecord(scanRid).data()));
-			bufMgr->unPinPage(file1, scanRid.page_number, false);
+			bufMgr->unPinPage(curFrame, false);
 
 			if( numResults < 5 )
 			{
@@ -949,3 +2066,506 @@ void deleteRelation()
 	{
 	}
 }
+
+off_t fileSize(const std::string& name)
+{
+	struct stat st;
+	if (stat(name.c_str(), &st) != 0)
+	{
+		return -1;
+	}
+	return st.st_size;
+}
+
+// Index every record of the relation a second time, under its key plus shift.
+void insertShifted(BTreeIndex* index, BufMgr* pool, int shift)
+{
+	FileScan fscan(relationName, pool);
+	try
+	{
+		RecordId scanRid;
+		while(1)
+		{
+			fscan.scanNext(scanRid);
+			std::string recordStr = fscan.getRecord();
+			int key = *((const int *)(recordStr.c_str() + offsetof (RECORD, i))) + shift;
+			index->insertEntry(&key, scanRid);
+		}
+	}
+	catch(const EndOfFileException &e)
+	{
+	}
+}
+
+int snapshotScan(BTreeSnapshot* snap, int lowVal, Operator lowOp, int highVal, Operator highOp)
+{
+	try
+	{
+		snap->startScan(&lowVal, lowOp, &highVal, highOp);
+	}
+	catch(const NoSuchKeyFoundException &e)
+	{
+		return 0;
+	}
+	int numResults = 0;
+	try
+	{
+		RecordId scanRid;
+		while(1)
+		{
+			snap->scanNext(scanRid);
+			numResults++;
+		}
+	}
+	catch(const IndexScanCompletedException &e)
+	{
+	}
+	snap->endScan();
+	return numResults;
+}
+
+// Pages in the integer index file, which must not be open.
+PageId indexPages()
+{
+	BlobFile file(intIndexName, false);
+	return file.getNumPages();
+}
+
+// Number of ranges, ranks and positions for which the index disagrees with keys, the
+// sorted keys of all of its entries.
+int countMismatches(BTreeIndex* index, const std::vector<int>& keys)
+{
+	int mismatches = 0;
+	for (int low = -relationSize; low < stressSize + relationSize; low += 997)
+	{
+		for (int width = 0; width < relationSize; width += width + 13)
+		{
+			int high = low + width;
+			std::size_t below = std::lower_bound(keys.begin(), keys.end(), low) - keys.begin();
+			std::size_t upTo = std::upper_bound(keys.begin(), keys.end(), high) - keys.begin();
+			std::size_t inRange = upTo - below;
+			std::size_t atLow = std::upper_bound(keys.begin(), keys.end(), low) - keys.begin() - below;
+			if (index->countRange(&low, GTE, &high, LTE) != inRange ||
+			    index->countRange(&low, GT, &high, LTE) != inRange - atLow ||
+			    index->rank(&low) != below)
+			{
+				mismatches++;
+			}
+		}
+	}
+	for (std::size_t position = 0; position < keys.size(); position += 97)
+	{
+		int key;
+		RecordId outRid;
+		index->select(position, &key, outRid);
+		if (key != keys[position])
+		{
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+void insertRange(BTreeIndex* index, int first, int count)
+// Insert the keys first .. first + count - 1, in a shuffled order.
+{
+	std::vector<int> keys;
+	for (int i = 0; i < count; i++)
+	{
+		keys.push_back(first + i);
+	}
+	std::mt19937 rng(first);
+	std::shuffle(keys.begin(), keys.end(), rng);
+	RecordId rid = RecordId();
+	rid.page_number = 1;
+	rid.slot_number = 1;
+	for (std::size_t i = 0; i < keys.size(); i++)
+	{
+		index->insertEntry(&keys[i], rid);
+	}
+}
+
+void lookupRange(BTreeIndex* index, int count, int rounds, std::atomic<int>* misses)
+// Look up each of the keys 0 .. count - 1 rounds times, counting the keys without
+// exactly one entry.
+{
+	RecordId rids[2];
+	for (int r = 0; r < rounds; r++)
+	{
+		for (int key = 0; key < count; key++)
+		{
+			if (index->lookup(&key, rids, 2) != 1)
+			{
+				(*misses)++;
+			}
+		}
+	}
+}
+
+void createRelationEmpty()
+// Create the relation with a single empty page.
+{
+	try
+	{
+		File::remove(relationName);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+	file1 = new PageFile(relationName, true);
+	PageId new_page_number;
+	Page new_page = file1->allocatePage(new_page_number);
+	file1->writePage(new_page_number, new_page);
+}
+
+std::uint64_t ridCode(const RecordId& rid)
+{
+	return (static_cast<std::uint64_t>(rid.page_number) << 16) | rid.slot_number;
+}
+
+int scanMismatches(BTreeIndex* index, const std::map<std::uint64_t, int>& keyOf, int lowVal, Operator lowOp, int highVal, Operator highOp,
+                   bool reverse)
+// Scan the index, backward if reverse, and check the record ids against keyOf, which maps
+// the record id of every entry to its key: each must be known, have a key in the range,
+// come in key order and come up once. Returns the number of record ids that do not,
+// plus those missed.
+{
+	std::size_t expected = 0;
+	for (std::map<std::uint64_t, int>::const_iterator it = keyOf.begin(); it != keyOf.end(); ++it)
+	{
+		if (inRange(it->second, lowVal, lowOp, highVal, highOp))
+		{
+			expected++;
+		}
+	}
+
+	int mismatches = 0;
+	std::set<std::uint64_t> seen;
+	try
+	{
+		if (reverse)
+		{
+			index->startReverseScan(&lowVal, lowOp, &highVal, highOp);
+		}
+		else
+		{
+			index->startScan(&lowVal, lowOp, &highVal, highOp);
+		}
+	}
+	catch(const NoSuchKeyFoundException &e)
+	{
+		return static_cast<int>(expected);
+	}
+	int previous = reverse ? INT_MAX : INT_MIN;
+	try
+	{
+		while (true)
+		{
+			RecordId rid;
+			index->scanNext(rid);
+			std::map<std::uint64_t, int>::const_iterator it = keyOf.find(ridCode(rid));
+			if (it == keyOf.end() || !inRange(it->second, lowVal, lowOp, highVal, highOp) || !seen.insert(it->first).second ||
+			    (reverse ? it->second > previous : it->second < previous))
+			{
+				mismatches++;
+				continue;
+			}
+			previous = it->second;
+		}
+	}
+	catch(const IndexScanCompletedException &e)
+	{
+	}
+	index->endScan();
+	return mismatches + static_cast<int>(expected - std::min(expected, seen.size()));
+}
+
+int lookupMismatches(BTreeIndex* index, const std::map<std::uint64_t, int>& keyOf, int key)
+// Look up key and compare the record ids with those keyOf has for it, in any order, and
+// check that a lookup into a smaller array fills it. Returns the number of differences.
+{
+	std::multiset<std::uint64_t> expected;
+	for (std::map<std::uint64_t, int>::const_iterator it = keyOf.begin(); it != keyOf.end(); ++it)
+	{
+		if (it->second == key)
+		{
+			expected.insert(it->first);
+		}
+	}
+	std::vector<RecordId> out(expected.size() + 1);
+	std::size_t found = index->lookup(&key, &out[0], out.size());
+	std::multiset<std::uint64_t> got;
+	for (std::size_t i = 0; i < found; i++)
+	{
+		got.insert(ridCode(out[i]));
+	}
+	int mismatches = (got == expected) ? 0 : 1;
+	if (expected.size() > 1 && index->lookup(&key, &out[0], expected.size() / 2) != expected.size() / 2)
+	{
+		mismatches++;
+	}
+	return mismatches;
+}
+
+void insertDuplicates(BTreeIndex* index, std::map<std::uint64_t, int>& keyOf, int key, int count)
+// Insert count entries of key, 0 <= key < 0xffff, with record ids that differ from those
+// of every other call: the slot number is key + 1 and the page numbers come in a random
+// order.
+{
+	std::vector<PageId> pages;
+	for (int i = 0; i < count; i++)
+	{
+		pages.push_back(1 + keyOf.size() + i);
+	}
+	std::mt19937 rng(key + keyOf.size());
+	std::shuffle(pages.begin(), pages.end(), rng);
+	for (int i = 0; i < count; i++)
+	{
+		RecordId rid = RecordId();
+		rid.page_number = pages[i];
+		rid.slot_number = key + 1;
+		index->insertEntry(&key, rid);
+		keyOf[ridCode(rid)] = key;
+	}
+}
+
+int postingMismatches(BTreeIndex* index, const std::map<std::uint64_t, int>& keyOf)
+// Compare lookups of every key below 100, counts and scans in both directions of ranges
+// that start and end inside, before and after the keys with posting lists with keyOf.
+{
+	int mismatches = 0;
+	for (int key = -1; key <= 100; key++)
+	{
+		mismatches += lookupMismatches(index, keyOf, key);
+	}
+	const int bounds[] = { -1, 0, 39, 40, 41, 50, 55, 60, 61, 69, 70, 99, 100 };
+	const int numBounds = sizeof(bounds) / sizeof(bounds[0]);
+	for (int l = 0; l < numBounds; l++)
+	{
+		for (int h = l; h < numBounds; h++)
+		{
+			int low = bounds[l];
+			int high = bounds[h];
+			std::size_t expected = 0;
+			for (std::map<std::uint64_t, int>::const_iterator it = keyOf.begin(); it != keyOf.end(); ++it)
+			{
+				if (it->second >= low && it->second <= high)
+				{
+					expected++;
+				}
+			}
+			if (index->countRange(&low, GTE, &high, LTE) != expected)
+			{
+				mismatches++;
+			}
+			if ((l + h) % 3 == 0)
+			{
+				mismatches += scanMismatches(index, keyOf, low, GTE, high, LTE);
+				mismatches += scanMismatches(index, keyOf, low, GT, high, LT, true);
+			}
+		}
+	}
+	mismatches += scanMismatches(index, keyOf, INT_MIN, GTE, INT_MAX, LTE);
+	mismatches += scanMismatches(index, keyOf, INT_MIN, GTE, INT_MAX, LTE, true);
+	return mismatches;
+}
+
+void insertKey(BTreeIndex* index, std::map<std::uint64_t, int>& keyOf, int key)
+// Insert an entry of key with a record id no other entry in keyOf has.
+{
+	RecordId rid = RecordId();
+	rid.page_number = 1 + keyOf.size();
+	rid.slot_number = 1;
+	index->insertEntry(&key, rid);
+	keyOf[ridCode(rid)] = key;
+}
+
+bool inRange(int key, int lowVal, Operator lowOp, int highVal, Operator highOp)
+{
+	return (lowOp == GT ? key > lowVal : key >= lowVal) && (highOp == LT ? key < highVal : key <= highVal);
+}
+
+int multiRangeMismatches(BTreeIndex* index, const std::map<std::uint64_t, int>& keyOf, const std::vector<ScanRange>& ranges)
+// Like scanMismatches(), for a multi-range scan: every entry in any of the ranges must
+// come up once, in key order.
+{
+	std::size_t expected = 0;
+	for (std::map<std::uint64_t, int>::const_iterator it = keyOf.begin(); it != keyOf.end(); ++it)
+	{
+		for (std::size_t r = 0; r < ranges.size(); r++)
+		{
+			if (inRange(it->second, *(const int*) ranges[r].lowVal, ranges[r].lowOp, *(const int*) ranges[r].highVal, ranges[r].highOp))
+			{
+				expected++;
+				break;
+			}
+		}
+	}
+
+	int mismatches = 0;
+	std::set<std::uint64_t> seen;
+	try
+	{
+		index->startMultiRangeScan(&ranges[0], ranges.size());
+	}
+	catch(const NoSuchKeyFoundException &e)
+	{
+		return static_cast<int>(expected);
+	}
+	int previous = INT_MIN;
+	try
+	{
+		while (true)
+		{
+			RecordId rid;
+			index->scanNext(rid);
+			std::map<std::uint64_t, int>::const_iterator it = keyOf.find(ridCode(rid));
+			bool covered = false;
+			for (std::size_t r = 0; it != keyOf.end() && !covered && r < ranges.size(); r++)
+			{
+				covered = inRange(it->second, *(const int*) ranges[r].lowVal, ranges[r].lowOp, *(const int*) ranges[r].highVal, ranges[r].highOp);
+			}
+			if (!covered || !seen.insert(it->first).second || it->second < previous)
+			{
+				mismatches++;
+				continue;
+			}
+			previous = it->second;
+		}
+	}
+	catch(const IndexScanCompletedException &e)
+	{
+	}
+	index->endScan();
+	return mismatches + static_cast<int>(expected - std::min(expected, seen.size()));
+}
+
+int probeMismatches(BTreeIndex* index, const std::map<std::uint64_t, int>& keyOf, const std::vector<int>& probes)
+// Look up every probe key and compare the record ids with those of keyOf, and contains()
+// with whether keyOf has the key. Returns the number of keys that differ.
+{
+	std::map<int, std::multiset<std::uint64_t> > ridsOf;
+	for (std::map<std::uint64_t, int>::const_iterator it = keyOf.begin(); it != keyOf.end(); ++it)
+	{
+		ridsOf[it->second].insert(it->first);
+	}
+	int mismatches = 0;
+	std::vector<RecordId> out(1000);
+	for (std::size_t i = 0; i < probes.size(); i++)
+	{
+		int key = probes[i];
+		std::map<int, std::multiset<std::uint64_t> >::const_iterator expected = ridsOf.find(key);
+		std::multiset<std::uint64_t> got;
+		std::size_t found = index->lookup(&key, &out[0], out.size());
+		for (std::size_t r = 0; r < found; r++)
+		{
+			got.insert(ridCode(out[r]));
+		}
+		if ((expected == ridsOf.end()) ? !got.empty() : got != expected->second)
+		{
+			mismatches++;
+		}
+		if (index->contains(&key) != (expected != ridsOf.end()))
+		{
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+int batchMismatches(BTreeIndex* index, const std::vector<int>& probes, std::size_t max)
+// Look up the probe keys with lookupBatch() and one by one with lookup(), up to max record
+// ids each. Returns the number of keys with different counts, or different record ids
+// where a key has fewer than max entries.
+{
+	std::vector<RecordId> results(probes.size() * max);
+	std::vector<std::size_t> counts(probes.size());
+	index->lookupBatch(&probes[0], probes.size(), &results[0], max, &counts[0]);
+	int mismatches = 0;
+	std::vector<RecordId> out(max);
+	for (std::size_t i = 0; i < probes.size(); i++)
+	{
+		std::size_t found = index->lookup(&probes[i], &out[0], max);
+		if (counts[i] != found)
+		{
+			mismatches++;
+			continue;
+		}
+		std::multiset<std::uint64_t> batch;
+		std::multiset<std::uint64_t> single;
+		for (std::size_t r = 0; r < found; r++)
+		{
+			batch.insert(ridCode(results[i * max + r]));
+			single.insert(ridCode(out[r]));
+		}
+		if (found < max && batch != single)
+		{
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+int sampleMismatches(BTreeIndex* index, const std::map<std::uint64_t, int>& keyOf, const std::vector<int>& keys, int slack)
+// Draw from ranges of the sorted keys, wide, of one key and empty, and check that every
+// draw is an entry of keyOf in the range and that an empty range yields nothing. Then
+// check that each quantile is a key whose entries come within slack entries of its
+// position. Returns the number of draws and quantiles that are off.
+{
+	int mismatches = 0;
+	const int lows[] = { INT_MIN, keys[0], keys[100], keys[keys.size() / 2], keys.back(), keys[101] + 1, INT_MAX };
+	const int highs[] = { INT_MAX, keys[0], keys[9000], keys[keys.size() / 2], INT_MAX, keys[102] - 1, INT_MAX };
+	const Operator lowOps[] = { GTE, GTE, GT, GTE, GTE, GTE, GT };
+	const Operator highOps[] = { LTE, LTE, LT, LTE, LTE, LTE, LTE };
+	for (int r = 0; r < 7; r++)
+	{
+		const std::size_t n = 500;
+		std::vector<int> drawn(n);
+		std::vector<RecordId> rids(n);
+		bool empty = std::lower_bound(keys.begin(), keys.end(), lows[r] + (lowOps[r] == GT ? 1 : 0)) ==
+		             std::upper_bound(keys.begin(), keys.end(), highs[r] - (highOps[r] == LT ? 1 : 0)) || (lowOps[r] == GT && lows[r] == INT_MAX);
+		std::size_t got = index->sampleRange(&lows[r], lowOps[r], &highs[r], highOps[r], n, &drawn[0], &rids[0]);
+		if (got != (empty ? 0 : n))
+		{
+			mismatches++;
+			continue;
+		}
+		for (std::size_t i = 0; i < got; i++)
+		{
+			std::map<std::uint64_t, int>::const_iterator it = keyOf.find(ridCode(rids[i]));
+			if (it == keyOf.end() || it->second != drawn[i] || !inRange(drawn[i], lows[r], lowOps[r], highs[r], highOps[r]))
+			{
+				mismatches++;
+			}
+		}
+	}
+
+	const double fractions[] = { 0, 0.01, 0.25, 0.5, 0.75, 0.99, 1 };
+	const std::size_t numFractions = sizeof(fractions) / sizeof(fractions[0]);
+	int quantiles[numFractions];
+	index->quantiles(fractions, numFractions, quantiles);
+	for (std::size_t i = 0; i < numFractions; i++)
+	{
+		long position = static_cast<long>(fractions[i] * (keys.size() - 1) + 0.5);
+		long first = std::lower_bound(keys.begin(), keys.end(), quantiles[i]) - keys.begin();
+		long last = std::upper_bound(keys.begin(), keys.end(), quantiles[i]) - keys.begin() - 1;
+		if (last < first || position < first - slack || position > last + slack)
+		{
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+void insertAndSync(BTreeIndex* index, int first, int count)
+// Insert the keys first .. first + count - 1, syncing after each.
+{
+	for (int key = first; key < first + count; key++)
+	{
+		RecordId rid = RecordId();
+		rid.page_number = 1;
+		rid.slot_number = 1 + key % 50;
+		index->insertEntry(&key, rid);
+		index->sync();
+	}
+}
@@ -0,0 +1,86 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "memtable.h"
+
+namespace badgerdb {
+
+MemTable::MemTable(const std::size_t capacity)
+	: capacity(capacity), height(1), seed(0x9e3779b9)
+{
+	arena.reserve(capacity + 1);
+	clear();
+}
+
+int MemTable::randomHeight()
+{
+	// xorshift; two random bits per level
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	int h = 1;
+	for (std::uint32_t bits = seed; h < MAX_HEIGHT && (bits & 3) == 0; bits >>= 2)
+		h++;
+	return h;
+}
+
+void MemTable::insert(const int key, const RecordId rid)
+{
+	// find the last node of every level with a key <= key
+	int prev[MAX_HEIGHT];
+	int pos = 0;
+	for (int level = height - 1; level >= 0; level--)
+	{
+		int next = arena[pos].next[level];
+		while (next != 0 && arena[next].key <= key)
+		{
+			pos = next;
+			next = arena[pos].next[level];
+		}
+		prev[level] = pos;
+	}
+
+	int h = randomHeight();
+	for (; height < h; height++)
+		prev[height] = 0;
+
+	Node node;
+	node.key = key;
+	node.rid = rid;
+	int index = static_cast<int>(arena.size());
+	for (int level = 0; level < h; level++)
+	{
+		node.next[level] = arena[prev[level]].next[level];
+		arena[prev[level]].next[level] = index;
+	}
+	arena.push_back(node);
+}
+
+MemTable::Iterator MemTable::seek(const int key) const
+{
+	int pos = 0;
+	for (int level = height - 1; level >= 0; level--)
+	{
+		int next = arena[pos].next[level];
+		while (next != 0 && arena[next].key < key)
+		{
+			pos = next;
+			next = arena[pos].next[level];
+		}
+	}
+	return Iterator(this, arena[pos].next[0]);
+}
+
+void MemTable::clear()
+{
+	arena.resize(1);
+	for (int level = 0; level < MAX_HEIGHT; level++)
+		arena[0].next[level] = 0;
+	height = 1;
+}
+
+}
@@ -0,0 +1,154 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "types.h"
+
+namespace badgerdb {
+
+/**
+* @brief Sorted in-memory table of index entries (key, record id), used as the write
+* buffer of a BTreeIndex. It is a skip list whose nodes live in one arena, reserved up
+* front for the expected number of entries: inserting does not allocate until the table
+* outgrows that size, and clear() frees every node at once. Entries with equal keys are
+* kept in insertion order.
+*
+* @warning This class is not threadsafe.
+*/
+class MemTable
+{
+ private:
+	/**
+	 * Maximum height of a node's tower of links; enough for millions of entries
+	 */
+	static const int MAX_HEIGHT = 12;
+
+	/**
+	 * An entry with its tower of links. Links are arena indexes; 0, the index of the
+	 * head, ends a list.
+	 */
+	struct Node {
+		int key;
+		RecordId rid;
+		int next[MAX_HEIGHT];
+	};
+
+	/**
+	 * All nodes; arena[0] is the head, which holds no entry
+	 */
+	std::vector<Node> arena;
+
+	/**
+	 * Number of entries at which full() becomes true
+	 */
+	std::size_t capacity;
+
+	/**
+	 * Height of the tallest tower in the table
+	 */
+	int height;
+
+	/**
+	 * State of the generator that picks tower heights
+	 */
+	std::uint32_t seed;
+
+	/**
+	 * Pick the height of a new tower: each level is kept with probability 1/4.
+	 */
+	int randomHeight();
+
+ public:
+	/**
+	 * @brief Position in a MemTable, in key order. Invalidated by insert() and clear().
+	 */
+	class Iterator
+	{
+	 public:
+		/**
+		 * True unless the iterator has moved past the last entry
+		 */
+		bool valid() const { return pos != 0; }
+
+		/**
+		 * Key of the current entry
+		 */
+		int key() const { return table->arena[pos].key; }
+
+		/**
+		 * Record id of the current entry
+		 */
+		RecordId rid() const { return table->arena[pos].rid; }
+
+		/**
+		 * Move to the next entry
+		 */
+		void next() { pos = table->arena[pos].next[0]; }
+
+	 private:
+		friend class MemTable;
+
+		Iterator(const MemTable* table, const int pos) : table(table), pos(pos) {}
+
+		/**
+		 * Table iterated over
+		 */
+		const MemTable* table;
+
+		/**
+		 * Arena index of the current entry
+		 */
+		int pos;
+	};
+
+	/**
+	 * Constructor of MemTable class
+	 *
+	 * @param capacity	Number of entries the table is meant to hold
+	 */
+	explicit MemTable(const std::size_t capacity);
+
+	/**
+	 * Insert an entry after the entries with the same key.
+	 *
+	 * @param key		Key of the entry
+	 * @param rid		Record id of the entry
+	 */
+	void insert(const int key, const RecordId rid);
+
+	/**
+	 * Iterator at the first entry with a key >= key.
+	 */
+	Iterator seek(const int key) const;
+
+	/**
+	 * Iterator at the first entry.
+	 */
+	Iterator begin() const { return Iterator(this, arena[0].next[0]); }
+
+	/**
+	 * Number of entries in the table.
+	 */
+	std::size_t size() const { return arena.size() - 1; }
+
+	/**
+	 * True once the table holds capacity entries.
+	 */
+	bool full() const { return size() >= capacity; }
+
+	/**
+	 * Remove all entries.
+	 */
+	void clear();
+};
+
+}
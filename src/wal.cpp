@@ -0,0 +1,657 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "wal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "exceptions/file_open_exception.h"
+#include "exceptions/log_io_exception.h"
+
+namespace badgerdb {
+
+namespace {
+
+/**
+ * Identifies a log file; the version is part of it.
+ */
+const std::uint64_t LOG_MAGIC = 0x42444757414c0001ULL;
+
+/**
+ * Header at the start of the log file
+ */
+struct LogFileHeader {
+	std::uint64_t magic;
+	Lsn baseLsn;
+};
+
+const off_t LOG_HEADER_SIZE = sizeof(LogFileHeader);
+
+std::uint32_t fnv32(std::uint32_t h, const char* p, const std::size_t n)
+{
+	for (std::size_t i = 0; i < n; i++)
+	{
+		h ^= static_cast<unsigned char>(p[i]);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/**
+ * Checksum of a record as if its checksum field were zero.
+ */
+std::uint32_t recordChecksum(const char* rec, const std::uint32_t length)
+{
+	static const char zero[sizeof(std::uint32_t)] = {0};
+	const std::size_t at = offsetof(LogRecordHeader, checksum);
+	std::uint32_t h = fnv32(2166136261u, rec, at);
+	h = fnv32(h, zero, sizeof(zero));
+	return fnv32(h, rec + at + sizeof(zero), length - at - sizeof(zero));
+}
+
+bool writeAll(const int fd, const char* p, std::size_t n, off_t offset)
+{
+	while (n > 0)
+	{
+		const ssize_t done = pwrite(fd, p, n, offset);
+		if (done <= 0)
+			return false;
+		p += done;
+		n -= done;
+		offset += done;
+	}
+	return true;
+}
+
+bool readAll(const int fd, char* p, std::size_t n, off_t offset)
+{
+	while (n > 0)
+	{
+		const ssize_t done = pread(fd, p, n, offset);
+		if (done <= 0)
+			return false;
+		p += done;
+		n -= done;
+		offset += done;
+	}
+	return true;
+}
+
+}
+
+// -----------------------------------------------------------------------------
+// LogUnit::add
+// -----------------------------------------------------------------------------
+
+void LogUnit::add(const std::uint16_t type, const File* file, const PageId pageNo,
+                  const void* data, const std::uint32_t length)
+{
+	LogRecordHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.length = sizeof(hdr) + length;
+	hdr.fileKey = LogManager::fileKey(file);
+	hdr.pageNo = pageNo;
+	hdr.type = type;
+
+	const std::size_t at = bytes.size();
+	bytes.resize(at + hdr.length);
+	memcpy(&bytes[at], &hdr, sizeof(hdr));
+	if (length > 0)
+		memcpy(&bytes[at + sizeof(hdr)], data, length);
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::LogManager -- Constructor
+// -----------------------------------------------------------------------------
+
+LogManager::LogManager(const std::string& logName)
+	: logName(logName), tailUnits(0), flushing(false), syncStop(false)
+{
+	fd = ::open(logName.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		throw FileOpenException(this->logName);
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		throw FileOpenException(this->logName);
+	}
+
+	LogFileHeader header;
+	if (st.st_size < LOG_HEADER_SIZE)
+	{
+		// New log. LSN 0 is reserved for "no record".
+		header.magic = LOG_MAGIC;
+		header.baseLsn = 1;
+		if (!writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header), 0) ||
+		    ftruncate(fd, LOG_HEADER_SIZE) != 0 || fdatasync(fd) != 0)
+		{
+			::close(fd);
+			throw FileOpenException(this->logName);
+		}
+		baseLsn = nextLsn = 1;
+	}
+	else
+	{
+		if (!readAll(fd, reinterpret_cast<char*>(&header), sizeof(header), 0) ||
+		    header.magic != LOG_MAGIC)
+		{
+			::close(fd);
+			throw FileOpenException(this->logName);
+		}
+		baseLsn = header.baseLsn;
+
+		// Keep the longest prefix of intact records that ends with a commit; anything
+		// after it belongs to a unit whose flush was cut short by a crash.
+		std::vector<char> body(st.st_size - LOG_HEADER_SIZE);
+		if (!readAll(fd, body.data(), body.size(), LOG_HEADER_SIZE))
+		{
+			::close(fd);
+			throw FileOpenException(this->logName);
+		}
+		std::size_t pos = 0;
+		std::size_t kept = 0;
+		while (pos + sizeof(LogRecordHeader) <= body.size())
+		{
+			LogRecordHeader hdr;
+			memcpy(&hdr, &body[pos], sizeof(hdr));
+			if (hdr.length < sizeof(hdr) || hdr.length > body.size() - pos ||
+			    hdr.lsn != baseLsn + pos ||
+			    hdr.checksum != recordChecksum(&body[pos], hdr.length))
+				break;
+			pos += hdr.length;
+			if (hdr.type == LOG_COMMIT)
+				kept = pos;
+		}
+		if (kept < body.size())
+		{
+			if (ftruncate(fd, LOG_HEADER_SIZE + kept) != 0 || fdatasync(fd) != 0)
+			{
+				::close(fd);
+				throw FileOpenException(this->logName);
+			}
+		}
+		nextLsn = baseLsn + kept;
+	}
+	durableLsn = tailLsn = nextLsn;
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::~LogManager -- Destructor
+// -----------------------------------------------------------------------------
+
+LogManager::~LogManager()
+{
+	stopSyncer();
+	try
+	{
+		flush();
+	}
+	catch (const LogIOException&)
+	{
+		// Nothing left to report the failure to; unflushed units are lost as in a crash.
+	}
+	::close(fd);
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::fileKey
+// -----------------------------------------------------------------------------
+
+std::uint64_t LogManager::fileKey(const File* file)
+{
+	if (file == NULL)
+		return 0;
+	const std::string& name = file->filename();
+	std::uint64_t h = 14695981039346656037ULL;
+	for (std::size_t i = 0; i < name.size(); i++)
+	{
+		h ^= static_cast<unsigned char>(name[i]);
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::commit
+// -----------------------------------------------------------------------------
+
+Lsn LogManager::commit(LogUnit& unit)
+{
+	LogRecordHeader done;
+	memset(&done, 0, sizeof(done));
+	done.length = sizeof(done);
+	done.pageNo = Page::INVALID_NUMBER;
+	done.type = LOG_COMMIT;
+
+	std::lock_guard<std::mutex> lock(logMutex);
+	const std::size_t start = tail.size();
+	tail.insert(tail.end(), unit.bytes.begin(), unit.bytes.end());
+	tail.resize(tail.size() + sizeof(done));
+	memcpy(&tail[tail.size() - sizeof(done)], &done, sizeof(done));
+
+	// Stamp LSNs and checksums now that the position of the unit is known.
+	Lsn commitLsn = 0;
+	for (std::size_t pos = start; pos < tail.size(); )
+	{
+		char* rec = &tail[pos];
+		LogRecordHeader hdr;
+		memcpy(&hdr, rec, sizeof(hdr));
+		hdr.lsn = nextLsn + (pos - start);
+		hdr.checksum = 0;
+		memcpy(rec, &hdr, sizeof(hdr));
+		hdr.checksum = recordChecksum(rec, hdr.length);
+		memcpy(rec, &hdr, sizeof(hdr));
+		commitLsn = hdr.lsn;
+		pos += hdr.length;
+	}
+	nextLsn += tail.size() - start;
+	tailUnits++;
+	stats.commits++;
+	if (tail.size() >= config.maxBatchBytes)
+		batchFull.notify_one();
+	unit.clear();
+	return commitLsn;
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::flush
+// -----------------------------------------------------------------------------
+
+void LogManager::flush(const Lsn lsn)
+{
+	std::unique_lock<std::mutex> lock(logMutex);
+	const Lsn target = lsn == 0 ? nextLsn : std::min(lsn + 1, nextLsn);
+	if (durableLsn < target)
+		stats.syncRequests++;
+	while (durableLsn < target)
+	{
+		if (flushing)
+		{
+			// Someone else is writing; their batch or the next one will cover us.
+			flushed.wait(lock);
+			continue;
+		}
+		flushing = true;
+		if (config.delayUs > 0)
+		{
+			// Give concurrent committers a moment to join this sync. Flushes that come
+			// in meanwhile wait for the flushing role and ride along.
+			const std::uint32_t maxBytes = config.maxBatchBytes;
+			batchFull.wait_for(lock, std::chrono::microseconds(config.delayUs),
+			                   [this, maxBytes] { return tail.size() >= maxBytes; });
+		}
+		writeTail(lock);
+		releaseFlushRole();
+	}
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::endLsn
+// -----------------------------------------------------------------------------
+
+Lsn LogManager::endLsn()
+{
+	std::lock_guard<std::mutex> lock(logMutex);
+	return nextLsn;
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::flushedLsn
+// -----------------------------------------------------------------------------
+
+Lsn LogManager::flushedLsn()
+{
+	std::lock_guard<std::mutex> lock(logMutex);
+	return durableLsn;
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::configure
+// -----------------------------------------------------------------------------
+
+void LogManager::configure(const GroupCommitConfig& newConfig)
+{
+	stopSyncer();
+	std::lock_guard<std::mutex> lock(logMutex);
+	config = newConfig;
+	if (config.intervalMs > 0)
+	{
+		syncStop = false;
+		syncThread = std::thread(&LogManager::backgroundSyncer, this);
+	}
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::getStats / clearStats
+// -----------------------------------------------------------------------------
+
+LogStats LogManager::getStats()
+{
+	std::lock_guard<std::mutex> lock(logMutex);
+	return stats;
+}
+
+void LogManager::clearStats()
+{
+	std::lock_guard<std::mutex> lock(logMutex);
+	stats.clear();
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::truncate
+// -----------------------------------------------------------------------------
+
+void LogManager::truncate(const Lsn upTo)
+{
+	std::unique_lock<std::mutex> lock(logMutex);
+	drain(lock);
+	const Lsn from = std::min(upTo, durableLsn);
+	if (from <= baseLsn)
+	{
+		releaseFlushRole();
+		return;
+	}
+	const Lsn to = durableLsn;
+	lock.unlock();
+
+	// Write the records that stay into a new file and rename it over the log, so a
+	// crash leaves either the old log or the new one. Units appended meanwhile wait in
+	// the tail; the flushing role keeps them from being written to the old file.
+	const std::string tmpName = logName + ".tmp";
+	int newFd = -1;
+	bool ok = false;
+	try
+	{
+		std::vector<char> keep;
+		readRecords(from, to, keep);
+		newFd = ::open(tmpName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		LogFileHeader header;
+		header.magic = LOG_MAGIC;
+		header.baseLsn = from;
+		ok = newFd >= 0 &&
+		     writeAll(newFd, reinterpret_cast<const char*>(&header), sizeof(header), 0) &&
+		     writeAll(newFd, keep.data(), keep.size(), LOG_HEADER_SIZE) &&
+		     fdatasync(newFd) == 0 &&
+		     std::rename(tmpName.c_str(), logName.c_str()) == 0;
+	}
+	catch (const LogIOException&)
+	{
+		ok = false;
+	}
+	if (ok)
+	{
+		// Make the rename itself durable.
+		const std::size_t slash = logName.rfind('/');
+		const std::string dir = slash == std::string::npos ? "." : logName.substr(0, slash + 1);
+		const int dirFd = ::open(dir.c_str(), O_RDONLY);
+		if (dirFd >= 0)
+		{
+			fsync(dirFd);
+			::close(dirFd);
+		}
+	}
+
+	lock.lock();
+	if (ok)
+	{
+		::close(fd);
+		fd = newFd;
+		baseLsn = from;
+	}
+	else if (newFd >= 0)
+	{
+		::close(newFd);
+		std::remove(tmpName.c_str());
+	}
+	releaseFlushRole();
+	if (!ok)
+		throw LogIOException(logName);
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::redo
+// -----------------------------------------------------------------------------
+
+std::uint64_t LogManager::redo(BlobFile* file, RedoHandler& handler)
+{
+	std::vector<char> body;
+	Lsn from;
+	{
+		std::unique_lock<std::mutex> lock(logMutex);
+		drain(lock);
+		from = baseLsn;
+		const Lsn to = durableLsn;
+		lock.unlock();
+		try
+		{
+			readRecords(from, to, body);
+		}
+		catch (const LogIOException&)
+		{
+			lock.lock();
+			releaseFlushRole();
+			throw;
+		}
+		lock.lock();
+		releaseFlushRole();
+	}
+
+	const std::uint64_t key = fileKey(file);
+
+	// Pass 1: find the last committed creation of the file; what came before it
+	// describes an earlier file of the same name.
+	Lsn startLsn = 0;
+	Lsn pendingCreate = 0;
+	for (std::size_t pos = 0; pos < body.size(); )
+	{
+		LogRecordHeader hdr;
+		memcpy(&hdr, &body[pos], sizeof(hdr));
+		if (hdr.type == LOG_FILE_CREATE && hdr.fileKey == key)
+			pendingCreate = hdr.lsn;
+		else if (hdr.type == LOG_COMMIT)
+		{
+			if (pendingCreate != 0)
+				startLsn = pendingCreate;
+			pendingCreate = 0;
+		}
+		pos += hdr.length;
+	}
+
+	// Pass 2: hand the records of committed units to the handler in log order.
+	std::map<PageId, Page> pages;
+	const PageId numPages = file->getNumPages();
+	std::vector<std::size_t> unit;
+	std::uint64_t applied = 0;
+	for (std::size_t pos = 0; pos < body.size(); )
+	{
+		LogRecordHeader hdr;
+		memcpy(&hdr, &body[pos], sizeof(hdr));
+		if (hdr.type != LOG_COMMIT)
+		{
+			if (hdr.fileKey == key && hdr.lsn >= startLsn && hdr.type >= LOG_CLIENT_TYPES)
+				unit.push_back(pos);
+			pos += hdr.length;
+			continue;
+		}
+
+		for (std::size_t i = 0; i < unit.size(); i++)
+		{
+			LogRecordHeader rh;
+			memcpy(&rh, &body[unit[i]], sizeof(rh));
+			std::map<PageId, Page>::iterator it = pages.find(rh.pageNo);
+			if (it == pages.end())
+			{
+				Page page;
+				if (rh.pageNo < numPages)
+					page = file->readPage(rh.pageNo);
+				else
+					memset(static_cast<void*>(&page), 0, sizeof(page));
+				it = pages.insert(std::make_pair(rh.pageNo, page)).first;
+			}
+			LogRecord rec;
+			rec.lsn = rh.lsn;
+			rec.commitLsn = hdr.lsn;
+			rec.type = rh.type;
+			rec.pageNo = rh.pageNo;
+			rec.data = &body[unit[i] + sizeof(rh)];
+			rec.length = rh.length - sizeof(rh);
+			handler.redo(rec, it->second);
+			applied++;
+		}
+		unit.clear();
+		pos += hdr.length;
+	}
+
+	if (!pages.empty())
+	{
+		for (std::map<PageId, Page>::const_iterator it = pages.begin(); it != pages.end(); ++it)
+			file->writePage(it->first, it->second);
+		file->extendTo(pages.rbegin()->first + 1);
+		file->sync();
+	}
+	return applied;
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::offsetOf
+// -----------------------------------------------------------------------------
+
+off_t LogManager::offsetOf(const Lsn lsn) const
+{
+	return LOG_HEADER_SIZE + static_cast<off_t>(lsn - baseLsn);
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::writeTail
+// -----------------------------------------------------------------------------
+
+void LogManager::writeTail(std::unique_lock<std::mutex>& lock)
+{
+	std::vector<char> batch;
+	batch.swap(tail);
+	const std::uint64_t units = tailUnits;
+	tailUnits = 0;
+	const Lsn start = tailLsn;
+	const Lsn end = nextLsn;
+	const off_t offset = offsetOf(tailLsn);
+	tailLsn = nextLsn;
+	lock.unlock();
+
+	const bool ok = writeAll(fd, batch.data(), batch.size(), offset) && fdatasync(fd) == 0;
+
+	lock.lock();
+	if (!ok)
+	{
+		// Put the batch back in front of what was committed meanwhile, so that the next
+		// flush writes it again at the same offset instead of leaving a hole.
+		batch.insert(batch.end(), tail.begin(), tail.end());
+		tail.swap(batch);
+		tailUnits += units;
+		tailLsn = start;
+		releaseFlushRole();
+		throw LogIOException(logName);
+	}
+	durableLsn = end;
+
+	stats.syncs++;
+	stats.syncedUnits += units;
+	stats.syncedBytes += batch.size();
+	stats.maxBatchUnits = std::max(stats.maxBatchUnits, units);
+	int bucket = 0;
+	while (bucket < 7 && (std::uint64_t(2) << bucket) <= units)
+		bucket++;
+	stats.batchUnits[bucket]++;
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::drain
+// -----------------------------------------------------------------------------
+
+void LogManager::drain(std::unique_lock<std::mutex>& lock)
+{
+	while (flushing)
+		flushed.wait(lock);
+	flushing = true;
+	if (durableLsn < nextLsn)
+		writeTail(lock);
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::releaseFlushRole
+// -----------------------------------------------------------------------------
+
+void LogManager::releaseFlushRole()
+{
+	flushing = false;
+	flushed.notify_all();
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::backgroundSyncer
+// -----------------------------------------------------------------------------
+
+void LogManager::backgroundSyncer()
+{
+	std::unique_lock<std::mutex> lock(logMutex);
+	while (!syncStop)
+	{
+		syncWakeup.wait_for(lock, std::chrono::milliseconds(config.intervalMs));
+		if (syncStop)
+			break;
+		if (durableLsn == nextLsn)
+			continue;
+		lock.unlock();
+		try
+		{
+			flush();
+		}
+		catch (const LogIOException&)
+		{
+			// the next foreground flush() runs into the same error and reports it
+		}
+		lock.lock();
+	}
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::stopSyncer
+// -----------------------------------------------------------------------------
+
+void LogManager::stopSyncer()
+{
+	{
+		std::lock_guard<std::mutex> lock(logMutex);
+		if (!syncThread.joinable())
+			return;
+		syncStop = true;
+	}
+	syncWakeup.notify_all();
+	syncThread.join();
+}
+
+// -----------------------------------------------------------------------------
+// LogManager::readRecords
+// -----------------------------------------------------------------------------
+
+void LogManager::readRecords(const Lsn from, const Lsn to, std::vector<char>& out)
+{
+	out.resize(to - from);
+	if (!readAll(fd, out.data(), out.size(), offsetOf(from)))
+		throw LogIOException(logName);
+}
+
+}
@@ -0,0 +1,485 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <sys/types.h>
+
+#include "file.h"
+#include "page.h"
+
+namespace badgerdb {
+
+/**
+* @brief Log sequence number: the position of a record in the write-ahead log. LSNs keep
+* growing across log truncation; zero means "no record".
+*/
+typedef std::uint64_t Lsn;
+
+/**
+* @brief Record types understood by the log itself. Clients number their own types from
+* LOG_CLIENT_TYPES upwards.
+*/
+enum LogRecordType {
+	LOG_COMMIT = 1,       /* Ends a unit; the records before it since the last commit apply */
+	LOG_FILE_CREATE = 2,  /* File was (re)created; earlier records for its name are stale */
+	LOG_CLIENT_TYPES = 16
+};
+
+/**
+* @brief Header in front of every record in the log
+*/
+struct LogRecordHeader {
+	/**
+	 * Length of the record in bytes, header included
+	 */
+	std::uint32_t length;
+
+	/**
+	 * Checksum over the whole record, computed with this field set to zero
+	 */
+	std::uint32_t checksum;
+
+	/**
+	 * LSN of the record
+	 */
+	Lsn lsn;
+
+	/**
+	 * Hash of the name of the file the record applies to
+	 */
+	std::uint64_t fileKey;
+
+	/**
+	 * Page of the file the record applies to
+	 */
+	PageId pageNo;
+
+	/**
+	 * One of LogRecordType or a client type
+	 */
+	std::uint16_t type;
+
+	std::uint16_t unused;
+};
+
+/**
+* @brief A committed record handed to a RedoHandler during recovery
+*/
+struct LogRecord {
+	/**
+	 * LSN of the record
+	 */
+	Lsn lsn;
+
+	/**
+	 * LSN of the commit record ending the record's unit
+	 */
+	Lsn commitLsn;
+
+	/**
+	 * Client record type
+	 */
+	std::uint16_t type;
+
+	/**
+	 * Page the record applies to
+	 */
+	PageId pageNo;
+
+	/**
+	 * Payload of the record
+	 */
+	const char* data;
+
+	/**
+	 * Length of the payload in bytes
+	 */
+	std::uint32_t length;
+};
+
+/**
+* @brief Reapplies the committed log records of one file during recovery
+*/
+class RedoHandler {
+ public:
+	virtual ~RedoHandler() {}
+
+	/**
+	 * Reapply rec to page unless the page already reflects it. Pages that did not exist
+	 * on disk are handed over zero-filled.
+	 *
+	 * @param rec		Committed record
+	 * @param page	Copy of the page the record applies to
+	 */
+	virtual void redo(const LogRecord& rec, Page& page) = 0;
+};
+
+/**
+* @brief Records of one atomic unit of page changes, built up privately by a client and
+* then appended to the log as a whole by LogManager::commit().
+*/
+class LogUnit {
+	friend class LogManager;
+
+ public:
+	/**
+	 * Add a record to the unit.
+	 *
+	 * @param type		Client record type
+	 * @param file		File the record applies to
+	 * @param pageNo	Page the record applies to
+	 * @param data		Payload
+	 * @param length	Length of the payload in bytes
+	 */
+	void add(const std::uint16_t type, const File* file, const PageId pageNo,
+	         const void* data, const std::uint32_t length);
+
+	/**
+	 * True if no records have been added since the unit was created or cleared.
+	 */
+	bool empty() const { return bytes.empty(); }
+
+	/**
+	 * Drop all records so the unit can be reused.
+	 */
+	void clear() { bytes.clear(); }
+
+ private:
+	/**
+	 * Records laid out back to back, LSNs and checksums still unset
+	 */
+	std::vector<char> bytes;
+};
+
+/**
+* @brief Trade-off between commit latency and sync throughput. Passed to
+* LogManager::configure().
+*/
+struct GroupCommitConfig
+{
+	/**
+	 * Microseconds the thread that leads a sync waits for more commits to join the batch
+	 * before it syncs. Zero syncs right away.
+	 */
+	unsigned delayUs;
+
+	/**
+	 * The leader stops waiting as soon as this many bytes of records are pending.
+	 */
+	std::uint32_t maxBatchBytes;
+
+	/**
+	 * If nonzero, a background thread syncs the log this often, so commits become
+	 * durable within intervalMs even if nobody calls flush().
+	 */
+	unsigned intervalMs;
+
+	/**
+	 * Default: sync at once, no background syncs
+	 */
+	GroupCommitConfig()
+		: delayUs(0), maxBatchBytes(1024 * 1024), intervalMs(0) {}
+};
+
+/**
+* @brief Counters of commits and log syncs
+*/
+struct LogStats
+{
+	/**
+	 * Number of units committed
+	 */
+	std::uint64_t commits;
+
+	/**
+	 * Number of flush() calls that had to wait for the disk
+	 */
+	std::uint64_t syncRequests;
+
+	/**
+	 * Number of times the log was written and synced
+	 */
+	std::uint64_t syncs;
+
+	/**
+	 * Number of units made durable by those syncs
+	 */
+	std::uint64_t syncedUnits;
+
+	/**
+	 * Number of bytes made durable by those syncs
+	 */
+	std::uint64_t syncedBytes;
+
+	/**
+	 * Largest number of units made durable by one sync
+	 */
+	std::uint64_t maxBatchUnits;
+
+	/**
+	 * Histogram of units per sync: entry i counts syncs of 2^i to 2^(i+1)-1 units, the
+	 * last entry everything larger
+	 */
+	std::uint64_t batchUnits[8];
+
+	/**
+	 * Clear all values
+	 */
+	void clear()
+	{
+		commits = syncRequests = syncs = syncedUnits = syncedBytes = maxBatchUnits = 0;
+		for (int i = 0; i < 8; i++)
+			batchUnits[i] = 0;
+	}
+
+	/**
+	 * Constructor of LogStats class
+	 */
+	LogStats()
+	{
+		clear();
+	}
+};
+
+/**
+* @brief Write-ahead log shared by all files of a buffer manager.
+*
+* Clients describe every change to a page with log records and append the records of one
+* atomic change as a LogUnit, which commit() closes with a commit record. Recovery only
+* applies units whose commit record made it to disk, so a unit is all-or-nothing.
+*
+* Appends go to an in-memory tail; flush() writes and syncs it. Concurrent flushes are
+* batched: one thread writes and syncs everything appended so far while the others wait
+* and find their records durable when it is done (group commit). configure() lets the
+* leading thread wait a little for more commits, trading commit latency for fewer syncs,
+* or hands syncing to a background thread altogether.
+*
+* The buffer manager never writes a page before the log is durable up to the page's LSN,
+* and truncates the log at checkpoints once the pages the records describe are on disk.
+*/
+class LogManager {
+ public:
+	/**
+	 * Open the log, creating it if needed. A torn record at the end, left behind by a
+	 * crash in the middle of a flush, is cut off.
+	 *
+	 * @param logName	Name of the log file
+	 * @throws FileOpenException If the log cannot be opened or is not a log file
+	 */
+	explicit LogManager(const std::string& logName);
+
+	/**
+	 * Stops the background syncer, flushes the log and closes it.
+	 */
+	~LogManager();
+
+	LogManager(const LogManager&) = delete;
+	LogManager& operator=(const LogManager&) = delete;
+
+	/**
+	 * Append the records of unit followed by a commit record.
+	 *
+	 * @param unit	Records to append; cleared afterwards
+	 * @return			LSN of the commit record
+	 */
+	Lsn commit(LogUnit& unit);
+
+	/**
+	 * Make the log durable at least up to and including the record at lsn.
+	 *
+	 * @param lsn	LSN to flush through; zero flushes everything appended so far
+	 * @throws LogIOException If the log cannot be written; the records stay in memory
+	 *				and the next flush writes them again
+	 */
+	void flush(const Lsn lsn = 0);
+
+	/**
+	 * LSN the next record will get. Every record appended from now on has an LSN at
+	 * least this large.
+	 */
+	Lsn endLsn();
+
+	/**
+	 * Everything below this LSN is on disk.
+	 */
+	Lsn flushedLsn();
+
+	/**
+	 * Change the group commit settings. Starts or stops the background syncer as needed.
+	 * Must not be called by several threads at once.
+	 *
+	 * @param config	New settings
+	 */
+	void configure(const GroupCommitConfig& config);
+
+	/**
+	 * Returns a snapshot of the commit and sync counters
+	 */
+	LogStats getStats();
+
+	/**
+	 * Clear the commit and sync counters
+	 */
+	void clearStats();
+
+	/**
+	 * Discard the records below upTo, which the caller guarantees are reflected in
+	 * durable pages.
+	 *
+	 * @param upTo	LSN of the first record to keep
+	 * @throws LogIOException If the log cannot be rewritten
+	 */
+	void truncate(const Lsn upTo);
+
+	/**
+	 * Reapply the committed records of file that come after its last LOG_FILE_CREATE,
+	 * write the resulting pages back and sync the file. Called before the file is used,
+	 * so none of its pages may be in the buffer pool.
+	 *
+	 * @param file		File to recover
+	 * @param handler	Applies the client records
+	 * @return				Number of records handed to the handler
+	 */
+	std::uint64_t redo(BlobFile* file, RedoHandler& handler);
+
+	/**
+	 * Key identifying a file in log records.
+	 */
+	static std::uint64_t fileKey(const File* file);
+
+ private:
+	/**
+	 * File offset of the record at lsn.
+	 */
+	off_t offsetOf(const Lsn lsn) const;
+
+	/**
+	 * Write the tail and sync the log. Called by the flushing thread with flushing set;
+	 * drops lock while doing I/O.
+	 */
+	void writeTail(std::unique_lock<std::mutex>& lock);
+
+	/**
+	 * Wait until no other thread is flushing, write out the tail and keep the flushing
+	 * role, so that the log file can be read or replaced without racing a flush.
+	 */
+	void drain(std::unique_lock<std::mutex>& lock);
+
+	/**
+	 * Give up the flushing role and wake the threads waiting for it.
+	 */
+	void releaseFlushRole();
+
+	/**
+	 * Body of the background syncer thread
+	 */
+	void backgroundSyncer();
+
+	/**
+	 * Stop the background syncer, if one runs, and wait for it to exit
+	 */
+	void stopSyncer();
+
+	/**
+	 * Read the records in [from, to) from the log file. Caller holds the flushing role.
+	 */
+	void readRecords(const Lsn from, const Lsn to, std::vector<char>& out);
+
+	/**
+	 * Name of the log file
+	 */
+	std::string logName;
+
+	/**
+	 * Descriptor of the log file
+	 */
+	int fd;
+
+	/**
+	 * LSN of the first record in the log file
+	 */
+	Lsn baseLsn;
+
+	/**
+	 * LSN the next record will get
+	 */
+	Lsn nextLsn;
+
+	/**
+	 * Everything below this LSN is durable
+	 */
+	Lsn durableLsn;
+
+	/**
+	 * Records appended but not yet written, starting at LSN tailLsn
+	 */
+	std::vector<char> tail;
+
+	/**
+	 * LSN of the first byte of tail
+	 */
+	Lsn tailLsn;
+
+	/**
+	 * Number of units in tail
+	 */
+	std::uint64_t tailUnits;
+
+	/**
+	 * Group commit settings
+	 */
+	GroupCommitConfig config;
+
+	/**
+	 * Commit and sync counters
+	 */
+	LogStats stats;
+
+	/**
+	 * True while a thread is writing the tail; others wait on flushed
+	 */
+	bool flushing;
+
+	/**
+	 * Protects all of the above
+	 */
+	std::mutex logMutex;
+
+	/**
+	 * Signalled when a flush finishes
+	 */
+	std::condition_variable flushed;
+
+	/**
+	 * Signalled when the tail outgrows config.maxBatchBytes, to cut a waiting leader short
+	 */
+	std::condition_variable batchFull;
+
+	/**
+	 * Background syncer thread, if one has been started
+	 */
+	std::thread syncThread;
+
+	/**
+	 * Wakes the background syncer up early when it has to stop
+	 */
+	std::condition_variable syncWakeup;
+
+	/**
+	 * Set to ask the background syncer to exit
+	 */
+	bool syncStop;
+};
+
+}